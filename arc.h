@@ -0,0 +1,311 @@
+#ifndef ARC_H
+#define ARC_H
+
+#include <stddef.h>
+#include <hashmap.h>
+
+/**
+ * ARC (Adaptive Replacement Cache, Megiddo & Modha, FAST '03).
+ *
+ * Resident entries live on T1 (seen once recently) or T2 (seen at least
+ * twice).  Evicted entries leave their key behind on the ghost lists B1
+ * and B2.  A later hit on a ghost tells which side evicted too early, and
+ * moves the target size p of T1 towards recency (B1 hit) or frequency
+ * (B2 hit).  At most capacity entries are resident and at most capacity
+ * ghosts are kept.
+ *
+ * Same API as lru_cache_t: on a get miss, fetch the value and put it.
+ */
+
+enum arc_list {
+	ARC_T1,  // Resident, recency
+	ARC_T2,  // Resident, frequency
+	ARC_B1,  // Ghosts evicted from T1
+	ARC_B2,  // Ghosts evicted from T2
+	ARC_NR_LISTS,
+};
+
+/**
+ * Structure representing an ARC cache.
+ */
+typedef struct arc_cache {
+	unsigned int capacity;	  // Maximum number of resident items (c)
+	unsigned int bucket_size;   // Number of hash buckets for O(1) lookup
+	unsigned int p;			 // Adaptive target size of T1 (0..c)
+
+	// The four lists, MRU at .next and LRU at .prev, and their lengths
+	struct list_head lists[ARC_NR_LISTS];
+	unsigned int size[ARC_NR_LISTS];
+
+	// Hash table over resident and ghost entries (array of hlist_head)
+	struct hlist_head *buckets;
+} arc_cache_t;
+
+// Structure representing an individual node in the cache.
+typedef struct arc_node {
+	char *key;
+	int value;  // Only meaningful while resident (T1/T2)
+	int list;   // enum arc_list the node is on
+
+	// Hash map linkage (via hlist)
+	struct hlist_node h_node;
+
+	// T1/T2/B1/B2 linkage (via list_head)
+	struct list_head arc_list;
+} arc_node_t;
+
+/**
+ * Internal helper: Look up a resident or ghost node by key.
+ */
+static arc_node_t* arc_lookup(arc_cache_t *cache, const char *key) {
+	unsigned long hash = hash_function(key);
+	unsigned int index = hash % cache->bucket_size;
+
+	struct hlist_node *pos;
+	arc_node_t *entry;
+
+	hlist_for_each_entry(entry, pos, &cache->buckets[index], h_node) {
+		if (strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Internal helper: Move a node to the MRU end of another list.
+ */
+static void arc_move(arc_cache_t *cache, arc_node_t *node, int list) {
+	cache->size[node->list]--;
+	list_move(&node->arc_list, &cache->lists[list]);
+	node->list = list;
+	cache->size[list]++;
+}
+
+/**
+ * Internal helper: The LRU node of a list.
+ */
+static arc_node_t* arc_lru(arc_cache_t *cache, int list) {
+	return list_entry(cache->lists[list].prev, arc_node_t, arc_list);
+}
+
+/**
+ * Internal helper: Drop a node (resident or ghost) completely.
+ */
+static void arc_free_node(arc_cache_t *cache, arc_node_t *node) {
+	cache->size[node->list]--;
+	hlist_del(&node->h_node);
+	list_del(&node->arc_list);
+	free(node->key);
+	free(node);
+}
+
+/**
+ * Internal helper: REPLACE() from the paper.  Demote the LRU entry of T1
+ * to B1 if T1 is above its target, else the LRU entry of T2 to B2.
+ * @param in_b2 The request that triggered it is a B2 ghost hit.
+ */
+static void arc_replace(arc_cache_t *cache, int in_b2) {
+	unsigned int t1 = cache->size[ARC_T1];
+
+	// Only make room when the resident set is full
+	if (t1 + cache->size[ARC_T2] < cache->capacity) return;
+
+	if (t1 && (t1 > cache->p || (in_b2 && t1 == cache->p) || !cache->size[ARC_T2])) {
+		arc_move(cache, arc_lru(cache, ARC_T1), ARC_B1);
+	} else {
+		arc_move(cache, arc_lru(cache, ARC_T2), ARC_B2);
+	}
+}
+
+/**
+ * Create and initialize a new ARC cache.
+ * @param capacity	Maximum number of resident items.
+ * @param bucket_size Size of the internal hash table (it also indexes up
+ *					to capacity ghost entries).
+ * @return Pointer to the newly created ARC cache, or NULL on failure.
+ */
+arc_cache_t* arc_cache_create(unsigned int capacity, unsigned int bucket_size) {
+	if (capacity == 0 || bucket_size == 0) return NULL;
+
+	arc_cache_t *cache = (arc_cache_t*)malloc(sizeof(arc_cache_t));
+	if (!cache) {
+		perror("malloc arc_cache_t");
+		return NULL;
+	}
+
+	cache->buckets = (struct hlist_head*)malloc(sizeof(struct hlist_head) * bucket_size);
+	if (!cache->buckets) {
+		perror("malloc buckets");
+		free(cache);
+		return NULL;
+	}
+
+	cache->capacity = capacity;
+	cache->bucket_size = bucket_size;
+	cache->p = 0;
+
+	for (int i = 0; i < ARC_NR_LISTS; i++) {
+		INIT_LIST_HEAD(&cache->lists[i]);
+		cache->size[i] = 0;
+	}
+
+	for (unsigned int i = 0; i < bucket_size; i++) {
+		INIT_HLIST_HEAD(&cache->buckets[i]);
+	}
+
+	return cache;
+}
+
+/**
+ * Destroy the ARC cache and free all associated memory (ghosts included).
+ * @param cache ARC cache instance to destroy.
+ */
+void arc_cache_destroy(arc_cache_t *cache) {
+	if (!cache) return;
+
+	arc_node_t *entry, *tmp;
+
+	// Everything goes away: no need to unlink node by node
+	for (int i = 0; i < ARC_NR_LISTS; i++) {
+		list_for_each_entry_safe(entry, tmp, &cache->lists[i], arc_list) {
+			free(entry->key);
+			free(entry);
+		}
+	}
+
+	free(cache->buckets);
+	free(cache);
+}
+
+/**
+ * Retrieve a value from the cache.
+ * A hit moves the item to the MRU end of T2.  Ghost entries are misses.
+ * @param cache ARC cache instance.
+ * @param key   Key to look up.
+ * @param value Output pointer for the retrieved value.
+ * @return 1 if the key is resident (cache hit), 0 otherwise (cache miss).
+ */
+int arc_cache_get(arc_cache_t *cache, const char *key, int *value) {
+	arc_node_t *node = arc_lookup(cache, key);
+
+	if (node && (node->list == ARC_T1 || node->list == ARC_T2)) {
+		arc_move(cache, node, ARC_T2);
+		*value = node->value;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Insert or update a key-value pair in the cache.
+ * A put on a ghost key adapts p, and the item becomes resident on T2;
+ * a brand new key starts on T1.
+ * @param cache ARC cache instance.
+ * @param key   Key string.
+ * @param value Value to store.
+ * @return 0 on success, -1 on memory allocation failure.
+ */
+int arc_cache_put(arc_cache_t *cache, const char *key, int value) {
+	unsigned int c = cache->capacity;
+	unsigned int *size = cache->size;
+	arc_node_t *node = arc_lookup(cache, key);
+
+	if (node) {
+		unsigned int delta;
+
+		switch (node->list) {
+		case ARC_B1:
+			// Case II: T1 was too small, grow its target
+			delta = size[ARC_B2] > size[ARC_B1] ? size[ARC_B2] / size[ARC_B1] : 1;
+			cache->p = cache->p + delta < c ? cache->p + delta : c;
+			arc_replace(cache, 0);
+			break;
+		case ARC_B2:
+			// Case III: T2 was too small, shrink T1's target
+			delta = size[ARC_B1] > size[ARC_B2] ? size[ARC_B1] / size[ARC_B2] : 1;
+			cache->p = cache->p > delta ? cache->p - delta : 0;
+			arc_replace(cache, 1);
+			break;
+		default:
+			// Case I: resident hit
+			break;
+		}
+
+		node->value = value;
+		arc_move(cache, node, ARC_T2);
+		return 0;
+	}
+
+	// Case IV: not in the cache nor in the ghost lists
+	if (size[ARC_T1] + size[ARC_B1] >= c) {
+		if (size[ARC_T1] < c) {
+			arc_free_node(cache, arc_lru(cache, ARC_B1));
+			arc_replace(cache, 0);
+		} else {
+			// B1 is empty: T1 alone fills the cache, drop its LRU for good
+			arc_free_node(cache, arc_lru(cache, ARC_T1));
+		}
+	} else if (size[ARC_T1] + size[ARC_T2] + size[ARC_B1] + size[ARC_B2] >= c) {
+		if (size[ARC_T1] + size[ARC_T2] + size[ARC_B1] + size[ARC_B2] >= 2 * c) {
+			arc_free_node(cache, arc_lru(cache, ARC_B2));
+		}
+		arc_replace(cache, 0);
+	}
+
+	node = (arc_node_t*)malloc(sizeof(arc_node_t));
+	if (!node) {
+		perror("malloc arc_node_t");
+		return -1;
+	}
+
+	node->key = strdup(key);
+	if (!node->key) {
+		perror("strdup key");
+		free(node);
+		return -1;
+	}
+	node->value = value;
+	node->list = ARC_T1;
+
+	unsigned long hash = hash_function(key);
+	unsigned int index = hash % cache->bucket_size;
+	hlist_add_head(&node->h_node, &cache->buckets[index]);
+
+	list_add(&node->arc_list, &cache->lists[ARC_T1]);
+	size[ARC_T1]++;
+
+	return 0;
+}
+
+/**
+ * Print the current state of the cache (for debugging).
+ * Every list is printed in MRU -> LRU order.
+ * @param cache ARC cache instance.
+ */
+void arc_cache_print(arc_cache_t *cache) {
+	static const char *names[ARC_NR_LISTS] = { "T1", "T2", "B1", "B2" };
+
+	if (!cache) return;
+
+	printf("\n--- ARC Cache State (Resident: %u / Capacity: %u, p: %u) ---\n",
+		   cache->size[ARC_T1] + cache->size[ARC_T2], cache->capacity, cache->p);
+
+	for (int i = 0; i < ARC_NR_LISTS; i++) {
+		arc_node_t *entry;
+
+		printf("%s (%u): MRU -> ", names[i], cache->size[i]);
+		list_for_each_entry(entry, &cache->lists[i], arc_list) {
+			if (i == ARC_T1 || i == ARC_T2) {
+				printf("['%s': %d] -> ", entry->key, entry->value);
+			} else {
+				printf("['%s'] -> ", entry->key);
+			}
+		}
+		printf("LRU\n");
+	}
+	printf("-----------------------------------------------------\n\n");
+}
+
+#endif /* ARC_H */
@@ -0,0 +1,665 @@
+/*
+ * Benchmark suite for the data structures in this tree.
+ *
+ * Every structure is populated with --keys keys (inserted in random
+ * order), then driven by a precomputed stream of --ops operations:
+ *
+ *   uniform     every key equally likely
+ *   zipf        Zipfian popularity (--theta, YCSB style), hot keys
+ *               scattered over the key space
+ *   sequential  keys in order, wrapping around
+ *
+ * A --read-pct share of the operations are lookups, the rest updates of
+ * existing keys, so the size of each structure stays constant.
+ *
+ * Each configuration runs --warmup untimed passes, then --reps timed
+ * passes.  A pass is run twice: once back to back for throughput, once
+ * with every operation timed into a histogram for the latency
+ * percentiles (the timer overhead is reported alongside).  Bytes per
+ * element is the heap growth from populating, divided by --keys.
+ *
+ * The report is JSON on stdout; pass --label (e.g. the commit id) to tell
+ * runs apart when tracking regressions.
+ *
+ *   ./bench --struct hashmap,lru --workload zipf --read-pct 95 --label $(git rev-parse --short HEAD)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <malloc.h>
+
+#include <hashmap.h>
+#include <lru.h>
+#include <arc.h>
+#include <btree.h>
+#include <rbtree.h>
+#include <skiplist.h>
+#include <histogram.h>
+
+#define OP_WRITE 0x80000000U  // Marks an update in the op stream
+#define OP_KEY(op) ((op) & ~OP_WRITE)
+
+struct bench_config {
+	unsigned long keys;
+	unsigned long ops;
+	unsigned int reps;
+	unsigned int warmup;
+	double theta;
+	unsigned long seed;
+	const char *label;
+};
+
+static char (*names)[24];  // String form of every key, shared by all structures
+
+/*
+ * ====================================================================================
+ * Structures under test
+ * ====================================================================================
+ */
+
+struct bench_ds {
+	const char *name;
+	void *(*create)(unsigned long nkeys);
+	void (*destroy)(void *ds);
+	int (*get)(void *ds, unsigned long key);
+	void (*put)(void *ds, unsigned long key);
+};
+
+// hash_map
+static void *hashmap_create(unsigned long nkeys) {
+	return hash_map_create(nkeys);
+}
+
+static void hashmap_destroy(void *ds) {
+	hash_map_destroy_bulk(ds, NULL, NULL);
+}
+
+static int hashmap_get(void *ds, unsigned long key) {
+	int value;
+
+	return hash_map_get(ds, names[key], &value);
+}
+
+static void hashmap_put(void *ds, unsigned long key) {
+	hash_map_insert(ds, names[key], (int)key);
+}
+
+// lru_cache_t, capacity for every key: nothing is evicted
+static void *lru_create(unsigned long nkeys) {
+	return lru_cache_create(nkeys, nkeys);
+}
+
+static void *lru_aligned_create(unsigned long nkeys) {
+	lru_cache_t *cache = lru_cache_create(nkeys, nkeys);
+
+	if (cache) cache->flags = LRU_F_HWCACHE_ALIGN;
+	return cache;
+}
+
+static void lru_destroy(void *ds) {
+	lru_cache_destroy(ds);
+}
+
+static int lru_get(void *ds, unsigned long key) {
+	int value;
+
+	return lru_cache_get(ds, names[key], &value);
+}
+
+static void lru_put(void *ds, unsigned long key) {
+	lru_cache_put(ds, names[key], (int)key);
+}
+
+// arc_cache_t, same
+static void *arc_create(unsigned long nkeys) {
+	return arc_cache_create(nkeys, nkeys);
+}
+
+static void arc_destroy(void *ds) {
+	arc_cache_destroy(ds);
+}
+
+static int arc_get(void *ds, unsigned long key) {
+	int value;
+
+	return arc_cache_get(ds, names[key], &value);
+}
+
+static void arc_put(void *ds, unsigned long key) {
+	arc_cache_put(ds, names[key], (int)key);
+}
+
+// rbtree, one preallocated item per key
+struct rb_item {
+	long key;
+	long value;
+	struct rb_node node;
+};
+
+struct rb_bench {
+	struct rb_root root;
+	struct rb_item *items;
+};
+
+#define rb_item_cmp(k, entry) (((k) > (entry)->key) - ((k) < (entry)->key))
+
+static void *rbtree_create(unsigned long nkeys) {
+	struct rb_bench *rb = malloc(sizeof(*rb));
+
+	if (!rb) return NULL;
+	rb->root = RB_ROOT;
+	rb->items = calloc(nkeys, sizeof(*rb->items));
+	if (!rb->items) {
+		free(rb);
+		return NULL;
+	}
+	return rb;
+}
+
+static void rbtree_destroy(void *ds) {
+	struct rb_bench *rb = ds;
+
+	free(rb->items);
+	free(rb);
+}
+
+static int rbtree_get(void *ds, unsigned long key) {
+	struct rb_bench *rb = ds;
+	struct rb_item *entry;
+
+	return rb_find_entry(entry, &rb->root, node, rb_item_cmp((long)key, entry)) != NULL;
+}
+
+static void rbtree_put(void *ds, unsigned long key) {
+	struct rb_bench *rb = ds;
+	struct rb_node **link = &rb->root.rb_node, *parent = NULL;
+	struct rb_item *item = &rb->items[key];
+
+	while (*link) {
+		struct rb_item *this = rb_entry(*link, struct rb_item, node);
+
+		parent = *link;
+		if ((long)key < this->key) {
+			link = &parent->rb_left;
+		} else if ((long)key > this->key) {
+			link = &parent->rb_right;
+		} else {
+			this->value++;
+			return;
+		}
+	}
+	item->key = key;
+	rb_link_node(&item->node, parent, link);
+	rb_insert_color(&item->node, &rb->root);
+}
+
+// Skip list, same
+struct sl_item {
+	long key;
+	long value;
+	struct sl_node node;
+};
+
+struct sl_bench {
+	struct skiplist sl;
+	struct sl_item *items;
+};
+
+static int sl_item_cmp(const struct sl_node *node, const void *key) {
+	long a = sl_entry(node, struct sl_item, node)->key;
+	long b = *(const long*)key;
+
+	return (a > b) - (a < b);
+}
+
+static void *skiplist_create(unsigned long nkeys) {
+	struct sl_bench *s = malloc(sizeof(*s));
+
+	if (!s) return NULL;
+	sl_init(&s->sl, sl_item_cmp);
+	s->items = calloc(nkeys, sizeof(*s->items));
+	if (!s->items) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+static void skiplist_destroy(void *ds) {
+	struct sl_bench *s = ds;
+
+	free(s->items);
+	free(s);
+}
+
+static int skiplist_get(void *ds, unsigned long key) {
+	struct sl_bench *s = ds;
+	long k = key;
+
+	return sl_find(&s->sl, &k) != NULL;
+}
+
+static void skiplist_put(void *ds, unsigned long key) {
+	struct sl_bench *s = ds;
+	struct sl_node *node;
+	long k = key;
+
+	node = sl_find(&s->sl, &k);
+	if (node) {
+		sl_entry(node, struct sl_item, node)->value++;
+		return;
+	}
+	s->items[key].key = k;
+	sl_insert(&s->sl, &s->items[key].node, &k);
+}
+
+// Binary search tree; an update is a delete and re-insert
+static void *btree_create(unsigned long nkeys) {
+	struct bt_root *root = malloc(sizeof(*root));
+
+	if (root) *root = BT_ROOT;
+	return root;
+}
+
+static void btree_destroy(void *ds) {
+	bt_destroy(ds, NULL, NULL);
+	free(ds);
+}
+
+static int btree_get(void *ds, unsigned long key) {
+	return bt_search(((struct bt_root*)ds)->node, (int)key) != NULL;
+}
+
+static void btree_put(void *ds, unsigned long key) {
+	struct bt_root *root = ds;
+
+	root->node = bt_delete(root->node, (int)key);
+	bt_insert(root, (int)key);
+}
+
+static const struct bench_ds structures[] = {
+	{ "hashmap", hashmap_create, hashmap_destroy, hashmap_get, hashmap_put },
+	{ "lru", lru_create, lru_destroy, lru_get, lru_put },
+	{ "lru-aligned", lru_aligned_create, lru_destroy, lru_get, lru_put },
+	{ "arc", arc_create, arc_destroy, arc_get, arc_put },
+	{ "rbtree", rbtree_create, rbtree_destroy, rbtree_get, rbtree_put },
+	{ "skiplist", skiplist_create, skiplist_destroy, skiplist_get, skiplist_put },
+	{ "btree", btree_create, btree_destroy, btree_get, btree_put },
+};
+
+#define NR_STRUCTURES (sizeof(structures) / sizeof(structures[0]))
+
+/*
+ * ====================================================================================
+ * Workloads
+ * ====================================================================================
+ */
+
+enum workload {
+	WL_UNIFORM,
+	WL_ZIPF,
+	WL_SEQUENTIAL,
+	WL_NR,
+};
+
+static const char *const workload_names[WL_NR] = { "uniform", "zipf", "sequential" };
+
+static uint64_t bench_rand(uint64_t *seed) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static double bench_rand01(uint64_t *seed) {
+	return (bench_rand(seed) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Zipfian ranks in [0, n) (Gray et al., "Quickly generating billion-record
+ * synthetic databases", as used by YCSB).
+ */
+struct zipf {
+	unsigned long n;
+	double theta, alpha, zetan, eta;
+};
+
+static void zipf_init(struct zipf *z, unsigned long n, double theta) {
+	double zeta2 = 0;
+
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (unsigned long i = 1; i <= n; i++) {
+		z->zetan += 1.0 / pow((double)i, theta);
+		if (i == 2) zeta2 = z->zetan;
+	}
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static unsigned long zipf_next(struct zipf *z, uint64_t *seed) {
+	double u = bench_rand01(seed);
+	double uz = u * z->zetan;
+	unsigned long rank;
+
+	if (uz < 1.0) return 0;
+	if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+	rank = (unsigned long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+	return rank < z->n ? rank : z->n - 1;
+}
+
+/**
+ * Fill @stream with @n operations
+ */
+static void workload_fill(uint32_t *stream, unsigned long n, enum workload wl,
+			  unsigned int read_pct, struct zipf *z, const struct bench_config *cfg,
+			  uint64_t *seed) {
+	for (unsigned long i = 0; i < n; i++) {
+		unsigned long key;
+
+		switch (wl) {
+		case WL_ZIPF:
+			// Scatter the popular ranks over the key space
+			key = (zipf_next(z, seed) * 2654435761UL) % cfg->keys;
+			break;
+		case WL_SEQUENTIAL:
+			key = i % cfg->keys;
+			break;
+		default:
+			key = bench_rand(seed) % cfg->keys;
+			break;
+		}
+		stream[i] = (uint32_t)key;
+		if (bench_rand(seed) % 100 >= read_pct) stream[i] |= OP_WRITE;
+	}
+}
+
+/*
+ * ====================================================================================
+ * Runner
+ * ====================================================================================
+ */
+
+static inline uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long heap_in_use(void) {
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+}
+
+static uint64_t timer_overhead_ns(void) {
+	uint64_t t0 = now_ns(), t1 = t0;
+
+	for (int i = 0; i < 1000; i++) t1 = now_ns();
+	return (t1 - t0) / 1000;
+}
+
+static int run_ops(const struct bench_ds *ds, void *obj, const uint32_t *stream, unsigned long n) {
+	int hits = 0;
+
+	for (unsigned long i = 0; i < n; i++) {
+		if (stream[i] & OP_WRITE) {
+			ds->put(obj, OP_KEY(stream[i]));
+		} else {
+			hits += ds->get(obj, stream[i]);
+		}
+	}
+	return hits;
+}
+
+static void run_ops_timed(const struct bench_ds *ds, void *obj, const uint32_t *stream,
+			  unsigned long n, struct histogram *hist) {
+	for (unsigned long i = 0; i < n; i++) {
+		uint64_t t0 = now_ns();
+
+		if (stream[i] & OP_WRITE) {
+			ds->put(obj, OP_KEY(stream[i]));
+		} else {
+			ds->get(obj, stream[i]);
+		}
+		hist_record(hist, now_ns() - t0);
+	}
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Run one configuration and print its JSON object
+ */
+static int run_one(const struct bench_ds *ds, enum workload wl, unsigned int read_pct,
+		   const struct bench_config *cfg, struct zipf *z, int first) {
+	static struct histogram hist;
+	uint32_t *stream = malloc(cfg->ops * sizeof(uint32_t));
+	unsigned long *order = malloc(cfg->keys * sizeof(unsigned long));
+	double *rates = malloc(cfg->reps * sizeof(double));
+	uint64_t seed = cfg->seed;
+	unsigned long heap_before, heap_after;
+	double median;
+	void *obj;
+	int ret = -1;
+
+	if (!stream || !order || !rates) {
+		fprintf(stderr, "bench: out of memory\n");
+		goto out;
+	}
+
+	// Populate in random order (sorted inserts would degenerate btree)
+	for (unsigned long i = 0; i < cfg->keys; i++) order[i] = i;
+	for (unsigned long i = cfg->keys - 1; i > 0; i--) {
+		unsigned long j = bench_rand(&seed) % (i + 1), tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	heap_before = heap_in_use();
+	obj = ds->create(cfg->keys);
+	if (!obj) {
+		fprintf(stderr, "bench: cannot create %s\n", ds->name);
+		goto out;
+	}
+	for (unsigned long i = 0; i < cfg->keys; i++) ds->put(obj, order[i]);
+	heap_after = heap_in_use();
+
+	for (unsigned int w = 0; w < cfg->warmup; w++) {
+		workload_fill(stream, cfg->ops, wl, read_pct, z, cfg, &seed);
+		run_ops(ds, obj, stream, cfg->ops);
+	}
+
+	hist_init(&hist);
+	for (unsigned int r = 0; r < cfg->reps; r++) {
+		uint64_t t0;
+
+		workload_fill(stream, cfg->ops, wl, read_pct, z, cfg, &seed);
+		t0 = now_ns();
+		run_ops(ds, obj, stream, cfg->ops);
+		rates[r] = cfg->ops * 1e9 / (double)(now_ns() - t0);
+
+		run_ops_timed(ds, obj, stream, cfg->ops, &hist);
+	}
+	qsort(rates, cfg->reps, sizeof(double), cmp_double);
+	median = rates[cfg->reps / 2];
+	if (!(cfg->reps & 1)) median = (rates[cfg->reps / 2 - 1] + median) / 2;
+
+	printf("%s    {\"struct\": \"%s\", \"workload\": \"%s\", \"read_pct\": %u, "
+		   "\"keys\": %lu, \"ops\": %lu, \"reps\": %u,\n",
+		   first ? "" : ",\n", ds->name, workload_names[wl], read_pct, cfg->keys, cfg->ops, cfg->reps);
+	printf("     \"ops_per_sec\": {\"median\": %.0f, \"min\": %.0f, \"max\": %.0f},\n",
+		   median, rates[0], rates[cfg->reps - 1]);
+	printf("     \"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu, \"mean\": %.1f},\n",
+		   (unsigned long long)hist_percentile(&hist, 50.0),
+		   (unsigned long long)hist_percentile(&hist, 99.0),
+		   (unsigned long long)hist_percentile(&hist, 99.9),
+		   (unsigned long long)hist.max, hist_mean(&hist));
+	printf("     \"bytes_per_element\": %.1f}", (double)(heap_after - heap_before) / cfg->keys);
+	fflush(stdout);
+
+	ds->destroy(obj);
+	ret = 0;
+out:
+	free(stream);
+	free(order);
+	free(rates);
+	return ret;
+}
+
+/*
+ * ====================================================================================
+ * Command line
+ * ====================================================================================
+ */
+
+/**
+ * Print @str as the body of a JSON string: quotes, backslashes and
+ * control characters escaped
+ */
+static void json_print_string(FILE *fp, const char *str) {
+	for (const unsigned char *p = (const unsigned char*)str; *p; p++) {
+		if (*p == '"' || *p == '\\') {
+			fprintf(fp, "\\%c", *p);
+		} else if (*p < 0x20) {
+			fprintf(fp, "\\u%04x", *p);
+		} else {
+			fputc(*p, fp);
+		}
+	}
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --struct LIST     comma separated, or 'all' (default all):\n"
+		"                    ", prog);
+	for (unsigned int i = 0; i < NR_STRUCTURES; i++) {
+		fprintf(stderr, "%s%s", structures[i].name, i + 1 < NR_STRUCTURES ? " " : "\n");
+	}
+	fprintf(stderr,
+		"  --workload LIST   uniform, zipf, sequential, or 'all' (default all)\n"
+		"  --read-pct LIST   share of lookups in percent (default 100,50)\n"
+		"  --keys N          number of keys (default 100000)\n"
+		"  --ops N           operations per pass (default 1000000)\n"
+		"  --reps N          timed passes (default 3)\n"
+		"  --warmup N        untimed passes (default 1)\n"
+		"  --theta X         Zipfian skew (default 0.99)\n"
+		"  --seed N          random seed\n"
+		"  --label STR       free-form tag copied to the report, e.g. a commit id\n");
+}
+
+/**
+ * Internal helper: is @name in the comma separated @list ("all" matches)?
+ */
+static int in_list(const char *list, const char *name) {
+	size_t len = strlen(name);
+
+	if (strcmp(list, "all") == 0) return 1;
+	for (const char *p = list; p; p = strchr(p, ',')) {
+		if (*p == ',') p++;
+		if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	static const struct option options[] = {
+		{ "struct", required_argument, NULL, 's' },
+		{ "workload", required_argument, NULL, 'w' },
+		{ "read-pct", required_argument, NULL, 'r' },
+		{ "keys", required_argument, NULL, 'k' },
+		{ "ops", required_argument, NULL, 'n' },
+		{ "reps", required_argument, NULL, 'R' },
+		{ "warmup", required_argument, NULL, 'W' },
+		{ "theta", required_argument, NULL, 't' },
+		{ "seed", required_argument, NULL, 'S' },
+		{ "label", required_argument, NULL, 'l' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct bench_config cfg = { 100000, 1000000, 3, 1, 0.99, 0x9e3779b97f4a7c15UL, "" };
+	const char *struct_list = "all", *workload_list = "all", *read_list = "100,50";
+	struct zipf z;
+	int opt, first = 1, matched = 0;
+
+	while ((opt = getopt_long(argc, argv, "s:w:r:k:n:R:W:t:S:l:h", options, NULL)) != -1) {
+		switch (opt) {
+		case 's': struct_list = optarg; break;
+		case 'w': workload_list = optarg; break;
+		case 'r': read_list = optarg; break;
+		case 'k': cfg.keys = strtoul(optarg, NULL, 0); break;
+		case 'n': cfg.ops = strtoul(optarg, NULL, 0); break;
+		case 'R': cfg.reps = (unsigned int)strtoul(optarg, NULL, 0); break;
+		case 'W': cfg.warmup = (unsigned int)strtoul(optarg, NULL, 0); break;
+		case 't': cfg.theta = strtod(optarg, NULL); break;
+		case 'S': cfg.seed = strtoul(optarg, NULL, 0); break;
+		case 'l': cfg.label = optarg; break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+	if (cfg.keys < 2 || cfg.keys > OP_WRITE || cfg.keys > INT_MAX || !cfg.ops || !cfg.reps ||
+		cfg.theta <= 0 || cfg.theta >= 1 || !cfg.seed) {
+		fprintf(stderr, "bench: need 2 <= keys <= INT_MAX, ops > 0, reps > 0, 0 < theta < 1, seed != 0\n");
+		return 1;
+	}
+
+	names = malloc(cfg.keys * sizeof(*names));
+	if (!names) {
+		perror("malloc names");
+		return 1;
+	}
+	for (unsigned long i = 0; i < cfg.keys; i++) {
+		snprintf(names[i], sizeof(names[i]), "key-%lu", i);
+	}
+	zipf_init(&z, cfg.keys, cfg.theta);
+
+	printf("{\"label\": \"");
+	json_print_string(stdout, cfg.label);
+	printf("\", \"theta\": %.3f, \"warmup\": %u, \"timer_overhead_ns\": %llu,\n"
+		   " \"results\": [\n", cfg.theta, cfg.warmup, (unsigned long long)timer_overhead_ns());
+
+	for (unsigned int s = 0; s < NR_STRUCTURES; s++) {
+		if (!in_list(struct_list, structures[s].name)) continue;
+
+		for (int wl = 0; wl < WL_NR; wl++) {
+			if (!in_list(workload_list, workload_names[wl])) continue;
+
+			for (const char *p = read_list; p; p = strchr(p, ',')) {
+				unsigned long read_pct = strtoul(*p == ',' ? p + 1 : p, NULL, 10);
+
+				if (read_pct > 100) read_pct = 100;
+				if (run_one(&structures[s], wl, (unsigned int)read_pct, &cfg, &z, first) < 0) {
+					return 1;
+				}
+				first = 0;
+				matched++;
+				if (*p == ',') p++;
+			}
+		}
+	}
+
+	printf("\n ]}\n");
+	free(names);
+
+	if (!matched) {
+		fprintf(stderr, "bench: nothing matched\n");
+		usage(argv[0]);
+		return 1;
+	}
+	return 0;
+}
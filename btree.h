@@ -25,15 +25,22 @@
 #define _BINARY_TREE_H
 
 #include <stddef.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <fault.h>
+
 struct bt_node {
     int data;
     struct bt_node *left;
     struct bt_node *right;
 };
 
+// Two nodes per cache line: a 24-byte node is a 32-byte malloc chunk
+_Static_assert(sizeof(void *) != 8 || sizeof(struct bt_node) <= 24,
+               "bt_node no longer fits a 32-byte malloc chunk");
+
 struct bt_root {
     struct bt_node *node;
 };
@@ -42,7 +49,7 @@ struct bt_root {
 
 // Helper to create a new node
 struct bt_node* bt_new_node(int data) {
-    struct bt_node* node = (struct bt_node*)malloc(sizeof(struct bt_node));
+    struct bt_node* node = FAULT_INJECT(FAULT_BT_NODE) ? NULL : (struct bt_node*)malloc(sizeof(struct bt_node));
     if (node) {
         node->data = data;
         node->left = node->right = NULL;
@@ -183,13 +190,37 @@ int bt_is_bst(struct bt_node *node) {
     return bt_is_bst_util(node, INT_MIN, INT_MAX);
 }
 
+// Release every node (bulk destroy): iterative, O(n), no stack.
+// Whenever the current node has a left child, rotate it right so the
+// left subtree moves up; a node without a left child can be released
+// and the walk continues with its right subtree.  @release may return
+// the node to a pool; NULL means free().
+void bt_destroy(struct bt_root *root, void (*release)(struct bt_node *, void *), void *arg) {
+    struct bt_node *node = root->node;
+    struct bt_node *next;
+
+    while (node) {
+        if (node->left) {
+            next = node->left;
+            node->left = next->right;
+            next->right = node;
+        } else {
+            next = node->right;
+            if (release)
+                release(node, arg);
+            else
+                free(node);
+        }
+        node = next;
+    }
+    root->node = NULL;
+}
+
 // Free tree
 void bt_free(struct bt_node *node) {
-    if (node) {
-        bt_free(node->left);
-        bt_free(node->right);
-        free(node);
-    }
+    struct bt_root root = { node };
+
+    bt_destroy(&root, NULL, NULL);
 }
 
 #endif /* _BINARY_TREE_H */
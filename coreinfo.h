@@ -0,0 +1,671 @@
+#ifndef COREINFO_H
+#define COREINFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/procfs.h>
+#include <sys/user.h>
+
+/**
+ * ELF core reader: what gdb's "bt" would say about a core, without gdb.
+ *
+ * The core is mmap()ed and only its notes are parsed: NT_PRSTATUS (the
+ * registers; the thread with pr_cursig set crashed), NT_PRPSINFO,
+ * NT_SIGINFO (the fault address, kernel cores only), NT_AUXV and NT_FILE
+ * (which file backs which mapping).  Stack memory is read from the PT_LOAD
+ * segments on demand.  The stack is unwound by following frame pointers,
+ * as crash.h does in the live process; on x86_64 the words below the first
+ * frame record are also scanned for return addresses, for the frames of
+ * code built without frame pointers (libc: memset(), abort()).  Return
+ * addresses are
+ * symbolized from the .symtab (or .dynsym) of the files named by NT_FILE,
+ * mapped once per path and shared by every core and thread.
+ *
+ * The crash signature is the signal plus the function names of the top
+ * CORE_SIG_FRAMES frames outside the C runtime and above the caller's
+ * driver code: no addresses, so it is the same across ASLR, pids, run
+ * modes and rebuilds that do not touch the crashing code.
+ *
+ * Native architecture only.  sigabbrev_np() needs _GNU_SOURCE.
+ */
+
+#define CORE_MAX_FRAMES 32
+#define CORE_SIG_FRAMES 5
+#define CORE_SCAN_BYTES (64 * 1024)  // Stack scanned for frames without a frame pointer
+
+struct core_segment {
+	uint64_t addr;
+	uint64_t memsz;
+	uint64_t filesz;
+	uint64_t offset;
+	uint32_t flags;	 // PF_R | PF_W | PF_X
+};
+
+struct core_mapping {
+	uint64_t start;
+	uint64_t end;
+	uint64_t offset;	// In bytes
+	const char *path;   // In the mapped core
+};
+
+struct core_frame {
+	uint64_t pc;
+	uint64_t off;		   // From func, or from the start of module if func is empty
+	char func[96];
+	char module[64];		// Base name
+};
+
+struct core_info {
+	const unsigned char *base;
+	size_t size;
+	pid_t pid;
+	int signo;
+	int si_code;
+	int has_siginfo;		// NT_SIGINFO present: si_code and fault_addr are valid
+	uint64_t fault_addr;
+	unsigned int nthreads;
+	elf_gregset_t regs;	 // Of the crashed thread
+	char fname[16];
+	char psargs[80];
+	struct core_segment *segs;
+	unsigned int nsegs;
+	struct core_mapping *maps;
+	unsigned int nmaps;
+	const uint64_t *auxv;
+	size_t auxv_len;
+};
+
+/*
+ * ====================================================================================
+ * Parsing
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: NT_FILE is count, page size, {start, end, page offset}
+ * per mapping, then the NUL-terminated paths
+ */
+static int core_parse_nt_file(struct core_info *ci, const unsigned char *desc, size_t len) {
+	const uint64_t *hdr = (const uint64_t*)desc;
+	const char *path, *end = (const char*)desc + len;
+	uint64_t count, page;
+
+	if (len < 2 * sizeof(uint64_t)) return -1;
+	count = hdr[0];
+	page = hdr[1];
+	if (count > (len - 2 * sizeof(uint64_t)) / (3 * sizeof(uint64_t))) return -1;
+
+	ci->maps = (struct core_mapping*)calloc(count ? count : 1, sizeof(*ci->maps));
+	if (!ci->maps) {
+		perror("calloc core maps");
+		return -1;
+	}
+	path = (const char*)(hdr + 2 + 3 * count);
+	for (uint64_t i = 0; i < count && path < end; i++) {
+		const uint64_t *e = hdr + 2 + 3 * i;
+
+		ci->maps[i].start = e[0];
+		ci->maps[i].end = e[1];
+		ci->maps[i].offset = e[2] * page;
+		ci->maps[i].path = path;
+		ci->nmaps++;
+		path += strnlen(path, end - path) + 1;
+	}
+	return 0;
+}
+
+static int core_parse_notes(struct core_info *ci, const unsigned char *p, size_t len) {
+	const unsigned char *end = p + len;
+
+	while (p + sizeof(Elf64_Nhdr) <= end) {
+		const Elf64_Nhdr *nhdr = (const Elf64_Nhdr*)p;
+		const char *name = (const char*)(nhdr + 1);
+		const unsigned char *desc = p + sizeof(*nhdr) + ((nhdr->n_namesz + 3) & ~3u);
+
+		if (desc + nhdr->n_descsz > end) break;
+		p = desc + ((nhdr->n_descsz + 3) & ~3u);
+		if (nhdr->n_namesz != 5 || memcmp(name, "CORE", 5) != 0) continue;
+
+		switch (nhdr->n_type) {
+		case NT_PRSTATUS: {
+			struct elf_prstatus status;
+
+			if (nhdr->n_descsz < sizeof(status)) break;
+			memcpy(&status, desc, sizeof(status));
+			// The kernel writes the crashed thread first, but only it has pr_cursig
+			if (!ci->nthreads++ || (status.pr_cursig && !ci->signo)) {
+				ci->signo = status.pr_cursig;
+				memcpy(ci->regs, status.pr_reg, sizeof(ci->regs));
+			}
+			break;
+		}
+		case NT_PRPSINFO: {
+			struct elf_prpsinfo psinfo;
+
+			if (nhdr->n_descsz < sizeof(psinfo)) break;
+			memcpy(&psinfo, desc, sizeof(psinfo));
+			ci->pid = psinfo.pr_pid;
+			memcpy(ci->fname, psinfo.pr_fname, sizeof(ci->fname) - 1);
+			memcpy(ci->psargs, psinfo.pr_psargs, sizeof(ci->psargs) - 1);
+			break;
+		}
+		case NT_SIGINFO: {
+			siginfo_t si;
+
+			if (nhdr->n_descsz < sizeof(si)) break;
+			memcpy(&si, desc, sizeof(si));
+			ci->has_siginfo = 1;
+			ci->si_code = si.si_code;
+			ci->fault_addr = (uintptr_t)si.si_addr;
+			break;
+		}
+		case NT_AUXV:
+			ci->auxv = (const uint64_t*)desc;
+			ci->auxv_len = nhdr->n_descsz;
+			break;
+		case NT_FILE:
+			if (!ci->maps && core_parse_nt_file(ci, desc, nhdr->n_descsz) < 0) return -1;
+			break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Map and parse a core
+ * @return 0 on success, -1 on error
+ */
+int core_open(struct core_info *ci, const char *path) {
+	const Elf64_Ehdr *ehdr;
+	const Elf64_Phdr *phdr;
+	struct stat st;
+	int fd;
+
+	memset(ci, 0, sizeof(*ci));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+		fprintf(stderr, "%s: not an ELF core\n", path);
+		close(fd);
+		return -1;
+	}
+	ci->base = (const unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ci->base == MAP_FAILED) {
+		perror("mmap core");
+		ci->base = NULL;
+		return -1;
+	}
+	ci->size = st.st_size;
+
+	ehdr = (const Elf64_Ehdr*)ci->base;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+		ehdr->e_type != ET_CORE || ehdr->e_phentsize != sizeof(Elf64_Phdr) ||
+		ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > ci->size) {
+		fprintf(stderr, "%s: not an ELF core\n", path);
+		goto err;
+	}
+	phdr = (const Elf64_Phdr*)(ci->base + ehdr->e_phoff);
+
+	ci->segs = (struct core_segment*)calloc(ehdr->e_phnum ? ehdr->e_phnum : 1, sizeof(*ci->segs));
+	if (!ci->segs) {
+		perror("calloc core segments");
+		goto err;
+	}
+	for (unsigned int i = 0; i < ehdr->e_phnum; i++) {
+		if (phdr[i].p_offset + phdr[i].p_filesz > ci->size) continue;  // Truncated core
+		if (phdr[i].p_type == PT_NOTE) {
+			if (core_parse_notes(ci, ci->base + phdr[i].p_offset, phdr[i].p_filesz) < 0) goto err;
+		} else if (phdr[i].p_type == PT_LOAD) {
+			struct core_segment *seg = &ci->segs[ci->nsegs++];
+
+			seg->addr = phdr[i].p_vaddr;
+			seg->memsz = phdr[i].p_memsz;
+			seg->filesz = phdr[i].p_filesz;
+			seg->offset = phdr[i].p_offset;
+			seg->flags = phdr[i].p_flags;
+		}
+	}
+	if (!ci->nthreads) {
+		fprintf(stderr, "%s: no NT_PRSTATUS\n", path);
+		goto err;
+	}
+	return 0;
+err:
+	munmap((void*)ci->base, ci->size);
+	free(ci->segs);
+	free(ci->maps);
+	memset(ci, 0, sizeof(*ci));
+	return -1;
+}
+
+void core_close(struct core_info *ci) {
+	if (ci->base) munmap((void*)ci->base, ci->size);
+	free(ci->segs);
+	free(ci->maps);
+	memset(ci, 0, sizeof(*ci));
+}
+
+/**
+ * Read process memory saved in the core
+ * @return 0 on success, -1 if not all of it is in the core
+ */
+int core_read(const struct core_info *ci, uint64_t addr, void *buf, size_t len) {
+	for (unsigned int i = 0; i < ci->nsegs; i++) {
+		const struct core_segment *seg = &ci->segs[i];
+
+		if (addr < seg->addr || addr - seg->addr >= seg->filesz) continue;
+		if (seg->filesz - (addr - seg->addr) < len) return -1;
+		memcpy(buf, ci->base + seg->offset + (addr - seg->addr), len);
+		return 0;
+	}
+	return -1;
+}
+
+const struct core_mapping* core_mapping_of(const struct core_info *ci, uint64_t addr) {
+	for (unsigned int i = 0; i < ci->nmaps; i++) {
+		if (addr >= ci->maps[i].start && addr < ci->maps[i].end) return &ci->maps[i];
+	}
+	return NULL;
+}
+
+uint64_t core_pc(const struct core_info *ci) {
+#if defined(__x86_64__)
+	return ((const struct user_regs_struct*)ci->regs)->rip;
+#elif defined(__aarch64__)
+	return ((const struct user_regs_struct*)ci->regs)->pc;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * ====================================================================================
+ * Symbols
+ * ====================================================================================
+ */
+
+struct core_sym {
+	uint64_t addr;
+	uint64_t size;
+	const char *name;
+};
+
+/* An ELF file named by NT_FILE, mapped for its symbols */
+struct core_module {
+	struct core_module *next;
+	char *path;
+	const unsigned char *base;
+	size_t size;
+	const Elf64_Phdr *phdrs;
+	unsigned int nphdrs;
+	struct core_sym *syms;	  // Functions, by address
+	size_t nsyms;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct core_module *modules;
+} core_symbols = { PTHREAD_MUTEX_INITIALIZER, NULL };
+
+static int core_sym_cmp(const void *a, const void *b) {
+	const struct core_sym *x = (const struct core_sym*)a, *y = (const struct core_sym*)b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/**
+ * Internal helper: collect the functions of .symtab, or .dynsym for
+ * stripped files
+ */
+static void core_module_symbols(struct core_module *mod) {
+	const Elf64_Ehdr *ehdr = (const Elf64_Ehdr*)mod->base;
+	const Elf64_Shdr *shdrs, *tab = NULL;
+
+	if (ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > mod->size) return;
+	shdrs = (const Elf64_Shdr*)(mod->base + ehdr->e_shoff);
+	for (unsigned int i = 0; i < ehdr->e_shnum; i++) {
+		if (shdrs[i].sh_type == SHT_SYMTAB || (shdrs[i].sh_type == SHT_DYNSYM && !tab)) tab = &shdrs[i];
+	}
+	if (!tab || tab->sh_link >= ehdr->e_shnum || tab->sh_offset + tab->sh_size > mod->size ||
+		shdrs[tab->sh_link].sh_offset + shdrs[tab->sh_link].sh_size > mod->size) {
+		return;
+	}
+
+	const Elf64_Sym *syms = (const Elf64_Sym*)(mod->base + tab->sh_offset);
+	const char *strtab = (const char*)mod->base + shdrs[tab->sh_link].sh_offset;
+	size_t n = tab->sh_size / sizeof(Elf64_Sym), strsz = shdrs[tab->sh_link].sh_size;
+
+	mod->syms = (struct core_sym*)malloc((n ? n : 1) * sizeof(*mod->syms));
+	if (!mod->syms) return;
+	for (size_t i = 0; i < n; i++) {
+		if (ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC || !syms[i].st_value || syms[i].st_name >= strsz) {
+			continue;
+		}
+		mod->syms[mod->nsyms].addr = syms[i].st_value;
+		mod->syms[mod->nsyms].size = syms[i].st_size;
+		mod->syms[mod->nsyms].name = strtab + syms[i].st_name;
+		mod->nsyms++;
+	}
+	qsort(mod->syms, mod->nsyms, sizeof(*mod->syms), core_sym_cmp);
+}
+
+/**
+ * Internal helper: the module for @path, mapped on first use.  Files that
+ * cannot be read are cached too, without symbols.
+ */
+static const struct core_module* core_module_get(const char *path) {
+	struct core_module *mod;
+	struct stat st;
+	int fd;
+
+	pthread_mutex_lock(&core_symbols.lock);
+	for (mod = core_symbols.modules; mod; mod = mod->next) {
+		if (strcmp(mod->path, path) == 0) goto out;
+	}
+
+	mod = (struct core_module*)calloc(1, sizeof(*mod));
+	if (!mod || !(mod->path = strdup(path))) {
+		free(mod);
+		mod = NULL;
+		goto out;
+	}
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Elf64_Ehdr)) {
+		void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (base != MAP_FAILED) {
+			const Elf64_Ehdr *ehdr = (const Elf64_Ehdr*)base;
+
+			mod->base = (const unsigned char*)base;
+			mod->size = st.st_size;
+			if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 && ehdr->e_ident[EI_CLASS] == ELFCLASS64 &&
+				ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) <= mod->size) {
+				mod->phdrs = (const Elf64_Phdr*)(mod->base + ehdr->e_phoff);
+				mod->nphdrs = ehdr->e_phnum;
+				core_module_symbols(mod);
+			}
+		}
+	}
+	if (fd >= 0) close(fd);
+	mod->next = core_symbols.modules;
+	core_symbols.modules = mod;
+out:
+	pthread_mutex_unlock(&core_symbols.lock);
+	return mod;
+}
+
+/**
+ * Internal helper: the function containing file offset @off of @mod
+ */
+static const struct core_sym* core_module_lookup(const struct core_module *mod, uint64_t off, uint64_t *vaddr) {
+	size_t lo = 0, hi = mod->nsyms;
+
+	*vaddr = 0;
+	for (unsigned int i = 0; i < mod->nphdrs; i++) {
+		const Elf64_Phdr *ph = &mod->phdrs[i];
+
+		if (ph->p_type == PT_LOAD && off >= ph->p_offset && off < ph->p_offset + ph->p_filesz) {
+			*vaddr = off - ph->p_offset + ph->p_vaddr;
+			break;
+		}
+	}
+	if (!*vaddr) return NULL;
+
+	// Last symbol at or below vaddr
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (mod->syms[mid].addr <= *vaddr) lo = mid + 1;
+		else hi = mid;
+	}
+	if (!lo) return NULL;
+	if (mod->syms[lo - 1].size && *vaddr >= mod->syms[lo - 1].addr + mod->syms[lo - 1].size) return NULL;
+	return &mod->syms[lo - 1];
+}
+
+/**
+ * Symbolize @pc
+ * @param ret Whether pc is a return address: it is looked up as pc - 1,
+ *			which is still in the calling function if the call was its last
+ *			instruction
+ */
+void core_symbolize(const struct core_info *ci, uint64_t pc, int ret, struct core_frame *frame) {
+	const struct core_mapping *map = core_mapping_of(ci, pc);
+	const struct core_module *mod;
+	const struct core_sym *sym;
+	const char *slash;
+	uint64_t off, vaddr;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->pc = pc;
+	if (!map) return;
+
+	slash = strrchr(map->path, '/');
+	snprintf(frame->module, sizeof(frame->module), "%s", slash ? slash + 1 : map->path);
+	off = pc - map->start + map->offset;
+	frame->off = off;
+
+	mod = core_module_get(map->path);
+	if (!mod || !(sym = core_module_lookup(mod, off - (ret ? 1 : 0), &vaddr))) return;
+	snprintf(frame->func, sizeof(frame->func), "%s", sym->name);
+	frame->off = vaddr + (ret ? 1 : 0) - sym->addr;
+}
+
+/*
+ * ====================================================================================
+ * Backtrace and signature
+ * ====================================================================================
+ */
+
+static int core_is_code(const struct core_info *ci, uint64_t addr) {
+	for (unsigned int i = 0; i < ci->nsegs; i++) {
+		if ((ci->segs[i].flags & PF_X) && addr >= ci->segs[i].addr &&
+			addr - ci->segs[i].addr < ci->segs[i].memsz) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Internal helper: whether @addr follows a call instruction, i.e. is a
+ * plausible return address.  Code is rarely in the core, so it is read
+ * from the mapped file.
+ */
+static int core_after_call(const struct core_info *ci, uint64_t addr) {
+#if defined(__x86_64__)
+	const struct core_mapping *map = core_mapping_of(ci, addr);
+	const struct core_module *mod;
+	const unsigned char *c;
+	uint64_t off;
+
+	if (!map || !(mod = core_module_get(map->path)) || !mod->base) return 0;
+	off = addr - map->start + map->offset;
+	if (off < 7 || off > mod->size) return 0;
+	c = mod->base + off;
+
+	// call rel32, or call r/m64 (ff /2) with a 1, 2, 5 or 6 byte operand
+	return c[-5] == 0xe8 || (c[-2] == 0xff && (c[-1] & 0x38) == 0x10) ||
+		(c[-3] == 0xff && (c[-2] & 0x38) == 0x10) || (c[-6] == 0xff && (c[-5] & 0x38) == 0x10) ||
+		(c[-7] == 0xff && (c[-6] & 0x38) == 0x10);
+#else
+	return core_is_code(ci, addr);
+#endif
+}
+
+static int core_is_return(const struct core_info *ci, uint64_t addr) {
+	return core_is_code(ci, addr) && core_after_call(ci, addr);
+}
+
+/**
+ * Internal helper: whether the frame record at @fp, saved frame pointer
+ * @saved, looks like one: the next record higher up the stack and a
+ * return address after this one.  Two in a row are needed to trust one
+ * found by scanning.
+ */
+static int core_is_frame_record(const struct core_info *ci, uint64_t fp, uint64_t saved) {
+	uint64_t ret;
+
+	return saved > fp && saved - fp < (1 << 20) && !(saved & 7) &&
+		core_read(ci, fp + 8, &ret, sizeof(ret)) == 0 && core_is_return(ci, ret);
+}
+
+/**
+ * Unwind the crashed thread's stack by its frame pointers
+ * @return Number of frames filled in
+ */
+int core_backtrace(const struct core_info *ci, struct core_frame *frames, int max) {
+	uint64_t fp, lr = 0;
+	int n = 0;
+
+#if defined(__x86_64__)
+	const struct user_regs_struct *r = (const struct user_regs_struct*)ci->regs;
+	uint64_t end;
+
+	fp = r->rbp;
+#elif defined(__aarch64__)
+	fp = ((const struct user_regs_struct*)ci->regs)->regs[29];
+	lr = ((const struct user_regs_struct*)ci->regs)->regs[30];
+#else
+	fp = 0;
+#endif
+
+	if (max < 1) return 0;
+	core_symbolize(ci, core_pc(ci), 0, &frames[n++]);
+
+#if defined(__x86_64__)
+	/*
+	 * Frameless functions between the crash and the first frame record
+	 * leave nothing but their return addresses on the stack.  rbp itself
+	 * may be just a register to them: without a frame record in reach,
+	 * the scan looks for one, a saved rbp right below a return address.
+	 */
+	if (fp < r->rsp || fp - r->rsp > CORE_SCAN_BYTES) {
+		uint64_t saved;
+
+		// Still fine when it checks out: a huge frame puts rsp out of reach, not rbp
+		if (core_read(ci, fp, &saved, sizeof(saved)) < 0 || !core_is_frame_record(ci, fp, saved)) fp = 0;
+	}
+	if (!fp) end = r->rsp + CORE_SCAN_BYTES;
+	else end = fp >= r->rsp && fp - r->rsp <= CORE_SCAN_BYTES ? fp : r->rsp;
+	for (uint64_t sp = r->rsp; sp < end && n < max; sp += 8) {
+		uint64_t word, saved, next[2];
+
+		if (core_read(ci, sp, &word, sizeof(word)) < 0) break;
+		if (!core_is_return(ci, word)) continue;
+		if (!fp && sp - 8 >= r->rsp && core_read(ci, sp - 8, &saved, sizeof(saved)) == 0 &&
+			core_is_frame_record(ci, sp - 8, saved) &&
+			core_read(ci, saved, next, sizeof(next)) == 0 && core_is_frame_record(ci, saved, next[0])) {
+			fp = sp - 8;
+			break;
+		}
+		core_symbolize(ci, word, 1, &frames[n++]);
+	}
+#endif
+
+	while (n < max) {
+		uint64_t record[2];
+
+		if (!fp || (fp & 7) || core_read(ci, fp, record, sizeof(record)) < 0) break;
+		// aarch64 leaf functions keep their return address in lr only
+		if (lr && lr != record[1] && n < max) core_symbolize(ci, lr, 1, &frames[n++]);
+		lr = 0;
+		if (!record[1] || !core_is_code(ci, record[1]) || n >= max) break;
+		core_symbolize(ci, record[1], 1, &frames[n++]);
+		// Stacks grow down: the caller's frame is always above
+		if (record[0] <= fp) break;
+		fp = record[0];
+	}
+	return n;
+}
+
+/**
+ * Short stable id of a signature: its 64-bit FNV-1a hash
+ */
+uint64_t core_signature_id(const char *signature) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (const char *p = signature; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/* Where abort(), memset() & co. live: the same for every crash that goes through them */
+static const char *const core_runtime_modules[] = { "libc.so", "libc-", "ld-linux", "libpthread", "libstdc++" };
+
+static int core_frame_is_runtime(const struct core_frame *f) {
+	for (size_t i = 0; i < sizeof(core_runtime_modules) / sizeof(core_runtime_modules[0]); i++) {
+		if (strncmp(f->module, core_runtime_modules[i], strlen(core_runtime_modules[i])) == 0) return 1;
+	}
+	return 0;
+}
+
+static int core_frame_is_driver(const struct core_frame *f, const char *const *drivers) {
+	for (; drivers && *drivers; drivers++) {
+		if (strcmp(f->func, *drivers) == 0) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Crash signature of a backtrace: "SIGSEGV null_dereference".
+ * Frames in the C runtime are left out unless there is nothing else.
+ * @param drivers NULL-terminated function names (or NULL) of the code that
+ *                ran the crashing code, e.g. main(): the backtrace is cut
+ *                at the first of them, so the way the code was run does
+ *                not change the signature
+ * @return core_signature_id() of it
+ */
+uint64_t core_signature(int signo, const struct core_frame *frames, int nframes, const char *const *drivers,
+			char *buf, size_t size) {
+	const char *sig = sigabbrev_np(signo);
+	int app = 0, used = 0;
+	size_t len;
+
+	for (int i = 0; i < nframes; i++) {
+		if (core_frame_is_driver(&frames[i], drivers)) {
+			// Keep at least the crashing frame
+			nframes = i ? i : 1;
+			break;
+		}
+	}
+	for (int i = 0; i < nframes; i++) app += !core_frame_is_runtime(&frames[i]);
+
+	len = snprintf(buf, size, "SIG%s", sig ? sig : "?");
+	for (int i = 0; i < nframes && used < CORE_SIG_FRAMES && len < size; i++) {
+		const struct core_frame *f = &frames[i];
+		const char *sep = used++ ? " < " : " ";
+
+		if (app && core_frame_is_runtime(f)) {
+			used--;
+			continue;
+		}
+		// Without a symbol, fall back to the module offset: stable for one build
+		if (f->func[0]) {
+			len += snprintf(buf + len, size - len, "%s%s", sep, f->func);
+		} else if (f->module[0]) {
+			len += snprintf(buf + len, size - len, "%s%s+0x%llx", sep, f->module, (unsigned long long)f->off);
+		} else {
+			len += snprintf(buf + len, size - len, "%s?", sep);
+		}
+	}
+	return core_signature_id(buf);
+}
+
+#endif /* COREINFO_H */
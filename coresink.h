@@ -0,0 +1,429 @@
+#ifndef CORESINK_H
+#define CORESINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include <sparse.h>
+
+/**
+ * Core sink: the receiving end of a core_pattern pipe
+ * ("|/path/ludtm --core-sink ... %p %e").
+ *
+ * The kernel writes the core into our stdin and the crashed process is
+ * not reaped until we have read all of it, so the sink reads as fast as it
+ * can and leaves the rest to other threads:
+ *
+ *   reader (caller) --> SINK_CHUNK slots --> N compressors --> writer
+ *
+ * Each chunk is compressed on its own into an independent zstd or lz4
+ * frame; concatenated frames are a valid .zst / .lz4 file, so chunks can
+ * be compressed in any order and written in sequence.  The compression
+ * libraries are loaded with dlopen() at run time, so ludtm builds and runs
+ * (uncompressed) without them.  Uncompressed output goes through sparse.h,
+ * zero pages become holes.  There is a single fsync(), at the end.
+ */
+
+#define SINK_CHUNK (4 << 20)
+#define SINK_MAX_THREADS 16
+
+enum sink_codec_id {
+	SINK_NONE,
+	SINK_ZSTD,
+	SINK_LZ4,
+};
+
+struct sink_codec {
+	const char *name;
+	const char *ext;		// Appended to the file name
+	const char *lib;		// dlopen()ed
+	int default_level;
+};
+
+static const struct sink_codec sink_codecs[] = {
+	[SINK_NONE] = { "none", "", NULL, 0 },
+	[SINK_ZSTD] = { "zstd", ".zst", "libzstd.so.1", 3 },
+	[SINK_LZ4] = { "lz4", ".lz4", "liblz4.so.1", 0 },
+};
+
+/* The few entry points we need, declared here since the headers may not be installed */
+static size_t (*sink_zstd_bound)(size_t);
+static size_t (*sink_zstd_compress)(void *dst, size_t cap, const void *src, size_t len, int level);
+static unsigned (*sink_zstd_is_error)(size_t);
+
+/* lz4frame.h's LZ4F_preferences_t, stable since lz4 1.8 */
+struct sink_lz4_prefs {
+	int block_size_id;
+	int block_mode;
+	int content_checksum;
+	int frame_type;
+	unsigned long long content_size;
+	unsigned dict_id;
+	int block_checksum;
+	int compression_level;
+	unsigned auto_flush;
+	unsigned favor_dec_speed;
+	unsigned reserved[3];
+};
+
+static size_t (*sink_lz4_bound)(size_t, const struct sink_lz4_prefs*);
+static size_t (*sink_lz4_compress)(void *dst, size_t cap, const void *src, size_t len,
+								   const struct sink_lz4_prefs*);
+static unsigned (*sink_lz4_is_error)(size_t);
+
+enum sink_slot_state {
+	SLOT_EMPTY,
+	SLOT_FILLED,	// Read, waiting for a compressor
+	SLOT_BUSY,	  // Being compressed
+	SLOT_DONE,	  // Ready to be written
+};
+
+struct sink_slot {
+	enum sink_slot_state state;
+	size_t len;
+	size_t out_len;
+	char *in;
+	char *out;
+};
+
+struct core_sink_stats {
+	uint64_t in_bytes;
+	uint64_t out_bytes;	 // Written, holes excluded
+	uint64_t hole_bytes;
+	unsigned int chunks;
+};
+
+struct core_sink {
+	int in_fd;
+	int out_fd;
+	struct sparse_file out;		 // Uncompressed output
+	enum sink_codec_id codec;
+	int level;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct sink_slot *slots;
+	unsigned int nslots;
+	uint64_t next_fill;		 // Sequence numbers of chunks
+	uint64_t next_compress;
+	uint64_t next_write;
+	int eof;
+	int error;
+	struct core_sink_stats stats;
+};
+
+/*
+ * ====================================================================================
+ * Codecs
+ * ====================================================================================
+ */
+
+/**
+ * Parse "none", "zstd", "zstd:19", "lz4:9"... and load the library
+ * @return 0 on success, -1 on error
+ */
+int sink_codec_load(const char *spec, enum sink_codec_id *codec, int *level) {
+	const char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+	void *lib;
+
+	for (*codec = SINK_NONE; *codec <= SINK_LZ4; (*codec)++) {
+		if (strlen(sink_codecs[*codec].name) == len && strncmp(spec, sink_codecs[*codec].name, len) == 0) {
+			break;
+		}
+	}
+	if (*codec > SINK_LZ4) {
+		fprintf(stderr, "core sink: unknown codec '%s' (none, zstd[:LEVEL], lz4[:LEVEL])\n", spec);
+		return -1;
+	}
+	*level = colon ? atoi(colon + 1) : sink_codecs[*codec].default_level;
+	if (*codec == SINK_NONE) return 0;
+
+	lib = dlopen(sink_codecs[*codec].lib, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		fprintf(stderr, "core sink: %s\n", dlerror());
+		return -1;
+	}
+	if (*codec == SINK_ZSTD) {
+		*(void**)&sink_zstd_bound = dlsym(lib, "ZSTD_compressBound");
+		*(void**)&sink_zstd_compress = dlsym(lib, "ZSTD_compress");
+		*(void**)&sink_zstd_is_error = dlsym(lib, "ZSTD_isError");
+		if (sink_zstd_bound && sink_zstd_compress && sink_zstd_is_error) return 0;
+	} else {
+		*(void**)&sink_lz4_bound = dlsym(lib, "LZ4F_compressFrameBound");
+		*(void**)&sink_lz4_compress = dlsym(lib, "LZ4F_compressFrame");
+		*(void**)&sink_lz4_is_error = dlsym(lib, "LZ4F_isError");
+		if (sink_lz4_bound && sink_lz4_compress && sink_lz4_is_error) return 0;
+	}
+	fprintf(stderr, "core sink: %s lacks the functions we need\n", sink_codecs[*codec].lib);
+	return -1;
+}
+
+static size_t sink_bound(const struct core_sink *sink, size_t len) {
+	struct sink_lz4_prefs prefs = { .compression_level = sink->level };
+
+	switch (sink->codec) {
+	case SINK_ZSTD: return sink_zstd_bound(len);
+	case SINK_LZ4: return sink_lz4_bound(len, &prefs);
+	default: return 0;
+	}
+}
+
+/**
+ * Internal helper: compress a slot into one frame
+ * @return 0 on success, -1 on error
+ */
+static int sink_compress(const struct core_sink *sink, struct sink_slot *slot) {
+	struct sink_lz4_prefs prefs = { .compression_level = sink->level };
+	size_t cap = sink_bound(sink, SINK_CHUNK), n;
+
+	if (sink->codec == SINK_ZSTD) {
+		n = sink_zstd_compress(slot->out, cap, slot->in, slot->len, sink->level);
+		if (sink_zstd_is_error(n)) return -1;
+	} else {
+		n = sink_lz4_compress(slot->out, cap, slot->in, slot->len, &prefs);
+		if (sink_lz4_is_error(n)) return -1;
+	}
+	slot->out_len = n;
+	return 0;
+}
+
+/*
+ * ====================================================================================
+ * Output
+ * ====================================================================================
+ */
+
+static int sink_write_all(int fd, const char *buf, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			perror("core sink: write");
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * ====================================================================================
+ * Pipeline
+ * ====================================================================================
+ */
+
+static void sink_fail(struct core_sink *sink) {
+	pthread_mutex_lock(&sink->lock);
+	sink->error = 1;
+	pthread_cond_broadcast(&sink->cond);
+	pthread_mutex_unlock(&sink->lock);
+}
+
+static void* sink_compressor(void *arg) {
+	struct core_sink *sink = (struct core_sink*)arg;
+
+	pthread_mutex_lock(&sink->lock);
+	for (;;) {
+		struct sink_slot *slot;
+		int ret;
+
+		while (!sink->error && !sink->eof && sink->next_compress >= sink->next_fill) {
+			pthread_cond_wait(&sink->cond, &sink->lock);
+		}
+		if (sink->error || sink->next_compress >= sink->next_fill) break;
+
+		slot = &sink->slots[sink->next_compress++ % sink->nslots];
+		slot->state = SLOT_BUSY;
+		pthread_mutex_unlock(&sink->lock);
+
+		ret = sink_compress(sink, slot);
+
+		pthread_mutex_lock(&sink->lock);
+		if (ret < 0) {
+			fprintf(stderr, "core sink: %s compression failed\n", sink_codecs[sink->codec].name);
+			sink->error = 1;
+		}
+		slot->state = SLOT_DONE;
+		pthread_cond_broadcast(&sink->cond);
+	}
+	pthread_mutex_unlock(&sink->lock);
+	return NULL;
+}
+
+static void* sink_writer(void *arg) {
+	struct core_sink *sink = (struct core_sink*)arg;
+
+	pthread_mutex_lock(&sink->lock);
+	for (;;) {
+		struct sink_slot *slot = &sink->slots[sink->next_write % sink->nslots];
+		int ret;
+
+		while (!sink->error && !(sink->next_write < sink->next_fill && slot->state == SLOT_DONE) &&
+			   !(sink->eof && sink->next_write >= sink->next_fill)) {
+			pthread_cond_wait(&sink->cond, &sink->lock);
+		}
+		if (sink->error || sink->next_write >= sink->next_fill) break;
+		pthread_mutex_unlock(&sink->lock);
+
+		if (sink->codec == SINK_NONE) {
+			ret = sparse_write(&sink->out, slot->in, slot->len);
+		} else {
+			ret = sink_write_all(sink->out_fd, slot->out, slot->out_len);
+			sink->stats.out_bytes += slot->out_len;
+		}
+
+		pthread_mutex_lock(&sink->lock);
+		if (ret < 0) sink->error = 1;
+		slot->state = SLOT_EMPTY;
+		sink->next_write++;
+		sink->stats.chunks++;
+		pthread_cond_broadcast(&sink->cond);
+	}
+	pthread_mutex_unlock(&sink->lock);
+	return NULL;
+}
+
+/**
+ * Internal helper: fill @buf from the pipe
+ * @return bytes read (< SINK_CHUNK at end of input), -1 on error
+ */
+static ssize_t sink_read_chunk(int fd, char *buf) {
+	size_t len = 0;
+
+	while (len < SINK_CHUNK) {
+		ssize_t n = read(fd, buf + len, SINK_CHUNK - len);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			perror("core sink: read");
+			return -1;
+		}
+		if (!n) break;
+		len += n;
+	}
+	return len;
+}
+
+/**
+ * Copy @in_fd to @out_fd through the pipeline
+ * @param codec What sink_codec_load() returned
+ * @param nthreads Compressor threads (ignored without compression)
+ * @param stats Filled in (optional)
+ * @return 0 on success, -1 on error
+ */
+int core_sink_run(int in_fd, int out_fd, enum sink_codec_id codec, int level, int nthreads,
+				  struct core_sink_stats *stats) {
+	pthread_t workers[SINK_MAX_THREADS], writer;
+	struct core_sink sink;
+	int nworkers = 0, writer_started = 0;
+
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > SINK_MAX_THREADS) nthreads = SINK_MAX_THREADS;
+	if (codec == SINK_NONE) nthreads = 0;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.in_fd = in_fd;
+	sink.out_fd = out_fd;
+	sink.codec = codec;
+	sink.level = level;
+	if (codec == SINK_NONE && sparse_open(&sink.out, out_fd) < 0) return -1;
+	// Enough slots for every compressor, one being read and one being written
+	sink.nslots = nthreads + 2;
+	pthread_mutex_init(&sink.lock, NULL);
+	pthread_cond_init(&sink.cond, NULL);
+
+	sink.slots = (struct sink_slot*)calloc(sink.nslots, sizeof(*sink.slots));
+	if (!sink.slots) {
+		perror("calloc slots");
+		return -1;
+	}
+	for (unsigned int i = 0; i < sink.nslots; i++) {
+		sink.slots[i].in = (char*)malloc(SINK_CHUNK);
+		if (codec != SINK_NONE) sink.slots[i].out = (char*)malloc(sink_bound(&sink, SINK_CHUNK));
+		if (!sink.slots[i].in || (codec != SINK_NONE && !sink.slots[i].out)) {
+			perror("malloc slot");
+			sink.error = 1;
+			goto out;
+		}
+	}
+
+	for (; nworkers < nthreads; nworkers++) {
+		if (pthread_create(&workers[nworkers], NULL, sink_compressor, &sink) != 0) {
+			perror("pthread_create");
+			sink_fail(&sink);
+			goto out;
+		}
+	}
+	if (pthread_create(&writer, NULL, sink_writer, &sink) != 0) {
+		perror("pthread_create");
+		sink_fail(&sink);
+		goto out;
+	}
+	writer_started = 1;
+
+	// Reader: keep the pipe drained, the crashed process waits on it
+	for (;;) {
+		struct sink_slot *slot;
+		ssize_t len;
+
+		pthread_mutex_lock(&sink.lock);
+		slot = &sink.slots[sink.next_fill % sink.nslots];
+		while (!sink.error && slot->state != SLOT_EMPTY) pthread_cond_wait(&sink.cond, &sink.lock);
+		pthread_mutex_unlock(&sink.lock);
+		if (sink.error) break;
+
+		len = sink_read_chunk(in_fd, slot->in);
+
+		pthread_mutex_lock(&sink.lock);
+		if (len < 0) {
+			sink.error = 1;
+		} else if (len > 0) {
+			slot->len = len;
+			slot->state = codec == SINK_NONE ? SLOT_DONE : SLOT_FILLED;
+			sink.next_fill++;
+			sink.stats.in_bytes += len;
+		}
+		if (len < SINK_CHUNK) sink.eof = 1;
+		pthread_cond_broadcast(&sink.cond);
+		pthread_mutex_unlock(&sink.lock);
+		if (len < SINK_CHUNK) break;
+	}
+
+out:
+	if (writer_started) pthread_join(writer, NULL);
+	if (!writer_started || sink.error) sink_fail(&sink);
+	for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+
+	// A trailing hole needs the file size set explicitly, then one fsync
+	if (!sink.error && codec == SINK_NONE) {
+		if (sparse_finish(&sink.out) < 0) sink.error = 1;
+		sink.stats.out_bytes = sink.out.written;
+		sink.stats.hole_bytes = sink.out.holes;
+	}
+	if (!sink.error && fsync(out_fd) < 0) {
+		perror("core sink: fsync");
+		sink.error = 1;
+	}
+
+	for (unsigned int i = 0; i < sink.nslots; i++) {
+		free(sink.slots[i].in);
+		free(sink.slots[i].out);
+	}
+	free(sink.slots);
+	pthread_mutex_destroy(&sink.lock);
+	pthread_cond_destroy(&sink.cond);
+	if (stats) *stats = sink.stats;
+	return sink.error ? -1 : 0;
+}
+
+#endif /* CORESINK_H */
@@ -0,0 +1,455 @@
+#ifndef CRASH_H
+#define CRASH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // REG_RIP and friends; include this header first
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * Built-in crash reporter, a replacement for LD_PRELOAD=libSegFault.so
+ * (architecture-specific paths, and gone from glibc 2.35).
+ *
+ * On SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT and SIGTRAP it prints, like
+ * libSegFault did:
+ *
+ *  - the signal, si_code, fault address, pid and tid
+ *  - the registers from the signal context (x86_64 and aarch64)
+ *  - a backtrace, one "module(+0xoffset)[0xaddress]" line per frame
+ *  - /proc/self/maps
+ *
+ * and then lets the signal take its default action, so the core dump is
+ * unchanged.
+ *
+ * Everything in the handler is async-signal-safe: the handler runs on an
+ * alternate signal stack (a stack overflow still gets a report), output
+ * goes through a static buffer with raw write() calls, and the backtrace
+ * follows frame pointers from the signal context instead of calling
+ * backtrace(), which may allocate.  Each frame is checked for readability
+ * (a write() of it into a pipe fails with EFAULT instead of faulting)
+ * before it is followed.  Frames without frame pointers end the walk
+ * early: build with -fno-omit-frame-pointer.
+ *
+ * The alternate stack is per thread: threads that should survive their own
+ * stack overflow call crash_handler_thread_init().
+ */
+
+#define CRASH_MAX_FRAMES 64
+#define CRASH_BUF_SIZE 4096
+#define CRASH_MAPS_SIZE (256 * 1024)
+#define CRASH_ALTSTACK_SIZE (64 * 1024)
+
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTRAP };
+static const char *const crash_signal_names[] = { "SIGSEGV", "SIGBUS", "SIGILL", "SIGFPE", "SIGABRT", "SIGTRAP" };
+
+#define NR_CRASH_SIGNALS (sizeof(crash_signals) / sizeof(crash_signals[0]))
+
+/**
+ * Called from the handler after the report is written, with the maps loaded
+ * (minidump.h uses it).  Must be async-signal-safe.
+ */
+typedef void (*crash_hook_t)(int sig, siginfo_t *info, ucontext_t *uc);
+
+static struct {
+	int fd;					  // Report goes here
+	int probe[2];			   // Pipe to test addresses for readability
+	crash_hook_t hook;
+	size_t len;
+	char buf[CRASH_BUF_SIZE];	// Pending output
+	size_t maps_len;
+	char maps[CRASH_MAPS_SIZE];  // /proc/self/maps, read at crash time
+} crash = { .fd = -1, .probe = { -1, -1 } };
+
+/**
+ * One line of /proc/self/maps
+ */
+struct crash_map {
+	uintptr_t start;
+	uintptr_t end;
+	uintptr_t offset;
+	char perms[4];	  // "rwxp"
+	const char *path;   // Not NUL-terminated; empty for anonymous mappings
+	size_t path_len;
+};
+
+/*
+ * ====================================================================================
+ * Async-signal-safe output
+ * ====================================================================================
+ */
+
+static void crash_flush(void) {
+	size_t off = 0;
+
+	while (off < crash.len) {
+		ssize_t n = write(crash.fd, crash.buf + off, crash.len - off);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		off += n;
+	}
+	crash.len = 0;
+}
+
+static void crash_put(const char *s, size_t n) {
+	while (n) {
+		size_t room = sizeof(crash.buf) - crash.len;
+
+		if (!room) {
+			crash_flush();
+			continue;
+		}
+		if (room > n) room = n;
+		memcpy(crash.buf + crash.len, s, room);
+		crash.len += room;
+		s += room;
+		n -= room;
+	}
+}
+
+static void crash_puts(const char *s) {
+	crash_put(s, strlen(s));
+}
+
+/**
+ * Internal helper: print @v in hex, zero-padded to @width digits
+ */
+static void crash_hex(uintptr_t v, int width) {
+	char tmp[2 + 2 * sizeof(v)];
+	int n = sizeof(tmp);
+
+	do {
+		tmp[--n] = "0123456789abcdef"[v & 0xf];
+		v >>= 4;
+		width--;
+	} while (v || width > 0);
+	tmp[--n] = 'x';
+	tmp[--n] = '0';
+	crash_put(tmp + n, sizeof(tmp) - n);
+}
+
+static void crash_dec(long v) {
+	char tmp[24];
+	int n = sizeof(tmp);
+	unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+
+	do {
+		tmp[--n] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (v < 0) tmp[--n] = '-';
+	crash_put(tmp + n, sizeof(tmp) - n);
+}
+
+/*
+ * ====================================================================================
+ * Memory map and symbolization
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: can @n bytes at @p be read without faulting?
+ */
+static int crash_readable(const void *p, size_t n) {
+	char tmp[2 * sizeof(uintptr_t)];
+
+	if (n > sizeof(tmp) || write(crash.probe[1], p, n) != (ssize_t)n) return 0;
+	while (read(crash.probe[0], tmp, n) < 0 && errno == EINTR)
+		;
+	return 1;
+}
+
+static void crash_maps_load(void) {
+	int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	ssize_t n;
+
+	crash.maps_len = 0;
+	if (fd < 0) return;
+	while (crash.maps_len < sizeof(crash.maps)) {
+		n = read(fd, crash.maps + crash.maps_len, sizeof(crash.maps) - crash.maps_len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		crash.maps_len += n;
+	}
+	close(fd);
+}
+
+/**
+ * Internal helper: parse a hex number at @p, up to the first non-hex char
+ */
+static uintptr_t crash_parse_hex(const char **p, const char *end) {
+	uintptr_t v = 0;
+
+	for (; *p < end; (*p)++) {
+		char c = **p;
+
+		if (c >= '0' && c <= '9') v = (v << 4) | (c - '0');
+		else if (c >= 'a' && c <= 'f') v = (v << 4) | (c - 'a' + 10);
+		else break;
+	}
+	return v;
+}
+
+/**
+ * Iterate over the maps loaded by crash_maps_load()
+ * @param pos Cursor, 0 to start
+ * @return 1 and the next mapping in @m, 0 at the end
+ */
+static int crash_maps_next(size_t *pos, struct crash_map *m) {
+	const char *end = crash.maps + crash.maps_len, *p = crash.maps + *pos, *eol;
+
+	if (p >= end) return 0;
+	eol = memchr(p, '\n', end - p);
+	if (!eol) eol = end;
+	*pos = eol - crash.maps + 1;
+
+	// "start-end perms offset dev inode path"
+	m->start = crash_parse_hex(&p, eol);
+	p++;
+	m->end = crash_parse_hex(&p, eol);
+	while (p < eol && *p == ' ') p++;
+	memset(m->perms, '-', sizeof(m->perms));
+	for (int i = 0; p < eol && *p != ' '; p++, i++) {
+		if (i < 4) m->perms[i] = *p;
+	}
+	while (p < eol && *p == ' ') p++;
+	m->offset = crash_parse_hex(&p, eol);
+	for (int field = 0; field < 2; field++) {
+		while (p < eol && *p == ' ') p++;
+		while (p < eol && *p != ' ') p++;
+	}
+	while (p < eol && *p == ' ') p++;
+	m->path = p;
+	m->path_len = eol - p;
+	return 1;
+}
+
+/**
+ * Internal helper: print "module(+0xoffset)[0xaddress]" for @pc, the offset
+ * being into the mapped file, or "[0xaddress]" outside any file mapping
+ */
+static void crash_symbolize(uintptr_t pc) {
+	struct crash_map m;
+	size_t pos = 0;
+
+	while (crash_maps_next(&pos, &m)) {
+		if (pc < m.start || pc >= m.end) continue;
+		if (m.path_len && m.path[0] != '[') {
+			crash_put(m.path, m.path_len);
+			crash_puts("(+");
+			crash_hex(pc - m.start + m.offset, 0);
+			crash_puts(")");
+		}
+		break;
+	}
+	crash_puts("[");
+	crash_hex(pc, 0);
+	crash_puts("]\n");
+}
+
+/*
+ * ====================================================================================
+ * Registers and backtrace
+ * ====================================================================================
+ */
+
+#if defined(__x86_64__)
+static const char *const crash_reg_names[NGREG] = {
+	"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rdi", "rsi", "rbp", "rbx",
+	"rdx", "rax", "rcx", "rsp", "rip", "efl", "csgsfs", "err", "trapno", "oldmask", "cr2",
+};
+#endif
+
+static void crash_registers(const ucontext_t *uc, uintptr_t *pc, uintptr_t *fp, uintptr_t *lr) {
+#if defined(__x86_64__)
+	const greg_t *regs = uc->uc_mcontext.gregs;
+
+	for (int i = 0; i < NGREG; i++) {
+		const char *name = crash_reg_names[i];
+
+		crash_put("       ", 7 - strlen(name));
+		crash_puts(name);
+		crash_puts(": ");
+		crash_hex((uintptr_t)regs[i], 16);
+		crash_puts(i % 4 == 3 || i == NGREG - 1 ? "\n" : " ");
+	}
+	*pc = regs[REG_RIP];
+	*fp = regs[REG_RBP];
+	*lr = 0;
+#elif defined(__aarch64__)
+	const mcontext_t *mc = &uc->uc_mcontext;
+
+	for (int i = 0; i < 31; i++) {
+		crash_puts(i < 10 ? "  x" : " x");
+		crash_dec(i);
+		crash_puts(": ");
+		crash_hex(mc->regs[i], 16);
+		crash_puts(i % 4 == 3 ? "\n" : " ");
+	}
+	crash_puts("  sp: ");
+	crash_hex(mc->sp, 16);
+	crash_puts("\n  pc: ");
+	crash_hex(mc->pc, 16);
+	crash_puts(" pstate: ");
+	crash_hex(mc->pstate, 16);
+	crash_puts(" fault: ");
+	crash_hex(mc->fault_address, 16);
+	crash_puts("\n");
+	*pc = mc->pc;
+	*fp = mc->regs[29];
+	*lr = mc->regs[30];
+#else
+	crash_puts("(registers not supported on this architecture)\n");
+	*pc = *fp = *lr = 0;
+#endif
+}
+
+/**
+ * Internal helper: walk the frame records from @fp.  On both x86_64 and
+ * aarch64 a frame record is { caller's frame pointer, return address }.
+ */
+static void crash_backtrace(uintptr_t pc, uintptr_t fp, uintptr_t lr) {
+	int frames = 0;
+
+	if (!pc) return;
+	crash_symbolize(pc);
+
+	while (frames++ < CRASH_MAX_FRAMES) {
+		uintptr_t record[2];
+
+		if (!fp || (fp & (sizeof(uintptr_t) - 1)) || !crash_readable((void*)fp, sizeof(record))) {
+			break;
+		}
+		memcpy(record, (void*)fp, sizeof(record));
+		// aarch64 leaf functions keep their return address in lr only
+		if (lr && lr != record[1]) crash_symbolize(lr);
+		lr = 0;
+		if (!record[1]) break;
+		crash_symbolize(record[1]);
+		// Stacks grow down: the caller's frame is always above
+		if (record[0] <= fp) break;
+		fp = record[0];
+	}
+	if (frames > CRASH_MAX_FRAMES) crash_puts("...\n");
+}
+
+/*
+ * ====================================================================================
+ * Handler
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: whether si_addr is a fault address.  For a signal sent
+ * by a process (si_code <= 0) it holds the sender's pid and uid instead.
+ */
+static int crash_has_fault_addr(int sig, int si_code) {
+	return si_code > 0 && (sig == SIGSEGV || sig == SIGBUS || sig == SIGILL || sig == SIGFPE);
+}
+
+static void crash_handler(int sig, siginfo_t *info, void *ucontext) {
+	int saved_errno = errno;
+	uintptr_t pc, fp, lr;
+	const char *name = "signal";
+
+	for (unsigned int i = 0; i < NR_CRASH_SIGNALS; i++) {
+		if (crash_signals[i] == sig) name = crash_signal_names[i];
+	}
+	crash.len = 0;
+	crash_puts("*** ");
+	crash_puts(name);
+	crash_puts(" (si_code ");
+	crash_dec(info->si_code);
+	crash_puts(")");
+	if (crash_has_fault_addr(sig, info->si_code)) {
+		crash_puts(" at address ");
+		crash_hex((uintptr_t)info->si_addr, 0);
+	}
+	crash_puts(", pid ");
+	crash_dec(getpid());
+	crash_puts(", tid ");
+	crash_dec(syscall(SYS_gettid));
+	crash_puts("\n\nRegisters:\n");
+	crash_registers((const ucontext_t*)ucontext, &pc, &fp, &lr);
+
+	crash_maps_load();
+	crash_puts("\nBacktrace:\n");
+	crash_backtrace(pc, fp, lr);
+
+	crash_puts("\nMemory map:\n\n");
+	crash_put(crash.maps, crash.maps_len);
+	crash_puts("\n");
+	crash_flush();
+	if (crash.hook) crash.hook(sig, info, (ucontext_t*)ucontext);
+
+	errno = saved_errno;
+	// SA_RESETHAND restored the default action.  A fault re-executes the
+	// faulting instruction on return; a sent signal has to be sent again.
+	if (info->si_code <= 0) raise(sig);
+}
+
+/**
+ * Give the calling thread its own alternate signal stack, so that its
+ * stack overflows get reported too
+ * @return 0 on success, -1 on error
+ */
+int crash_handler_thread_init(void) {
+	stack_t ss;
+
+	ss.ss_size = CRASH_ALTSTACK_SIZE;
+	if (ss.ss_size < (size_t)sysconf(_SC_SIGSTKSZ)) ss.ss_size = sysconf(_SC_SIGSTKSZ);
+	ss.ss_sp = mmap(NULL, ss.ss_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ss.ss_sp == MAP_FAILED) {
+		perror("mmap crash stack");
+		return -1;
+	}
+	ss.ss_flags = 0;
+	if (sigaltstack(&ss, NULL) < 0) {
+		perror("sigaltstack");
+		munmap(ss.ss_sp, ss.ss_size);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Install the crash reporter for the whole process (and an alternate
+ * signal stack for the calling thread)
+ * @param fd Where reports go, usually STDERR_FILENO
+ * @return 0 on success, -1 on error
+ */
+int crash_handler_install(int fd) {
+	struct sigaction sa;
+
+	if (crash.probe[0] < 0 && pipe2(crash.probe, O_CLOEXEC | O_NONBLOCK) < 0) {
+		perror("pipe2");
+		return -1;
+	}
+	if (crash_handler_thread_init() < 0) return -1;
+
+	crash.fd = fd;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = crash_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	for (unsigned int i = 0; i < NR_CRASH_SIGNALS; i++) {
+		if (sigaction(crash_signals[i], &sa, NULL) < 0) {
+			perror("sigaction");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#endif /* CRASH_H */
@@ -0,0 +1,296 @@
+#ifndef ELFCORE_H
+#define ELFCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/procfs.h>
+
+#include <sparse.h>
+
+/**
+ * ELF core file writer, for cores put together in user space (minidump.h,
+ * a ptrace snapshot) rather than by the kernel.
+ *
+ * The layout is the kernel's: ELF header, one PT_NOTE program header then
+ * one PT_LOAD per memory segment, the notes, and the segment contents at
+ * page-aligned offsets.  Notes: NT_PRSTATUS per thread (the crashing one
+ * first, gdb's thread 1), NT_PRPSINFO, NT_SIGINFO (the fault address) when
+ * known, NT_AUXV (gdb needs AT_ENTRY to
+ * relocate a PIE) and NT_FILE (which file backs which mapping, so gdb can
+ * find the shared libraries).
+ *
+ * Segments may be left out of the file (p_filesz 0, e.g. code that gdb
+ * reads from the binary instead), come from a buffer, or from a read
+ * callback for memory that is not in this process.  Output goes through
+ * sparse.h: zero pages, the padding and unreadable memory included, end up
+ * as holes in the file.
+ *
+ * Native architecture only: registers are the host's elf_gregset_t.
+ */
+
+#if defined(__x86_64__)
+#define ELFCORE_MACHINE EM_X86_64
+#elif defined(__aarch64__)
+#define ELFCORE_MACHINE EM_AARCH64
+#elif defined(__i386__)
+#define ELFCORE_MACHINE EM_386
+#else
+#define ELFCORE_MACHINE EM_NONE
+#endif
+
+#define ELFCORE_ALIGN 4096
+
+struct elfcore_thread {
+	pid_t tid;
+	int signo;		  // 0 for threads that did not crash
+	elf_gregset_t regs;
+};
+
+struct elfcore_segment {
+	uint64_t addr;
+	uint64_t size;
+	uint64_t filesz;	// Bytes in the file: size, or 0 to leave it out
+	uint32_t flags;	 // PF_R | PF_W | PF_X
+	const void *data;   // filesz bytes, or NULL to use elfcore.read
+};
+
+struct elfcore_file {
+	uint64_t start;
+	uint64_t end;
+	uint64_t offset;	// In bytes
+	const char *path;
+};
+
+struct elfcore {
+	pid_t pid;
+	int signo;
+	char fname[16];	 // Executable name (comm)
+	char psargs[80];	// Command line
+	const struct elfcore_thread *threads;
+	unsigned int nthreads;
+	const struct elfcore_segment *segs;
+	unsigned int nsegs;
+	const struct elfcore_file *files;
+	unsigned int nfiles;
+	const void *auxv;
+	size_t auxv_len;
+	const siginfo_t *siginfo;   // Of the crashing thread, optional
+	/* Fills @buf with @len bytes at @addr; returns len, or -1 */
+	ssize_t (*read)(void *arg, uint64_t addr, void *buf, size_t len);
+	void *read_arg;
+};
+
+/*
+ * ====================================================================================
+ * Internal helpers
+ * ====================================================================================
+ */
+
+static int elfcore_out(struct sparse_file *sf, const void *buf, size_t len) {
+	return sparse_write(sf, buf, len);
+}
+
+static int elfcore_pad(struct sparse_file *sf, uint64_t *pos, uint64_t to) {
+	static const char zeros[ELFCORE_ALIGN];
+
+	while (*pos < to) {
+		size_t n = to - *pos < sizeof(zeros) ? to - *pos : sizeof(zeros);
+
+		if (elfcore_out(sf, zeros, n) < 0) return -1;
+		*pos += n;
+	}
+	return 0;
+}
+
+static size_t elfcore_note_size(size_t descsz) {
+	// Nhdr, "CORE\0" padded to 8, desc padded to 4
+	return sizeof(Elf64_Nhdr) + 8 + ((descsz + 3) & ~(size_t)3);
+}
+
+static int elfcore_note(struct sparse_file *sf, uint64_t *pos, uint32_t type, const void *desc, size_t descsz) {
+	Elf64_Nhdr nhdr = { .n_namesz = 5, .n_descsz = (Elf64_Word)descsz, .n_type = type };
+	char name[8] = "CORE";
+
+	if (elfcore_out(sf, &nhdr, sizeof(nhdr)) < 0 || elfcore_out(sf, name, sizeof(name)) < 0 ||
+		elfcore_out(sf, desc, descsz) < 0) {
+		return -1;
+	}
+	*pos += sizeof(nhdr) + sizeof(name) + descsz;
+	return elfcore_pad(sf, pos, (*pos + 3) & ~(uint64_t)3);
+}
+
+/**
+ * Internal helper: NT_FILE payload: count, page size, {start, end, page
+ * offset} per file, then the NUL-terminated paths
+ */
+static size_t elfcore_nt_file(const struct elfcore *core, char *buf) {
+	uint64_t hdr[2] = { core->nfiles, ELFCORE_ALIGN };
+	size_t len = sizeof(hdr) + core->nfiles * 3 * sizeof(uint64_t);
+
+	if (buf) memcpy(buf, hdr, sizeof(hdr));
+	for (unsigned int i = 0; i < core->nfiles; i++) {
+		const struct elfcore_file *f = &core->files[i];
+		uint64_t entry[3] = { f->start, f->end, f->offset / ELFCORE_ALIGN };
+		size_t plen = strlen(f->path) + 1;
+
+		if (buf) {
+			memcpy(buf + sizeof(hdr) + i * sizeof(entry), entry, sizeof(entry));
+			memcpy(buf + len, f->path, plen);
+		}
+		len += plen;
+	}
+	return len;
+}
+
+static int elfcore_segment_data(struct sparse_file *sf, const struct elfcore *core, const struct elfcore_segment *seg) {
+	static char chunk[64 * 1024];
+
+	if (seg->data) return elfcore_out(sf, seg->data, seg->filesz);
+
+	for (uint64_t off = 0; off < seg->filesz; off += sizeof(chunk)) {
+		size_t len = seg->filesz - off < sizeof(chunk) ? seg->filesz - off : sizeof(chunk);
+
+		// Unreadable memory reads as zeros rather than failing the core
+		if (!core->read || core->read(core->read_arg, seg->addr + off, chunk, len) != (ssize_t)len) {
+			memset(chunk, 0, len);
+		}
+		if (elfcore_out(sf, chunk, len) < 0) return -1;
+	}
+	return 0;
+}
+
+/*
+ * ====================================================================================
+ * API
+ * ====================================================================================
+ */
+
+/**
+ * Write @core to @fd, from its current position
+ * @return 0 on success, -1 on error
+ */
+int elfcore_write(int fd, const struct elfcore *core) {
+	struct sparse_file out, *sf = &out;
+	Elf64_Ehdr ehdr;
+	Elf64_Phdr phdr;
+	struct elf_prpsinfo psinfo;
+	uint64_t pos = 0, notes_off, notes_size, data_off;
+	size_t file_len = elfcore_nt_file(core, NULL);
+	char *file_note;
+	unsigned int nphdrs = core->nsegs + 1;
+
+	if (sparse_open(sf, fd) < 0) return -1;
+
+	memset(&ehdr, 0, sizeof(ehdr));
+	memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+	ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+	ehdr.e_ident[EI_DATA] = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? ELFDATA2LSB : ELFDATA2MSB;
+	ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+	ehdr.e_type = ET_CORE;
+	ehdr.e_machine = ELFCORE_MACHINE;
+	ehdr.e_version = EV_CURRENT;
+	ehdr.e_phoff = sizeof(ehdr);
+	ehdr.e_ehsize = sizeof(ehdr);
+	ehdr.e_phentsize = sizeof(Elf64_Phdr);
+	ehdr.e_phnum = nphdrs;
+
+	notes_off = sizeof(ehdr) + (uint64_t)nphdrs * sizeof(Elf64_Phdr);
+	notes_size = core->nthreads * elfcore_note_size(sizeof(struct elf_prstatus)) +
+		elfcore_note_size(sizeof(struct elf_prpsinfo)) +
+		(core->siginfo ? elfcore_note_size(sizeof(siginfo_t)) : 0) +
+		(core->auxv_len ? elfcore_note_size(core->auxv_len) : 0) +
+		(core->nfiles ? elfcore_note_size(file_len) : 0);
+	data_off = (notes_off + notes_size + ELFCORE_ALIGN - 1) & ~(uint64_t)(ELFCORE_ALIGN - 1);
+
+	if (elfcore_out(sf, &ehdr, sizeof(ehdr)) < 0) return -1;
+	pos += sizeof(ehdr);
+
+	memset(&phdr, 0, sizeof(phdr));
+	phdr.p_type = PT_NOTE;
+	phdr.p_offset = notes_off;
+	phdr.p_filesz = notes_size;
+	phdr.p_align = 4;
+	if (elfcore_out(sf, &phdr, sizeof(phdr)) < 0) return -1;
+	pos += sizeof(phdr);
+
+	for (unsigned int i = 0; i < core->nsegs; i++) {
+		const struct elfcore_segment *seg = &core->segs[i];
+
+		memset(&phdr, 0, sizeof(phdr));
+		phdr.p_type = PT_LOAD;
+		phdr.p_offset = seg->filesz ? data_off : 0;
+		phdr.p_vaddr = seg->addr;
+		phdr.p_memsz = seg->size;
+		phdr.p_filesz = seg->filesz;
+		phdr.p_flags = seg->flags;
+		phdr.p_align = ELFCORE_ALIGN;
+		data_off += (seg->filesz + ELFCORE_ALIGN - 1) & ~(uint64_t)(ELFCORE_ALIGN - 1);
+		if (elfcore_out(sf, &phdr, sizeof(phdr)) < 0) return -1;
+		pos += sizeof(phdr);
+	}
+
+	for (unsigned int i = 0; i < core->nthreads; i++) {
+		struct elf_prstatus status;
+
+		memset(&status, 0, sizeof(status));
+		status.pr_info.si_signo = core->threads[i].signo;
+		status.pr_cursig = core->threads[i].signo;
+		status.pr_pid = core->threads[i].tid;
+		status.pr_pgrp = core->pid;
+		status.pr_sid = core->pid;
+		memcpy(&status.pr_reg, core->threads[i].regs, sizeof(status.pr_reg));
+		if (elfcore_note(sf, &pos, NT_PRSTATUS, &status, sizeof(status)) < 0) return -1;
+	}
+
+	memset(&psinfo, 0, sizeof(psinfo));
+	psinfo.pr_state = 0;
+	psinfo.pr_sname = 'R';
+	psinfo.pr_pid = core->pid;
+	psinfo.pr_uid = getuid();
+	psinfo.pr_gid = getgid();
+	memcpy(psinfo.pr_fname, core->fname, sizeof(psinfo.pr_fname));
+	memcpy(psinfo.pr_psargs, core->psargs, sizeof(psinfo.pr_psargs));
+	if (elfcore_note(sf, &pos, NT_PRPSINFO, &psinfo, sizeof(psinfo)) < 0) return -1;
+
+	if (core->siginfo && elfcore_note(sf, &pos, NT_SIGINFO, core->siginfo, sizeof(siginfo_t)) < 0) return -1;
+
+	if (core->auxv_len && elfcore_note(sf, &pos, NT_AUXV, core->auxv, core->auxv_len) < 0) {
+		return -1;
+	}
+
+	if (core->nfiles) {
+		file_note = (char*)malloc(file_len);
+		if (!file_note) {
+			perror("malloc NT_FILE");
+			return -1;
+		}
+		elfcore_nt_file(core, file_note);
+		if (elfcore_note(sf, &pos, NT_FILE, file_note, file_len) < 0) {
+			free(file_note);
+			return -1;
+		}
+		free(file_note);
+	}
+
+	for (unsigned int i = 0; i < core->nsegs; i++) {
+		const struct elfcore_segment *seg = &core->segs[i];
+
+		if (!seg->filesz) continue;
+		if (elfcore_pad(sf, &pos, (pos + ELFCORE_ALIGN - 1) & ~(uint64_t)(ELFCORE_ALIGN - 1)) < 0 ||
+			elfcore_segment_data(sf, core, seg) < 0) {
+			return -1;
+		}
+		pos += seg->filesz;
+	}
+	return sparse_finish(sf);
+}
+
+#endif /* ELFCORE_H */
@@ -0,0 +1,204 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Deterministic fault injection for the allocations of hash_map,
+ * lru_cache_t and the binary tree, to run their out-of-memory branches.
+ *
+ * Build with -DLUDTM_FAULT to enable.  Without it FAULT_INJECT() is the
+ * constant 0 and the data structures compile exactly as before.
+ *
+ * Each allocation site calls FAULT_INJECT(site) first and fails, with
+ * errno set to ENOMEM, when it says so.  Once armed with fault_arm(), a
+ * policy picks the failures among the calls of its sites:
+ *
+ *  - nth:  call number nth fails, then every every-th call after it
+ *  - probability: each call fails with this probability, from a seeded
+ *    generator, so a run is reproducible
+ *  - sites: only calls from these sites count and fail
+ *
+ * Calls are numbered in the order they are made: with more than one
+ * thread the numbering, and so the run, is no longer deterministic.
+ */
+
+enum fault_site {
+	FAULT_HM_NODE,		// hash_map_insert(): struct hash_node
+	FAULT_HM_KEY,		 // hash_map_insert(): strdup() of the key
+	FAULT_LRU_NODE,	   // lru_cache_put(): lru_node_t
+	FAULT_LRU_KEY,		// lru_cache_put(): strndup() of the key
+	FAULT_LRU_SLAB,	   // lru_cache_put(), LRU_F_HWCACHE_ALIGN: a slab chunk
+	FAULT_LRU_WHEEL,	  // lru_cache_put_ttl(): the timer wheel
+	FAULT_BT_NODE,		// bt_insert(): bt_new_node()
+	FAULT_NR_SITES,
+};
+
+#define FAULT_ALL_SITES ((1u << FAULT_NR_SITES) - 1)
+
+static const char *const fault_site_names[FAULT_NR_SITES] = {
+	"hm_node", "hm_key", "lru_node", "lru_key", "lru_slab", "lru_wheel", "bt_node",
+};
+
+struct fault_policy {
+	uint32_t sites;			// Mask of 1 << enum fault_site
+	unsigned long nth;		 // 0: none
+	unsigned long every;	   // 0: only the nth
+	double probability;		// 0: none
+	uint64_t seed;
+};
+
+#define FAULT_POLICY_NONE ((struct fault_policy) { FAULT_ALL_SITES, 0, 0, 0.0, 1 })
+
+#ifdef LUDTM_FAULT
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+	int armed;
+	struct fault_policy policy;
+	uint64_t rng;
+	unsigned long calls;					 // Calls of the policy's sites since fault_arm()
+	unsigned long site_calls[FAULT_NR_SITES];
+	unsigned long site_failed[FAULT_NR_SITES];
+} fault;
+
+/**
+ * Internal helper: does this call of @site fail?
+ */
+static int fault_inject(enum fault_site site) {
+	unsigned long n;
+	int fail = 0;
+
+	if (!fault.armed) return 0;
+	__atomic_fetch_add(&fault.site_calls[site], 1, __ATOMIC_RELAXED);
+	if (!(fault.policy.sites & (1u << site))) return 0;
+
+	n = __atomic_add_fetch(&fault.calls, 1, __ATOMIC_RELAXED);
+	if (fault.policy.nth && n >= fault.policy.nth) {
+		fail = n == fault.policy.nth || (fault.policy.every && (n - fault.policy.nth) % fault.policy.every == 0);
+	}
+	if (!fail && fault.policy.probability > 0) {
+		// xorshift64*, the top 53 bits as a double in [0, 1)
+		fault.rng ^= fault.rng >> 12;
+		fault.rng ^= fault.rng << 25;
+		fault.rng ^= fault.rng >> 27;
+		fail = ((fault.rng * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0) < fault.policy.probability;
+	}
+	if (fail) {
+		__atomic_fetch_add(&fault.site_failed[site], 1, __ATOMIC_RELAXED);
+		errno = ENOMEM;
+	}
+	return fail;
+}
+
+#define FAULT_INJECT(site) __builtin_expect(fault_inject(site), 0)
+
+/**
+ * Start injecting failures by @policy, with all counters reset
+ */
+void fault_arm(const struct fault_policy *policy) {
+	memset(&fault, 0, sizeof(fault));
+	fault.policy = *policy;
+	fault.rng = policy->seed ? policy->seed : 1;
+	fault.armed = 1;
+}
+
+/**
+ * Stop injecting failures; the counters stay for fault_print_stats()
+ */
+void fault_disarm(void) {
+	fault.armed = 0;
+}
+
+/**
+ * Failures injected at @site since fault_arm()
+ */
+unsigned long fault_injected(enum fault_site site) {
+	return fault.site_failed[site];
+}
+
+/**
+ * Parse a policy such as "hm_node,hm_key,nth=100,every=50" or
+ * "lru_node,p=0.01,seed=7": site names (or "all"), then any of nth=N,
+ * every=N, p=PROBABILITY and seed=N.  No site names means all sites.
+ * @return 0 on success, -1 on error
+ */
+int fault_parse_policy(const char *spec, struct fault_policy *policy) {
+	char buf[256], *save = NULL;
+
+	*policy = FAULT_POLICY_NONE;
+	policy->sites = 0;
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		int site;
+
+		if (!strncmp(tok, "nth=", 4)) {
+			policy->nth = strtoul(tok + 4, NULL, 0);
+		} else if (!strncmp(tok, "every=", 6)) {
+			policy->every = strtoul(tok + 6, NULL, 0);
+		} else if (!strncmp(tok, "p=", 2)) {
+			policy->probability = strtod(tok + 2, NULL);
+		} else if (!strncmp(tok, "seed=", 5)) {
+			policy->seed = strtoull(tok + 5, NULL, 0);
+		} else if (!strcmp(tok, "all")) {
+			policy->sites = FAULT_ALL_SITES;
+		} else {
+			for (site = 0; site < FAULT_NR_SITES && strcmp(tok, fault_site_names[site]); site++)
+				;
+			if (site == FAULT_NR_SITES) {
+				fprintf(stderr, "fault: unknown site or option '%s'\n", tok);
+				return -1;
+			}
+			policy->sites |= 1u << site;
+		}
+	}
+	if (!policy->sites) policy->sites = FAULT_ALL_SITES;
+	return 0;
+}
+
+/**
+ * Print calls and injected failures per site, for the sites called at all
+ */
+void fault_print_stats(FILE *fp) {
+	for (int i = 0; i < FAULT_NR_SITES; i++) {
+		if (!fault.site_calls[i]) continue;
+		fprintf(fp, "  %-10s %10lu calls %8lu failed\n", fault_site_names[i], fault.site_calls[i],
+				fault.site_failed[i]);
+	}
+}
+
+#else /* !LUDTM_FAULT */
+
+#define FAULT_INJECT(site) 0
+
+static inline void fault_arm(const struct fault_policy *policy) {
+	(void)policy;
+}
+
+static inline void fault_disarm(void) {
+}
+
+static inline unsigned long fault_injected(enum fault_site site) {
+	(void)site;
+	return 0;
+}
+
+static inline int fault_parse_policy(const char *spec, struct fault_policy *policy) {
+	(void)spec;
+	(void)policy;
+	fprintf(stderr, "fault injection disabled (build with -DLUDTM_FAULT)\n");
+	return -1;
+}
+
+static inline void fault_print_stats(FILE *fp) {
+	fprintf(fp, "--- fault injection disabled (build with -DLUDTM_FAULT) ---\n");
+}
+
+#endif /* LUDTM_FAULT */
+
+#endif /* FAULT_H */
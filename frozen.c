@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rbtree.h>
+#include <btree.h>
+#include <frozen.h>
+
+struct mytype {
+	int value;
+	struct rb_node node;
+};
+
+#define mytype_cmp(key, entry) (((key) > (entry)->value) - ((key) < (entry)->value))
+
+static struct mytype *my_search(struct rb_root *root, int value) {
+	struct mytype *entry;
+
+	return rb_find_entry(entry, root, node, mytype_cmp(value, entry));
+}
+
+static int my_insert(struct rb_root *root, struct mytype *data) {
+	struct rb_node **new_node = &(root->rb_node), *parent = NULL;
+	struct mytype *this;
+
+	while (*new_node) {
+		this = rb_entry(*new_node, struct mytype, node);
+		parent = *new_node;
+		if (data->value < this->value) {
+			new_node = &((*new_node)->rb_left);
+		} else if (data->value > this->value) {
+			new_node = &((*new_node)->rb_right);
+		} else {
+			return 0;
+		}
+	}
+
+	rb_link_node(&data->node, parent, new_node);
+	rb_insert_color(&data->node, root);
+	return 1;
+}
+
+static void my_release(struct rb_node *node, void *arg) {
+	free(rb_entry(node, struct mytype, node));
+}
+
+static long my_key(const struct rb_node *node) {
+	return rb_entry(node, struct mytype, node)->value;
+}
+
+static long my_value(const struct rb_node *node) {
+	// Anything derived from the node: here, the key squared
+	long v = rb_entry(node, struct mytype, node)->value;
+
+	return v * v;
+}
+
+static double now_sec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long xorshift(unsigned long *seed) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+/*
+ * Cold-cache lookups: a tree much larger than the LLC, built in random
+ * order so the nodes are scattered over the heap, probed with random keys.
+ */
+static int bench(unsigned int nkeys, const char *path) {
+	struct rb_root tree = RB_ROOT;
+	struct frozen f, mapped;
+	unsigned int nlookups = 4 * 1000 * 1000;
+	int *probe = malloc((size_t)nlookups * sizeof(int));
+	int *order = malloc((size_t)nkeys * sizeof(int));
+	unsigned long seed = 0x9e3779b97f4a7c15UL, hits;
+	double t0, rb_ns, frozen_ns, mapped_ns;
+	long value;
+
+	if (!probe || !order) {
+		fprintf(stderr, "bench: out of memory\n");
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < nkeys; i++) order[i] = 2 * i;  // Odd keys miss
+	for (unsigned int i = nkeys - 1; i > 0; i--) {
+		unsigned int j = xorshift(&seed) % (i + 1);
+		int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (unsigned int i = 0; i < nkeys; i++) {
+		struct mytype *data = malloc(sizeof(*data));
+
+		if (!data) {
+			perror("malloc");
+			return 1;
+		}
+		data->value = order[i];
+		my_insert(&tree, data);
+	}
+	for (unsigned int i = 0; i < nlookups; i++) probe[i] = xorshift(&seed) % (2 * nkeys);
+
+	if (frozen_from_rbtree(&f, &tree, my_key, my_value) < 0) return 1;
+	if (frozen_save(&f, path) < 0 || frozen_open(&mapped, path) < 0) return 1;
+
+	hits = 0;
+	t0 = now_sec();
+	for (unsigned int i = 0; i < nlookups; i++) hits += my_search(&tree, probe[i]) != NULL;
+	rb_ns = (now_sec() - t0) * 1e9 / nlookups;
+	printf("%-16s %8.1f ns/lookup (%lu hits)\n", "my_search", rb_ns, hits);
+
+	hits = 0;
+	t0 = now_sec();
+	for (unsigned int i = 0; i < nlookups; i++) hits += frozen_get(&f, probe[i], &value);
+	frozen_ns = (now_sec() - t0) * 1e9 / nlookups;
+	printf("%-16s %8.1f ns/lookup (%lu hits) %.2fx\n", "frozen_get", frozen_ns, hits, rb_ns / frozen_ns);
+
+	hits = 0;
+	t0 = now_sec();
+	for (unsigned int i = 0; i < nlookups; i++) hits += frozen_get(&mapped, probe[i], &value);
+	mapped_ns = (now_sec() - t0) * 1e9 / nlookups;
+	printf("%-16s %8.1f ns/lookup (%lu hits) %.2fx\n", "frozen (mmap)", mapped_ns, hits, rb_ns / mapped_ns);
+
+	frozen_free(&mapped);
+	frozen_free(&f);
+	rb_destroy(&tree, my_release, NULL);
+	unlink(path);
+	free(probe);
+	free(order);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = "/tmp/ludtm-frozen.bin";
+	struct rb_root tree = RB_ROOT;
+	struct bt_root bt = BT_ROOT;
+	struct frozen f;
+	int values[] = { 50, 30, 70, 20, 40, 60, 80, 10 };
+	int num_values = sizeof(values) / sizeof(values[0]);
+	long value;
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		unsigned int nkeys = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 0) : 4 * 1000 * 1000;
+
+		return bench(nkeys ? nkeys : 4 * 1000 * 1000, path);
+	}
+
+	for (int i = 0; i < num_values; i++) {
+		struct mytype *data = malloc(sizeof(*data));
+
+		if (!data) {
+			perror("malloc");
+			return 1;
+		}
+		data->value = values[i];
+		my_insert(&tree, data);
+	}
+
+	// 1. Freeze the rbtree and show the layout
+	if (frozen_from_rbtree(&f, &tree, my_key, my_value) < 0) return 1;
+	rb_destroy(&tree, my_release, NULL);
+
+	printf("Eytzinger layout: ");
+	for (unsigned long k = 1; k <= f.n; k++) printf("%ld ", f.keys[k]);
+	printf("\n");
+
+	// 2. Lookups
+	if (frozen_get(&f, 40, &value)) printf("Get 40: %ld\n", value);
+	if (!frozen_get(&f, 45, &value)) printf("Get 45: miss\n");
+	unsigned long k = frozen_lower_bound(&f, 45);
+	printf("lower_bound(45): %ld\n", k ? f.keys[k] : -1L);
+	k = frozen_lower_bound(&f, 81);
+	printf("lower_bound(81): %s\n", k ? "found" : "end");
+
+	// 3. Round trip through a file
+	if (frozen_save(&f, path) < 0) return 1;
+	frozen_free(&f);
+	if (frozen_open(&f, path) < 0) return 1;
+	if (frozen_get(&f, 70, &value)) printf("Get 70 (mapped): %ld\n", value);
+	frozen_free(&f);
+	unlink(path);
+
+	// 4. bt trees freeze the same way
+	for (int i = 0; i < num_values; i++) bt_insert(&bt, values[i]);
+	if (frozen_from_bt(&f, &bt) < 0) return 1;
+	bt_free(bt.node);
+	printf("bt tree frozen: %lu keys, 60 %s\n", f.n, frozen_get(&f, 60, &value) ? "found" : "missing");
+	frozen_free(&f);
+
+	printf("Run './frozen bench [nkeys]' to compare against my_search on a cold cache.\n");
+	return 0;
+}
@@ -0,0 +1,344 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rbtree.h>
+#include <btree.h>
+
+/**
+ * Frozen search trees: a read-only, pointer-free image of an rbtree or a
+ * bt tree for lookup tables that are built once and read forever.
+ *
+ * The keys are stored in Eytzinger (BFS) order in one 64-byte aligned
+ * array: keys[1] is the root and the children of keys[k] are keys[2k] and
+ * keys[2k+1] (keys[0] is unused).  The top levels of the tree share a few
+ * cache lines, and the 8 descendants of keys[k] three levels down,
+ * keys[8k..8k+7], are one aligned cache line, so the search can prefetch
+ * them before it needs them.  The loop body has no data-dependent branch.
+ *
+ * Values live in a parallel array and are only touched on a hit.
+ *
+ * The image can be written to a file and mmap()ed back: the file is the
+ * same arrays behind a small header, so opening it costs nothing.
+ */
+
+#define FROZEN_MAGIC "LUDTMFRZ"
+#define FROZEN_VERSION 1
+#define FROZEN_ALIGN 64
+// Keys of the great-grandchildren of k start at keys[k * FROZEN_PREFETCH]
+#define FROZEN_PREFETCH (FROZEN_ALIGN / sizeof(long))
+
+struct frozen {
+	unsigned long n;   // Number of keys
+	long *keys;		// n + 1 entries in Eytzinger order, keys[0] unused
+	long *values;	  // Parallel to keys
+	void *map;		 // File mapping (frozen_open()), NULL if heap allocated
+	size_t map_size;
+};
+
+struct frozen_header {
+	char magic[8];		 // FROZEN_MAGIC
+	uint32_t version;	  // FROZEN_VERSION
+	uint32_t key_size;	 // sizeof(long) of the writer
+	uint64_t n;
+	uint64_t keys_off;	 // FROZEN_ALIGN aligned
+	uint64_t values_off;   // FROZEN_ALIGN aligned
+	uint64_t file_size;
+};
+
+#define FROZEN_ARRAY_SIZE(n) ((((n) + 1) * sizeof(long) + FROZEN_ALIGN - 1) & ~(size_t)(FROZEN_ALIGN - 1))
+
+/**
+ * Internal helper: allocate the two arrays for @n keys.
+ */
+static int frozen_alloc(struct frozen *f, unsigned long n) {
+	f->n = n;
+	f->map = NULL;
+	f->map_size = 0;
+	f->keys = (long*)aligned_alloc(FROZEN_ALIGN, FROZEN_ARRAY_SIZE(n));
+	f->values = (long*)aligned_alloc(FROZEN_ALIGN, FROZEN_ARRAY_SIZE(n));
+	if (!f->keys || !f->values) {
+		perror("aligned_alloc frozen");
+		free(f->keys);
+		free(f->values);
+		return -1;
+	}
+	f->keys[0] = f->values[0] = 0;
+	return 0;
+}
+
+/**
+ * Internal helper: lay sorted arrays out in Eytzinger order.
+ * In-order walk of the implicit tree, so @i visits the input in order.
+ */
+static unsigned long frozen_permute(struct frozen *f, const long *keys, const long *values,
+				    unsigned long i, unsigned long k) {
+	if (k <= f->n) {
+		i = frozen_permute(f, keys, values, i, 2 * k);
+		f->keys[k] = keys[i];
+		f->values[k] = values[i];
+		i++;
+		i = frozen_permute(f, keys, values, i, 2 * k + 1);
+	}
+	return i;
+}
+
+/**
+ * Internal helper: build from sorted (key, value) arrays.
+ */
+static int frozen_build(struct frozen *f, const long *keys, const long *values, unsigned long n) {
+	if (frozen_alloc(f, n) < 0) return -1;
+	frozen_permute(f, keys, values, 0, 1);
+	return 0;
+}
+
+/**
+ * Freeze an rbtree
+ * @param f     Frozen image to fill
+ * @param root  Tree, left untouched
+ * @param key   Returns the (long) key of a node; the tree must be sorted by it
+ * @param value Returns the value to store for a node
+ * @return 0 on success, -1 on failure
+ */
+int frozen_from_rbtree(struct frozen *f, struct rb_root *root,
+		       long (*key)(const struct rb_node *), long (*value)(const struct rb_node *)) {
+	unsigned long n = 0, i = 0;
+	struct rb_node *node;
+	long *keys, *values;
+	int ret;
+
+	for (node = rb_first(root); node; node = rb_next(node)) n++;
+
+	keys = (long*)malloc((n + 1) * sizeof(long));
+	values = (long*)malloc((n + 1) * sizeof(long));
+	if (!keys || !values) {
+		perror("malloc frozen");
+		free(keys);
+		free(values);
+		return -1;
+	}
+
+	for (node = rb_first(root); node; node = rb_next(node), i++) {
+		keys[i] = key(node);
+		values[i] = value(node);
+	}
+
+	ret = frozen_build(f, keys, values, n);
+	free(keys);
+	free(values);
+	return ret;
+}
+
+/**
+ * Freeze a bt tree (BST ordered by data); the stored value is the data.
+ * The tree may be arbitrarily unbalanced, the walk is iterative.
+ * @return 0 on success, -1 on failure
+ */
+int frozen_from_bt(struct frozen *f, struct bt_root *root) {
+	struct bt_node **stack = NULL, *node = root->node;
+	unsigned long depth = 0, stack_size = 0, n = 0, size = 0;
+	long *keys = NULL, *tmp;
+	int ret = -1;
+
+	while (node || depth) {
+		if (node) {
+			if (depth == stack_size) {
+				struct bt_node **grown;
+
+				stack_size = stack_size ? 2 * stack_size : 64;
+				grown = (struct bt_node**)realloc(stack, stack_size * sizeof(*stack));
+				if (!grown) {
+					perror("realloc frozen");
+					goto out;
+				}
+				stack = grown;
+			}
+			stack[depth++] = node;
+			node = node->left;
+			continue;
+		}
+
+		node = stack[--depth];
+		if (n == size) {
+			size = size ? 2 * size : 64;
+			tmp = (long*)realloc(keys, size * sizeof(long));
+			if (!tmp) {
+				perror("realloc frozen");
+				goto out;
+			}
+			keys = tmp;
+		}
+		keys[n++] = node->data;
+		node = node->right;
+	}
+
+	ret = frozen_build(f, keys, keys, n);
+out:
+	free(stack);
+	free(keys);
+	return ret;
+}
+
+/**
+ * Index of the first key >= @key in Eytzinger order, 0 if there is none.
+ * Branchless: the only branch is the loop condition, which depends on
+ * the tree height alone.
+ */
+static inline unsigned long frozen_lower_bound(const struct frozen *f, long key) {
+	const long *keys = f->keys;
+	unsigned long k = 1;
+
+	while (k <= f->n) {
+		__builtin_prefetch(keys + k * FROZEN_PREFETCH);
+		k = 2 * k + (keys[k] < key);
+	}
+	// Undo the right turns taken after the last left turn
+	k >>= __builtin_ffsl(~k);
+	return k;
+}
+
+/**
+ * Look up a key
+ * @param f     Frozen image
+ * @param key   Key to search
+ * @param value Pointer to store the value
+ * @return 1 if found, 0 otherwise
+ */
+static inline int frozen_get(const struct frozen *f, long key, long *value) {
+	unsigned long k = frozen_lower_bound(f, key);
+
+	if (k && f->keys[k] == key) {
+		*value = f->values[k];
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Write the image to @path (replaced atomically)
+ * @return 0 on success, -1 on failure
+ */
+int frozen_save(const struct frozen *f, const char *path) {
+	struct frozen_header hdr;
+	char tmp_path[4096];
+	size_t array_size = FROZEN_ARRAY_SIZE(f->n);
+	int fd, err = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FROZEN_MAGIC, sizeof(hdr.magic));
+	hdr.version = FROZEN_VERSION;
+	hdr.key_size = sizeof(long);
+	hdr.n = f->n;
+	hdr.keys_off = FROZEN_ALIGN;
+	hdr.values_off = hdr.keys_off + array_size;
+	hdr.file_size = hdr.values_off + array_size;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(tmp_path);
+		return -1;
+	}
+
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+		pwrite(fd, f->keys, array_size, hdr.keys_off) != (ssize_t)array_size ||
+		pwrite(fd, f->values, array_size, hdr.values_off) != (ssize_t)array_size ||
+		fsync(fd) != 0) {
+		perror("write frozen image");
+		err = 1;
+	}
+	if (close(fd) != 0 && !err) {
+		perror("close frozen image");
+		err = 1;
+	}
+	if (!err && rename(tmp_path, path) != 0) {
+		perror("rename frozen image");
+		err = 1;
+	}
+	if (err) {
+		unlink(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Map an image written by frozen_save(); nothing is copied
+ * @return 0 on success, -1 on failure
+ */
+int frozen_open(struct frozen *f, const char *path) {
+	const struct frozen_header *hdr;
+	struct stat st;
+	void *map;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("fstat frozen image");
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a frozen image\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap frozen image");
+		return -1;
+	}
+
+	hdr = (const struct frozen_header*)map;
+	if (memcmp(hdr->magic, FROZEN_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != FROZEN_VERSION || hdr->key_size != sizeof(long) ||
+		hdr->file_size != (uint64_t)st.st_size ||
+		hdr->keys_off % FROZEN_ALIGN || hdr->values_off % FROZEN_ALIGN ||
+		// Bound n by the mapping first, so FROZEN_ARRAY_SIZE() cannot overflow
+		hdr->n >= hdr->file_size / sizeof(long) ||
+		hdr->keys_off > hdr->file_size || hdr->values_off > hdr->file_size ||
+		FROZEN_ARRAY_SIZE(hdr->n) > hdr->file_size - hdr->keys_off ||
+		FROZEN_ARRAY_SIZE(hdr->n) > hdr->file_size - hdr->values_off) {
+		fprintf(stderr, "%s: bad or truncated frozen image\n", path);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	f->n = hdr->n;
+	f->keys = (long*)((char*)map + hdr->keys_off);
+	f->values = (long*)((char*)map + hdr->values_off);
+	f->map = map;
+	f->map_size = st.st_size;
+	return 0;
+}
+
+/**
+ * Release a frozen image (heap or mapped)
+ */
+void frozen_free(struct frozen *f) {
+	if (f->map) {
+		munmap(f->map, f->map_size);
+	} else {
+		free(f->keys);
+		free(f->values);
+	}
+	f->keys = f->values = NULL;
+	f->map = NULL;
+	f->n = 0;
+}
+
+#endif /* FROZEN_H */
@@ -0,0 +1,588 @@
+/*
+ * guardalloc: electric-fence style debug allocator, as an LD_PRELOAD shim.
+ *
+ *   make guardalloc
+ *   LD_PRELOAD=./guardalloc.so ./ludtm --batch -v heap_overflow double_free
+ *   LD_PRELOAD=./guardalloc.so GUARDALLOC_RATE=1000 ./server     # 1 in 1000
+ *
+ * Every guarded allocation gets pages of its own, right-aligned against a
+ * PROT_NONE guard page, so the first byte written past its end faults at
+ * the offending instruction instead of corrupting the next chunk.  free()
+ * puts the pages in a quarantine where they are PROT_NONE too, so a use
+ * after free faults, and freeing a block twice is caught from the
+ * metadata and aborts with where it was allocated and first freed.
+ *
+ * What makes this cheaper than one mmap() per allocation:
+ *
+ *  - slots are carved out of large PROT_NONE arenas, reserved a few at a
+ *    time, and a slot leaving the quarantine is reused for the next
+ *    allocation of the same number of pages: one mprotect() per malloc()
+ *  - freed slots are protected in batches of GUARDALLOC_BATCH (64): the
+ *    batch is sorted and each run of neighbouring slots takes one
+ *    mprotect(), and a reused slot keeps its pages
+ *  - metadata is out of band, in an open-addressing hash map from the
+ *    user pointer to its slot, so the guarded pages hold nothing else
+ *  - GUARDALLOC_RATE=N guards one allocation in N and hands the rest to
+ *    glibc, to run on real traffic
+ *
+ * A batch not yet protected is a window of GUARDALLOC_BATCH - 1 frees in
+ * which a use after free goes unnoticed; GUARDALLOC_BATCH=1 closes it.
+ * Blocks are aligned to GUARDALLOC_ALIGN bytes (16, as malloc() promises),
+ * so an overflow by less than that lands in padding; GUARDALLOC_ALIGN=1
+ * catches those too, for code that does not need aligned blocks.
+ *
+ * Each live block is a mapping of its own: vm.max_map_count (65530 by
+ * default) caps the number of them, and past it allocations fall back to
+ * glibc with a warning.
+ */
+
+#include <crash.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#define GUARD_PAGE 4096
+#define GUARD_ARENA (256ul << 20)		// Reserved at a time
+#define GUARD_MAX_ARENAS 1024
+#define GUARD_CLASSES 16				 // Slots up to this many pages are reused
+#define GUARD_MAX_BATCH 1024
+#define GUARD_DEFAULT_BATCH 64
+#define GUARD_DEFAULT_QUARANTINE (64ul << 20)
+#define GUARD_DEFAULT_ALIGN 16
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+enum guard_state {
+	GUARD_EMPTY = 0,
+	GUARD_LIVE,
+	GUARD_PENDING,	  // Freed, waiting for the next batch to be protected
+	GUARD_FREED,		// Freed and protected
+	GUARD_DELETED,
+};
+
+/**
+ * Metadata of one guarded block: data pages [base, base + npages pages),
+ * then the guard page
+ */
+struct guard_meta {
+	uintptr_t ptr;		  // Key: what malloc() returned
+	uintptr_t base;
+	size_t size;
+	uint32_t npages;
+	uint32_t state;
+	uintptr_t alloc_pc;
+	uintptr_t free_pc;
+};
+
+/**
+ * A growable array in its own mapping, since malloc() is not available
+ */
+struct guard_vec {
+	uintptr_t *v;
+	size_t n;
+	size_t cap;
+	size_t head;			// Queue: first element
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int ready;
+	size_t rate;
+	size_t batch;
+	size_t quarantine_max;
+	size_t align;
+	int verbose;
+
+	struct guard_meta *meta;	// Hash map
+	size_t meta_cap;		  // Power of two
+	size_t meta_used;		 // Live, freed and deleted entries
+
+	uintptr_t arenas[GUARD_MAX_ARENAS];
+	unsigned int narenas;
+	uintptr_t bump;			// Next fresh slot in the last arena
+	uintptr_t bump_end;
+
+	struct guard_vec free_slots[GUARD_CLASSES + 1];   // Bases, by number of pages
+	struct guard_vec quarantine;	  // User pointers, oldest first
+	size_t quarantine_bytes;
+	uintptr_t pending[GUARD_MAX_BATCH];   // Freed, not yet protected
+	size_t npending;
+	int exhausted;
+
+	unsigned long allocs, frees, mprotects, flushes, runs, fallbacks;
+} guard = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread size_t guard_until __attribute__((tls_model("initial-exec")));
+
+/*
+ * ====================================================================================
+ * Internal helpers
+ * ====================================================================================
+ */
+
+static void* guard_map(size_t len, int prot) {
+	void *p = mmap(NULL, len, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static int guard_vec_push(struct guard_vec *vec, uintptr_t v) {
+	// A queue that is mostly consumed slides down instead of growing
+	if (vec->n == vec->cap && vec->head && vec->n - vec->head <= vec->cap / 2) {
+		memmove(vec->v, vec->v + vec->head, (vec->n - vec->head) * sizeof(uintptr_t));
+		vec->n -= vec->head;
+		vec->head = 0;
+	}
+	if (vec->n == vec->cap) {
+		size_t cap = vec->cap ? vec->cap * 2 : GUARD_PAGE / sizeof(uintptr_t);
+		uintptr_t *nv = (uintptr_t*)guard_map(cap * sizeof(uintptr_t), PROT_READ | PROT_WRITE);
+
+		if (!nv) return -1;
+		// Unwrap the queue while copying
+		for (size_t i = 0; i < vec->n - vec->head; i++) nv[i] = vec->v[vec->head + i];
+		if (vec->v) munmap(vec->v, vec->cap * sizeof(uintptr_t));
+		vec->n -= vec->head;
+		vec->head = 0;
+		vec->v = nv;
+		vec->cap = cap;
+	}
+	vec->v[vec->n++] = v;
+	return 0;
+}
+
+static inline uint64_t guard_hash(uintptr_t p) {
+	uint64_t x = p;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	return x;
+}
+
+static struct guard_meta* guard_meta_find(uintptr_t p) {
+	if (!guard.meta) return NULL;
+	for (size_t i = guard_hash(p) & (guard.meta_cap - 1);; i = (i + 1) & (guard.meta_cap - 1)) {
+		struct guard_meta *m = &guard.meta[i];
+
+		if (m->state == GUARD_EMPTY) return NULL;
+		if (m->ptr == p && m->state != GUARD_DELETED) return m;
+	}
+}
+
+static inline int guard_meta_used(const struct guard_meta *m) {
+	return m->state != GUARD_EMPTY && m->state != GUARD_DELETED;
+}
+
+/**
+ * Internal helper: rehash into a table a quarter full, which also clears
+ * out the deleted entries
+ */
+static int guard_meta_grow(void) {
+	struct guard_meta *old = guard.meta, *nm;
+	size_t old_cap = guard.meta_cap, cap = 4096, live = 0;
+
+	for (size_t i = 0; i < old_cap; i++) live += guard_meta_used(&old[i]);
+	while (cap < (live + 1) * 4) cap *= 2;
+	nm = (struct guard_meta*)guard_map(cap * sizeof(*nm), PROT_READ | PROT_WRITE);
+	if (!nm) return -1;
+	for (size_t i = 0; i < old_cap; i++) {
+		if (!guard_meta_used(&old[i])) continue;
+		for (size_t j = guard_hash(old[i].ptr) & (cap - 1);; j = (j + 1) & (cap - 1)) {
+			if (nm[j].state == GUARD_EMPTY) {
+				nm[j] = old[i];
+				break;
+			}
+		}
+	}
+	if (old) munmap(old, old_cap * sizeof(*old));
+	guard.meta = nm;
+	guard.meta_cap = cap;
+	guard.meta_used = live;
+	return 0;
+}
+
+static struct guard_meta* guard_meta_insert(uintptr_t p) {
+	size_t i;
+
+	if ((guard.meta_used + 1) * 4 > guard.meta_cap * 3 && guard_meta_grow() < 0) return NULL;
+	for (i = guard_hash(p) & (guard.meta_cap - 1); guard_meta_used(&guard.meta[i]); i = (i + 1) & (guard.meta_cap - 1))
+		;
+	if (guard.meta[i].state == GUARD_EMPTY) guard.meta_used++;
+	guard.meta[i].ptr = p;
+	return &guard.meta[i];
+}
+
+/**
+ * Internal helper: whether @p points into an arena, so that a free() of it
+ * not found in the metadata is a bug rather than a glibc block
+ */
+static int guard_owns(uintptr_t p) {
+	for (unsigned int i = 0; i < guard.narenas; i++) {
+		if (p - guard.arenas[i] < GUARD_ARENA) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Internal helper: data pages for a new block of @npages, still PROT_NONE
+ */
+static uintptr_t guard_slot_get(uint32_t npages) {
+	size_t len = (npages + 1) * (size_t)GUARD_PAGE;
+	struct guard_vec *vec = npages <= GUARD_CLASSES ? &guard.free_slots[npages] : NULL;
+	uintptr_t base;
+
+	if (vec && vec->n) return vec->v[--vec->n];
+	if (!vec) {
+		// Too big to pool: a mapping of its own, with the guard page at its end
+		return (uintptr_t)guard_map(len, PROT_NONE);
+	}
+	if (guard.bump + len > guard.bump_end) {
+		if (guard.narenas == GUARD_MAX_ARENAS) return 0;
+		base = (uintptr_t)guard_map(GUARD_ARENA, PROT_NONE);
+		if (!base) return 0;
+		guard.arenas[guard.narenas++] = base;
+		guard.bump = base;
+		guard.bump_end = base + GUARD_ARENA;
+	}
+	base = guard.bump;
+	guard.bump += len;
+	return base;
+}
+
+/**
+ * Internal helper: protect the pending freed blocks, sorted so that each
+ * run of neighbouring slots (guard pages between them included) takes one
+ * mprotect().  Their pages stay resident until reused: dropping them costs
+ * another call now and a page fault later.
+ */
+static void guard_flush(void) {
+	size_t n = guard.npending;
+
+	if (!n) return;
+	for (size_t i = 1; i < n; i++) {
+		uintptr_t v = guard.pending[i];
+		size_t j = i;
+
+		for (; j > 0 && guard.pending[j - 1] > v; j--) guard.pending[j] = guard.pending[j - 1];
+		guard.pending[j] = v;
+	}
+	for (size_t i = 0; i < n;) {
+		struct guard_meta *m = guard_meta_find(guard.pending[i]);
+		uintptr_t start = m->base, end = m->base + m->npages * (size_t)GUARD_PAGE;
+
+		m->state = GUARD_FREED;
+		// The next slot starts right after this one's guard page
+		for (i++; i < n; i++) {
+			m = guard_meta_find(guard.pending[i]);
+			if (m->base != end + GUARD_PAGE) break;
+			m->state = GUARD_FREED;
+			end = m->base + m->npages * (size_t)GUARD_PAGE;
+		}
+		mprotect((void*)start, end - start, PROT_NONE);
+		guard.runs++;
+	}
+	guard.flushes++;
+	guard.npending = 0;
+}
+
+/**
+ * Internal helper: release the oldest quarantined blocks for reuse
+ */
+static void guard_evict(void) {
+	struct guard_vec *q = &guard.quarantine;
+
+	while (guard.quarantine_bytes > guard.quarantine_max && q->head < q->n) {
+		struct guard_meta *m = guard_meta_find(q->v[q->head++]);
+		size_t len = (m->npages + 1) * (size_t)GUARD_PAGE;
+
+		// Still pending (a small quarantine): protect it first, its slot will be handed out again
+		if (m->state == GUARD_PENDING) guard_flush();
+		guard.quarantine_bytes -= len;
+		// Out of memory for the free list: the slot is lost, but stays protected
+		if (m->npages <= GUARD_CLASSES) {
+			guard_vec_push(&guard.free_slots[m->npages], m->base);
+		} else {
+			munmap((void*)m->base, len);
+		}
+		m->state = GUARD_DELETED;
+	}
+	if (q->head == q->n) q->head = q->n = 0;
+}
+
+static void guard_init(void) {
+	const char *s;
+
+	guard.rate = 1;
+	guard.batch = GUARD_DEFAULT_BATCH;
+	guard.quarantine_max = GUARD_DEFAULT_QUARANTINE;
+	guard.align = GUARD_DEFAULT_ALIGN;
+	if ((s = getenv("GUARDALLOC_RATE")) && atol(s) > 0) guard.rate = atol(s);
+	if ((s = getenv("GUARDALLOC_BATCH")) && atol(s) > 0) guard.batch = atol(s);
+	if (guard.batch > GUARD_MAX_BATCH) guard.batch = GUARD_MAX_BATCH;
+	if ((s = getenv("GUARDALLOC_QUARANTINE"))) guard.quarantine_max = strtoul(s, NULL, 0) << 20;
+	if ((s = getenv("GUARDALLOC_ALIGN")) && atol(s) > 0 && !(atol(s) & (atol(s) - 1))) guard.align = atol(s);
+	if ((s = getenv("GUARDALLOC_VERBOSE"))) guard.verbose = atoi(s);
+	crash.fd = STDERR_FILENO;
+	guard.ready = 1;
+}
+
+/**
+ * Internal helper: report a bad free() and abort, like glibc would
+ */
+static __attribute__((noreturn)) void guard_abort(const char *what, uintptr_t p, struct guard_meta *m, uintptr_t pc) {
+	crash_maps_load();
+	crash_puts("guardalloc: ");
+	crash_puts(what);
+	crash_puts(" of ");
+	crash_hex(p, 0);
+	if (m) {
+		crash_puts(", a ");
+		crash_dec(m->size);
+		crash_puts("-byte block\n  allocated at ");
+		crash_symbolize(m->alloc_pc);
+		crash_puts("  freed at     ");
+		crash_symbolize(m->free_pc);
+		crash_puts("  freed again  ");
+	} else {
+		crash_puts(", not the start of a block\n  at ");
+	}
+	crash_symbolize(pc);
+	crash_flush();
+	pthread_mutex_unlock(&guard.lock);
+	abort();
+}
+
+/*
+ * ====================================================================================
+ * Guarded allocation
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: a block right-aligned against its guard page
+ * @return the block, or NULL to let glibc serve the request
+ */
+static void* guard_alloc(size_t size, size_t align, uintptr_t pc) {
+	struct guard_meta *m;
+	uint32_t npages;
+	uintptr_t base, p;
+
+	if (size > (1ul << 40)) return NULL;
+	if (align < guard.align) align = guard.align;
+	// Slots are page-aligned: a bigger alignment needs room to round down into
+	npages = (size + (align > GUARD_PAGE ? align - GUARD_PAGE : 0) + GUARD_PAGE - 1) / GUARD_PAGE;
+	if (!npages) npages = 1;
+
+	pthread_mutex_lock(&guard.lock);
+	if (guard.exhausted) goto fallback;
+	base = guard_slot_get(npages);
+	if (!base) goto exhausted;
+	p = (base + (size_t)npages * GUARD_PAGE - size) & ~(align - 1);
+	if (mprotect((void*)base, (size_t)npages * GUARD_PAGE, PROT_READ | PROT_WRITE) < 0) {
+		if (npages <= GUARD_CLASSES) guard_vec_push(&guard.free_slots[npages], base);
+		goto exhausted;
+	}
+	guard.mprotects++;
+	m = guard_meta_insert(p);
+	if (!m) goto exhausted;
+	m->base = base;
+	m->size = size;
+	m->npages = npages;
+	m->state = GUARD_LIVE;
+	m->alloc_pc = pc;
+	m->free_pc = 0;
+	guard.allocs++;
+	pthread_mutex_unlock(&guard.lock);
+	return (void*)p;
+
+exhausted:
+	// Mostly vm.max_map_count: every live block is a mapping
+	guard.exhausted = 1;
+	crash_puts("guardalloc: out of mappings or address space, falling back to malloc\n");
+	crash_flush();
+fallback:
+	guard.fallbacks++;
+	pthread_mutex_unlock(&guard.lock);
+	return NULL;
+}
+
+/**
+ * Internal helper: quarantine a guarded block
+ * @return 0 if @p was guardalloc's, -1 if it belongs to glibc
+ */
+static int guard_release(void *ptr, uintptr_t pc) {
+	uintptr_t p = (uintptr_t)ptr;
+	struct guard_meta *m;
+
+	pthread_mutex_lock(&guard.lock);
+	m = guard_meta_find(p);
+	if (!m) {
+		if (guard_owns(p)) guard_abort("free() of an interior pointer", p, NULL, pc);
+		pthread_mutex_unlock(&guard.lock);
+		return -1;
+	}
+	if (m->state != GUARD_LIVE) guard_abort("double free", p, m, pc);
+
+	m->state = GUARD_PENDING;
+	m->free_pc = pc;
+	guard.frees++;
+	guard.pending[guard.npending++] = p;
+	guard_vec_push(&guard.quarantine, p);
+	guard.quarantine_bytes += (m->npages + 1) * (size_t)GUARD_PAGE;
+	if (guard.npending >= guard.batch) guard_flush();
+	guard_evict();
+	pthread_mutex_unlock(&guard.lock);
+	return 0;
+}
+
+static inline int guard_sampled(void) {
+	if (__builtin_expect(!guard.ready, 0)) guard_init();
+	if (guard.rate == 1) return 1;
+	if (guard_until) {
+		guard_until--;
+		return 0;
+	}
+	guard_until = guard.rate - 1;
+	return 1;
+}
+
+/**
+ * Internal helper: size of a block, guarded or not
+ */
+static size_t guard_size(void *ptr) {
+	struct guard_meta *m;
+	size_t size = 0;
+	int found;
+
+	pthread_mutex_lock(&guard.lock);
+	m = guard_meta_find((uintptr_t)ptr);
+	found = m && m->state == GUARD_LIVE;
+	if (found) size = m->size;
+	pthread_mutex_unlock(&guard.lock);
+	if (!found) {
+		static size_t (*libc_usable_size)(void*);
+
+		if (!libc_usable_size) libc_usable_size = (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+		size = libc_usable_size ? libc_usable_size(ptr) : 0;
+	}
+	return size;
+}
+
+/*
+ * ====================================================================================
+ * Interposed allocator
+ * ====================================================================================
+ */
+
+void* malloc(size_t size) {
+	void *p = guard_sampled() ? guard_alloc(size, 1, (uintptr_t)__builtin_return_address(0)) : NULL;
+
+	return p ? p : __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+	size_t total;
+	void *p;
+
+	if (__builtin_mul_overflow(n, size, &total)) return __libc_calloc(n, size);
+	p = guard_sampled() ? guard_alloc(total, 1, (uintptr_t)__builtin_return_address(0)) : NULL;
+	if (!p) return __libc_calloc(n, size);
+	// A reused slot holds what was freed there
+	memset(p, 0, total);
+	return p;
+}
+
+void free(void *p) {
+	if (p && guard_release(p, (uintptr_t)__builtin_return_address(0)) < 0) __libc_free(p);
+}
+
+void* realloc(void *old, size_t size) {
+	struct guard_meta *m;
+	size_t old_size;
+	void *p;
+
+	if (!old) return malloc(size);
+	pthread_mutex_lock(&guard.lock);
+	m = guard_meta_find((uintptr_t)old);
+	old_size = m ? m->size : 0;
+	pthread_mutex_unlock(&guard.lock);
+	if (!m) {
+		if (guard_owns((uintptr_t)old)) {
+			// Let free() report it
+			free(old);
+		}
+		return __libc_realloc(old, size);
+	}
+
+	// Guarded stays guarded, so that the new end is fenced too
+	p = guard_alloc(size, 1, (uintptr_t)__builtin_return_address(0));
+	if (!p) p = __libc_malloc(size);
+	if (!p) return NULL;
+	memcpy(p, old, old_size < size ? old_size : size);
+	guard_release(old, (uintptr_t)__builtin_return_address(0));
+	return p;
+}
+
+void* memalign(size_t align, size_t size) {
+	void *p;
+
+	if (align & (align - 1)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	p = guard_sampled() ? guard_alloc(size, align, (uintptr_t)__builtin_return_address(0)) : NULL;
+	return p ? p : __libc_memalign(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+	return memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) {
+	void *p;
+
+	if (align < sizeof(void*) || (align & (align - 1))) return EINVAL;
+	p = memalign(align, size);
+	if (!p) return ENOMEM;
+	*out = p;
+	return 0;
+}
+
+void* valloc(size_t size) {
+	return memalign(GUARD_PAGE, size);
+}
+
+void* pvalloc(size_t size) {
+	return memalign(GUARD_PAGE, (size + GUARD_PAGE - 1) & ~(size_t)(GUARD_PAGE - 1));
+}
+
+size_t malloc_usable_size(void *p) {
+	return p ? guard_size(p) : 0;
+}
+
+__attribute__((destructor)) static void guard_fini(void) {
+	if (!guard.verbose) return;
+	crash_puts("guardalloc: ");
+	crash_dec(guard.allocs);
+	crash_puts(" guarded allocations, ");
+	crash_dec(guard.frees);
+	crash_puts(" frees, ");
+	crash_dec(guard.fallbacks);
+	crash_puts(" fallbacks; ");
+	crash_dec(guard.mprotects);
+	crash_puts(" mprotect calls, ");
+	crash_dec(guard.runs);
+	crash_puts(" protect calls in ");
+	crash_dec(guard.flushes);
+	crash_puts(" batches; ");
+	crash_dec(guard.narenas);
+	crash_puts(" arenas\n");
+	crash_flush();
+}
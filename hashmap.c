@@ -3,10 +3,84 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <time.h>
+
 #include <list.h>
 #include <hashmap.h>
 
-int main() {
+static double now_sec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Per-key lookup cost of hash_map_get() against hash_map_get_batch() on a
+ * map much larger than the cache, with keys probed in random order.
+ */
+static int bench(unsigned int nkeys) {
+	static const unsigned int batch_sizes[] = { 1, 8, 32, 128 };
+	unsigned int nlookups = nkeys;
+	char (*names)[16] = malloc((size_t)nkeys * sizeof(*names));
+	const char **probe = malloc((size_t)nlookups * sizeof(*probe));
+	int *values = malloc(128 * sizeof(int));
+	int *found = malloc(128 * sizeof(int));
+	struct hash_map *map = hash_map_create(nkeys);
+	unsigned long seed = 0x9e3779b97f4a7c15UL;
+	unsigned long sum = 0;
+	double t0, single;
+
+	if (!names || !probe || !values || !found || !map) {
+		fprintf(stderr, "bench: out of memory\n");
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < nkeys; i++) {
+		snprintf(names[i], sizeof(names[i]), "key-%u", i);
+		hash_map_insert(map, names[i], (int)i);
+	}
+	for (unsigned int i = 0; i < nlookups; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		probe[i] = names[seed % nkeys];
+	}
+
+	t0 = now_sec();
+	for (unsigned int i = 0; i < nlookups; i++) {
+		int value;
+
+		sum += hash_map_get(map, probe[i], &value);
+	}
+	single = (now_sec() - t0) * 1e9 / nlookups;
+	printf("%-18s %10.1f ns/key\n", "hash_map_get", single);
+
+	for (unsigned int b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+		unsigned int size = batch_sizes[b];
+		double batched;
+
+		t0 = now_sec();
+		for (unsigned int i = 0; i + size <= nlookups; i += size) {
+			sum += hash_map_get_batch(map, probe + i, size, values, found);
+		}
+		batched = (now_sec() - t0) * 1e9 / (nlookups - nlookups % size);
+		printf("get_batch(%3u)     %10.1f ns/key  speedup %.2fx\n", size, batched, single / batched);
+	}
+
+	hash_map_destroy_bulk(map, NULL, NULL);
+	free(names);
+	free(probe);
+	free(values);
+	free(found);
+	return sum == 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		return bench(argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 0) : 1u << 21);
+	}
+
 	// 1. Create hashmap (bucket size 16)
 	struct hash_map *map = hash_map_create(16);
 	if (!map) {
@@ -53,7 +127,25 @@ int main() {
 	hash_map_delete(map, "Eve");
 	hash_map_print(map);
 
-	// 5. Destroy hashmap
+	// 5. Batched lookup
+	printf("--- Batched lookup ---\n");
+	const char *keys[] = { "Alice", "Bob", "Charlie", "David" };
+	int values[4], found[4];
+	unsigned int hits = hash_map_get_batch(map, keys, 4, values, found);
+	for (int i = 0; i < 4; i++) {
+		if (found[i]) {
+			printf("Found '%s': %d\n", keys[i], values[i]);
+		} else {
+			printf("'%s' not found\n", keys[i]);
+		}
+	}
+	printf("%u of 4 keys found\n\n", hits);
+
+	// 6. Statistics, without walking the elements (build with STATS=1
+	// for the operation counters and latencies)
+	hash_map_print_stats(map, stdout);
+
+	// 7. Destroy hashmap
 	hash_map_destroy(map);
 	// The map pointer is now invalid.
 
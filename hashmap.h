@@ -4,26 +4,42 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <list.h>
+#include <stats.h>
+#include <fault.h>
 
 // 1. Data Structure Definition
 
+#ifndef L1_CACHE_BYTES
+#define L1_CACHE_BYTES 64
+#endif
+
 /**
  * Node structure to be stored in the hashmap (Key: string, Value: integer).
+ * A chain walk only reads hash and h_node, which lead the node: the key
+ * string is out of line and only dereferenced when the hashes match.
  */
 struct hash_node {
+	unsigned long hash;	   // hash_function(key), compared before the key
+	struct hlist_node h_node; // Embedded hlist node
 	char *key;
 	int value;
-	struct hlist_node h_node; // Embedded hlist node
 };
 
+_Static_assert(offsetof(struct hash_node, h_node) + sizeof(struct hlist_node) <= L1_CACHE_BYTES / 2,
+	       "hash_node: hash and chain link must stay in the first half line");
+_Static_assert(sizeof(void *) != 8 || sizeof(struct hash_node) <= 40,
+	       "hash_node grew: 40 bytes (a 48-byte malloc chunk) on LP64");
+
 /**
  * Hashmap structure definition.
  */
 struct hash_map {
 	struct hlist_head *buckets; // Bucket array (dynamically allocated)
 	unsigned int size;		  // Bucket size
+	unsigned long count;		// Number of elements
 };
 
 // 2. Hash Function
@@ -68,6 +84,7 @@ struct hash_map* hash_map_create(unsigned int size) {
 
 	// 3. Initialization
 	map->size = size;
+	map->count = 0;
 	for (unsigned int i = 0; i < size; i++) {
 		INIT_HLIST_HEAD(&map->buckets[i]);
 	}
@@ -81,18 +98,21 @@ struct hash_map* hash_map_create(unsigned int size) {
  * @param key Key to search
  * @return Found hash_node pointer, NULL if not found
  */
-static struct hash_node* hash_map_lookup(struct hash_map *map, const char *key) {
-	unsigned long hash = hash_function(key);
+static struct hash_node* hash_map_lookup_hashed(struct hash_map *map, const char *key,
+					       unsigned long hash) {
 	unsigned int index = hash % map->size;
 
 	struct hlist_head *head = &map->buckets[index];
 	struct hlist_node *pos;
 	struct hash_node *entry;
 
+	STAT_INC(STAT_HM_LOOKUP);
+
 	// Traverse bucket using hlist_for_each_entry macro
 	// hlist_for_each_entry(tpos, pos, head, member)
 	hlist_for_each_entry(entry, pos, head, h_node) {
-		if (strcmp(entry->key, key) == 0) {
+		STAT_INC(STAT_HM_CHAIN_STEPS);
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) {
 			return entry;
 		}
 	}
@@ -100,6 +120,10 @@ static struct hash_node* hash_map_lookup(struct hash_map *map, const char *key)
 	return NULL;
 }
 
+static struct hash_node* hash_map_lookup(struct hash_map *map, const char *key) {
+	return hash_map_lookup_hashed(map, key, hash_function(key));
+}
+
 /**
  * Retrieve value using key
  * @param map Hashmap pointer
@@ -108,11 +132,16 @@ static struct hash_node* hash_map_lookup(struct hash_map *map, const char *key)
  * @return 1 if key found, 0 on failure
  */
 int hash_map_get(struct hash_map *map, const char *key, int *value) {
+	STAT_LATENCY_BEGIN(t);
 	struct hash_node *node = hash_map_lookup(map, key);
 	if (node) {
 		*value = node->value;
+		STAT_INC(STAT_HM_GET_HIT);
+		STAT_LATENCY_END(STAT_LAT_HM_GET, t);
 		return 1;
 	}
+	STAT_INC(STAT_HM_GET_MISS);
+	STAT_LATENCY_END(STAT_LAT_HM_GET, t);
 	return 0;
 }
 
@@ -124,43 +153,172 @@ int hash_map_get(struct hash_map *map, const char *key, int *value) {
  * @param value Value to insert
  * @return 0 on success, -1 on failure (memory allocation error, etc.)
  */
-int hash_map_insert(struct hash_map *map, const char *key, int value) {
+static int hash_map_insert_hashed(struct hash_map *map, const char *key, unsigned long hash,
+				  int value) {
 	// 1. Check if key already exists
-	struct hash_node *entry = hash_map_lookup(map, key);
+	struct hash_node *entry = hash_map_lookup_hashed(map, key, hash);
 	if (entry) {
 		// If exists, update the value
 		entry->value = value;
+		STAT_INC(STAT_HM_UPDATE);
 		return 0;
 	}
 
 	// 2. Create new node
-	entry = (struct hash_node*)malloc(sizeof(struct hash_node));
+	entry = FAULT_INJECT(FAULT_HM_NODE) ? NULL : (struct hash_node*)malloc(sizeof(struct hash_node));
 	if (!entry) {
 		perror("malloc hash_node");
 		return -1;
 	}
 
 	// 3. Copy key string (using strdup) and set value
-	entry->key = strdup(key);
+	entry->key = FAULT_INJECT(FAULT_HM_KEY) ? NULL : strdup(key);
 	if (!entry->key) {
 		perror("strdup key");
 		free(entry);
 		return -1;
 	}
 	entry->value = value;
+	entry->hash = hash;
 	INIT_HLIST_NODE(&entry->h_node);
 
 	// 4. Calculate bucket index
-	unsigned long hash = hash_function(key);
 	unsigned int index = hash % map->size;
 	struct hlist_head *head = &map->buckets[index];
 
 	// 5. Add node to the head of the bucket list (O(1))
 	hlist_add_head(&entry->h_node, head);
+	map->count++;
+	STAT_INC(STAT_HM_INSERT);
 
 	return 0;
 }
 
+int hash_map_insert(struct hash_map *map, const char *key, int value) {
+	STAT_LATENCY_BEGIN(t);
+	int ret = hash_map_insert_hashed(map, key, hash_function(key), value);
+
+	STAT_LATENCY_END(STAT_LAT_HM_PUT, t);
+	return ret;
+}
+
+// 4. Batched Operations
+
+/*
+ * Lookups of independent keys each miss in the cache on the bucket head,
+ * then on the first node, then on its key string.  The batch APIs walk a
+ * group of keys through those steps one stage at a time ("group
+ * prefetching"): hash everything and prefetch every bucket head, then
+ * prefetch every first node, then every first key, and only then compare.
+ * The misses of one stage overlap instead of being serialized.
+ */
+#define HASH_MAP_BATCH 16  // Keys in flight per group
+
+/**
+ * Look up many keys at once
+ * @param map Hashmap pointer
+ * @param keys Keys to search
+ * @param n Number of keys
+ * @param values values[i] receives the value of keys[i] when found
+ * @param found found[i] is set to 1 if keys[i] was found, 0 otherwise
+ * @return Number of keys found
+ */
+unsigned int hash_map_get_batch(struct hash_map *map, const char *const *keys, unsigned int n,
+				int *values, int *found) {
+	unsigned long hash[HASH_MAP_BATCH];
+	struct hlist_head *head[HASH_MAP_BATCH];
+	struct hlist_node *first[HASH_MAP_BATCH];
+	unsigned int hits = 0;
+
+	for (unsigned int base = 0; base < n; base += HASH_MAP_BATCH) {
+		unsigned int group = n - base < HASH_MAP_BATCH ? n - base : HASH_MAP_BATCH;
+		unsigned int i;
+
+		// Stage 1: hash, prefetch the bucket heads
+		for (i = 0; i < group; i++) {
+			hash[i] = hash_function(keys[base + i]);
+			head[i] = &map->buckets[hash[i] % map->size];
+			prefetch(head[i]);
+		}
+
+		// Stage 2: prefetch the first node of each chain
+		for (i = 0; i < group; i++) {
+			first[i] = head[i]->first;
+			if (first[i]) {
+				prefetch(hlist_entry(first[i], struct hash_node, h_node));
+			}
+		}
+
+		// Stage 3: prefetch the key string of each first node
+		for (i = 0; i < group; i++) {
+			if (first[i]) {
+				prefetch(hlist_entry(first[i], struct hash_node, h_node)->key);
+			}
+		}
+
+		// Stage 4: compare, by now the lines are (hopefully) in the cache
+		for (i = 0; i < group; i++) {
+			struct hlist_node *pos;
+			struct hash_node *entry;
+
+			found[base + i] = 0;
+			for (pos = first[i]; pos; pos = pos->next) {
+				entry = hlist_entry(pos, struct hash_node, h_node);
+				if (entry->hash == hash[i] && strcmp(entry->key, keys[base + i]) == 0) {
+					values[base + i] = entry->value;
+					found[base + i] = 1;
+					hits++;
+					break;
+				}
+			}
+		}
+	}
+
+	STAT_ADD(STAT_HM_GET_HIT, hits);
+	STAT_ADD(STAT_HM_GET_MISS, n - hits);
+	return hits;
+}
+
+/**
+ * Insert (or update) many key-value pairs at once
+ * @param map Hashmap pointer
+ * @param keys Keys to insert
+ * @param values values[i] is stored under keys[i]
+ * @param n Number of pairs
+ * @return 0 on success, -1 if any insertion failed
+ */
+int hash_map_insert_batch(struct hash_map *map, const char *const *keys, const int *values,
+			  unsigned int n) {
+	unsigned long hash[HASH_MAP_BATCH];
+	int ret = 0;
+
+	for (unsigned int base = 0; base < n; base += HASH_MAP_BATCH) {
+		unsigned int group = n - base < HASH_MAP_BATCH ? n - base : HASH_MAP_BATCH;
+		unsigned int i;
+
+		for (i = 0; i < group; i++) {
+			hash[i] = hash_function(keys[base + i]);
+			prefetch(&map->buckets[hash[i] % map->size]);
+		}
+
+		for (i = 0; i < group; i++) {
+			struct hlist_node *first = map->buckets[hash[i] % map->size].first;
+
+			if (first) {
+				prefetch(hlist_entry(first, struct hash_node, h_node));
+			}
+		}
+
+		for (i = 0; i < group; i++) {
+			if (hash_map_insert_hashed(map, keys[base + i], hash[i], values[base + i]) < 0) {
+				ret = -1;
+			}
+		}
+	}
+
+	return ret;
+}
+
 /**
  * Delete node using key
  * @param map Hashmap pointer
@@ -174,6 +332,8 @@ void hash_map_delete(struct hash_map *map, const char *key) {
 		// 2. Remove from list (using hlist_del)
 		// hlist_del operates in O(1) thanks to the pprev pointer.
 		hlist_del(&entry->h_node);
+		map->count--;
+		STAT_INC(STAT_HM_DELETE);
 
 		// 3. Free memory
 		free(entry->key); // Free key allocated with strdup
@@ -209,35 +369,94 @@ void hash_map_print(struct hash_map *map) {
 }
 
 /**
- * Destroy hashmap and free all memory
- * @param map Hashmap pointer
+ * Print hashmap statistics without walking the elements: size, load
+ * factor and, with LUDTM_STATS, the operation counters and latencies
+ * (process wide, all maps)
  */
-void hash_map_destroy(struct hash_map *map) {
-	if (!map) return;
+void hash_map_print_stats(struct hash_map *map, FILE *fp) {
+	double load = (double)map->count / map->size;
+
+	fprintf(fp, "\n--- HashMap Stats (Bucket Size: %u) ---\n", map->size);
+	fprintf(fp, "elements: %lu, load factor: %.2f\n", map->count, load);
+	// Uniform hashing: a hit visits 1 + load/2 nodes, a miss load nodes
+	fprintf(fp, "expected chain steps: %.2f per hit, %.2f per miss\n", 1.0 + load / 2, load);
+#ifdef LUDTM_STATS
+	if (stats_counter(STAT_HM_LOOKUP)) {
+		fprintf(fp, "measured chain steps: %.2f per lookup\n",
+			(double)stats_counter(STAT_HM_CHAIN_STEPS) / stats_counter(STAT_HM_LOOKUP));
+	}
+#endif
+	stats_dump(fp);
+	fprintf(fp, "--------------------------------------------\n\n");
+}
 
-	printf("Destroying hash map...\n");
-	int count = 0;
+/**
+ * Release all nodes in one linear pass over the buckets (bulk destroy).
+ * Chains are walked through their next pointers and never relinked; the
+ * buckets are simply reset afterwards.
+ * @param map Hashmap pointer
+ * @param release Called for every node (e.g. to return it to a pool),
+ *                NULL frees the key and the node
+ * @param arg Passed through to release
+ * @return Number of released nodes
+ */
+unsigned long hash_map_clear(struct hash_map *map,
+			     void (*release)(struct hash_node *, void *), void *arg) {
+	unsigned long count = 0;
 
-	// Traverse all buckets
 	for (unsigned int i = 0; i < map->size; i++) {
-		struct hlist_head *head = &map->buckets[i];
-		struct hlist_node *pos, *n; // n is temporary storage for safe traversal
-		struct hash_node *entry;
-
-		// Delete and free all nodes in the bucket (use safe macro since deleting during traversal)
-		// hlist_for_each_entry_safe(tpos, pos, n, head, member)
-		hlist_for_each_entry_safe(entry, pos, n, head, h_node) {
-			hlist_del(&entry->h_node);
-			free(entry->key);
-			free(entry);
+		struct hlist_node *pos = map->buckets[i].first, *n;
+
+		while (pos) {
+			struct hash_node *entry = hlist_entry(pos, struct hash_node, h_node);
+
+			n = pos->next;
+			prefetch(n);
+			if (release) {
+				release(entry, arg);
+			} else {
+				free(entry->key);
+				free(entry);
+			}
+			pos = n;
 			count++;
 		}
+		INIT_HLIST_HEAD(&map->buckets[i]);
 	}
+	map->count = 0;
+
+	return count;
+}
+
+/**
+ * Bulk destroy: release all nodes, then free the buckets and the map
+ * @param map Hashmap pointer
+ * @param release See hash_map_clear()
+ * @param arg Passed through to release
+ */
+void hash_map_destroy_bulk(struct hash_map *map,
+			   void (*release)(struct hash_node *, void *), void *arg) {
+	if (!map) return;
+
+	hash_map_clear(map, release, arg);
+	free(map->buckets);
+	free(map);
+}
+
+/**
+ * Destroy hashmap and free all memory
+ * @param map Hashmap pointer
+ */
+void hash_map_destroy(struct hash_map *map) {
+	if (!map) return;
+
+	printf("Destroying hash map...\n");
+	unsigned long count = hash_map_clear(map, NULL, NULL);
 
 	// Free bucket array and map structure
 	free(map->buckets);
 	free(map);
-	printf("Freed %d elements.\n", count);
+	printf("Freed %lu elements.\n", count);
 }
 
 #endif /* HASHMAP_H */
@@ -0,0 +1,223 @@
+/*
+ * hashstat: how well does a hash function spread a key set over N buckets?
+ *
+ *   ./hashstat [-f HASH,...|all] [-b BUCKETS,...] [-v] [KEYFILE|-]
+ *   ./hashstat [-f ...] [-b ...] [-v] -g N     (keys "key-0" .. "key-N-1")
+ *
+ * KEYFILE has one key per line.  Without -b, every hash is tried with the
+ * power of two and the prime nearest above the number of keys, which is
+ * where djb2 plus a modulo shows its weak low bits.  Without arguments, a
+ * small demo analyzes a live hash_map and lru_cache_t.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hashmap.h>
+#include <lru.h>
+#include <hashstat.h>
+
+static unsigned long next_pow2(unsigned long n) {
+	unsigned long p = 1;
+
+	while (p < n) p <<= 1;
+	return p;
+}
+
+static int is_prime(unsigned long n) {
+	if (n < 2) return 0;
+	for (unsigned long d = 2; d * d <= n; d++) {
+		if (n % d == 0) return 0;
+	}
+	return 1;
+}
+
+static unsigned long next_prime(unsigned long n) {
+	while (!is_prime(n)) n++;
+	return n;
+}
+
+static char **read_keys(FILE *fp, unsigned long *nkeys) {
+	char **keys = NULL, *line = NULL;
+	unsigned long n = 0, size = 0;
+	size_t cap = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &cap, fp)) >= 0) {
+		if (len && line[len - 1] == '\n') line[--len] = '\0';
+		if (n == size) {
+			char **grown;
+
+			size = size ? 2 * size : 1024;
+			grown = realloc(keys, size * sizeof(*keys));
+			if (!grown) {
+				perror("realloc keys");
+				exit(1);
+			}
+			keys = grown;
+		}
+		keys[n] = strdup(line);
+		if (!keys[n]) {
+			perror("strdup key");
+			exit(1);
+		}
+		n++;
+	}
+	free(line);
+	*nkeys = n;
+	return keys;
+}
+
+static char **gen_keys(unsigned long n) {
+	char **keys = malloc(n * sizeof(*keys));
+
+	if (!keys) {
+		perror("malloc keys");
+		exit(1);
+	}
+	for (unsigned long i = 0; i < n; i++) {
+		char buf[32];
+
+		snprintf(buf, sizeof(buf), "key-%lu", i);
+		keys[i] = strdup(buf);
+		if (!keys[i]) {
+			perror("strdup key");
+			exit(1);
+		}
+	}
+	return keys;
+}
+
+static int demo(void) {
+	struct hash_chain_stats st;
+	struct hash_map *map = hash_map_create(64);
+	lru_cache_t *cache = lru_cache_create(100, 64);
+	char key[32];
+
+	if (!map || !cache) return 1;
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "user:%d", i);
+		hash_map_insert(map, key, i);
+		lru_cache_put(cache, key, i);
+	}
+
+	printf("--- hash_map, 100 keys in 64 buckets ---\n");
+	if (hash_map_analyze(map, &st) == 0) hash_chain_print(&st, stdout, 1);
+	printf("\n--- lru_cache_t, 100 keys in 64 buckets ---\n");
+	if (lru_cache_analyze(cache, &st) == 0) hash_chain_print(&st, stdout, 0);
+
+	hash_map_destroy_bulk(map, NULL, NULL);
+	lru_cache_destroy(cache);
+	printf("\nRun './hashstat -h' to analyze a key file.\n");
+	return 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-f HASH,...|all] [-b BUCKETS,...] [-v] [KEYFILE|-|-g N]\n"
+		"Hash functions:", prog);
+	for (unsigned int i = 0; i < NR_HASH_FUNCTIONS; i++) {
+		fprintf(stderr, " %s", hash_functions[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *fn_list = "all", *bucket_list = NULL;
+	unsigned long nkeys = 0, gen = 0;
+	unsigned long buckets[64];
+	unsigned int nbuckets = 0;
+	char **keys;
+	int opt, verbose = 0;
+
+	if (argc == 1) return demo();
+
+	while ((opt = getopt(argc, argv, "f:b:g:vh")) != -1) {
+		switch (opt) {
+		case 'f': fn_list = optarg; break;
+		case 'b': bucket_list = optarg; break;
+		case 'g': gen = strtoul(optarg, NULL, 0); break;
+		case 'v': verbose = 1; break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (gen) {
+		keys = gen_keys(gen);
+		nkeys = gen;
+	} else if (optind < argc && strcmp(argv[optind], "-") != 0) {
+		FILE *fp = fopen(argv[optind], "r");
+
+		if (!fp) {
+			perror(argv[optind]);
+			return 1;
+		}
+		keys = read_keys(fp, &nkeys);
+		fclose(fp);
+	} else {
+		keys = read_keys(stdin, &nkeys);
+	}
+	if (!nkeys) {
+		fprintf(stderr, "hashstat: no keys\n");
+		return 1;
+	}
+
+	if (bucket_list) {
+		for (char *p = (char*)bucket_list; *p && nbuckets < 64; ) {
+			char *end;
+			unsigned long b = strtoul(p, &end, 0);
+
+			if (end == p) break;
+			if (b) buckets[nbuckets++] = b;
+			p = *end == ',' ? end + 1 : end;
+		}
+	} else {
+		buckets[nbuckets++] = next_pow2(nkeys);
+		buckets[nbuckets++] = next_prime(nkeys);
+	}
+	if (!nbuckets) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%lu keys\n", nkeys);
+	printf("%-10s %10s %6s %7s %5s %12s %12s %9s\n", "hash", "buckets", "load", "empty%",
+		   "max", "probes/hit", "probes/miss", "chi2 z");
+
+	for (unsigned int f = 0; f < NR_HASH_FUNCTIONS; f++) {
+		const char *name = hash_functions[f].name;
+		size_t len = strlen(name);
+		int selected = strcmp(fn_list, "all") == 0;
+
+		for (const char *p = fn_list; !selected && p; p = strchr(p, ',')) {
+			if (*p == ',') p++;
+			selected = strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0');
+		}
+		if (!selected) continue;
+
+		for (unsigned int b = 0; b < nbuckets; b++) {
+			struct hash_chain_stats st;
+
+			if (hash_keys_analyze((const char *const *)keys, nkeys, hash_functions[f].fn,
+					      buckets[b], &st) < 0) {
+				return 1;
+			}
+			printf("%-10s %10lu %6.2f %6.1f%% %5lu %5.2f/%-6.2f %5.2f/%-6.2f %9.2f%s\n",
+				   name, st.nbuckets, st.load, 100.0 * st.empty / st.nbuckets, st.max_chain,
+				   st.hit_probes, st.hit_probes_expected, st.miss_probes, st.miss_probes_expected,
+				   st.chi2_z, st.chi2_z > 3 ? " !" : "");
+			if (verbose) {
+				hash_chain_print(&st, stdout, 1);
+				printf("\n");
+			}
+		}
+	}
+	printf("(probes: actual/uniform; '!' marks z > 3, i.e. clustered)\n");
+
+	for (unsigned long i = 0; i < nkeys; i++) free(keys[i]);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,256 @@
+#ifndef HASHSTAT_H
+#define HASHSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <hashmap.h>
+#include <lru.h>
+
+/**
+ * Hash chain quality analysis.
+ *
+ * Everything is derived from the chain length of every bucket, so the
+ * cost is one pass over the buckets (and the keys, to count them) and the
+ * report size does not depend on the number of keys:
+ *
+ *  - occupancy histogram: how many buckets hold 0, 1, 2, ... keys
+ *  - max chain, and mean chain over the non-empty buckets
+ *  - probes: nodes visited by an average successful lookup, and by an
+ *    unsuccessful one for a key drawn like the stored ones, against what
+ *    uniform hashing would give for the same load factor
+ *  - chi-square of the bucket counts against a uniform distribution,
+ *    and its z-score ((chi2 - df) / sqrt(2 df)): z > 3 means clustering,
+ *    z < -3 a spread more even than random (e.g. sequential keys)
+ *
+ * Chains are analyzed as they are in a live hash_map or lru_cache_t, or
+ * simulated for a key set, a hash function and a bucket count to choose
+ * both before deploying them.
+ */
+
+#define HASH_OCC_MAX 16  // Last occupancy bin counts chains >= HASH_OCC_MAX
+
+typedef unsigned long (*hash_fn_t)(const char *key);
+
+struct hash_chain_stats {
+	unsigned long nbuckets;
+	unsigned long nkeys;
+	unsigned long empty;		  // Buckets without keys
+	unsigned long max_chain;
+	double load;				  // nkeys / nbuckets
+	double mean_chain;			// Over non-empty buckets
+	double hit_probes;			// Nodes visited per successful lookup
+	double hit_probes_expected;   // Same, uniform hashing
+	double miss_probes;		   // Per unsuccessful lookup, key-weighted
+	double miss_probes_expected;  // Same, uniform hashing
+	double chi2;
+	double chi2_z;
+	unsigned long occupancy[HASH_OCC_MAX + 1];
+};
+
+/*
+ * ====================================================================================
+ * Hash functions to compare against djb2 (hash_function())
+ * ====================================================================================
+ */
+
+static unsigned long hash_fnv1a(const char *str) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 0x100000001b3ULL;
+	}
+	return (unsigned long)hash;
+}
+
+static unsigned long hash_sdbm(const char *str) {
+	unsigned long hash = 0;
+	int c;
+
+	while ((c = *str++))
+		hash = c + (hash << 6) + (hash << 16) - hash;
+	return hash;
+}
+
+/**
+ * djb2 followed by a 64-bit finalizer (MurmurHash3 fmix64): keeps djb2's
+ * speed but spreads its entropy into the low bits that the modulo uses.
+ */
+static unsigned long hash_djb2_mix(const char *str) {
+	uint64_t h = hash_function(str);
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (unsigned long)h;
+}
+
+static const struct {
+	const char *name;
+	hash_fn_t fn;
+} hash_functions[] = {
+	{ "djb2", hash_function },
+	{ "djb2-mix", hash_djb2_mix },
+	{ "fnv1a", hash_fnv1a },
+	{ "sdbm", hash_sdbm },
+};
+
+#define NR_HASH_FUNCTIONS (sizeof(hash_functions) / sizeof(hash_functions[0]))
+
+/*
+ * ====================================================================================
+ * Analysis
+ * ====================================================================================
+ */
+
+/**
+ * Analyze chain lengths
+ * @param counts counts[i] is the length of chain i
+ * @param nbuckets Number of buckets
+ * @param st Filled in
+ */
+void hash_chain_analyze(const unsigned int *counts, unsigned long nbuckets,
+			struct hash_chain_stats *st) {
+	double sum_sq = 0, sum_tri = 0, dev = 0, expected;
+
+	memset(st, 0, sizeof(*st));
+	st->nbuckets = nbuckets;
+	if (!nbuckets) return;
+
+	for (unsigned long i = 0; i < nbuckets; i++) {
+		unsigned long c = counts[i];
+
+		st->nkeys += c;
+		if (!c) st->empty++;
+		if (c > st->max_chain) st->max_chain = c;
+		st->occupancy[c < HASH_OCC_MAX ? c : HASH_OCC_MAX]++;
+		sum_sq += (double)c * c;
+		sum_tri += (double)c * (c + 1) / 2;
+	}
+
+	st->load = (double)st->nkeys / nbuckets;
+	if (st->nbuckets > st->empty) {
+		st->mean_chain = (double)st->nkeys / (st->nbuckets - st->empty);
+	}
+	if (!st->nkeys) return;
+
+	// The k-th key of a chain costs k probes to find
+	st->hit_probes = sum_tri / st->nkeys;
+	st->hit_probes_expected = 1.0 + (st->nkeys - 1) / (2.0 * nbuckets);
+	// A miss for a key hashed like the stored ones walks a chain of c
+	// nodes with probability c / nkeys
+	st->miss_probes = sum_sq / st->nkeys;
+	st->miss_probes_expected = 1.0 + (double)(st->nkeys - 1) / nbuckets;
+
+	expected = st->load;
+	for (unsigned long i = 0; i < nbuckets; i++) {
+		double d = counts[i] - expected;
+
+		dev += d * d;
+	}
+	st->chi2 = dev / expected;
+	if (nbuckets > 1) {
+		st->chi2_z = (st->chi2 - (nbuckets - 1)) / sqrt(2.0 * (nbuckets - 1));
+	}
+}
+
+/**
+ * Analyze the chains of a live hash map (one pass over the chains)
+ * @return 0 on success, -1 on memory allocation failure
+ */
+int hash_map_analyze(struct hash_map *map, struct hash_chain_stats *st) {
+	unsigned int *counts = (unsigned int*)calloc(map->size, sizeof(unsigned int));
+
+	if (!counts) {
+		perror("calloc counts");
+		return -1;
+	}
+	for (unsigned int i = 0; i < map->size; i++) {
+		struct hlist_node *pos;
+
+		hlist_for_each(pos, &map->buckets[i]) {
+			counts[i]++;
+		}
+	}
+	hash_chain_analyze(counts, map->size, st);
+	free(counts);
+	return 0;
+}
+
+/**
+ * Analyze the chains of a live LRU cache (one pass over the chains)
+ * @return 0 on success, -1 on memory allocation failure
+ */
+int lru_cache_analyze(lru_cache_t *cache, struct hash_chain_stats *st) {
+	unsigned int *counts = (unsigned int*)calloc(cache->bucket_size, sizeof(unsigned int));
+
+	if (!counts) {
+		perror("calloc counts");
+		return -1;
+	}
+	for (unsigned int i = 0; i < cache->bucket_size; i++) {
+		struct hlist_node *pos;
+
+		hlist_for_each(pos, &cache->buckets[i]) {
+			counts[i]++;
+		}
+	}
+	hash_chain_analyze(counts, cache->bucket_size, st);
+	free(counts);
+	return 0;
+}
+
+/**
+ * Simulate the chains @fn and @nbuckets would give a key set, without
+ * building a map (duplicate keys count as distinct)
+ * @return 0 on success, -1 on memory allocation failure
+ */
+int hash_keys_analyze(const char *const *keys, unsigned long nkeys, hash_fn_t fn,
+		      unsigned long nbuckets, struct hash_chain_stats *st) {
+	unsigned int *counts = (unsigned int*)calloc(nbuckets, sizeof(unsigned int));
+
+	if (!counts) {
+		perror("calloc counts");
+		return -1;
+	}
+	for (unsigned long i = 0; i < nkeys; i++) {
+		counts[fn(keys[i]) % nbuckets]++;
+	}
+	hash_chain_analyze(counts, nbuckets, st);
+	free(counts);
+	return 0;
+}
+
+/**
+ * Print an analysis
+ * @param verbose Also print the occupancy histogram
+ */
+void hash_chain_print(const struct hash_chain_stats *st, FILE *fp, int verbose) {
+	fprintf(fp, "buckets: %lu, keys: %lu, load factor: %.3f\n", st->nbuckets, st->nkeys, st->load);
+	fprintf(fp, "empty buckets: %lu (%.1f%%, uniform: %.1f%%)\n", st->empty,
+		100.0 * st->empty / (st->nbuckets ? st->nbuckets : 1), 100.0 * exp(-st->load));
+	fprintf(fp, "chain length: max %lu, mean (non-empty) %.3f\n", st->max_chain, st->mean_chain);
+	fprintf(fp, "probes per hit: %.3f (uniform %.3f), per miss: %.3f (uniform %.3f)\n",
+		st->hit_probes, st->hit_probes_expected, st->miss_probes, st->miss_probes_expected);
+	fprintf(fp, "chi-square: %.1f, df %lu, z = %.2f%s\n", st->chi2,
+		st->nbuckets ? st->nbuckets - 1 : 0, st->chi2_z,
+		st->chi2_z > 3 ? " (clustered)" : st->chi2_z < -3 ? " (more even than random)" : "");
+
+	if (!verbose) return;
+
+	fprintf(fp, "occupancy:\n");
+	for (unsigned int c = 0; c <= HASH_OCC_MAX; c++) {
+		if (!st->occupancy[c]) continue;
+		fprintf(fp, "  %s%2u keys: %lu buckets\n", c == HASH_OCC_MAX ? ">=" : "  ", c,
+			st->occupancy[c]);
+	}
+}
+
+#endif /* HASHSTAT_H */
@@ -0,0 +1,109 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Log-linear latency histogram (HDR histogram style).
+ *
+ * Values below 2^HIST_SUB_BITS get a bucket each; above that, every power
+ * of two is split into 2^HIST_SUB_BITS linear sub-buckets, so a bucket is
+ * never wider than 1/2^HIST_SUB_BITS (3.1%) of the values it holds.
+ * Recording is a couple of shifts and an increment; percentiles walk the
+ * fixed bucket array.  Histograms of the same kind can be merged by adding
+ * them, e.g. per-thread histograms at the end of a run.
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1UL << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline void hist_init(struct histogram *h) {
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+/**
+ * Internal helper: bucket of a value.
+ */
+static inline unsigned int hist_index(uint64_t v) {
+	unsigned int shift;
+
+	if (v < HIST_SUB_COUNT) return (unsigned int)v;
+
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + (unsigned int)((v >> shift) - HIST_SUB_COUNT);
+}
+
+/**
+ * Internal helper: smallest value of a bucket.
+ */
+static inline uint64_t hist_bucket_value(unsigned int index) {
+	unsigned int shift;
+
+	if (index < HIST_SUB_COUNT) return index;
+
+	shift = (index >> HIST_SUB_BITS) - 1;
+	return (uint64_t)(HIST_SUB_COUNT + (index & (HIST_SUB_COUNT - 1))) << shift;
+}
+
+static inline void hist_record(struct histogram *h, uint64_t v) {
+	h->buckets[hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v < h->min) h->min = v;
+	if (v > h->max) h->max = v;
+}
+
+/**
+ * Add @src into @dst
+ */
+static inline void hist_merge(struct histogram *dst, const struct histogram *src) {
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+/**
+ * Value at percentile @p (0..100): the smallest value of the first
+ * bucket that reaches it, clamped to [min, max]
+ */
+static inline uint64_t hist_percentile(const struct histogram *h, double p) {
+	uint64_t rank, seen = 0;
+
+	if (!h->count) return 0;
+
+	rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > h->count) rank = h->count;
+
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			uint64_t v = hist_bucket_value(i);
+
+			return v < h->min ? h->min : v > h->max ? h->max : v;
+		}
+	}
+	return h->max;
+}
+
+static inline double hist_mean(const struct histogram *h) {
+	return h->count ? (double)h->sum / h->count : 0.0;
+}
+
+#endif /* HISTOGRAM_H */
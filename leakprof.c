@@ -0,0 +1,438 @@
+/*
+ * leakprof: sampling heap profiler, as an LD_PRELOAD shim.
+ *
+ *   make leakprof
+ *   LD_PRELOAD=./leakprof.so ./ludtm --batch -v mem_leak
+ *   LD_PRELOAD=./leakprof.so LEAKPROF_RATE=65536 ./server &   kill -USR2 $!
+ *
+ * Allocations are sampled as a Poisson process over allocated bytes: each
+ * thread counts down an exponentially distributed number of bytes (mean
+ * LEAKPROF_RATE, 512 KiB by default) and samples the allocation that takes
+ * it below zero, so big allocations are more likely to be sampled and
+ * every byte has the same chance.  The fast path is that one subtraction,
+ * plus on free() a look at a small counting filter of sampled pointers.
+ *
+ * A sample records the allocation's stack, hashed into a call site, and
+ * its weight: the bytes it stands for, size / (1 - e^(-size/rate)).  Call
+ * sites and live sampled pointers are in fixed-size open-addressing tables
+ * updated with compare-and-swap only, so threads never wait on each other
+ * and nothing here calls malloc.
+ *
+ * The top LEAKPROF_TOP call sites by estimated live bytes are reported to
+ * LEAKPROF_OUT (default stderr) on LEAKPROF_SIGNAL (default SIGUSR2), at
+ * exit, and on the first malloc() that fails: running out of memory is
+ * when the report is wanted most.  Frames are printed as
+ * module(+offset)[address], as by the crash reporter.
+ */
+
+#include <crash.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <execinfo.h>
+#include <math.h>
+#include <errno.h>
+
+#define LEAKPROF_DEFAULT_RATE (512 * 1024)
+#define LEAKPROF_DEFAULT_TOP 10
+#define LEAKPROF_DEPTH 16
+#define LEAKPROF_SITES 4096			 // Power of two
+#define LEAKPROF_PTRS (64 * 1024)		// Power of two, live samples at most
+#define LEAKPROF_FILTER (64 * 1024)	  // Counting filter in front of the pointer table
+#define LEAKPROF_TOMBSTONE ((uintptr_t)1)
+
+/* glibc's own entry points, so that we need no dlsym() */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+struct leakprof_site {
+	_Atomic uint64_t hash;		  // 0 = free slot
+	_Atomic int ready;			  // pcs written
+	unsigned int depth;
+	void *pcs[LEAKPROF_DEPTH];
+	_Atomic int64_t live_bytes;	 // Estimated, from the weights
+	_Atomic int64_t live_samples;
+	_Atomic uint64_t total_bytes;
+	_Atomic uint64_t total_samples;
+};
+
+struct leakprof_ptr {
+	_Atomic uintptr_t ptr;		  // 0 = free, LEAKPROF_TOMBSTONE = deleted
+	uint32_t site;
+	uint64_t weight;
+};
+
+static struct leakprof_site leakprof_sites[LEAKPROF_SITES];
+static struct leakprof_ptr leakprof_ptrs[LEAKPROF_PTRS];
+static _Atomic uint32_t leakprof_filter[LEAKPROF_FILTER];	// Up to LEAKPROF_PTRS per slot
+static _Atomic long leakprof_live;	   // Live samples: free() skips the filter while 0
+static _Atomic long leakprof_dropped;	// Tables full
+static _Atomic int leakprof_oom_reported;
+
+static double leakprof_rate = LEAKPROF_DEFAULT_RATE;
+static int leakprof_top = LEAKPROF_DEFAULT_TOP;
+
+static __thread int64_t leakprof_until __attribute__((tls_model("initial-exec")));
+static __thread uint64_t leakprof_rng __attribute__((tls_model("initial-exec")));
+static __thread int leakprof_busy __attribute__((tls_model("initial-exec")));
+
+/*
+ * ====================================================================================
+ * Sampling
+ * ====================================================================================
+ */
+
+static inline uint64_t leakprof_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+/**
+ * Internal helper: bytes until the next sample, exponentially distributed
+ */
+static int64_t leakprof_next_gap(void) {
+	double u;
+
+	if (!leakprof_rng) leakprof_rng = leakprof_mix((uintptr_t)&leakprof_rng ^ (uint64_t)getpid()) | 1;
+	// xorshift64*, 53 random bits in (0, 1]
+	leakprof_rng ^= leakprof_rng >> 12;
+	leakprof_rng ^= leakprof_rng << 25;
+	leakprof_rng ^= leakprof_rng >> 27;
+	u = ((leakprof_rng * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+	return (int64_t)(-log(1.0 - u) * leakprof_rate) + 1;
+}
+
+static struct leakprof_site* leakprof_site_get(uint64_t hash, void *const *pcs, unsigned int depth) {
+	if (!hash) hash = 1;
+	for (unsigned int i = 0; i < LEAKPROF_SITES; i++) {
+		struct leakprof_site *site = &leakprof_sites[(hash + i) & (LEAKPROF_SITES - 1)];
+		uint64_t cur = atomic_load_explicit(&site->hash, memory_order_acquire);
+
+		if (cur == hash) return site;
+		if (cur == 0) {
+			uint64_t expected = 0;
+
+			if (atomic_compare_exchange_strong(&site->hash, &expected, hash)) {
+				site->depth = depth;
+				memcpy(site->pcs, pcs, depth * sizeof(pcs[0]));
+				atomic_store_explicit(&site->ready, 1, memory_order_release);
+				return site;
+			}
+			if (expected == hash) return site;
+		}
+	}
+	return NULL;
+}
+
+static inline unsigned int leakprof_filter_slot(const void *p) {
+	// No hashing on the free() path: malloc() pointers are 16-byte aligned and spread enough
+	return ((uintptr_t)p >> 4) & (LEAKPROF_FILTER - 1);
+}
+
+static void leakprof_ptr_insert(void *p, uint32_t site, uint64_t weight) {
+	uint64_t h = leakprof_mix((uintptr_t)p ^ 0x9e3779b97f4a7c15ull);
+
+	for (unsigned int i = 0; i < LEAKPROF_PTRS; i++) {
+		struct leakprof_ptr *e = &leakprof_ptrs[(h + i) & (LEAKPROF_PTRS - 1)];
+		uintptr_t cur = atomic_load_explicit(&e->ptr, memory_order_relaxed);
+
+		// Live pointers are unique, so a free or deleted slot can simply be claimed
+		if ((cur == 0 || cur == LEAKPROF_TOMBSTONE) &&
+			atomic_compare_exchange_strong(&e->ptr, &cur, LEAKPROF_TOMBSTONE + 1)) {
+			e->site = site;
+			e->weight = weight;
+			atomic_store_explicit(&e->ptr, (uintptr_t)p, memory_order_release);
+			atomic_fetch_add(&leakprof_filter[leakprof_filter_slot(p)], 1);
+			atomic_fetch_add(&leakprof_live, 1);
+			return;
+		}
+	}
+	atomic_fetch_add(&leakprof_dropped, 1);
+}
+
+/**
+ * Internal helper: forget @p if it was sampled, before it is freed
+ */
+static void leakprof_ptr_remove(void *p) {
+	uint64_t h = leakprof_mix((uintptr_t)p ^ 0x9e3779b97f4a7c15ull);
+
+	for (unsigned int i = 0; i < LEAKPROF_PTRS; i++) {
+		struct leakprof_ptr *e = &leakprof_ptrs[(h + i) & (LEAKPROF_PTRS - 1)];
+		uintptr_t cur = atomic_load_explicit(&e->ptr, memory_order_acquire);
+
+		if (cur == 0) return;
+		if (cur != (uintptr_t)p) continue;
+
+		// Once the slot is a tombstone an insert may reuse it: read it first
+		struct leakprof_site *site = &leakprof_sites[e->site];
+		uint64_t weight = e->weight;
+
+		if (!atomic_compare_exchange_strong(&e->ptr, &cur, LEAKPROF_TOMBSTONE)) return;
+		atomic_fetch_sub(&site->live_bytes, (int64_t)weight);
+		atomic_fetch_sub(&site->live_samples, 1);
+		atomic_fetch_sub(&leakprof_filter[leakprof_filter_slot(p)], 1);
+		atomic_fetch_sub(&leakprof_live, 1);
+		return;
+	}
+}
+
+static void leakprof_report(void);
+
+/**
+ * Internal helper: the slow path, once per LEAKPROF_RATE bytes on average
+ */
+static __attribute__((noinline)) void leakprof_sample(void *p, size_t size) {
+	void *pcs[LEAKPROF_DEPTH + 2];
+	struct leakprof_site *site;
+	uint64_t hash = 0, weight;
+	int depth, first = !leakprof_rng;
+
+	// backtrace() may allocate the first time it runs
+	if (leakprof_busy) return;
+	leakprof_busy = 1;
+	leakprof_until = leakprof_next_gap();
+	// A thread's first countdown starts here, so do not count this one
+	if (first || !p) goto out;
+
+	// Without leakprof_sample and the interposed function
+	depth = backtrace(pcs, LEAKPROF_DEPTH + 2) - 2;
+	if (depth <= 0) goto out;
+	for (int i = 0; i < depth; i++) hash = leakprof_mix(hash ^ (uintptr_t)pcs[i + 2]);
+
+	site = leakprof_site_get(hash, pcs + 2, depth);
+	if (!site) {
+		atomic_fetch_add(&leakprof_dropped, 1);
+		goto out;
+	}
+	weight = size >= leakprof_rate * 40 ? size : (uint64_t)(size / (1.0 - exp(-(double)size / leakprof_rate)));
+	atomic_fetch_add(&site->live_bytes, (int64_t)weight);
+	atomic_fetch_add(&site->live_samples, 1);
+	atomic_fetch_add(&site->total_bytes, weight);
+	atomic_fetch_add(&site->total_samples, 1);
+	leakprof_ptr_insert(p, (uint32_t)(site - leakprof_sites), weight);
+out:
+	leakprof_busy = 0;
+}
+
+static inline __attribute__((always_inline)) void leakprof_alloc(void *p, size_t size) {
+	if (__builtin_expect(!p && size, 0) && !atomic_exchange(&leakprof_oom_reported, 1)) leakprof_report();
+	if (__builtin_expect((leakprof_until -= (int64_t)size) < 0, 0)) leakprof_sample(p, size);
+}
+
+static inline __attribute__((always_inline)) void leakprof_free(void *p) {
+	if (p && atomic_load_explicit(&leakprof_live, memory_order_relaxed) &&
+		atomic_load_explicit(&leakprof_filter[leakprof_filter_slot(p)], memory_order_relaxed)) {
+		leakprof_ptr_remove(p);
+	}
+}
+
+/*
+ * ====================================================================================
+ * Interposed allocator
+ * ====================================================================================
+ */
+
+void* malloc(size_t size) {
+	void *p = __libc_malloc(size);
+
+	leakprof_alloc(p, size);
+	return p;
+}
+
+void* calloc(size_t n, size_t size) {
+	void *p = __libc_calloc(n, size);
+	size_t total;
+
+	leakprof_alloc(p, __builtin_mul_overflow(n, size, &total) ? SIZE_MAX : total);
+	return p;
+}
+
+void* realloc(void *old, size_t size) {
+	void *p = __libc_realloc(old, size);
+
+	// On failure @old is still live; realloc(old, 0) frees it
+	if (p || !size) leakprof_free(old);
+	leakprof_alloc(p, size);
+	return p;
+}
+
+void free(void *p) {
+	leakprof_free(p);
+	__libc_free(p);
+}
+
+// Inlined into each entry point, so that all have the same frames to skip
+static inline __attribute__((always_inline)) void* leakprof_memalign(size_t align, size_t size) {
+	void *p = __libc_memalign(align, size);
+
+	leakprof_alloc(p, size);
+	return p;
+}
+
+void* memalign(size_t align, size_t size) {
+	return leakprof_memalign(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+	return leakprof_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) {
+	void *p;
+
+	if (align < sizeof(void*) || (align & (align - 1))) return EINVAL;
+	p = leakprof_memalign(align, size);
+	if (!p && size) return ENOMEM;
+	*out = p;
+	return 0;
+}
+
+void* valloc(size_t size) {
+	return leakprof_memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+/*
+ * ====================================================================================
+ * Report
+ * ====================================================================================
+ */
+
+static void leakprof_mib(int64_t bytes) {
+	// One decimal without printf: async-signal-safe
+	int64_t tenths = bytes * 10 / (1024 * 1024);
+
+	if (tenths < 0) {
+		crash_puts("-");
+		tenths = -tenths;
+	}
+	crash_dec(tenths / 10);
+	crash_puts(".");
+	crash_dec(tenths % 10);
+	crash_puts(" MiB");
+}
+
+/**
+ * Internal helper: top sites by live bytes, with no allocation: selection
+ * over the table, leakprof_top times
+ */
+static void leakprof_report(void) {
+	static int shown[LEAKPROF_SITES];
+	int64_t live = 0;
+	unsigned int nsites = 0;
+
+	memset(shown, 0, sizeof(shown));
+	for (unsigned int i = 0; i < LEAKPROF_SITES; i++) {
+		if (!atomic_load(&leakprof_sites[i].ready)) continue;
+		nsites++;
+		live += atomic_load(&leakprof_sites[i].live_bytes);
+	}
+
+	crash_maps_load();
+	crash_puts("leakprof: pid ");
+	crash_dec(getpid());
+	crash_puts(", ");
+	crash_dec(atomic_load(&leakprof_live));
+	crash_puts(" live samples of 1 per ");
+	crash_dec((long)leakprof_rate);
+	crash_puts(" bytes, ~");
+	leakprof_mib(live);
+	crash_puts(" live in ");
+	crash_dec(nsites);
+	crash_puts(" call sites");
+	if (atomic_load(&leakprof_dropped)) {
+		crash_puts(", ");
+		crash_dec(atomic_load(&leakprof_dropped));
+		crash_puts(" samples dropped (tables full)");
+	}
+	crash_puts("\n");
+
+	for (int rank = 1; rank <= leakprof_top; rank++) {
+		struct leakprof_site *best = NULL;
+		int64_t best_live = 0;
+
+		for (unsigned int i = 0; i < LEAKPROF_SITES; i++) {
+			struct leakprof_site *site = &leakprof_sites[i];
+			int64_t bytes = atomic_load(&site->live_bytes);
+
+			if (!shown[i] && atomic_load(&site->ready) && bytes > best_live) {
+				best = site;
+				best_live = bytes;
+			}
+		}
+		if (!best) break;
+		shown[best - leakprof_sites] = 1;
+
+		crash_puts("#");
+		crash_dec(rank);
+		crash_puts(" ~");
+		leakprof_mib(best_live);
+		crash_puts(" live (");
+		crash_dec(atomic_load(&best->live_samples));
+		crash_puts(" samples), ~");
+		leakprof_mib(atomic_load(&best->total_bytes));
+		crash_puts(" allocated (");
+		crash_dec(atomic_load(&best->total_samples));
+		crash_puts(" samples)\n");
+		for (unsigned int f = 0; f < best->depth; f++) {
+			crash_puts("    ");
+			crash_symbolize((uintptr_t)best->pcs[f]);
+		}
+	}
+	crash_flush();
+}
+
+static void leakprof_signal(int sig) {
+	int saved = errno;
+
+	(void)sig;
+	leakprof_report();
+	errno = saved;
+}
+
+__attribute__((constructor)) static void leakprof_init(void) {
+	const char *s;
+	void *pcs[1];
+	int sig = SIGUSR2;
+
+	crash.fd = STDERR_FILENO;
+	if ((s = getenv("LEAKPROF_RATE")) && atof(s) >= 1) leakprof_rate = atof(s);
+	if ((s = getenv("LEAKPROF_TOP")) && atoi(s) > 0) leakprof_top = atoi(s);
+	if ((s = getenv("LEAKPROF_SIGNAL"))) sig = atoi(s);
+	if ((s = getenv("LEAKPROF_OUT"))) {
+		int fd = open(s, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+		if (fd >= 0) crash.fd = fd;
+	}
+	// Load libgcc's unwinder now rather than in the middle of a sample
+	leakprof_busy = 1;
+	backtrace(pcs, 1);
+	leakprof_busy = 0;
+
+	if (sig > 0) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = leakprof_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(sig, &sa, NULL);
+	}
+}
+
+__attribute__((destructor)) static void leakprof_fini(void) {
+	// Nothing sampled (a parent that only forks, say): nothing to say
+	for (unsigned int i = 0; i < LEAKPROF_SITES; i++) {
+		if (atomic_load(&leakprof_sites[i].ready)) {
+			if (!atomic_load(&leakprof_oom_reported)) leakprof_report();
+			return;
+		}
+	}
+}
@@ -1,9 +1,113 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <lru.h>
+#include <perfctr.h>
+
+// Fake clock for the TTL phase, in milliseconds
+static unsigned long demo_now;
+
+static unsigned long demo_clock(void) {
+	return demo_now;
+}
+
+static double now_sec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Random gets on a cache much larger than the LLC, with ~4 nodes per
+ * bucket, for plain malloc()ed nodes and for LRU_F_HWCACHE_ALIGN, then
+ * the per-key cost of lru_cache_get_batch() against single gets.
+ */
+static int bench(unsigned int nkeys) {
+	static const struct { const char *name; unsigned int flags; } modes[] = {
+		{ "malloc", 0 },
+		{ "hwcache-aligned", LRU_F_HWCACHE_ALIGN },
+	};
+	static const unsigned int batch_sizes[] = { 1, 8, 32, 128 };
+	unsigned int nlookups = 4 * 1000 * 1000;
+	char (*names)[16] = malloc((size_t)nkeys * sizeof(*names));
+	const char **probe = malloc((size_t)nlookups * sizeof(*probe));
+	int values[128], found[128];
+	struct perf_counters pc;
+	unsigned long seed = 0x9e3779b97f4a7c15UL;
+
+	if (!names || !probe) {
+		fprintf(stderr, "bench: out of memory\n");
+		return 1;
+	}
+	for (unsigned int i = 0; i < nkeys; i++) {
+		snprintf(names[i], sizeof(names[i]), "key-%u", i);
+	}
+	for (unsigned int i = 0; i < nlookups; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		probe[i] = names[seed % nkeys];
+	}
+
+	printf("lru_node_t: %zu bytes, hot part %zu bytes\n", sizeof(lru_node_t),
+		   offsetof(lru_node_t, ttl));
+	if (!perf_counters_open(&pc)) {
+		printf("(hardware counters unavailable, see perf_event_paranoid)\n");
+	}
+
+	for (unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		lru_cache_t *cache = lru_cache_create(nkeys, nkeys / 4 + 1);
+		unsigned long hits = 0;
+		double t0, ns;
+
+		if (!cache) return 1;
+		cache->flags = modes[m].flags;
+		for (unsigned int i = 0; i < nkeys; i++) {
+			lru_cache_put(cache, names[i], (int)i);
+		}
+
+		t0 = now_sec();
+		perf_counters_start(&pc);
+		for (unsigned int i = 0; i < nlookups; i++) {
+			int value;
+
+			hits += lru_cache_get(cache, probe[i], &value);
+		}
+		perf_counters_stop(&pc);
+		ns = (now_sec() - t0) * 1e9 / nlookups;
+
+		printf("%s: %.1f ns/get (%lu hits)\n", modes[m].name, ns, hits);
+		perf_counters_print(&pc, nlookups);
+
+		for (unsigned int b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+			unsigned int size = batch_sizes[b];
+			double batched;
+
+			t0 = now_sec();
+			for (unsigned int i = 0; i + size <= nlookups; i += size) {
+				hits += lru_cache_get_batch(cache, probe + i, size, values, found);
+			}
+			batched = (now_sec() - t0) * 1e9 / (nlookups - nlookups % size);
+			printf("  get_batch(%3u)   %10.1f ns/key  speedup %.2fx\n", size, batched, ns / batched);
+		}
+		lru_cache_destroy(cache);
+	}
+
+	perf_counters_close(&pc);
+	free(names);
+	free(probe);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		unsigned int nkeys = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 0) : 1000000;
+
+		return bench(nkeys ? nkeys : 1000000);
+	}
 
-int main() {
 	// 1. Create cache (capacity 4, 16 hash buckets)
 	const unsigned int CAPACITY = 4;
 	const unsigned int BUCKET_SIZE = 16;
@@ -74,9 +178,56 @@ int main() {
 		printf("Cache Miss for 'Z' (Expected)\n");
 	}
 
-	// 7. Destroy cache
+	// 7. TTL expiry (driven by a fake clock)
+	printf("\n--- Phase 6: TTL expiry ---\n");
+	cache->clock = demo_clock;
+	demo_now = 1000;
+	printf("Inserting 'G' with a 100 ms TTL and 'H' with a 5000 ms TTL\n");
+	lru_cache_put_ttl(cache, "G", 70, 100);
+	lru_cache_put_ttl(cache, "H", 80, 5000);
+	lru_cache_print(cache);
+
+	demo_now += 150;
+	if (lru_cache_get(cache, "G", &value)) {
+		printf("Accessed 'G': %d (Unexpected, should have expired)\n", value);
+	} else {
+		printf("Cache Miss for 'G' after 150 ms (Expected)\n");
+	}
+
+	demo_now += 5000;
+	printf("Reclaimed %lu expired entries after 5150 ms\n", lru_cache_expire(cache));
+
+	// Expected order: MRU -> [F, E] -> LRU
+	lru_cache_print(cache);
+
+	// 8. Destroy cache
+	lru_cache_destroy(cache);
+
+	// 9. Weighted capacity: bounded by total cost instead of item count
+	printf("\n--- Phase 7: Weighted capacity (budget 1000 bytes) ---\n");
+	cache = lru_cache_create_weighted(1000, BUCKET_SIZE);
+	if (!cache) {
+		fprintf(stderr, "Failed to create weighted LRU cache\n");
+		return 1;
+	}
+
+	lru_cache_put_weighted(cache, "small", 1, 100);
+	lru_cache_put_weighted(cache, "medium", 2, 300);
+	lru_cache_put_weighted(cache, "large", 3, 500);
+	lru_cache_print(cache);
+
+	printf("Inserting 'big' (cost 450): 'small' and 'medium' should be evicted\n");
+	lru_cache_put_weighted(cache, "big", 4, 450);
+
+	// Expected order: MRU -> [big, large] -> LRU
+	lru_cache_print(cache);
+
+	if (lru_cache_put_weighted(cache, "too_big", 5, 2000) < 0) {
+		printf("Rejected 'too_big' (cost 2000 > budget) (Expected)\n");
+	}
+
+	lru_cache_print_stats(cache, stdout);
 	lru_cache_destroy(cache);
 
 	return 0;
 }
-
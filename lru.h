@@ -2,7 +2,21 @@
 #define LRU_H
 
 #include <stddef.h>
+#include <limits.h>
+#include <time.h>
 #include <hashmap.h>
+#include <timerwheel.h>
+
+struct lru_node;
+
+// lru_cache_t flags, may be set right after lru_cache_create() (before
+// the first put)
+#define LRU_F_HWCACHE_ALIGN 0x1  // Cache line aligned nodes from a slab
+
+// LRU_F_HWCACHE_ALIGN slab: fixed slots (the node and, if it fits, its
+// key), carved from chunks of LRU_SLAB_CHUNK slots
+#define LRU_SLAB_SLOT 128
+#define LRU_SLAB_CHUNK 512
 
 /**
  * Structure representing an LRU (Least Recently Used) cache.
@@ -11,6 +25,14 @@ typedef struct lru_cache {
 	unsigned int capacity;	  // Maximum number of items the cache can store
 	unsigned int count;		 // Current number of items in the cache
 	unsigned int bucket_size;   // Number of hash buckets for O(1) lookup
+	unsigned int flags;		 // LRU_F_*
+
+	// Weighted capacity (see lru_cache_put_weighted()).  max_weight is the
+	// budget (0 = unlimited), weight the sum of the costs of all entries.
+	unsigned long max_weight;
+	unsigned long weight;
+	unsigned long evictions;	  // Entries evicted to make room
+	unsigned long evicted_bytes;  // Sum of the costs of evicted entries
 
 	// Doubly linked list to track usage order.
 	// The most recently used (MRU) item is at lru_head.next.
@@ -19,6 +41,17 @@ typedef struct lru_cache {
 
 	// Hash table buckets for O(1) key lookup (array of hlist_head)
 	struct hlist_head *buckets;
+
+	// TTL expiry (see lru_cache_put_ttl()).  The wheel is allocated on the
+	// first put with a TTL; clock returns the current time in ms and may
+	// be replaced right after lru_cache_create() (e.g. by a fake clock).
+	struct timer_wheel *wheel;
+	unsigned long (*clock)(void);
+
+	// LRU_F_HWCACHE_ALIGN slab: free slots and allocated chunks, both
+	// linked through their first word
+	void *slab_free;
+	void *slab_chunks;
 } lru_cache_t;
 
 /**
@@ -29,12 +62,34 @@ typedef struct lru_cache {
  */
 lru_cache_t* lru_cache_create(unsigned int capacity, unsigned int bucket_size);
 
+/**
+ * Create an LRU cache bounded by the total cost of its entries instead of
+ * their number, e.g. a memory budget in bytes.
+ * @param max_weight  Budget for the sum of the entry costs.
+ * @param bucket_size Size of the internal hash table.
+ * @return Pointer to the newly created LRU cache, or NULL on failure.
+ */
+lru_cache_t* lru_cache_create_weighted(unsigned long max_weight, unsigned int bucket_size);
+
 /**
  * Destroy the LRU cache and free all associated memory.
  * @param cache LRU cache instance to destroy.
  */
 void lru_cache_destroy(lru_cache_t *cache);
 
+/**
+ * Bulk destroy: release every node in one pass over the LRU list without
+ * unlinking them one by one, then free the cache.
+ * @param cache   LRU cache instance to destroy.
+ * @param release Called for every node (e.g. to return it to a pool),
+ *                NULL frees the key and the node.  With
+ *                LRU_F_HWCACHE_ALIGN the nodes belong to the cache's slab
+ *                and must not be freed by release.
+ * @param arg     Passed through to release.
+ */
+void lru_cache_destroy_bulk(lru_cache_t *cache, void (*release)(struct lru_node *, void *),
+			    void *arg);
+
 /**
  * Retrieve a value from the cache.
  * If the key exists, the item is marked as MRU.
@@ -55,6 +110,65 @@ int lru_cache_get(lru_cache_t *cache, const char *key, int *value);
  */
 int lru_cache_put(lru_cache_t *cache, const char *key, int value);
 
+/**
+ * Insert or update a key-value pair that expires after ttl_ms.
+ * Expired entries are misses for lru_cache_get() and are reclaimed by the
+ * timer wheel, without scanning the cache.
+ * @param cache  LRU cache instance.
+ * @param key    Key string.
+ * @param value  Value to store.
+ * @param ttl_ms Time to live in milliseconds, 0 for no expiry.
+ * @return 0 on success, -1 on memory allocation failure.
+ */
+int lru_cache_put_ttl(lru_cache_t *cache, const char *key, int value, unsigned long ttl_ms);
+
+/**
+ * Insert or update a key-value pair that costs @cost against max_weight.
+ * LRU entries are evicted until the new entry fits; lru_cache_put() and
+ * lru_cache_put_ttl() insert with a cost of 0.
+ * @param cache LRU cache instance.
+ * @param key   Key string.
+ * @param value Value to store.
+ * @param cost  Weight of the entry (e.g. its size in bytes).
+ * @return 0 on success, -1 on memory allocation failure or if @cost alone
+ *         exceeds max_weight.
+ */
+int lru_cache_put_weighted(lru_cache_t *cache, const char *key, int value, unsigned long cost);
+
+/**
+ * Insert or update with both a cost and a TTL (0 for no expiry).
+ */
+int lru_cache_put_ex(lru_cache_t *cache, const char *key, int value, unsigned long cost,
+		     unsigned long ttl_ms);
+
+/**
+ * Reclaim every entry whose TTL has run out.  Called by lru_cache_put*(),
+ * call it periodically as well if the cache can sit idle.
+ * @param cache LRU cache instance.
+ * @return Number of reclaimed entries.
+ */
+unsigned long lru_cache_expire(lru_cache_t *cache);
+
+/**
+ * Look up many keys at once, overlapping their cache misses (see
+ * hash_map_get_batch()).  Hits are moved to MRU in key order.
+ * @param cache LRU cache instance.
+ * @param keys  Keys to look up.
+ * @param n     Number of keys.
+ * @param values values[i] receives the value of keys[i] on a hit.
+ * @param found  found[i] is set to 1 on a hit, 0 on a miss.
+ * @return Number of hits.
+ */
+unsigned int lru_cache_get_batch(lru_cache_t *cache, const char *const *keys, unsigned int n,
+				 int *values, int *found);
+
+/**
+ * Insert or update many key-value pairs at once (see lru_cache_put()).
+ * @return 0 on success, -1 if any insertion failed.
+ */
+int lru_cache_put_batch(lru_cache_t *cache, const char *const *keys, const int *values,
+			unsigned int n);
+
 /**
  * Print the current state of the cache (for debugging).
  * Items are printed in MRU -> LRU order.
@@ -62,24 +176,59 @@ int lru_cache_put(lru_cache_t *cache, const char *key, int value);
  */
 void lru_cache_print(lru_cache_t *cache);
 
+/**
+ * Print cache statistics without walking the entries: fill, weight,
+ * evictions, armed TTLs and, with LUDTM_STATS, the operation counters
+ * and latencies (process wide).
+ * @param cache LRU cache instance.
+ * @param fp    Output stream.
+ */
+void lru_cache_print_stats(lru_cache_t *cache, FILE *fp);
+
 // Structure representing an individual node in the cache.
 // Uses intrusive list design for both the hash table and LRU list.
+//
+// Everything a get touches (hash, both linkages, key pointer, value) is in
+// the first 64 bytes, so with LRU_F_HWCACHE_ALIGN a hit costs one line
+// plus the key string.  The TTL timer is cold and starts the second line.
 typedef struct lru_node {
-	char *key;
-	int value;  // Stores integer values (based on hashmap.c example)
+	// --- Hot: first cache line ---
+	unsigned long hash;  // hash_function(key), compared before the key
 
 	// Hash map linkage (via hlist)
 	struct hlist_node h_node;
 
 	// LRU list linkage (via list_head)
 	struct list_head lru_list;
+
+	char *key;
+	int value;  // Stores integer values (based on hashmap.c example)
+	unsigned long weight;  // Cost charged against max_weight
+
+	// --- Cold ---
+	// Expiry timer, armed only for entries with a TTL
+	struct tw_timer ttl;
 } lru_node_t;
 
+_Static_assert(offsetof(lru_node_t, weight) + sizeof(unsigned long) <= L1_CACHE_BYTES,
+	       "lru_node_t: hot fields must fit in the first cache line");
+_Static_assert(sizeof(void *) != 8 || offsetof(lru_node_t, ttl) == L1_CACHE_BYTES,
+	       "lru_node_t: the cold part starts the second cache line on LP64");
+
+/**
+ * Default clock: CLOCK_MONOTONIC in milliseconds.
+ */
+static unsigned long lru_clock_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
 /**
  * Internal helper: Look up a node in the hash map by key.
  */
-static lru_node_t* cache_lookup(lru_cache_t *cache, const char *key) {
-	unsigned long hash = hash_function(key);
+static lru_node_t* cache_lookup_hashed(lru_cache_t *cache, const char *key, unsigned long hash) {
 	unsigned int index = hash % cache->bucket_size;
 
 	struct hlist_head *head = &cache->buckets[index];
@@ -88,17 +237,129 @@ static lru_node_t* cache_lookup(lru_cache_t *cache, const char *key) {
 
 	// Traverse the hlist for this bucket.
 	hlist_for_each_entry(entry, pos, head, h_node) {
-		if (strcmp(entry->key, key) == 0) {
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) {
 			return entry;
 		}
 	}
 	return NULL;
 }
 
+static lru_node_t* cache_lookup(lru_cache_t *cache, const char *key) {
+	return cache_lookup_hashed(cache, key, hash_function(key));
+}
+
 /**
- * Internal helper: Remove a node safely from both lists and free its memory.
+ * Internal helper: Take a slot from the LRU_F_HWCACHE_ALIGN slab.
+ * aligned_alloc() per node would waste about a line per node; a chunk
+ * of slots wastes one slot per LRU_SLAB_CHUNK.
  */
-static void free_node(lru_node_t *node) {
+static void* slab_alloc(lru_cache_t *cache) {
+	void *slot;
+
+	if (!cache->slab_free) {
+		char *chunk = FAULT_INJECT(FAULT_LRU_SLAB) ? NULL :
+			(char*)aligned_alloc(L1_CACHE_BYTES, LRU_SLAB_SLOT * LRU_SLAB_CHUNK);
+
+		if (!chunk) {
+			perror("aligned_alloc slab");
+			return NULL;
+		}
+		// Slot 0 links the chunk, the others go on the free list
+		*(void**)chunk = cache->slab_chunks;
+		cache->slab_chunks = chunk;
+		for (unsigned int i = LRU_SLAB_CHUNK - 1; i > 0; i--) {
+			slot = chunk + i * LRU_SLAB_SLOT;
+			*(void**)slot = cache->slab_free;
+			cache->slab_free = slot;
+		}
+	}
+
+	slot = cache->slab_free;
+	cache->slab_free = *(void**)slot;
+	return slot;
+}
+
+/**
+ * Internal helper: does a key of key_len bytes fit inline in a slab slot?
+ */
+static int key_fits_slot(size_t key_len) {
+	return sizeof(lru_node_t) + key_len + 1 <= LRU_SLAB_SLOT;
+}
+
+/**
+ * Internal helper: is the node's key stored inline in its slab slot?
+ * Only LRU_F_HWCACHE_ALIGN nodes have a slot, and alloc_node() puts the
+ * key there whenever it fits.
+ */
+static int node_key_inline(lru_cache_t *cache, lru_node_t *node) {
+	return (cache->flags & LRU_F_HWCACHE_ALIGN) && key_fits_slot(strlen(node->key));
+}
+
+/**
+ * Internal helper: Allocate a node and a copy of its key (key_len bytes,
+ * NUL added).  With LRU_F_HWCACHE_ALIGN the node starts a cache line and
+ * a short key is stored inline right after it, in the cold line, instead
+ * of in a separate allocation somewhere else on the heap.
+ */
+static lru_node_t* alloc_node(lru_cache_t *cache, const char *key, size_t key_len) {
+	lru_node_t *node;
+
+	if (cache->flags & LRU_F_HWCACHE_ALIGN) {
+		node = (lru_node_t*)slab_alloc(cache);
+		if (!node) return NULL;
+		if (key_fits_slot(key_len)) {
+			node->key = (char*)(node + 1);
+			memcpy(node->key, key, key_len);
+			node->key[key_len] = '\0';
+			return node;
+		}
+	} else {
+		node = FAULT_INJECT(FAULT_LRU_NODE) ? NULL : (lru_node_t*)malloc(sizeof(lru_node_t));
+		if (!node) {
+			perror("malloc lru_node_t");
+			return NULL;
+		}
+	}
+
+	node->key = FAULT_INJECT(FAULT_LRU_KEY) ? NULL : strndup(key, key_len);
+	if (!node->key) {
+		perror("strdup key");
+		if (cache->flags & LRU_F_HWCACHE_ALIGN) {
+			*(void**)node = cache->slab_free;
+			cache->slab_free = node;
+		} else {
+			free(node);
+		}
+		return NULL;
+	}
+	return node;
+}
+
+/**
+ * Internal helper: Free a node allocated by alloc_node().
+ */
+static void release_node(lru_cache_t *cache, lru_node_t *node) {
+	if (!node_key_inline(cache, node)) {
+		free(node->key);
+	}
+	if (cache->flags & LRU_F_HWCACHE_ALIGN) {
+		*(void**)node = cache->slab_free;
+		cache->slab_free = node;
+	} else {
+		free(node);
+	}
+}
+
+/**
+ * Internal helper: Remove a node safely from both lists, uncharge it from
+ * the cache and free its memory.
+ */
+static void free_node(lru_cache_t *cache, lru_node_t *node) {
+	// 0. Cancel its expiry timer (if armed)
+	if (cache->wheel) {
+		tw_del(cache->wheel, &node->ttl);
+	}
+
 	// 1. Remove from hash map (if linked)
 	if (node->h_node.pprev) {
 		 hlist_del(&node->h_node);
@@ -109,9 +370,25 @@ static void free_node(lru_node_t *node) {
 		list_del(&node->lru_list);
 	}
 
-	// 3. Free memory
-	free(node->key);
-	free(node);
+	// 3. Uncharge and free memory
+	cache->count--;
+	cache->weight -= node->weight;
+	release_node(cache, node);
+}
+
+/**
+ * Internal helper: Evict the LRU entry.
+ */
+static void evict_node(lru_cache_t *cache) {
+	// The LRU node is at the tail (lru_head.prev)
+	lru_node_t *lru_node = list_entry(cache->lru_head.prev, lru_node_t, lru_list);
+	STAT_LATENCY_BEGIN(t);
+
+	cache->evictions++;
+	cache->evicted_bytes += lru_node->weight;
+	free_node(cache, lru_node);
+	STAT_INC(STAT_LRU_EVICT);
+	STAT_LATENCY_END(STAT_LAT_LRU_EVICT, t);
 }
 
 /*
@@ -141,7 +418,16 @@ lru_cache_t* lru_cache_create(unsigned int capacity, unsigned int bucket_size) {
 	// 3. Initialize attributes
 	cache->capacity = capacity;
 	cache->bucket_size = bucket_size;
+	cache->flags = 0;
 	cache->count = 0;
+	cache->max_weight = 0;
+	cache->weight = 0;
+	cache->evictions = 0;
+	cache->evicted_bytes = 0;
+	cache->wheel = NULL;
+	cache->clock = lru_clock_ms;
+	cache->slab_free = NULL;
+	cache->slab_chunks = NULL;
 
 	// 4. Initialize LRU list head
 	INIT_LIST_HEAD(&cache->lru_head);
@@ -154,23 +440,91 @@ lru_cache_t* lru_cache_create(unsigned int capacity, unsigned int bucket_size) {
 	return cache;
 }
 
-void lru_cache_destroy(lru_cache_t *cache) {
+lru_cache_t* lru_cache_create_weighted(unsigned long max_weight, unsigned int bucket_size) {
+	if (max_weight == 0) return NULL;
+
+	lru_cache_t *cache = lru_cache_create(UINT_MAX, bucket_size);
+	if (cache) {
+		cache->max_weight = max_weight;
+	}
+	return cache;
+}
+
+void lru_cache_destroy_bulk(lru_cache_t *cache, void (*release)(struct lru_node *, void *),
+			    void *arg) {
 	if (!cache) return;
 
 	lru_node_t *entry, *tmp;
 
-	// Use the safe iteration macro since nodes are freed during traversal.
+	// Every node goes away, so neither the hash chains nor the LRU list
+	// need to be kept consistent: no hlist_del/list_del per node.
 	list_for_each_entry_safe(entry, tmp, &cache->lru_head, lru_list) {
-		free_node(entry);
+		prefetch(tmp);
+		if (release) {
+			release(entry, arg);
+		} else if (cache->flags & LRU_F_HWCACHE_ALIGN) {
+			// The node itself goes away with its slab chunk
+			if (!node_key_inline(cache, entry)) {
+				free(entry->key);
+			}
+		} else {
+			free(entry->key);
+			free(entry);
+		}
+	}
+
+	// Slab nodes go away with their chunks
+	while (cache->slab_chunks) {
+		void *chunk = cache->slab_chunks;
+
+		cache->slab_chunks = *(void**)chunk;
+		free(chunk);
 	}
 
+	free(cache->wheel);
 	free(cache->buckets);
 	free(cache);
 }
 
-int lru_cache_get(lru_cache_t *cache, const char *key, int *value) {
-	// 1. Lookup the key in the hash map
-	lru_node_t *node = cache_lookup(cache, key);
+void lru_cache_destroy(lru_cache_t *cache) {
+	lru_cache_destroy_bulk(cache, NULL, NULL);
+}
+
+/**
+ * Internal helper: has the node's TTL run out?
+ */
+static int node_expired(lru_cache_t *cache, lru_node_t *node) {
+	return tw_timer_pending(&node->ttl) &&
+		   tw_time_after_eq(cache->clock(), node->ttl.expires);
+}
+
+/**
+ * Internal helper: timer wheel callback for an expired entry.
+ */
+static void expire_node(struct tw_timer *timer, void *arg) {
+	lru_cache_t *cache = arg;
+	lru_node_t *node = container_of(timer, lru_node_t, ttl);
+
+	free_node(cache, node);
+	STAT_INC(STAT_LRU_EXPIRE);
+}
+
+unsigned long lru_cache_expire(lru_cache_t *cache) {
+	if (!cache->wheel) return 0;
+
+	return tw_advance(cache->wheel, cache->clock(), expire_node, cache);
+}
+
+/**
+ * Internal helper: the part of lru_cache_get() after the hash lookup.
+ */
+static int cache_get_node(lru_cache_t *cache, lru_node_t *node, int *value) {
+	// Expired but not reclaimed yet: reclaim it now and report a miss
+	if (node && node_expired(cache, node)) {
+		free_node(cache, node);
+		STAT_INC(STAT_LRU_EXPIRE);
+		node = NULL;
+	}
 
 	if (node) {
 		// Cache hit: Move node to MRU position
@@ -178,57 +532,158 @@ int lru_cache_get(lru_cache_t *cache, const char *key, int *value) {
 
 		// Return the stored value
 		*value = node->value;
+		STAT_INC(STAT_LRU_GET_HIT);
 		return 1;
 	}
 
 	// Cache miss
+	STAT_INC(STAT_LRU_GET_MISS);
 	return 0;
 }
 
-int lru_cache_put(lru_cache_t *cache, const char *key, int value) {
+/**
+ * Internal helper: (re)arm or cancel the expiry timer of a node.
+ */
+static int set_ttl(lru_cache_t *cache, lru_node_t *node, unsigned long ttl_ms) {
+	if (!ttl_ms) {
+		if (cache->wheel) {
+			tw_del(cache->wheel, &node->ttl);
+		}
+		return 0;
+	}
+
+	if (!cache->wheel) {
+		cache->wheel = FAULT_INJECT(FAULT_LRU_WHEEL) ? NULL :
+			(struct timer_wheel*)malloc(sizeof(struct timer_wheel));
+		if (!cache->wheel) {
+			perror("malloc timer_wheel");
+			return -1;
+		}
+		tw_init(cache->wheel, cache->clock());
+	}
+
+	tw_add(cache->wheel, &node->ttl, cache->clock() + ttl_ms);
+	return 0;
+}
+
+/**
+ * Internal helper: would charging @cost more overflow the weight budget?
+ */
+static int over_weight(lru_cache_t *cache, unsigned long cost) {
+	return cache->max_weight && cache->weight + cost > cache->max_weight;
+}
+
+int lru_cache_get(lru_cache_t *cache, const char *key, int *value) {
+	STAT_LATENCY_BEGIN(t);
+
+	// 1. Lookup the key in the hash map
+	int hit = cache_get_node(cache, cache_lookup(cache, key), value);
+
+	STAT_LATENCY_END(STAT_LAT_LRU_GET, t);
+	return hit;
+}
+
+unsigned int lru_cache_get_batch(lru_cache_t *cache, const char *const *keys, unsigned int n,
+				 int *values, int *found) {
+	unsigned long hash[HASH_MAP_BATCH];
+	struct hlist_node *first[HASH_MAP_BATCH];
+	unsigned int hits = 0;
+
+	for (unsigned int base = 0; base < n; base += HASH_MAP_BATCH) {
+		unsigned int group = n - base < HASH_MAP_BATCH ? n - base : HASH_MAP_BATCH;
+		unsigned int i;
+
+		// Stage 1: hash, prefetch the bucket heads
+		for (i = 0; i < group; i++) {
+			hash[i] = hash_function(keys[base + i]);
+			prefetch(&cache->buckets[hash[i] % cache->bucket_size]);
+		}
+
+		// Stage 2: prefetch the first node of each chain
+		for (i = 0; i < group; i++) {
+			first[i] = cache->buckets[hash[i] % cache->bucket_size].first;
+			if (first[i]) {
+				prefetch(hlist_entry(first[i], lru_node_t, h_node));
+			}
+		}
+
+		// Stage 3: prefetch the key string of each first node
+		for (i = 0; i < group; i++) {
+			if (first[i]) {
+				prefetch(hlist_entry(first[i], lru_node_t, h_node)->key);
+			}
+		}
+
+		// Stage 4: compare and promote
+		for (i = 0; i < group; i++) {
+			lru_node_t *node = cache_lookup_hashed(cache, keys[base + i], hash[i]);
+
+			found[base + i] = cache_get_node(cache, node, &values[base + i]);
+			hits += found[base + i];
+		}
+	}
+
+	return hits;
+}
+
+/**
+ * Internal helper: lru_cache_put_ex() with the key already hashed.
+ */
+static int cache_put_hashed(lru_cache_t *cache, const char *key, unsigned long hash, int value,
+			    unsigned long cost, unsigned long ttl_ms) {
+	// Can never fit, even in an empty cache
+	if (cache->max_weight && cost > cache->max_weight) return -1;
+
+	STAT_INC(STAT_LRU_PUT);
+
+	// 0. Reclaim expired entries first, so they go before live LRU entries
+	lru_cache_expire(cache);
+
 	// 1. Check if the key already exists
-	lru_node_t *node = cache_lookup(cache, key);
+	lru_node_t *node = cache_lookup_hashed(cache, key, hash);
 
 	if (node) {
-		// Key exists: Update value and move to MRU
+		// Key exists: Update value, cost and TTL, and move to MRU
 		node->value = value;
 		list_move(&node->lru_list, &cache->lru_head);
-		return 0;
+
+		cache->weight -= node->weight;
+		node->weight = cost;
+		cache->weight += cost;
+		// Shrink from the LRU end; the node itself sits at the MRU end
+		while (over_weight(cache, 0) && cache->lru_head.prev != &node->lru_list) {
+			evict_node(cache);
+		}
+		return set_ttl(cache, node, ttl_ms);
 	}
 
 	// 2. Insert a new entry
 
-	// 2.1. Evict LRU if capacity exceeded
-	if (cache->count >= cache->capacity) {
-		// The LRU node is at the tail (lru_head.prev)
-		lru_node_t *lru_node = list_entry(cache->lru_head.prev, lru_node_t, lru_list);
-
-		// Remove and free the LRU node
-		free_node(lru_node);
-		cache->count--;
+	// 2.1. Evict LRU entries until the new one fits
+	while (!list_empty(&cache->lru_head) &&
+		   (cache->count >= cache->capacity || over_weight(cache, cost))) {
+		evict_node(cache);
 	}
 
 	// 2.2. Allocate a new node
-	lru_node_t *new_node = (lru_node_t*)malloc(sizeof(lru_node_t));
-	if (!new_node) {
-		perror("malloc lru_node_t");
-		return -1;
-	}
+	lru_node_t *new_node = alloc_node(cache, key, strlen(key));
+	if (!new_node) return -1;
 
-	new_node->key = strdup(key);
-	if (!new_node->key) {
-		perror("strdup key");
-		free(new_node);
-		return -1;
-	}
+	new_node->hash = hash;
 	new_node->value = value;
+	new_node->weight = cost;
 
 	// Initialize list nodes
 	INIT_HLIST_NODE(&new_node->h_node);
 	INIT_LIST_HEAD(&new_node->lru_list);
+	tw_timer_init(&new_node->ttl);
+
+	if (set_ttl(cache, new_node, ttl_ms) < 0) {
+		release_node(cache, new_node);
+		return -1;
+	}
 
 	// 2.3. Insert into hash table
-	unsigned long hash = hash_function(key);
 	unsigned int index = hash % cache->bucket_size;
 	hlist_add_head(&new_node->h_node, &cache->buckets[index]);
 
@@ -236,14 +691,73 @@ int lru_cache_put(lru_cache_t *cache, const char *key, int value) {
 	list_add(&new_node->lru_list, &cache->lru_head);
 
 	cache->count++;
+	cache->weight += cost;
 
 	return 0;
 }
 
+int lru_cache_put(lru_cache_t *cache, const char *key, int value) {
+	return lru_cache_put_ex(cache, key, value, 0, 0);
+}
+
+int lru_cache_put_ttl(lru_cache_t *cache, const char *key, int value, unsigned long ttl_ms) {
+	return lru_cache_put_ex(cache, key, value, 0, ttl_ms);
+}
+
+int lru_cache_put_weighted(lru_cache_t *cache, const char *key, int value, unsigned long cost) {
+	return lru_cache_put_ex(cache, key, value, cost, 0);
+}
+
+int lru_cache_put_ex(lru_cache_t *cache, const char *key, int value, unsigned long cost,
+		     unsigned long ttl_ms) {
+	STAT_LATENCY_BEGIN(t);
+	int ret = cache_put_hashed(cache, key, hash_function(key), value, cost, ttl_ms);
+
+	STAT_LATENCY_END(STAT_LAT_LRU_PUT, t);
+	return ret;
+}
+
+int lru_cache_put_batch(lru_cache_t *cache, const char *const *keys, const int *values,
+			unsigned int n) {
+	unsigned long hash[HASH_MAP_BATCH];
+	int ret = 0;
+
+	for (unsigned int base = 0; base < n; base += HASH_MAP_BATCH) {
+		unsigned int group = n - base < HASH_MAP_BATCH ? n - base : HASH_MAP_BATCH;
+		unsigned int i;
+
+		for (i = 0; i < group; i++) {
+			hash[i] = hash_function(keys[base + i]);
+			prefetch(&cache->buckets[hash[i] % cache->bucket_size]);
+		}
+
+		for (i = 0; i < group; i++) {
+			struct hlist_node *first = cache->buckets[hash[i] % cache->bucket_size].first;
+
+			if (first) {
+				prefetch(hlist_entry(first, lru_node_t, h_node));
+			}
+		}
+
+		for (i = 0; i < group; i++) {
+			if (cache_put_hashed(cache, keys[base + i], hash[i], values[base + i], 0, 0) < 0) {
+				ret = -1;
+			}
+		}
+	}
+
+	return ret;
+}
+
 void lru_cache_print(lru_cache_t *cache) {
 	if (!cache) return;
 
-	printf("\n--- LRU Cache State (Count: %u / Capacity: %u) ---\n", cache->count, cache->capacity);
+	if (cache->max_weight) {
+		printf("\n--- LRU Cache State (Count: %u, Weight: %lu / %lu, Evicted: %lu entries / %lu) ---\n",
+			   cache->count, cache->weight, cache->max_weight, cache->evictions, cache->evicted_bytes);
+	} else {
+		printf("\n--- LRU Cache State (Count: %u / Capacity: %u) ---\n", cache->count, cache->capacity);
+	}
 	printf("MRU -> ");
 
 	lru_node_t *entry;
@@ -256,5 +770,18 @@ void lru_cache_print(lru_cache_t *cache) {
 	printf("-----------------------------------------------------\n\n");
 }
 
+void lru_cache_print_stats(lru_cache_t *cache, FILE *fp) {
+	if (!cache) return;
+
+	fprintf(fp, "\n--- LRU Cache Stats (Count: %u / Capacity: %u, Buckets: %u) ---\n",
+		cache->count, cache->capacity, cache->bucket_size);
+	fprintf(fp, "load factor: %.2f, weight: %lu / %lu\n",
+		(double)cache->count / cache->bucket_size, cache->weight, cache->max_weight);
+	fprintf(fp, "evicted: %lu entries / %lu, TTLs armed: %lu\n",
+		cache->evictions, cache->evicted_bytes, cache->wheel ? cache->wheel->pending : 0UL);
+	stats_dump(fp);
+	fprintf(fp, "-----------------------------------------------------\n\n");
+}
+
 #endif /* LRU_H */
 
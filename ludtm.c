@@ -1,3 +1,6 @@
+#define _GNU_SOURCE
+
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -20,8 +23,24 @@
 #include <unistd.h>
 #include <threads.h>
 #include <stdatomic.h>
+#include <limits.h>
+#include <glob.h>
 
 #include "list.h"
+#include "crash.h"
+#include "minidump.h"
+#include "coresink.h"
+#include "coreinfo.h"
+#include "hashmap.h"
+#include "snapshot.h"
+#include "ptsnap.h"
+
+#ifdef LUDTM_FAULT
+#include <malloc.h>
+
+#include "lru.h"
+#include "btree.h"
+#endif
 
 struct a_list
 {
@@ -32,10 +51,14 @@ struct a_list
 
 #define CORE_PATH "/var/crash"
 #define ULIMIT_CORE "ulimit -c unlimited"
-#define CMD "LD_SHOW_AUXV=1 LD_PRELOAD=/lib/aarch64-linux-gnu/libSegFault.so ./ludtm"
+#define CMD "LD_SHOW_AUXV=1 ./ludtm"
 
 #define __HELP "--help"
 #define __H "-h"
+#define __BATCH "--batch"
+#define __CORE_SINK "--core-sink"
+#define __ANALYZE "analyze"
+#define __PTRACE "--ptrace"
 
 #define CMD_SIZE 512
 #define PARAM_SIZE 128
@@ -50,18 +73,7 @@ static char devcourse_mailing_list[] =
 	"Paran Lee <p4ranlee@gmail.com>";
 
 void do_func(char[]);
-
-#define SEGFAULT "segfault"
-#define NULL_DEREFERENCE "null_dereference"
-#define WRITE_WEIRED_AREA "write_weired_area"
-#define STACK_CORRUPTION "stack_corruption"
-#define STACK_OVERFLOW_RECURSIVE "stack_overflow_recursive"
-#define STACK_OVERFLOW_OVERSIZE "stack_overflow_oversize"
-#define HEAP_OVERFLOW "heap_overflow"
-#define MEM_LEAK "mem_leak"
-#define DOUBLE_FREE "double_free"
-#define LIST_CONCURRENCY "list_concurrency"
-#define WRONG_FUNTION_POINTER "wrong_funtion_pointer"
+int make_coredump(char buf[]);
 
 void segfault();
 void null_dereference();
@@ -74,58 +86,116 @@ void mem_leak();
 void double_free();
 void list_concurrency();
 void wrong_funtion_pointer();
+#ifdef LUDTM_FAULT
+void fault_hashmap();
+void fault_lru();
+void fault_btree();
+#endif
 
 #define BIG_NUM 16384 * 2
 
-void make_coredump(char buf[])
+/*
+ * Scenario registry: everything ludtm can do is one line here.  Dispatch,
+ * --help and "--batch all" are all generated from this table, so a new
+ * scenario is a function plus an entry.  Entries may be in any order; the
+ * table is sorted once on first lookup and searched with bsearch().
+ */
+struct scenario
 {
-	printf("Do %s\n", buf);
-	if (CMP(SEGFAULT, buf))
-	{
-		segfault();
-	}
-	else if (CMP(NULL_DEREFERENCE, buf))
-	{
-		null_dereference();
-	}
-	else if (CMP(WRITE_WEIRED_AREA, buf))
-	{
-		write_weired_area();
-	}
-	else if (CMP(STACK_CORRUPTION, buf))
-	{
-		stack_corruption();
-	}
-	else if (CMP(STACK_OVERFLOW_RECURSIVE, buf))
-	{
-		stack_overflow_recursive();
-	}
-	else if (CMP(STACK_OVERFLOW_OVERSIZE, buf))
-	{
-		stack_overflow_oversize();
-	}
-	else if (CMP(HEAP_OVERFLOW, buf))
-	{
-		heap_overflow();
-	}
-	else if (CMP(MEM_LEAK, buf))
-	{
-		mem_leak();
-	}
-	else if (CMP(DOUBLE_FREE, buf))
-	{
-		double_free();
-	}
-	else if (CMP(LIST_CONCURRENCY, buf))
+	const char *name;
+	void (*fn)(void);
+	int expected_signal;	/* 0: expected to exit normally */
+	const char *desc;
+};
+
+#define SCENARIO(fn, sig, desc) { #fn, fn, sig, desc }
+
+static struct scenario scenarios[] =
+{
+	SCENARIO(segfault, SIGSEGV, "write through a small integer cast to a pointer"),
+	SCENARIO(null_dereference, SIGSEGV, "write fields of a NULL struct pointer"),
+	SCENARIO(write_weired_area, SIGSEGV, "write 16 GiB past a malloc(0) block"),
+	SCENARIO(stack_corruption, SIGSEGV, "memset far past a local variable"),
+	SCENARIO(stack_overflow_recursive, SIGSEGV, "unbounded recursion"),
+	SCENARIO(stack_overflow_oversize, SIGSEGV, "1 GiB of local arrays"),
+	SCENARIO(heap_overflow, SIGSEGV, "memset far past a heap block"),
+	SCENARIO(mem_leak, SIGSEGV, "malloc without free until malloc fails, then use its NULL"),
+	SCENARIO(double_free, SIGABRT, "free the same block twice"),
+	SCENARIO(list_concurrency, SIGSEGV, "two threads mutate one list without a lock"),
+	SCENARIO(wrong_funtion_pointer, 0, "call through a function pointer"),
+#ifdef LUDTM_FAULT
+	SCENARIO(fault_hashmap, 0, "hash_map workload with failing allocations, checked"),
+	SCENARIO(fault_lru, 0, "lru_cache_t workload with failing allocations, checked"),
+	SCENARIO(fault_btree, 0, "binary tree workload with failing allocations, checked"),
+#endif
+};
+
+#define NR_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static int scenario_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct scenario *)a)->name, ((const struct scenario *)b)->name);
+}
+
+static void scenarios_sort(void)
+{
+	static int sorted;
+
+	if (sorted)
+		return;
+	qsort(scenarios, NR_SCENARIOS, sizeof(scenarios[0]), scenario_cmp);
+	for (size_t i = 1; i < NR_SCENARIOS; i++)
 	{
-		list_concurrency();
+		if (scenario_cmp(&scenarios[i - 1], &scenarios[i]) == 0)
+			fprintf(stderr, "ludtm: scenario '%s' registered twice\n", scenarios[i].name);
 	}
-	else if (CMP(WRONG_FUNTION_POINTER, buf))
+	sorted = 1;
+}
+
+/*
+ * Look up a scenario by exact name, NULL if there is none
+ */
+const struct scenario *scenario_find(const char *name)
+{
+	struct scenario key = { .name = name };
+
+	scenarios_sort();
+	return bsearch(&key, scenarios, NR_SCENARIOS, sizeof(scenarios[0]), scenario_cmp);
+}
+
+static const char *signal_name(int sig, char *buf, size_t size)
+{
+	if (!sig)
+		snprintf(buf, size, "exit");
+	else
+		snprintf(buf, size, "SIG%s", sigabbrev_np(sig));
+	return buf;
+}
+
+void scenarios_print(FILE *fp)
+{
+	char sig[16];
+
+	scenarios_sort();
+	for (size_t i = 0; i < NR_SCENARIOS; i++)
 	{
-		wrong_funtion_pointer();
+		fprintf(fp, " echo %-26s | ./ludtm   %-8s %s\n", scenarios[i].name,
+			signal_name(scenarios[i].expected_signal, sig, sizeof(sig)), scenarios[i].desc);
 	}
 }
 
+int make_coredump(char buf[])
+{
+	const struct scenario *s;
+
+	printf("Do %s\n", buf);
+	s = scenario_find(buf);
+	if (!s)
+		return -1;
+	s->fn();
+	return 0;
+}
+
 void segfault()
 {
 	int *a = (int *) 1;
@@ -364,6 +434,416 @@ void wrong_funtion_pointer()
 	(*fun_ptr)(10);
 }
 
+#ifdef LUDTM_FAULT
+/*
+ * Fault injection (fault.h, make FAULT=1): the workloads of ./bench on
+ * hash_map, lru_cache_t and the binary tree, with their allocations
+ * failing by a list of policies.  After every operation and at the end
+ * the structure is checked against a shadow copy; a failed insert must
+ * leave it as it was.  The heap must be back where it started once the
+ * structure is destroyed, and every policy must have injected at least
+ * one failure.  Any violation aborts, so --batch reports it.
+ *
+ * LUDTM_FAULT=POLICY (see fault_parse_policy()) replaces the list.
+ */
+
+#define FAULT_KEYS 4096
+#define FAULT_OPS 200000
+#define FAULT_LRU_CAPACITY (FAULT_KEYS / 4)
+#define FAULT_LRU_TTL_MS (3600 * 1000)
+
+struct fault_result
+{
+	unsigned long failed;	/* Operations that returned an error */
+	long wasted;			/* Evictions for a put that then failed, -1: n/a */
+};
+
+static char fault_keys[FAULT_KEYS][16];
+static uint64_t fault_rng;
+static int fault_stderr = -1;
+
+static double elapsed_ms(const struct timespec *start);
+
+/*
+ * Heap bytes in use.  mallinfo2() counts the chunks cached in the tcache
+ * as in use, and how many there are depends on the last operations; fill
+ * every tcache bin first so that two measurements compare.
+ */
+static unsigned long fault_heap_in_use(void)
+{
+	struct mallinfo2 mi;
+	void *p[16];
+
+	for (size_t size = 24; size <= 1032; size += 16)
+	{
+		for (int i = 0; i < 16; i++)
+			p[i] = malloc(size);
+		for (int i = 0; i < 16; i++)
+			free(p[i]);
+	}
+	mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+}
+
+/*
+ * Workload generator, seeded per run so that every policy sees the same
+ * operations; separate from fault.h's own generator
+ */
+static unsigned int fault_next(void)
+{
+	fault_rng ^= fault_rng << 13;
+	fault_rng ^= fault_rng >> 7;
+	fault_rng ^= fault_rng << 17;
+	return fault_rng >> 32;
+}
+
+static unsigned long fault_injected_total(void)
+{
+	unsigned long n = 0;
+
+	for (int i = 0; i < FAULT_NR_SITES; i++)
+		n += fault_injected(i);
+	return n;
+}
+
+static void fault_violation(const char *what, int line)
+{
+	if (fault_stderr >= 0)
+		dup2(fault_stderr, STDERR_FILENO);
+	fprintf(stderr, "ludtm.c:%d: fault injection broke an invariant: %s\n", line, what);
+	fault_print_stats(stderr);
+	abort();
+}
+
+#define FAULT_CHECK(cond) \
+	do { if (!(cond)) fault_violation(#cond, __LINE__); } while (0)
+
+/*
+ * hash_map: 60% inserts, 20% lookups, 20% deletes of random keys
+ */
+static struct fault_result fault_run_hashmap(const struct fault_policy *policy)
+{
+	struct fault_result res = { 0, -1 };
+	static int shadow[FAULT_KEYS];
+	struct hash_map *map = hash_map_create(FAULT_KEYS / 4);
+	unsigned long present = 0, walked = 0;
+	int value;
+
+	FAULT_CHECK(map != NULL);
+	for (int i = 0; i < FAULT_KEYS; i++)
+		shadow[i] = -1;
+
+	fault_arm(policy);
+	for (int op = 0; op < FAULT_OPS; op++)
+	{
+		unsigned int r = fault_next(), k = r % FAULT_KEYS, kind = (r >> 16) % 10;
+
+		if (kind < 6)
+		{
+			if (hash_map_insert(map, fault_keys[k], op) == 0)
+			{
+				present += shadow[k] < 0;
+				shadow[k] = op;
+			}
+			else
+			{
+				res.failed++;
+				FAULT_CHECK(shadow[k] < 0 && !hash_map_get(map, fault_keys[k], &value));
+			}
+		}
+		else if (kind < 8)
+		{
+			FAULT_CHECK(hash_map_get(map, fault_keys[k], &value) == (shadow[k] >= 0));
+			FAULT_CHECK(shadow[k] < 0 || value == shadow[k]);
+		}
+		else
+		{
+			hash_map_delete(map, fault_keys[k]);
+			present -= shadow[k] >= 0;
+			shadow[k] = -1;
+		}
+	}
+	fault_disarm();
+
+	FAULT_CHECK(map->count == present);
+	for (unsigned int i = 0; i < map->size; i++)
+	{
+		struct hlist_node *pos;
+		struct hash_node *entry;
+
+		hlist_for_each_entry(entry, pos, &map->buckets[i], h_node)
+		{
+			FAULT_CHECK(entry->hash % map->size == i);
+			FAULT_CHECK(entry->value == shadow[atoi(entry->key + 4)]);
+			walked++;
+		}
+	}
+	FAULT_CHECK(walked == present);
+	hash_map_destroy_bulk(map, NULL, NULL);
+	return res;
+}
+
+/*
+ * lru_cache_t, a cache for a quarter of the keys: a get, and a put on a
+ * miss.  @flags and @ttl_ms select the mode.
+ */
+static struct fault_result fault_run_lru(const struct fault_policy *policy, unsigned int flags,
+					 unsigned long ttl_ms)
+{
+	struct fault_result res = { 0, 0 };
+	static int shadow[FAULT_KEYS];
+	lru_cache_t *cache = lru_cache_create(FAULT_LRU_CAPACITY, FAULT_LRU_CAPACITY);
+	unsigned long listed = 0, hashed = 0;
+	lru_node_t *node;
+	int value;
+
+	FAULT_CHECK(cache != NULL);
+	cache->flags = flags;
+
+	fault_arm(policy);
+	for (int op = 0; op < FAULT_OPS; op++)
+	{
+		unsigned int r = fault_next(), k = r % FAULT_KEYS;
+		unsigned long evictions;
+
+		if (lru_cache_get(cache, fault_keys[k], &value))
+		{
+			FAULT_CHECK(value == shadow[k]);
+			continue;
+		}
+
+		evictions = cache->evictions;
+		if (lru_cache_put_ttl(cache, fault_keys[k], op, ttl_ms) == 0)
+		{
+			shadow[k] = op;
+			FAULT_CHECK(lru_cache_get(cache, fault_keys[k], &value) && value == op);
+		}
+		else
+		{
+			res.failed++;
+			res.wasted += cache->evictions - evictions;
+			FAULT_CHECK(cache_lookup(cache, fault_keys[k]) == NULL);
+		}
+		FAULT_CHECK(cache->count <= cache->capacity);
+	}
+	fault_disarm();
+
+	list_for_each_entry(node, &cache->lru_head, lru_list)
+	{
+		FAULT_CHECK(cache_lookup(cache, node->key) == node);
+		FAULT_CHECK(node->value == shadow[atoi(node->key + 4)]);
+		listed++;
+	}
+	for (unsigned int i = 0; i < cache->bucket_size; i++)
+	{
+		struct hlist_node *pos;
+
+		hlist_for_each_entry(node, pos, &cache->buckets[i], h_node)
+			hashed++;
+	}
+	FAULT_CHECK(listed == cache->count && hashed == cache->count);
+	lru_cache_destroy(cache);
+	return res;
+}
+
+static struct fault_result fault_run_lru_plain(const struct fault_policy *policy)
+{
+	return fault_run_lru(policy, 0, 0);
+}
+
+static struct fault_result fault_run_lru_aligned(const struct fault_policy *policy)
+{
+	return fault_run_lru(policy, LRU_F_HWCACHE_ALIGN, 0);
+}
+
+static struct fault_result fault_run_lru_ttl(const struct fault_policy *policy)
+{
+	return fault_run_lru(policy, 0, FAULT_LRU_TTL_MS);
+}
+
+static int fault_bt_count(struct bt_node *node)
+{
+	return node ? 1 + fault_bt_count(node->left) + fault_bt_count(node->right) : 0;
+}
+
+/*
+ * Binary tree: 60% inserts, 20% searches, 20% deletes of random keys.
+ * bt_insert() returns nothing: a key that is missing afterwards must
+ * have had its node allocation failed.
+ */
+static struct fault_result fault_run_btree(const struct fault_policy *policy)
+{
+	struct fault_result res = { 0, -1 };
+	static char shadow[FAULT_KEYS];
+	struct bt_root root = BT_ROOT;
+	int present = 0;
+
+	memset(shadow, 0, sizeof(shadow));
+	fault_arm(policy);
+	for (int op = 0; op < FAULT_OPS; op++)
+	{
+		unsigned int r = fault_next(), k = r % FAULT_KEYS, kind = (r >> 16) % 10;
+		unsigned long injected = fault_injected(FAULT_BT_NODE);
+
+		if (kind < 6)
+		{
+			bt_insert(&root, k);
+			if (bt_search(root.node, k))
+			{
+				present += !shadow[k];
+				shadow[k] = 1;
+			}
+			else
+			{
+				res.failed++;
+				FAULT_CHECK(!shadow[k] && fault_injected(FAULT_BT_NODE) == injected + 1);
+			}
+		}
+		else if (kind < 8)
+		{
+			FAULT_CHECK(!bt_search(root.node, k) == !shadow[k]);
+		}
+		else
+		{
+			root.node = bt_delete(root.node, k);
+			present -= shadow[k];
+			shadow[k] = 0;
+		}
+	}
+	fault_disarm();
+
+	FAULT_CHECK(bt_is_bst(root.node));
+	FAULT_CHECK(fault_bt_count(root.node) == present);
+	bt_destroy(&root, NULL, NULL);
+	return res;
+}
+
+/*
+ * Run @run once without failures, then once per policy, and print a row
+ * for each.  A slower row than the baseline is a cliff in an error path.
+ */
+static void fault_drive(const char *title, struct fault_result (*run)(const struct fault_policy *),
+			const char *const *specs, size_t nspecs)
+{
+	const char *env = getenv("LUDTM_FAULT");
+	double base_ms = 0;
+
+	if (env)
+	{
+		specs = &env;
+		nspecs = 1;
+	}
+	for (int i = 0; i < FAULT_KEYS; i++)
+		snprintf(fault_keys[i], sizeof(fault_keys[i]), "key:%d", i);
+
+	printf("%s, %d ops on %d keys\n", title, FAULT_OPS, FAULT_KEYS);
+	printf("  %-24s %9s %9s %9s %9s %8s %8s\n", "policy", "injected", "failed", "wasted",
+	       "ms", "x base", "leaked");
+	fflush(stdout);
+	for (size_t i = 0; i <= nspecs; i++)
+	{
+		struct fault_policy policy = FAULT_POLICY_NONE;
+		struct fault_result res;
+		struct timespec start;
+		unsigned long heap;
+		double ms;
+		long leaked;
+		int null_fd;
+
+		if (i && fault_parse_policy(specs[i - 1], &policy) < 0)
+			continue;
+
+		// Every injected failure perrors; keep them off the terminal
+		fflush(stderr);
+		fault_stderr = dup(STDERR_FILENO);
+		null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0)
+		{
+			dup2(null_fd, STDERR_FILENO);
+			close(null_fd);
+		}
+
+		fault_rng = 0x9e3779b97f4a7c15ull;
+		heap = fault_heap_in_use();
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		res = run(&policy);
+		ms = elapsed_ms(&start);
+		leaked = fault_heap_in_use() - heap;
+
+		if (fault_stderr >= 0)
+		{
+			dup2(fault_stderr, STDERR_FILENO);
+			close(fault_stderr);
+			fault_stderr = -1;
+		}
+		if (!i)
+			base_ms = ms;
+
+		printf("  %-24s %9lu %9lu ", i ? specs[i - 1] : "none", fault_injected_total(), res.failed);
+		if (res.wasted < 0)
+			printf("%9s", "-");
+		else
+			printf("%9ld", res.wasted);
+		printf(" %9.1f %8.2f %8ld\n", ms, ms / base_ms, leaked);
+		fflush(stdout);
+		FAULT_CHECK(leaked == 0);
+		// A policy that never reaches its sites tests nothing
+		FAULT_CHECK(!i || fault_injected_total() > 0);
+	}
+}
+
+static const char *const fault_hashmap_policies[] =
+{
+	"nth=1,every=97", "p=0.01,seed=1", "p=0.2,seed=2", "p=1", "hm_node,p=0.05,seed=3",
+	"hm_key,p=0.05,seed=4",
+};
+
+static const char *const fault_lru_policies[] =
+{
+	"nth=1,every=97", "p=0.01,seed=1", "p=0.2,seed=2", "p=1", "lru_node,p=0.05,seed=3",
+	"lru_key,p=0.05,seed=4",
+};
+
+/* Slab nodes with inline keys: only a few slab chunks are ever allocated */
+static const char *const fault_lru_aligned_policies[] =
+{
+	"nth=1", "nth=2", "p=1", "lru_slab,nth=1,every=2",
+};
+
+static const char *const fault_lru_ttl_policies[] =
+{
+	"nth=1,every=97", "p=0.01,seed=1", "p=0.2,seed=2", "p=1", "lru_node,p=0.05,seed=3",
+	"lru_key,p=0.05,seed=4", "lru_wheel,nth=1",
+};
+
+static const char *const fault_btree_policies[] =
+{
+	"nth=1,every=97", "p=0.01,seed=1", "p=0.2,seed=2", "p=1",
+};
+
+#define FAULT_NR(policies) (sizeof(policies) / sizeof(policies[0]))
+
+void fault_hashmap()
+{
+	fault_drive("hash_map", fault_run_hashmap, fault_hashmap_policies, FAULT_NR(fault_hashmap_policies));
+}
+
+void fault_lru()
+{
+	fault_drive("lru_cache_t", fault_run_lru_plain, fault_lru_policies, FAULT_NR(fault_lru_policies));
+	fault_drive("lru_cache_t, LRU_F_HWCACHE_ALIGN", fault_run_lru_aligned, fault_lru_aligned_policies,
+		    FAULT_NR(fault_lru_aligned_policies));
+	fault_drive("lru_cache_t, TTL", fault_run_lru_ttl, fault_lru_ttl_policies,
+		    FAULT_NR(fault_lru_ttl_policies));
+}
+
+void fault_btree()
+{
+	fault_drive("binary tree", fault_run_btree, fault_btree_policies, FAULT_NR(fault_btree_policies));
+}
+#endif /* LUDTM_FAULT */
+
 void ssu_show_limit(int rlim_type, char *rlim_name);
 void self_ulimit_core_setup();
 int self_sys_core_setup();
@@ -417,7 +897,7 @@ int self_sys_core_setup()
 	if (fd < 0)
 	{
 		perror("open core pattern fail");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
 	dprintf(fd, "%s/%s", CORE_PATH, "core-%e.%p.%h.%t");
@@ -427,11 +907,890 @@ int self_sys_core_setup()
 	if (fd < 0)
 	{
 		perror("open core pipe limit fail");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
 	dprintf(fd, "%d", 0);
 	close(fd);
+	return 0;
+}
+
+/*
+ * Batch mode: ./ludtm --batch [-j WORKERS] [-t SECONDS] [-m MB] [-d DIR] [-v] name[:count] ...
+ *
+ * Runs every scenario (count times, 1 by default; "all" is every registered
+ * one) in its own forked child, at most WORKERS at a time.  The core size
+ * limit is raised once here with setrlimit() and inherited by the children,
+ * so there is no shell and no exec per run.  Each child is limited to MB of
+ * address space, so mem_leak ends with a malloc failure rather than the OOM
+ * killer, and is killed by SIGALRM after SECONDS.  As children are reaped,
+ * the exit signal, the core file and the wall time are recorded; a
+ * per-scenario summary, checked against the expected signals, is printed
+ * at the end.
+ *
+ * With -d, each crash writes a minidump (minidump.h) into DIR instead of a
+ * full core: kilobytes instead of gigabytes for mem_leak.
+ */
+
+#define BATCH_MAX_WORKERS 64
+#define BATCH_TIMEOUT 30
+#define BATCH_MEM_MB 1024
+
+struct batch_opts
+{
+	int workers;
+	int verbose;
+	unsigned int timeout;
+	unsigned long mem_mb;
+	const char *minidump_dir;	/* NULL: full cores */
+};
+
+struct batch_job
+{
+	const struct scenario *scn;
+	int rep;
+	pid_t pid;
+	int status;
+	struct timespec start;
+	double wall_ms;
+	int reaped;			/* Exit status collected */
+	int dumped;			/* Core or minidump found */
+	char core[PATH_MAX];
+};
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void batch_read_file(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	buf[0] = '\0';
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		len = 0;
+	while (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = '\0';
+}
+
+/*
+ * Find the core a child left behind: expand core_pattern the way the kernel
+ * does for everything known after the fact, turn the rest (%t, ...) into
+ * wildcards and glob for it.
+ */
+static void batch_core_path(const char *pattern, int uses_pid, const char *comm,
+			    const struct batch_job *job, char *out, size_t size)
+{
+	char expanded[PATH_MAX], host[HOST_NAME_MAX + 1];
+	size_t n = 0;
+	int has_pid = 0;
+	glob_t g;
+
+	if (!WCOREDUMP(job->status))
+	{
+		snprintf(out, size, "-");
+		return;
+	}
+	if (pattern[0] == '|')
+	{
+		snprintf(out, size, "(piped to %s)", pattern + 1);
+		return;
+	}
+
+	gethostname(host, sizeof(host));
+	host[HOST_NAME_MAX] = '\0';
+	for (const char *p = pattern; *p && n < sizeof(expanded) - 1; p++)
+	{
+		int len;
+
+		if (*p != '%' || !p[1])
+		{
+			expanded[n++] = *p;
+			continue;
+		}
+
+		switch (*++p)
+		{
+		case 'p': case 'P': case 'i': case 'I':
+			has_pid = 1;
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%ld", (long)job->pid);
+			break;
+		case 'e':
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%s", comm);
+			break;
+		case 'h':
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%s", host);
+			break;
+		case 's':
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%d", WTERMSIG(job->status));
+			break;
+		case 'u':
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%ld", (long)getuid());
+			break;
+		case 'g':
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%ld", (long)getgid());
+			break;
+		case '%':
+			len = snprintf(expanded + n, sizeof(expanded) - n, "%%");
+			break;
+		default:
+			len = snprintf(expanded + n, sizeof(expanded) - n, "*");
+			break;
+		}
+		n += len < sizeof(expanded) - n ? len : sizeof(expanded) - n - 1;
+	}
+	expanded[n] = '\0';
+	if (!has_pid && uses_pid)
+		snprintf(expanded + n, sizeof(expanded) - n, ".%ld", (long)job->pid);
+
+	if (glob(expanded, 0, NULL, &g) == 0)
+	{
+		snprintf(out, size, "%s", g.gl_pathv[g.gl_pathc - 1]);
+		globfree(&g);
+	}
+	else
+	{
+		snprintf(out, size, "%s (not found)", expanded);
+	}
+}
+
+static void batch_describe(int status, char *buf, size_t size)
+{
+	if (WIFEXITED(status))
+		snprintf(buf, size, "exit %d", WEXITSTATUS(status));
+	else if (WTERMSIG(status) == SIGALRM)
+		snprintf(buf, size, "timeout");
+	else
+		snprintf(buf, size, "SIG%s%s", sigabbrev_np(WTERMSIG(status)),
+			 WCOREDUMP(status) ? "+core" : "");
+}
+
+static int batch_expected(const struct batch_job *job)
+{
+	if (WIFEXITED(job->status))
+		return job->scn->expected_signal == 0;
+	return WTERMSIG(job->status) == job->scn->expected_signal;
+}
+
+static pid_t batch_spawn(struct batch_job *job, const struct batch_opts *opts)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	/* Child */
+	if (!opts->verbose)
+	{
+		int fd = open("/dev/null", O_WRONLY);
+
+		if (fd >= 0)
+		{
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+	}
+	if (opts->mem_mb)
+	{
+		struct rlimit l;
+
+		l.rlim_cur = opts->mem_mb << 20;
+		l.rlim_max = opts->mem_mb << 20;
+		if (setrlimit(RLIMIT_AS, &l) < 0)
+			perror("setrlimit RLIMIT_AS");
+	}
+	crash_handler_install(STDERR_FILENO);
+	if (opts->minidump_dir)
+		minidump_install(opts->minidump_dir);
+	alarm(opts->timeout);
+	printf("Do %s\n", job->scn->name);
+	job->scn->fn();
+	fflush(stdout);
+	_exit(EXIT_SUCCESS);
+}
+
+static void batch_summary(struct batch_job *jobs, int njobs)
+{
+	int unexpected = 0;
+
+	printf("\n%-26s %5s %-8s %-18s %6s %10s %10s %10s\n", "scenario", "runs", "expected",
+	       "result", "cores", "min ms", "avg ms", "max ms");
+
+	for (int i = 0; i < njobs; i++)
+	{
+		char result[64], other[64], expected[16];
+		double min = jobs[i].wall_ms, max = jobs[i].wall_ms, sum = 0;
+		int runs = 0, cores = 0, seen = 0, ok = 1;
+
+		/* One row per scenario, at its first run */
+		for (int j = 0; j < i && !seen; j++)
+			seen = jobs[j].scn == jobs[i].scn;
+		if (seen)
+			continue;
+
+		batch_describe(jobs[i].status, result, sizeof(result));
+		for (int j = i; j < njobs; j++)
+		{
+			if (jobs[j].scn != jobs[i].scn)
+				continue;
+			runs++;
+			ok &= batch_expected(&jobs[j]);
+			sum += jobs[j].wall_ms;
+			if (jobs[j].wall_ms < min)
+				min = jobs[j].wall_ms;
+			if (jobs[j].wall_ms > max)
+				max = jobs[j].wall_ms;
+			cores += jobs[j].dumped;
+			batch_describe(jobs[j].status, other, sizeof(other));
+			if (strcmp(other, result) != 0)
+				snprintf(result, sizeof(result), "mixed");
+		}
+		printf("%-26s %5d %-8s %-18s %6d %10.1f %10.1f %10.1f%s\n", jobs[i].scn->name, runs,
+		       signal_name(jobs[i].scn->expected_signal, expected, sizeof(expected)),
+		       result, cores, min, sum / runs, max, ok ? "" : " !");
+		unexpected += !ok;
+	}
+	if (unexpected)
+		printf("(! marks %d scenario(s) that did not end as expected)\n", unexpected);
+}
+
+/*
+ * Internal helper: append @count runs of @scn to the job list
+ */
+static int batch_add(struct batch_job **jobs, int *njobs, const struct scenario *scn, int count)
+{
+	struct batch_job *grown;
+
+	grown = realloc(*jobs, (*njobs + count) * sizeof(**jobs));
+	if (!grown)
+	{
+		perror("realloc");
+		return -1;
+	}
+	*jobs = grown;
+	for (int rep = 0; rep < count; rep++, (*njobs)++)
+	{
+		memset(&grown[*njobs], 0, sizeof(grown[*njobs]));
+		grown[*njobs].scn = scn;
+		grown[*njobs].rep = rep;
+	}
+	return 0;
+}
+
+int batch_run(int argc, char *argv[])
+{
+	struct batch_job *jobs = NULL;
+	char pattern[PATH_MAX], comm[32], uses_pid[16];
+	int njobs = 0, next = 0, running = 0, done = 0, opt;
+	struct batch_opts opts = { 1, 0, BATCH_TIMEOUT, BATCH_MEM_MB, NULL };
+	struct rlimit l;
+
+	while ((opt = getopt(argc, argv, "j:t:m:d:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			opts.workers = atoi(optarg);
+			break;
+		case 't':
+			opts.timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opts.mem_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			opts.minidump_dir = optarg;
+			break;
+		case 'v':
+			opts.verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: ./ludtm --batch [-j WORKERS] [-t SECONDS] [-m MB] [-d DIR] [-v] "
+				"name[:count]|all[:count] ...\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (opts.workers < 1)
+		opts.workers = 1;
+	if (opts.workers > BATCH_MAX_WORKERS)
+		opts.workers = BATCH_MAX_WORKERS;
+
+	for (int i = optind; i < argc; i++)
+	{
+		char *colon = strchr(argv[i], ':');
+		int count = colon ? atoi(colon + 1) : 1;
+		const struct scenario *scn;
+		int ret = 0;
+
+		if (colon)
+			*colon = '\0';
+		if (count < 1)
+			continue;
+
+		if (strcmp(argv[i], "all") == 0)
+		{
+			scenarios_sort();
+			for (size_t k = 0; k < NR_SCENARIOS && !ret; k++)
+				ret = batch_add(&jobs, &njobs, &scenarios[k], count);
+		}
+		else if ((scn = scenario_find(argv[i])))
+		{
+			ret = batch_add(&jobs, &njobs, scn, count);
+		}
+		else
+		{
+			fprintf(stderr, "ludtm: unknown scenario '%s' (see ./ludtm --help)\n", argv[i]);
+			ret = -1;
+		}
+		if (ret < 0)
+		{
+			free(jobs);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!njobs)
+	{
+		fprintf(stderr, "ludtm: no scenarios given\n");
+		free(jobs);
+		return EXIT_FAILURE;
+	}
+
+	/* Unlimited if allowed, else as far as the hard limit goes; none at all for minidumps */
+	l.rlim_cur = opts.minidump_dir ? 0 : RLIM_INFINITY;
+	l.rlim_max = opts.minidump_dir ? 0 : RLIM_INFINITY;
+	if (opts.minidump_dir && mkdir(opts.minidump_dir, 0755) < 0 && errno != EEXIST)
+	{
+		perror(opts.minidump_dir);
+		free(jobs);
+		return EXIT_FAILURE;
+	}
+	if (setrlimit(RLIMIT_CORE, &l) < 0)
+	{
+		getrlimit(RLIMIT_CORE, &l);
+		l.rlim_cur = l.rlim_max;
+		if (setrlimit(RLIMIT_CORE, &l) < 0)
+			perror("setrlimit");
+	}
+
+	batch_read_file("/proc/sys/kernel/core_pattern", pattern, sizeof(pattern));
+	batch_read_file("/proc/sys/kernel/core_uses_pid", uses_pid, sizeof(uses_pid));
+	batch_read_file("/proc/self/comm", comm, sizeof(comm));
+	if (opts.minidump_dir)
+		printf("%d runs, %d workers, minidumps in %s\n", njobs, opts.workers, opts.minidump_dir);
+	else if (pattern[0] != '|' && !strstr(pattern, "%p") && uses_pid[0] != '1' && opts.workers > 1)
+		fprintf(stderr, "warning: core_pattern '%s' has no %%p, concurrent cores overwrite each other\n",
+			pattern);
+	if (!opts.minidump_dir)
+		printf("%d runs, %d workers, core_pattern '%s'\n", njobs, opts.workers, pattern);
+
+	while (done < njobs)
+	{
+		struct batch_job *job = NULL;
+		char result[64];
+		int status;
+		pid_t w;
+
+		while (running < opts.workers && next < njobs)
+		{
+			jobs[next].pid = batch_spawn(&jobs[next], &opts);
+			if (jobs[next].pid == -1)
+			{
+				perror("fork");
+				break;
+			}
+			running++;
+			next++;
+		}
+		if (!running)
+			break;
+
+		w = waitpid(-1, &status, 0);
+		if (w == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("waitpid");
+			break;
+		}
+		for (int i = 0; i < next && !job; i++)
+		{
+			if (jobs[i].pid == w && !jobs[i].reaped)
+				job = &jobs[i];
+		}
+		if (!job)
+			continue;
+
+		job->wall_ms = elapsed_ms(&job->start);
+		job->status = status;
+		job->reaped = 1;
+		if (opts.minidump_dir)
+		{
+			snprintf(job->core, sizeof(job->core), "%s/%s.%ld.mdmp", opts.minidump_dir, comm, (long)w);
+			job->dumped = access(job->core, F_OK) == 0;
+			if (!job->dumped)
+				snprintf(job->core, sizeof(job->core), "-");
+		}
+		else
+		{
+			batch_core_path(pattern, uses_pid[0] == '1', comm, job, job->core, sizeof(job->core));
+			job->dumped = WIFSIGNALED(status) && WCOREDUMP(status);
+		}
+		batch_describe(status, result, sizeof(result));
+		running--;
+		done++;
+		printf("[%d/%d] %s#%d pid %ld: %s, %.1f ms, core %s\n", done, njobs, job->scn->name,
+		       job->rep, (long)w, result, job->wall_ms, job->core);
+	}
+
+	/* Summarize only what was reaped, keeping the submission order */
+	for (int i = 0, n = 0; i < njobs && n < done; i++)
+	{
+		if (jobs[i].reaped)
+			jobs[n++] = jobs[i];
+	}
+	batch_summary(jobs, done);
+	free(jobs);
+	return done == njobs ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#define CORE_SINK_USAGE \
+	"Usage: ./ludtm --core-sink [-o DIR] [-z none|zstd[:LEVEL]|lz4[:LEVEL]] [-j THREADS] PID COMM\n" \
+	"  echo '|$PWD/ludtm --core-sink -o /var/crash -z zstd:3 -j 4 %p %e' > /proc/sys/kernel/core_pattern\n"
+
+/*
+ * core_pattern pipe handler: the kernel runs us with the core on stdin and
+ * nothing else open, so errors go to DIR/core-sink.log along with a line
+ * per core.
+ */
+int core_sink_main(int argc, char *argv[])
+{
+	const char *dir = CORE_PATH, *spec = "zstd", *pid, *comm;
+	char path[PATH_MAX];
+	enum sink_codec_id codec;
+	struct core_sink_stats stats;
+	struct timespec start;
+	int level, threads = 2, fd, log, ret, opt;
+
+	while ((opt = getopt(argc, argv, "o:z:j:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			dir = optarg;
+			break;
+		case 'z':
+			spec = optarg;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			fputs(CORE_SINK_USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2)
+	{
+		fputs(CORE_SINK_USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	pid = argv[optind];
+	comm = argv[optind + 1];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	mkdir(dir, 0755);
+	snprintf(path, sizeof(path), "%s/core-sink.log", dir);
+	log = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (log >= 0 && !isatty(STDERR_FILENO))
+		dup2(log, STDERR_FILENO);
+
+	if (sink_codec_load(spec, &codec, &level) < 0)
+		return EXIT_FAILURE;
+
+	snprintf(path, sizeof(path), "%s/core-%s.%s%s", dir, comm, pid, sink_codecs[codec].ext);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	ret = core_sink_run(STDIN_FILENO, fd, codec, level, threads, &stats);
+	close(fd);
+	fprintf(stderr, "%s: %s, %llu bytes in, %llu bytes written, %llu bytes of holes, %u chunks, %.1f ms\n",
+		path, ret < 0 ? "FAILED" : "ok", (unsigned long long)stats.in_bytes,
+		(unsigned long long)stats.out_bytes, (unsigned long long)stats.hole_bytes, stats.chunks,
+		elapsed_ms(&start));
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * analyze: signal, backtrace and signature of many cores without gdb (see
+ * coreinfo.h), one thread per core up to -j.  Signatures are counted in an
+ * index, a hash map saved with snapshot.h, so a crash seen in an earlier
+ * run is reported as a duplicate.
+ */
+#define ANALYZE_INDEX "crash-index.snap"
+#define ANALYZE_MAX_THREADS 64
+#define ANALYZE_USAGE "Usage: ./ludtm analyze [-j THREADS] [-i INDEX] [-v] CORE ...\n" \
+	"       ./ludtm analyze [-i INDEX]    (list the index)\n"
+
+struct analyze_job
+{
+	const char *path;
+	int ok;
+	pid_t pid;
+	int signo;
+	int has_siginfo;
+	int si_code;
+	uint64_t fault_addr;
+	unsigned int nthreads;
+	char fname[16];
+	struct core_frame frames[CORE_MAX_FRAMES];
+	int nframes;
+	char signature[512];
+	uint64_t id;
+	double ms;
+};
+
+struct analyze_pool
+{
+	struct analyze_job *jobs;
+	int njobs;
+	atomic_int next;
+};
+
+/*
+ * ludtm's own frames between main() and a scenario: cut from signatures,
+ * so a crash gets the same one from every run mode
+ */
+static const char *const analyze_drivers[] =
+{
+	"make_coredump", "batch_spawn", "batch_run", "ptrace_run", "main", NULL
+};
+
+struct analyze_entry
+{
+	const char *signature;
+	int count;
+};
+
+static void analyze_core(struct analyze_job *job)
+{
+	struct core_info ci;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (core_open(&ci, job->path) == 0)
+	{
+		job->pid = ci.pid;
+		job->signo = ci.signo;
+		job->has_siginfo = ci.has_siginfo;
+		job->si_code = ci.si_code;
+		job->fault_addr = ci.fault_addr;
+		job->nthreads = ci.nthreads;
+		memcpy(job->fname, ci.fname, sizeof(job->fname));
+		job->nframes = core_backtrace(&ci, job->frames, CORE_MAX_FRAMES);
+		job->id = core_signature(ci.signo, job->frames, job->nframes, analyze_drivers, job->signature,
+					 sizeof(job->signature));
+		core_close(&ci);
+		job->ok = 1;
+	}
+	job->ms = elapsed_ms(&start);
+}
+
+static int analyze_worker(void *arg)
+{
+	struct analyze_pool *pool = (struct analyze_pool *)arg;
+	int i;
+
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->njobs)
+		analyze_core(&pool->jobs[i]);
+	return 0;
+}
+
+static void analyze_print_frame(const struct core_frame *f, int i)
+{
+	printf("  #%-2d 0x%016llx ", i, (unsigned long long)f->pc);
+	if (f->func[0])
+		printf("%s+0x%llx (%s)\n", f->func, (unsigned long long)f->off, f->module);
+	else if (f->module[0])
+		printf("%s+0x%llx\n", f->module, (unsigned long long)f->off);
+	else
+		printf("?\n");
+}
+
+static int analyze_entry_cmp(const void *a, const void *b)
+{
+	const struct analyze_entry *x = (const struct analyze_entry *)a, *y = (const struct analyze_entry *)b;
+
+	if (x->count != y->count)
+		return y->count - x->count;
+	return strcmp(x->signature, y->signature);
+}
+
+/*
+ * Signatures of @counts, most frequent first, with their total in @index
+ */
+static void analyze_print_table(struct hash_map *counts, struct hash_map *index, const char *title)
+{
+	struct analyze_entry *entries = calloc(counts->count ? counts->count : 1, sizeof(*entries));
+	unsigned long n = 0;
+
+	if (!entries)
+	{
+		perror("calloc");
+		return;
+	}
+	for (unsigned int b = 0; b < counts->size; b++)
+	{
+		struct hlist_node *pos;
+		struct hash_node *node;
+
+		hlist_for_each_entry(node, pos, &counts->buckets[b], h_node)
+		{
+			entries[n].signature = node->key;
+			entries[n].count = node->value;
+			n++;
+		}
+	}
+	qsort(entries, n, sizeof(*entries), analyze_entry_cmp);
+
+	printf("\n%-16s %6s %6s  %s\n", "id", title, "total", "signature");
+	for (unsigned long i = 0; i < n; i++)
+	{
+		int total = 0;
+
+		hash_map_get(index, entries[i].signature, &total);
+		printf("%016llx %6d %6d  %s\n", (unsigned long long)core_signature_id(entries[i].signature),
+		       entries[i].count, total, entries[i].signature);
+	}
+	free(entries);
+}
+
+int analyze_run(int argc, char *argv[])
+{
+	struct analyze_pool pool = { NULL, 0, 0 };
+	struct hash_map *index, *counts;
+	thrd_t threads[ANALYZE_MAX_THREADS];
+	const char *index_path = ANALYZE_INDEX;
+	int nthreads = 1, verbose = 0, failed = 0, opt;
+	struct timespec start;
+
+	while ((opt = getopt(argc, argv, "j:i:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'i':
+			index_path = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fputs(ANALYZE_USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > ANALYZE_MAX_THREADS)
+		nthreads = ANALYZE_MAX_THREADS;
+
+	index = access(index_path, F_OK) == 0 ? hash_map_load(index_path) : hash_map_create(1024);
+	if (!index)
+		return EXIT_FAILURE;
+
+	if (optind == argc)
+	{
+		if (!index->count)
+		{
+			fputs(ANALYZE_USAGE, stderr);
+			hash_map_destroy_bulk(index, NULL, NULL);
+			return EXIT_FAILURE;
+		}
+		printf("%s: %lu signatures\n", index_path, index->count);
+		analyze_print_table(index, index, "cores");
+		hash_map_destroy_bulk(index, NULL, NULL);
+		return EXIT_SUCCESS;
+	}
+
+	pool.njobs = argc - optind;
+	pool.jobs = calloc(pool.njobs, sizeof(*pool.jobs));
+	counts = hash_map_create(1024);
+	if (!pool.jobs || !counts)
+	{
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < pool.njobs; i++)
+		pool.jobs[i].path = argv[optind + i];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (nthreads > pool.njobs)
+		nthreads = pool.njobs;
+	for (int t = 0; t < nthreads; t++)
+	{
+		if (thrd_create(&threads[t], analyze_worker, &pool) != thrd_success)
+		{
+			fprintf(stderr, "thrd_create failed, %d threads\n", t);
+			nthreads = t;
+			break;
+		}
+	}
+	analyze_worker(&pool);
+	for (int t = 0; t < nthreads; t++)
+		thrd_join(threads[t], NULL);
+
+	for (int i = 0; i < pool.njobs; i++)
+	{
+		struct analyze_job *job = &pool.jobs[i];
+		char sig[32];
+		int seen = 0, count = 0;
+
+		if (!job->ok)
+		{
+			failed++;
+			continue;
+		}
+		hash_map_get(index, job->signature, &seen);
+		hash_map_insert(index, job->signature, seen + 1);
+		hash_map_get(counts, job->signature, &count);
+		hash_map_insert(counts, job->signature, count + 1);
+
+		printf("%s: %s pid %ld, %s", job->path, job->fname, (long)job->pid,
+		       signal_name(job->signo, sig, sizeof(sig)));
+		if (job->has_siginfo && crash_has_fault_addr(job->signo, job->si_code))
+			printf(" at 0x%llx", (unsigned long long)job->fault_addr);
+		printf(", %u threads, %s %016llx, %.2f ms\n", job->nthreads, seen ? "seen" : "NEW",
+		       (unsigned long long)job->id, job->ms);
+		if (verbose)
+		{
+			for (int f = 0; f < job->nframes; f++)
+				analyze_print_frame(&job->frames[f], f);
+		}
+		else if (job->nframes)
+		{
+			analyze_print_frame(&job->frames[0], 0);
+		}
+	}
+
+	analyze_print_table(counts, index, "cores");
+	printf("\n%d cores, %d unreadable, %.1f ms on %d threads\n", pool.njobs, failed, elapsed_ms(&start),
+	       nthreads + 1);
+
+	if (hash_map_save(index, index_path) < 0)
+		failed++;
+	hash_map_destroy_bulk(counts, NULL, NULL);
+	hash_map_destroy_bulk(index, NULL, NULL);
+	free(pool.jobs);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * --ptrace: the parent traces the child and writes its core itself at the
+ * fatal signal (see ptsnap.h), with only the mappings the policy selects.
+ * The kernel does not write one: RLIMIT_CORE is 0 in the child.
+ */
+#define PTRACE_USAGE "Usage: ./ludtm --ptrace [-p stacks,heap,data,code|all[,max=SIZE]] [-o DIR] [-m MB] NAME\n"
+
+int ptrace_run(int argc, char *argv[])
+{
+	struct ptsnap_policy policy = PTSNAP_POLICY_DEFAULT;
+	const struct scenario *scn;
+	struct ptsnap_stats stats;
+	const char *dir = CORE_PATH;
+	char path[PATH_MAX], result[64];
+	struct rlimit l = { 0, 0 };
+	unsigned long mem_mb = BATCH_MEM_MB;
+	struct stat st;
+	int status, opt;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "p:o:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			if (ptsnap_parse_policy(optarg, &policy) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'o':
+			dir = optarg;
+			break;
+		case 'm':
+			mem_mb = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fputs(PTRACE_USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 1)
+	{
+		fputs(PTRACE_USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	scn = scenario_find(argv[optind]);
+	if (!scn)
+	{
+		fprintf(stderr, "unknown scenario '%s', see ./ludtm --help\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	mkdir(dir, 0755);
+
+	pid = ptsnap_fork();
+	if (pid < 0)
+		return EXIT_FAILURE;
+	if (pid == 0)
+	{
+		setrlimit(RLIMIT_CORE, &l);
+		/* As in --batch: mem_leak should fail its malloc, not wake the OOM killer */
+		l.rlim_cur = l.rlim_max = mem_mb << 20;
+		if (mem_mb)
+			setrlimit(RLIMIT_AS, &l);
+		crash_handler_install(STDERR_FILENO);
+		scn->fn();
+		_exit(EXIT_SUCCESS);
+	}
+
+	printf("Child PID is %ld, traced\n", (long)pid);
+	snprintf(path, sizeof(path), "%s/core.%s.%ld", dir, scn->name, (long)pid);
+	if (ptsnap_wait(pid, path, &policy, &status, &stats) < 0)
+		return EXIT_FAILURE;
+
+	batch_describe(status, result, sizeof(result));
+	printf("%s: %s\n", scn->name, result);
+	if (!stats.dumped)
+	{
+		printf("no snapshot\n");
+		return WIFEXITED(status) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (stat(path, &st) < 0)
+		st.st_size = st.st_blocks = 0;
+	printf("%s: %u threads, %u of %u mappings, %.1f MiB read in %u process_vm_readv, "
+	       "%lld bytes (%lld allocated), %.1f ms\n", path, stats.nthreads, stats.nselected, stats.nmaps,
+	       stats.bytes / 1048576.0, stats.reads, (long long)st.st_size, (long long)st.st_blocks * 512, stats.ms);
+	return EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[])
@@ -441,7 +1800,30 @@ int main(int argc, char *argv[])
 	char cmd[CMD_SIZE];
 	char param[PARAM_SIZE];
 
-	self_sys_core_setup();
+	if (argc > 1 && CMP(__BATCH, argv[1]))
+	{
+		exit(batch_run(argc - 1, argv + 1));
+	}
+
+	if (argc > 1 && CMP(__CORE_SINK, argv[1]))
+	{
+		exit(core_sink_main(argc - 1, argv + 1));
+	}
+
+	if (argc > 1 && CMP(__ANALYZE, argv[1]))
+	{
+		exit(analyze_run(argc - 1, argv + 1));
+	}
+
+	if (argc > 1 && CMP(__PTRACE, argv[1]))
+	{
+		exit(ptrace_run(argc - 1, argv + 1));
+	}
+
+	if (self_sys_core_setup() < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
 
 	do
 	{
@@ -474,35 +1856,35 @@ int main(int argc, char *argv[])
 					"\n"
 					" echo TYEP_OF_CRASH | ./ludtm"
 					"\n"
-					"Make various dump:"
-					"\n"
-					" echo segfault | ./ludtm"
+					"Make various dump (expected outcome, what it does):"
 					"\n"
-					" echo null_dereference | ./ludtm"
-					"\n"
-					" echo write_weired_area | ./ludtm"
+				);
+				scenarios_print(stdout);
+				printf(
+					"Make many dumps in parallel (in-process setrlimit, no shell):"
 					"\n"
-					" echo stack_corruption | ./ludtm"
+					" ./ludtm --batch [-j WORKERS] [-t SECONDS] [-m MB] [-d DIR] [-v] name[:count]|all[:count] ..."
 					"\n"
-					" echo stack_overflow_recursive | ./ludtm"
+					" ./ludtm --batch -j 4 segfault:10 double_free:5 heap_overflow"
 					"\n"
-					" echo stack_overflow_oversize | ./ludtm"
+					"Receive cores from the kernel, compressed (see README):"
 					"\n"
-					" echo heap_overflow | ./ludtm"
+					" ./ludtm --core-sink [-o DIR] [-z none|zstd[:LEVEL]|lz4[:LEVEL]] [-j THREADS] %%p %%e"
 					"\n"
-					" echo mem_leak | ./ludtm"
+					"Signatures and backtraces of many cores, deduplicated across runs:"
 					"\n"
-					" echo double_free | ./ludtm"
+					" ./ludtm analyze [-j THREADS] [-i INDEX] [-v] CORE ..."
 					"\n"
-					" echo list_concurrency | ./ludtm"
+					"Core written by the parent through ptrace, with a policy on what goes in:"
 					"\n"
-					" echo wrong_funtion_pointer | ./ludtm"
+					" ./ludtm --ptrace [-p stacks,heap,data,code|all[,max=SIZE]] [-o DIR] [-m MB] NAME"
 					"\n"
 				);
 				exit(EXIT_SUCCESS);
 			}
 			else
 			{
+				crash_handler_install(STDERR_FILENO);
 				make_coredump(argv[1]);
 			}
 
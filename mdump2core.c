@@ -0,0 +1,77 @@
+/*
+ * mdump2core: inspect a minidump, or turn it into an ELF core for gdb.
+ *
+ *   ./mdump2core DUMP.mdmp          threads, memory ranges and modules
+ *   ./mdump2core DUMP.mdmp CORE     write CORE, then: gdb ./ludtm CORE
+ *
+ * Minidumps come from ludtm --batch -d DIR (see minidump.h).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <minidump.h>
+
+static const char *const reason_names[] = { "?", "stack", "near fault", "module data" };
+
+static void print_flags(uint32_t flags) {
+	printf("%c%c%c", flags & PF_R ? 'r' : '-', flags & PF_W ? 'w' : '-', flags & PF_X ? 'x' : '-');
+}
+
+static int summary(const char *path) {
+	const struct mdump_thread *threads;
+	const struct mdump_range *ranges;
+	const struct mdump_module *mod;
+	const char *mod_path;
+	mdump_file_t f;
+	uint64_t pos = 0, captured = 0;
+
+	if (minidump_open(&f, path) < 0) return 1;
+
+	printf("%s: %s (pid %d) %s, signal %d, si_code %d, fault address 0x%llx, %zu bytes\n", path,
+		   f.hdr->comm, f.hdr->pid, f.hdr->psargs, f.hdr->signo, f.hdr->si_code,
+		   (unsigned long long)f.hdr->fault_addr, f.size);
+
+	threads = (const struct mdump_thread*)minidump_stream(&f, MDUMP_STREAM_THREADS);
+	printf("\nthreads: %u\n", f.hdr->streams[MDUMP_STREAM_THREADS].count);
+	for (uint32_t i = 0; i < f.hdr->streams[MDUMP_STREAM_THREADS].count; i++) {
+		printf("  tid %-8d sp 0x%llx%s\n", threads[i].tid,
+			   (unsigned long long)mdump_sp(threads[i].regs), threads[i].signo ? " (crashed)" : "");
+	}
+
+	ranges = (const struct mdump_range*)minidump_stream(&f, MDUMP_STREAM_MEMORY);
+	printf("\nmemory ranges: %u\n", f.hdr->streams[MDUMP_STREAM_MEMORY].count);
+	for (uint32_t i = 0; i < f.hdr->streams[MDUMP_STREAM_MEMORY].count; i++) {
+		printf("  %016llx-%016llx ", (unsigned long long)ranges[i].addr,
+			   (unsigned long long)(ranges[i].addr + ranges[i].size));
+		print_flags(ranges[i].flags);
+		printf(" %8llu bytes  %s\n", (unsigned long long)ranges[i].size,
+			   reason_names[ranges[i].reason < 4 ? ranges[i].reason : 0]);
+		captured += ranges[i].size;
+	}
+	printf("  total %llu bytes\n", (unsigned long long)captured);
+
+	printf("\nmodules: %u\n", f.hdr->streams[MDUMP_STREAM_MODULES].count);
+	while ((mod = minidump_next_module(&f, &pos, &mod_path))) {
+		printf("  %016llx-%016llx ", (unsigned long long)mod->start, (unsigned long long)mod->end);
+		print_flags(mod->flags);
+		printf(" %08llx %s\n", (unsigned long long)mod->offset, mod_path);
+	}
+
+	minidump_close(&f);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc == 2) return summary(argv[1]);
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s DUMP.mdmp [CORE]\n", argv[0]);
+		return 1;
+	}
+	if (minidump_to_core(argv[1], argv[2]) < 0) return 1;
+	printf("%s: written, load it with gdb <executable> %s\n", argv[2], argv[2]);
+	return 0;
+}
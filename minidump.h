@@ -0,0 +1,761 @@
+#ifndef MINIDUMP_H
+#define MINIDUMP_H
+
+#include <crash.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/user.h>
+#if defined(__x86_64__)
+#include <asm/prctl.h>
+#endif
+
+#include <elfcore.h>
+
+/**
+ * Minidumps: a few hundred KiB instead of a full core.
+ *
+ * A full core of mem_leak or stack_overflow_oversize is gigabytes, most of
+ * it irrelevant to the crash.  A minidump, written from the crash handler
+ * (crash.h), only keeps:
+ *
+ *  - the registers of every thread: the crashing one from its signal
+ *    context, the others from their own, via a tgkill()ed MDUMP_SIGNAL
+ *    whose handler parks the thread
+ *  - a window of each thread's stack above its stack pointer
+ *  - the pages around the fault address and around every register of the
+ *    crashing thread that points into writable memory (the heap objects
+ *    it was working on)
+ *  - the start of each module's data segment and the vDSO, so a debugger
+ *    can walk the dynamic linker's module list and unwind signal frames
+ *  - the module list (file-backed mappings) and the auxiliary vector
+ *
+ * File format: a fixed header whose stream directory points at a thread
+ * table, a memory range table, the module records, the auxv and the memory
+ * contents; all little-endian native structures, 8-byte aligned.
+ *
+ * minidump_to_core() turns a minidump into an ELF core that gdb loads
+ * like a kernel one (mdump2core.c).
+ */
+
+#define MDUMP_MAGIC "LUDTMMDP"
+#define MDUMP_VERSION 1
+
+#define MDUMP_MAX_THREADS 128
+#define MDUMP_MAX_RANGES 256
+#define MDUMP_STACK_WINDOW (64 * 1024)		 // Crashing thread
+#define MDUMP_THREAD_STACK_WINDOW (16 * 1024)  // Other threads
+#define MDUMP_REDZONE 128					  // Below the stack pointer
+#define MDUMP_NEAR_PAGES 1					 // Pages each side of a pointer
+#define MDUMP_DATA_CAP (64 * 1024)			 // Per module data mapping
+#define MDUMP_THREAD_WAIT_MS 100
+#define MDUMP_SIGNAL (SIGRTMIN + 3)
+
+enum mdump_stream_type {
+	MDUMP_STREAM_THREADS,
+	MDUMP_STREAM_MEMORY,
+	MDUMP_STREAM_MODULES,
+	MDUMP_STREAM_AUXV,
+	MDUMP_NR_STREAMS,
+};
+
+enum mdump_reason {
+	MDUMP_R_STACK = 1,
+	MDUMP_R_NEAR_FAULT,
+	MDUMP_R_MODULE_DATA,
+};
+
+struct mdump_stream {
+	uint32_t type;
+	uint32_t count;
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct mdump_header {
+	char magic[8];
+	uint32_t version;
+	uint16_t machine;	   // ELF e_machine
+	uint16_t nstreams;
+	int32_t pid;
+	int32_t signo;
+	int32_t si_code;
+	uint32_t page_size;
+	uint64_t fault_addr;
+	char comm[16];
+	char psargs[80];
+	struct mdump_stream streams[MDUMP_NR_STREAMS];
+};
+
+struct mdump_thread {
+	int32_t tid;
+	int32_t signo;		  // Crashing thread only, which comes first
+	elf_gregset_t regs;
+};
+
+struct mdump_range {
+	uint64_t addr;
+	uint64_t size;
+	uint64_t offset;		// Of the contents in the file
+	uint32_t flags;		 // PF_R | PF_W | PF_X
+	uint32_t reason;		// enum mdump_reason
+};
+
+struct mdump_module {
+	uint64_t start;
+	uint64_t end;
+	uint64_t offset;		// In the file
+	uint32_t flags;
+	uint32_t path_len;	  // NUL-terminated path follows, padded to 8
+};
+
+static const char mdump_pad[8];
+
+static struct {
+	char dir[PATH_MAX / 2];
+	char path[PATH_MAX];		// Of the last minidump
+	int ready[MDUMP_MAX_THREADS];
+	struct mdump_thread threads[MDUMP_MAX_THREADS];
+	unsigned int nthreads;
+	struct mdump_range ranges[MDUMP_MAX_RANGES];
+	unsigned int nranges;
+	size_t auxv_len;
+	char auxv[4096];
+	struct mdump_header hdr;
+} mdump;
+
+#define MDUMP_ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+/*
+ * ====================================================================================
+ * Capture, all async-signal-safe
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: the ELF core register set of a signal context
+ */
+static void mdump_gregs(const ucontext_t *uc, elf_gregset_t regs) {
+	memset(regs, 0, sizeof(elf_gregset_t));
+#if defined(__x86_64__)
+	struct user_regs_struct *r = (struct user_regs_struct*)regs;
+	const greg_t *g = uc->uc_mcontext.gregs;
+	unsigned long base;
+
+	r->r15 = g[REG_R15];
+	r->r14 = g[REG_R14];
+	r->r13 = g[REG_R13];
+	r->r12 = g[REG_R12];
+	r->rbp = g[REG_RBP];
+	r->rbx = g[REG_RBX];
+	r->r11 = g[REG_R11];
+	r->r10 = g[REG_R10];
+	r->r9 = g[REG_R9];
+	r->r8 = g[REG_R8];
+	r->rax = g[REG_RAX];
+	r->rcx = g[REG_RCX];
+	r->rdx = g[REG_RDX];
+	r->rsi = g[REG_RSI];
+	r->rdi = g[REG_RDI];
+	r->orig_rax = -1;
+	r->rip = g[REG_RIP];
+	r->cs = g[REG_CSGSFS] & 0xffff;
+	r->eflags = g[REG_EFL];
+	r->rsp = g[REG_RSP];
+	r->ss = 0x2b;
+	// Not in the signal context, but per thread: this is the thread's own
+	if (syscall(SYS_arch_prctl, ARCH_GET_FS, &base) == 0) r->fs_base = base;
+	if (syscall(SYS_arch_prctl, ARCH_GET_GS, &base) == 0) r->gs_base = base;
+#elif defined(__aarch64__)
+	struct user_regs_struct *r = (struct user_regs_struct*)regs;
+
+	memcpy(r->regs, uc->uc_mcontext.regs, sizeof(r->regs));
+	r->sp = uc->uc_mcontext.sp;
+	r->pc = uc->uc_mcontext.pc;
+	r->pstate = uc->uc_mcontext.pstate;
+#endif
+}
+
+static uint64_t mdump_sp(const elf_gregset_t regs) {
+#if defined(__x86_64__) || defined(__aarch64__)
+	const struct user_regs_struct *r = (const struct user_regs_struct*)regs;
+
+#if defined(__x86_64__)
+	return r->rsp;
+#else
+	return r->sp;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Internal helper: MDUMP_SIGNAL handler, run by every other thread: save
+ * the registers, then park until the process dies
+ */
+static void mdump_thread_handler(int sig, siginfo_t *info, void *uc) {
+	pid_t tid = syscall(SYS_gettid);
+	unsigned int n = __atomic_load_n(&mdump.nthreads, __ATOMIC_ACQUIRE);
+
+	(void)sig;
+	(void)info;
+	for (unsigned int i = 1; i < n; i++) {
+		if (mdump.threads[i].tid != tid) continue;
+		mdump_gregs((const ucontext_t*)uc, mdump.threads[i].regs);
+		__atomic_store_n(&mdump.ready[i], 1, __ATOMIC_RELEASE);
+		break;
+	}
+	for (;;) pause();
+}
+
+struct mdump_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/**
+ * Internal helper: registers of every thread, the crashing one first
+ */
+static void mdump_collect_threads(int sig, const ucontext_t *uc) {
+	pid_t self = syscall(SYS_gettid), pid = getpid();
+	char buf[4096];
+	unsigned int n = 1;
+	long len;
+	int fd;
+
+	mdump.threads[0].tid = self;
+	mdump.threads[0].signo = sig;
+	mdump_gregs(uc, mdump.threads[0].regs);
+	mdump.ready[0] = 1;
+
+	// readdir() may allocate: walk the directory with getdents64
+	fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	while (fd >= 0 && (len = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for (long off = 0; off < len; ) {
+			struct mdump_dirent64 *d = (struct mdump_dirent64*)(buf + off);
+			pid_t tid = 0;
+
+			off += d->d_reclen;
+			for (const char *c = d->d_name; *c >= '0' && *c <= '9'; c++) tid = tid * 10 + (*c - '0');
+			if (!tid || tid == self || n == MDUMP_MAX_THREADS) continue;
+			mdump.threads[n].tid = tid;
+			mdump.threads[n].signo = 0;
+			mdump.ready[n] = 0;
+			n++;
+		}
+	}
+	if (fd >= 0) close(fd);
+	__atomic_store_n(&mdump.nthreads, n, __ATOMIC_RELEASE);
+
+	for (unsigned int i = 1; i < n; i++) {
+		syscall(SYS_tgkill, pid, mdump.threads[i].tid, MDUMP_SIGNAL);
+	}
+	for (int waited = 0; waited < MDUMP_THREAD_WAIT_MS * 10; waited++) {
+		struct timespec ts = { 0, 100 * 1000 };
+		unsigned int ready = 0;
+
+		for (unsigned int i = 0; i < n; i++) ready += __atomic_load_n(&mdump.ready[i], __ATOMIC_ACQUIRE);
+		if (ready == n) break;
+		nanosleep(&ts, NULL);
+	}
+}
+
+static uint32_t mdump_flags(const struct crash_map *m) {
+	return (m->perms[0] == 'r' ? PF_R : 0) | (m->perms[1] == 'w' ? PF_W : 0) |
+		(m->perms[2] == 'x' ? PF_X : 0);
+}
+
+/**
+ * Internal helper: add [start, end) to the ranges, merged with any range it
+ * overlaps or touches
+ */
+static void mdump_add_range(uint64_t start, uint64_t end, uint32_t flags, uint32_t reason) {
+	if (start >= end) return;
+
+	for (unsigned int i = 0; i < mdump.nranges; ) {
+		struct mdump_range *r = &mdump.ranges[i];
+
+		if (r->addr <= end && start <= r->addr + r->size) {
+			if (r->addr < start) start = r->addr;
+			if (r->addr + r->size > end) end = r->addr + r->size;
+			flags |= r->flags;
+			if (r->reason < reason) reason = r->reason;
+			*r = mdump.ranges[--mdump.nranges];
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+	if (mdump.nranges == MDUMP_MAX_RANGES) return;
+	mdump.ranges[mdump.nranges].addr = start;
+	mdump.ranges[mdump.nranges].size = end - start;
+	mdump.ranges[mdump.nranges].flags = flags;
+	mdump.ranges[mdump.nranges].reason = reason;
+	mdump.nranges++;
+}
+
+/**
+ * Internal helper: add the readable pages of [start, end) (of writable
+ * mappings only if @writable)
+ */
+static void mdump_add_readable(uint64_t start, uint64_t end, int writable, uint32_t reason) {
+	uint64_t page = mdump.hdr.page_size;
+	struct crash_map m;
+	size_t pos = 0;
+
+	// Whole pages, so that the ELF core's PT_LOADs are page-aligned
+	start &= ~(page - 1);
+	end = (end + page - 1) & ~(page - 1);
+
+	while (crash_maps_next(&pos, &m)) {
+		uint64_t lo = start > m.start ? start : m.start, hi = end < m.end ? end : m.end;
+
+		if (lo >= hi || m.perms[0] != 'r' || (writable && m.perms[1] != 'w')) continue;
+		mdump_add_range(lo, hi, mdump_flags(&m), reason);
+	}
+}
+
+static void mdump_collect_ranges(int sig, const siginfo_t *info) {
+	uint64_t page = mdump.hdr.page_size, near = MDUMP_NEAR_PAGES * page;
+	const uint64_t *gregs = (const uint64_t*)mdump.threads[0].regs;
+	struct crash_map m, prev = { 0 };
+	size_t pos = 0;
+
+	mdump.nranges = 0;
+	for (unsigned int i = 0; i < mdump.nthreads; i++) {
+		uint64_t sp = mdump_sp(mdump.threads[i].regs);
+
+		if (!mdump.ready[i] || !sp) continue;
+		mdump_add_readable(sp - MDUMP_REDZONE, sp + (i ? MDUMP_THREAD_STACK_WINDOW : MDUMP_STACK_WINDOW),
+				   0, MDUMP_R_STACK);
+	}
+
+	if (crash_has_fault_addr(sig, info->si_code)) {
+		mdump_add_readable(((uint64_t)info->si_addr & ~(page - 1)) - near,
+				   ((uint64_t)info->si_addr & ~(page - 1)) + page + near, 1, MDUMP_R_NEAR_FAULT);
+	}
+	for (unsigned int i = 0; i < sizeof(elf_gregset_t) / sizeof(uint64_t); i++) {
+		uint64_t v = gregs[i] & ~(page - 1);
+
+		mdump_add_readable(v - near, v + page + near, 1, MDUMP_R_NEAR_FAULT);
+	}
+
+	while (crash_maps_next(&pos, &m)) {
+		int data = m.perms[0] == 'r' && m.perms[1] == 'w' && m.path_len && m.path[0] == '/';
+		// A module's .bss continues in the anonymous mapping right after it
+		int bss = m.perms[1] == 'w' && !m.path_len && prev.end == m.start &&
+			prev.perms[1] == 'w' && prev.path_len && prev.path[0] == '/';
+		int vdso = m.path_len == 6 && memcmp(m.path, "[vdso]", 6) == 0;
+
+		if (data || bss) {
+			mdump_add_range(m.start, m.end - m.start > MDUMP_DATA_CAP ? m.start + MDUMP_DATA_CAP : m.end,
+					mdump_flags(&m), MDUMP_R_MODULE_DATA);
+		} else if (vdso) {
+			mdump_add_range(m.start, m.end, mdump_flags(&m), MDUMP_R_MODULE_DATA);
+		}
+		prev = m;
+	}
+}
+
+static void mdump_read_file(const char *path, char *buf, size_t size, size_t *len) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	ssize_t n;
+
+	*len = 0;
+	if (fd < 0) return;
+	while (*len < size && ((n = read(fd, buf + *len, size - *len)) > 0 || (n < 0 && errno == EINTR))) {
+		if (n > 0) *len += n;
+	}
+	close(fd);
+}
+
+/**
+ * Internal helper: copy @size bytes at @addr to @fd, zeros where the
+ * memory turns out to be unreadable (write() fails with EFAULT then)
+ */
+static void mdump_write_memory(int fd, uint64_t addr, uint64_t size) {
+	static const char zeros[4096];
+
+	while (size) {
+		size_t chunk = size < (1 << 20) ? size : (1 << 20);
+		ssize_t n = write(fd, (const void*)addr, chunk);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			n = size < sizeof(zeros) ? size : sizeof(zeros) - (addr & (sizeof(zeros) - 1));
+			if (write(fd, zeros, n) != n) return;
+		}
+		addr += n;
+		size -= n;
+	}
+}
+
+/**
+ * The crash hook: write <dir>/<comm>.<pid>.mdmp
+ */
+static void mdump_crash_hook(int sig, siginfo_t *info, ucontext_t *uc) {
+	struct mdump_header *hdr = &mdump.hdr;
+	char comm[sizeof(hdr->comm) + 1];
+	size_t comm_len, psargs_len, n;
+	uint64_t off, modules_size = 0, nmodules = 0, nready = 0;
+	struct crash_map m;
+	size_t pos;
+	int fd, saved_fd;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, MDUMP_MAGIC, sizeof(hdr->magic));
+	hdr->version = MDUMP_VERSION;
+	hdr->machine = ELFCORE_MACHINE;
+	hdr->nstreams = MDUMP_NR_STREAMS;
+	hdr->pid = getpid();
+	hdr->signo = sig;
+	hdr->si_code = info->si_code;
+	hdr->page_size = getpagesize();
+	hdr->fault_addr = (uint64_t)info->si_addr;
+	mdump_read_file("/proc/self/comm", comm, sizeof(comm) - 1, &comm_len);
+	while (comm_len && comm[comm_len - 1] == '\n') comm_len--;
+	comm[comm_len] = '\0';
+	memcpy(hdr->comm, comm, comm_len < sizeof(hdr->comm) ? comm_len : sizeof(hdr->comm) - 1);
+	mdump_read_file("/proc/self/cmdline", hdr->psargs, sizeof(hdr->psargs) - 1, &psargs_len);
+	for (size_t i = 0; i + 1 < psargs_len; i++) {
+		if (!hdr->psargs[i]) hdr->psargs[i] = ' ';
+	}
+	mdump_read_file("/proc/self/auxv", mdump.auxv, sizeof(mdump.auxv), &mdump.auxv_len);
+
+	mdump_collect_threads(sig, uc);
+	mdump_collect_ranges(sig, info);
+	for (unsigned int i = 0; i < mdump.nthreads; i++) nready += mdump.ready[i];
+	pos = 0;
+	while (crash_maps_next(&pos, &m)) {
+		if (!m.path_len || m.path[0] != '/') continue;
+		nmodules++;
+		modules_size += sizeof(struct mdump_module) + MDUMP_ALIGN8(m.path_len + 1);
+	}
+
+	// Layout: header, threads, ranges, modules, auxv, memory
+	off = sizeof(*hdr);
+	hdr->streams[MDUMP_STREAM_THREADS] = (struct mdump_stream){
+		MDUMP_STREAM_THREADS, (uint32_t)nready, off, nready * sizeof(struct mdump_thread) };
+	off += nready * sizeof(struct mdump_thread);
+	hdr->streams[MDUMP_STREAM_MEMORY] = (struct mdump_stream){
+		MDUMP_STREAM_MEMORY, mdump.nranges, off, mdump.nranges * sizeof(struct mdump_range) };
+	off += mdump.nranges * sizeof(struct mdump_range);
+	hdr->streams[MDUMP_STREAM_MODULES] = (struct mdump_stream){
+		MDUMP_STREAM_MODULES, (uint32_t)nmodules, off, modules_size };
+	off += modules_size;
+	hdr->streams[MDUMP_STREAM_AUXV] = (struct mdump_stream){
+		MDUMP_STREAM_AUXV, 1, off, mdump.auxv_len };
+	off += MDUMP_ALIGN8(mdump.auxv_len);
+	for (unsigned int i = 0; i < mdump.nranges; i++) {
+		mdump.ranges[i].offset = off;
+		off += MDUMP_ALIGN8(mdump.ranges[i].size);
+	}
+
+	// <dir>/<comm>.<pid>.mdmp
+	n = strlen(mdump.dir);
+	memcpy(mdump.path, mdump.dir, n);
+	mdump.path[n++] = '/';
+	memcpy(mdump.path + n, comm, comm_len);
+	n += comm_len;
+	mdump.path[n++] = '.';
+	for (unsigned long p = hdr->pid, div = 1000000000; div; div /= 10) {
+		if (p >= div || div == 1) mdump.path[n++] = '0' + p / div % 10;
+	}
+	memcpy(mdump.path + n, ".mdmp", 6);
+
+	fd = open(mdump.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		crash_puts("minidump: cannot create ");
+		crash_puts(mdump.path);
+		crash_puts("\n");
+		crash_flush();
+		return;
+	}
+
+	// Reuse the report's buffered writer for the tables
+	crash_flush();
+	saved_fd = crash.fd;
+	crash.fd = fd;
+	crash_put((const char*)hdr, sizeof(*hdr));
+	for (unsigned int i = 0; i < mdump.nthreads; i++) {
+		if (mdump.ready[i]) crash_put((const char*)&mdump.threads[i], sizeof(mdump.threads[i]));
+	}
+	crash_put((const char*)mdump.ranges, mdump.nranges * sizeof(struct mdump_range));
+	pos = 0;
+	while (crash_maps_next(&pos, &m)) {
+		struct mdump_module mod;
+
+		if (!m.path_len || m.path[0] != '/') continue;
+		mod.start = m.start;
+		mod.end = m.end;
+		mod.offset = m.offset;
+		mod.flags = mdump_flags(&m);
+		mod.path_len = (uint32_t)m.path_len;
+		crash_put((const char*)&mod, sizeof(mod));
+		crash_put(m.path, m.path_len);
+		crash_put(mdump_pad, MDUMP_ALIGN8(m.path_len + 1) - m.path_len);
+	}
+	crash_put(mdump.auxv, mdump.auxv_len);
+	crash_put(mdump_pad, MDUMP_ALIGN8(mdump.auxv_len) - mdump.auxv_len);
+	crash_flush();
+	for (unsigned int i = 0; i < mdump.nranges; i++) {
+		mdump_write_memory(fd, mdump.ranges[i].addr, mdump.ranges[i].size);
+		crash_put(mdump_pad, MDUMP_ALIGN8(mdump.ranges[i].size) - mdump.ranges[i].size);
+		crash_flush();
+	}
+	close(fd);
+	crash.fd = saved_fd;
+
+	crash_puts("minidump: ");
+	crash_puts(mdump.path);
+	crash_puts(", ");
+	crash_dec((long)off);
+	crash_puts(" bytes, ");
+	crash_dec((long)nready);
+	crash_puts(" threads, ");
+	crash_dec(mdump.nranges);
+	crash_puts(" memory ranges\n");
+	crash_flush();
+}
+
+/*
+ * ====================================================================================
+ * API
+ * ====================================================================================
+ */
+
+/**
+ * Write a minidump into @dir on crash.  Call after crash_handler_install();
+ * set RLIMIT_CORE to 0 as well to skip the full core.
+ * @return 0 on success, -1 on error
+ */
+int minidump_install(const char *dir) {
+	struct sigaction sa;
+
+	if (strlen(dir) >= sizeof(mdump.dir)) {
+		fprintf(stderr, "minidump: directory name too long\n");
+		return -1;
+	}
+	strcpy(mdump.dir, dir);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = mdump_thread_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(MDUMP_SIGNAL, &sa, NULL) < 0) {
+		perror("sigaction");
+		return -1;
+	}
+	crash.hook = mdump_crash_hook;
+	return 0;
+}
+
+/*
+ * ====================================================================================
+ * Reading and conversion
+ * ====================================================================================
+ */
+
+typedef struct {
+	void *base;
+	size_t size;
+	const struct mdump_header *hdr;
+} mdump_file_t;
+
+/**
+ * Map a minidump and check its header and directory
+ * @return 0 on success, -1 on error
+ */
+int minidump_open(mdump_file_t *f, const char *path) {
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct mdump_header)) {
+		fprintf(stderr, "%s: not a minidump\n", path);
+		close(fd);
+		return -1;
+	}
+	f->size = st.st_size;
+	f->base = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->base == MAP_FAILED) {
+		perror("mmap minidump");
+		return -1;
+	}
+	f->hdr = (const struct mdump_header*)f->base;
+
+	if (memcmp(f->hdr->magic, MDUMP_MAGIC, sizeof(f->hdr->magic)) != 0 ||
+		f->hdr->version != MDUMP_VERSION || f->hdr->nstreams != MDUMP_NR_STREAMS) {
+		fprintf(stderr, "%s: not a version %d minidump\n", path, MDUMP_VERSION);
+		munmap(f->base, f->size);
+		return -1;
+	}
+	for (int i = 0; i < MDUMP_NR_STREAMS; i++) {
+		const struct mdump_stream *s = &f->hdr->streams[i];
+
+		if (s->offset > f->size || s->size > f->size - s->offset) {
+			fprintf(stderr, "%s: truncated\n", path);
+			munmap(f->base, f->size);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void minidump_close(mdump_file_t *f) {
+	munmap(f->base, f->size);
+}
+
+static inline const void* minidump_stream(const mdump_file_t *f, enum mdump_stream_type type) {
+	return (const char*)f->base + f->hdr->streams[type].offset;
+}
+
+/**
+ * Next module record
+ * @param pos Byte offset into the module stream, 0 to start
+ * @return The module and its path in @path, or NULL at the end
+ */
+const struct mdump_module* minidump_next_module(const mdump_file_t *f, uint64_t *pos, const char **path) {
+	const struct mdump_stream *s = &f->hdr->streams[MDUMP_STREAM_MODULES];
+	const struct mdump_module *mod;
+
+	if (*pos + sizeof(*mod) > s->size) return NULL;
+	mod = (const struct mdump_module*)((const char*)f->base + s->offset + *pos);
+	if (*pos + sizeof(*mod) + mod->path_len + 1 > s->size) return NULL;
+	*path = (const char*)(mod + 1);
+	*pos += sizeof(*mod) + MDUMP_ALIGN8(mod->path_len + 1);
+	return mod;
+}
+
+static int mdump_segment_cmp(const void *a, const void *b) {
+	const struct elfcore_segment *x = (const struct elfcore_segment*)a, *y = (const struct elfcore_segment*)b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/**
+ * Convert a minidump into an ELF core: captured memory becomes PT_LOADs
+ * with contents, read-only module mappings PT_LOADs without (gdb reads
+ * them from the files named in NT_FILE)
+ * @return 0 on success, -1 on error
+ */
+int minidump_to_core(const char *in, const char *out) {
+	const struct mdump_thread *mthreads;
+	const struct mdump_range *ranges;
+	const struct mdump_module *mod;
+	struct elfcore core;
+	siginfo_t si;
+	struct elfcore_thread *threads = NULL;
+	struct elfcore_segment *segs = NULL;
+	struct elfcore_file *files = NULL;
+	mdump_file_t f;
+	uint32_t nthreads, nranges, nmodules;
+	uint64_t pos = 0;
+	const char *path;
+	int fd, ret = -1;
+
+	if (minidump_open(&f, in) < 0) return -1;
+	if (f.hdr->machine != ELFCORE_MACHINE) {
+		fprintf(stderr, "%s: minidump of another architecture (e_machine %u)\n", in, f.hdr->machine);
+		goto out;
+	}
+	nthreads = f.hdr->streams[MDUMP_STREAM_THREADS].count;
+	nranges = f.hdr->streams[MDUMP_STREAM_MEMORY].count;
+	nmodules = f.hdr->streams[MDUMP_STREAM_MODULES].count;
+	mthreads = (const struct mdump_thread*)minidump_stream(&f, MDUMP_STREAM_THREADS);
+	ranges = (const struct mdump_range*)minidump_stream(&f, MDUMP_STREAM_MEMORY);
+	if (nthreads * sizeof(*mthreads) > f.hdr->streams[MDUMP_STREAM_THREADS].size ||
+		nranges * sizeof(*ranges) > f.hdr->streams[MDUMP_STREAM_MEMORY].size) {
+		fprintf(stderr, "%s: corrupt stream directory\n", in);
+		goto out;
+	}
+
+	threads = (struct elfcore_thread*)calloc(nthreads + 1, sizeof(*threads));
+	segs = (struct elfcore_segment*)calloc(nranges + nmodules + 1, sizeof(*segs));
+	files = (struct elfcore_file*)calloc(nmodules + 1, sizeof(*files));
+	if (!threads || !segs || !files) {
+		perror("calloc");
+		goto out;
+	}
+
+	memset(&core, 0, sizeof(core));
+	core.pid = f.hdr->pid;
+	core.signo = f.hdr->signo;
+	memcpy(core.fname, f.hdr->comm, sizeof(core.fname));
+	memcpy(core.psargs, f.hdr->psargs, sizeof(core.psargs));
+	memset(&si, 0, sizeof(si));
+	si.si_signo = f.hdr->signo;
+	si.si_code = f.hdr->si_code;
+	si.si_addr = (void*)(uintptr_t)f.hdr->fault_addr;
+	core.siginfo = &si;
+	for (uint32_t i = 0; i < nthreads; i++) {
+		threads[i].tid = mthreads[i].tid;
+		threads[i].signo = mthreads[i].signo;
+		memcpy(threads[i].regs, mthreads[i].regs, sizeof(threads[i].regs));
+	}
+	core.threads = threads;
+	core.nthreads = nthreads;
+
+	for (uint32_t i = 0; i < nranges; i++) {
+		if (ranges[i].offset > f.size || ranges[i].size > f.size - ranges[i].offset) {
+			fprintf(stderr, "%s: memory range %u truncated\n", in, i);
+			goto out;
+		}
+		segs[core.nsegs].addr = ranges[i].addr;
+		segs[core.nsegs].size = ranges[i].size;
+		segs[core.nsegs].filesz = ranges[i].size;
+		segs[core.nsegs].flags = ranges[i].flags;
+		segs[core.nsegs].data = (const char*)f.base + ranges[i].offset;
+		core.nsegs++;
+	}
+	// The arrays are sized by the directory count, not by what the stream holds
+	while (core.nfiles < nmodules && (mod = minidump_next_module(&f, &pos, &path))) {
+		files[core.nfiles].start = mod->start;
+		files[core.nfiles].end = mod->end;
+		files[core.nfiles].offset = mod->offset;
+		files[core.nfiles].path = path;
+		core.nfiles++;
+		if (mod->flags & PF_W) continue;
+		segs[core.nsegs].addr = mod->start;
+		segs[core.nsegs].size = mod->end - mod->start;
+		segs[core.nsegs].flags = mod->flags;
+		core.nsegs++;
+	}
+	qsort(segs, core.nsegs, sizeof(*segs), mdump_segment_cmp);
+	core.segs = segs;
+	core.auxv = minidump_stream(&f, MDUMP_STREAM_AUXV);
+	core.auxv_len = f.hdr->streams[MDUMP_STREAM_AUXV].size;
+	core.files = files;
+
+	fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		perror(out);
+		goto out;
+	}
+	ret = elfcore_write(fd, &core);
+	if (close(fd) < 0) {
+		perror("close core");
+		ret = -1;
+	}
+
+out:
+	free(threads);
+	free(segs);
+	free(files);
+	minidump_close(&f);
+	return ret;
+}
+
+#endif /* MINIDUMP_H */
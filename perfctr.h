@@ -0,0 +1,117 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/**
+ * Minimal `perf stat` for benchmarks: hardware counters of the calling
+ * thread, user space only, read around a region of code.
+ *
+ * Every counter is opened on its own, so a PMU that lacks one event (or a
+ * VM without a PMU, or perf_event_paranoid > 2) degrades to "n/a" for
+ * that event instead of failing the benchmark.
+ */
+
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_NR_COUNTERS,
+};
+
+struct perf_counters {
+	int fd[PERF_NR_COUNTERS];		 // -1 if unavailable
+	uint64_t value[PERF_NR_COUNTERS];
+};
+
+static const char *const perf_counter_names[PERF_NR_COUNTERS] = {
+	"cycles", "instructions", "L1d-misses", "LLC-misses", "dTLB-misses",
+};
+
+#define PERF_HW_CACHE(cache, op, result) \
+	((cache) | ((op) << 8) | ((result) << 16))
+
+/**
+ * Open the counters, disabled
+ * @return Number of counters available (0 is not an error)
+ */
+static int perf_counters_open(struct perf_counters *pc) {
+	static const struct { uint32_t type; uint64_t config; } events[PERF_NR_COUNTERS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+						    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+		{ PERF_TYPE_HW_CACHE, PERF_HW_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+						    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+		{ PERF_TYPE_HW_CACHE, PERF_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+						    PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	};
+	int available = 0;
+
+	for (int i = 0; i < PERF_NR_COUNTERS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		pc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		pc->value[i] = 0;
+		if (pc->fd[i] >= 0) available++;
+	}
+	return available;
+}
+
+static void perf_counters_start(struct perf_counters *pc) {
+	for (int i = 0; i < PERF_NR_COUNTERS; i++) {
+		if (pc->fd[i] < 0) continue;
+		ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static void perf_counters_stop(struct perf_counters *pc) {
+	for (int i = 0; i < PERF_NR_COUNTERS; i++) {
+		if (pc->fd[i] < 0) continue;
+		ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(pc->fd[i], &pc->value[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+			pc->value[i] = 0;
+		}
+	}
+}
+
+/**
+ * Print every counter divided by @ops, one line each
+ */
+static void perf_counters_print(const struct perf_counters *pc, unsigned long ops) {
+	for (int i = 0; i < PERF_NR_COUNTERS; i++) {
+		if (pc->fd[i] < 0) {
+			printf("  %-14s %12s\n", perf_counter_names[i], "n/a");
+		} else {
+			printf("  %-14s %12.3f /op\n", perf_counter_names[i],
+				   (double)pc->value[i] / (ops ? ops : 1));
+		}
+	}
+}
+
+static void perf_counters_close(struct perf_counters *pc) {
+	for (int i = 0; i < PERF_NR_COUNTERS; i++) {
+		if (pc->fd[i] >= 0) close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+}
+
+#endif /* PERFCTR_H */
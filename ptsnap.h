@@ -0,0 +1,569 @@
+#ifndef PTSNAP_H
+#define PTSNAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include <elfcore.h>
+
+/**
+ * ptrace snapshots: the parent writes the core of a crashing child itself,
+ * instead of the kernel.
+ *
+ * ptsnap_fork() forks a child that waits on a pipe until the parent has
+ * PTRACE_SEIZEd it (with PTRACE_O_TRACECLONE, so its threads are traced
+ * too).  ptsnap_wait() then runs the child to completion; at the
+ * signal-delivery-stop of its first fatal signal, before any handler runs,
+ * it interrupts the other threads, reads every thread's registers
+ * (PTRACE_GETREGSET) and writes an ELF core through elfcore.h and sparse.h.
+ * Memory is read with process_vm_readv(), many mappings per call, into a
+ * PTSNAP_BATCH buffer.  Then the signal is delivered and the child dies as
+ * it would have.  Set RLIMIT_CORE to 0 in the child to skip the kernel's
+ * core on top.
+ *
+ * Unlike the kernel, we pick what goes in: a policy selects the mappings
+ * whose contents are written; the others are in the core with no data, as
+ * the kernel does for code.
+ *
+ * process_vm_readv() needs _GNU_SOURCE.
+ */
+
+#define PTSNAP_BATCH (8 << 20)   // Bytes per process_vm_readv()
+#define PTSNAP_IOV 256		   // Mappings per process_vm_readv()
+#define PTSNAP_MAX_THREADS 256
+
+enum ptsnap_include {
+	PTSNAP_STACKS = 1 << 0,	 // Mappings holding a thread's stack pointer
+	PTSNAP_HEAP = 1 << 1,	   // [heap] and other private anonymous memory
+	PTSNAP_DATA = 1 << 2,	   // Writable file mappings: .data and .bss of each module
+	PTSNAP_CODE = 1 << 3,	   // Read-only file mappings: code, which gdb can read from the files
+	PTSNAP_ALL = PTSNAP_STACKS | PTSNAP_HEAP | PTSNAP_DATA | PTSNAP_CODE,
+};
+
+struct ptsnap_policy {
+	unsigned int include;	   // enum ptsnap_include
+	uint64_t max_region;		// Mappings bigger than this are left out, 0 = no limit
+};
+
+#define PTSNAP_POLICY_DEFAULT { PTSNAP_STACKS | PTSNAP_HEAP | PTSNAP_DATA, 256ull << 20 }
+
+struct ptsnap_stats {
+	int dumped;
+	int signo;
+	unsigned int nthreads;
+	unsigned int nmaps;
+	unsigned int nselected;	 // Mappings with contents in the core
+	uint64_t bytes;			 // Read from the process
+	unsigned int reads;		 // process_vm_readv() calls
+	double ms;				  // From the fatal signal to the core on disk
+};
+
+/*
+ * ====================================================================================
+ * Policy
+ * ====================================================================================
+ */
+
+/**
+ * Parse a policy: "stacks,heap,data,code", "all", plus "max=SIZE[KMG]"
+ * @return 0 on success, -1 on error
+ */
+int ptsnap_parse_policy(const char *spec, struct ptsnap_policy *policy) {
+	static const struct {
+		const char *name;
+		unsigned int include;
+	} names[] = {
+		{ "stacks", PTSNAP_STACKS }, { "heap", PTSNAP_HEAP }, { "data", PTSNAP_DATA },
+		{ "code", PTSNAP_CODE }, { "all", PTSNAP_ALL },
+	};
+	char buf[256], *tok, *save;
+
+	policy->include = 0;
+	policy->max_region = 0;
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		size_t i;
+
+		if (strncmp(tok, "max=", 4) == 0) {
+			char *end;
+
+			policy->max_region = strtoull(tok + 4, &end, 0);
+			switch (*end) {
+			case 'G': case 'g': policy->max_region <<= 10; /* fall through */
+			case 'M': case 'm': policy->max_region <<= 10; /* fall through */
+			case 'K': case 'k': policy->max_region <<= 10;
+			}
+			continue;
+		}
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+			if (strcmp(tok, names[i].name) == 0) break;
+		}
+		if (i == sizeof(names) / sizeof(names[0])) {
+			fprintf(stderr, "ptsnap: unknown policy '%s' (stacks, heap, data, code, all, max=SIZE)\n", tok);
+			return -1;
+		}
+		policy->include |= names[i].include;
+	}
+	return 0;
+}
+
+/*
+ * ====================================================================================
+ * Internal helpers
+ * ====================================================================================
+ */
+
+struct ptsnap_thread {
+	pid_t tid;
+	int pending;	// Signal it stopped with, to deliver on resume
+};
+
+struct ptsnap_map {
+	uint64_t start;
+	uint64_t end;
+	uint64_t offset;
+	uint32_t flags;	 // PF_*
+	int private_;
+	const char *path;   // NULL for anonymous memory
+};
+
+/* What the read callback serves from: the last batch of memory read */
+struct ptsnap_reader {
+	pid_t pid;
+	const struct elfcore_segment *segs;
+	unsigned int nsegs;
+	unsigned int next;		  // Segment to look at first
+	char *buf;
+	struct {
+		uint64_t addr;
+		uint64_t len;
+		uint64_t off;		   // In buf
+	} pieces[PTSNAP_IOV];
+	unsigned int npieces;
+	struct ptsnap_stats *stats;
+};
+
+static ssize_t ptsnap_read_file(const char *path, char *buf, size_t size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	size_t len = 0;
+	ssize_t n;
+
+	if (fd < 0) return -1;
+	while (len < size && (n = read(fd, buf + len, size - len)) > 0) len += n;
+	close(fd);
+	return len;
+}
+
+/**
+ * Internal helper: the elfcore read callback.  Misses refill the buffer
+ * with the following PTSNAP_BATCH bytes of the selected segments, in one
+ * vectored read: elfcore_write() asks for segments in order.
+ */
+static ssize_t ptsnap_read(void *arg, uint64_t addr, void *buf, size_t len) {
+	struct ptsnap_reader *r = (struct ptsnap_reader*)arg;
+	struct iovec local, remote[PTSNAP_IOV];
+	uint64_t total = 0, a = addr;
+	ssize_t n;
+	unsigned int i;
+
+	for (i = 0; i < r->npieces; i++) {
+		if (addr >= r->pieces[i].addr && addr + len <= r->pieces[i].addr + r->pieces[i].len) {
+			memcpy(buf, r->buf + r->pieces[i].off + (addr - r->pieces[i].addr), len);
+			return len;
+		}
+	}
+
+	while (r->next < r->nsegs && addr >= r->segs[r->next].addr + r->segs[r->next].filesz) r->next++;
+	r->npieces = 0;
+	for (i = r->next; i < r->nsegs && total < PTSNAP_BATCH && r->npieces < PTSNAP_IOV; i++) {
+		const struct elfcore_segment *seg = &r->segs[i];
+		uint64_t end = seg->addr + seg->filesz, piece;
+
+		if (!seg->filesz || end <= a) continue;
+		if (a < seg->addr) a = seg->addr;
+		piece = end - a < PTSNAP_BATCH - total ? end - a : PTSNAP_BATCH - total;
+		remote[r->npieces].iov_base = (void*)(uintptr_t)a;
+		remote[r->npieces].iov_len = piece;
+		r->pieces[r->npieces].addr = a;
+		r->pieces[r->npieces].len = piece;
+		r->pieces[r->npieces].off = total;
+		r->npieces++;
+		total += piece;
+	}
+	local.iov_base = r->buf;
+	local.iov_len = total;
+
+	n = process_vm_readv(r->pid, &local, 1, remote, r->npieces, 0);
+	r->stats->reads++;
+	if (n < 0) n = 0;
+	r->stats->bytes += n;
+	// A short read stops at the first page that could not be read
+	for (i = 0; i < r->npieces; i++) {
+		if (r->pieces[i].off >= (uint64_t)n) break;
+		if (r->pieces[i].off + r->pieces[i].len > (uint64_t)n) r->pieces[i].len = n - r->pieces[i].off;
+	}
+	r->npieces = i;
+
+	for (i = 0; i < r->npieces; i++) {
+		if (addr >= r->pieces[i].addr && addr + len <= r->pieces[i].addr + r->pieces[i].len) {
+			memcpy(buf, r->buf + r->pieces[i].off + (addr - r->pieces[i].addr), len);
+			return len;
+		}
+	}
+	// Unreadable here: drop the batch so the next call starts past it
+	r->npieces = 0;
+	return -1;
+}
+
+/**
+ * Internal helper: parse /proc/PID/maps into @maps (paths point into @text)
+ * @return Number of mappings
+ */
+static unsigned int ptsnap_parse_maps(char *text, struct ptsnap_map *maps, unsigned int max) {
+	unsigned int n = 0;
+
+	for (char *line = text, *next; line && *line && n < max; line = next) {
+		unsigned long long start, end, offset;
+		char perms[5];
+		int path_at = 0;
+
+		next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+		if (sscanf(line, "%llx-%llx %4s %llx %*s %*s %n", &start, &end, perms, &offset, &path_at) < 4) {
+			continue;
+		}
+		maps[n].start = start;
+		maps[n].end = end;
+		maps[n].offset = offset;
+		maps[n].flags = (perms[0] == 'r' ? PF_R : 0) | (perms[1] == 'w' ? PF_W : 0) |
+			(perms[2] == 'x' ? PF_X : 0);
+		maps[n].private_ = perms[3] == 'p';
+		maps[n].path = path_at && line[path_at] ? line + path_at : NULL;
+		n++;
+	}
+	return n;
+}
+
+static int ptsnap_select(const struct ptsnap_map *m, const struct ptsnap_policy *policy,
+						 const uint64_t *sps, unsigned int nsps) {
+	int file = m->path && m->path[0] == '/';
+
+	if (!(m->flags & PF_R) || (m->path && (strcmp(m->path, "[vvar]") == 0 || strcmp(m->path, "[vsyscall]") == 0))) {
+		return 0;
+	}
+	// Stacks are taken whatever their size
+	if (policy->include & PTSNAP_STACKS) {
+		for (unsigned int i = 0; i < nsps; i++) {
+			if (sps[i] >= m->start && sps[i] < m->end) return 1;
+		}
+	}
+	if (policy->max_region && m->end - m->start > policy->max_region) return 0;
+	if (!file) {
+		if (m->path && strcmp(m->path, "[vdso]") == 0) return 1;
+		return (policy->include & PTSNAP_HEAP) && m->private_ && (m->flags & PF_W);
+	}
+	if (m->flags & PF_W) return (policy->include & PTSNAP_DATA) != 0;
+	return (policy->include & PTSNAP_CODE) != 0;
+}
+
+static uint64_t ptsnap_sp(const elf_gregset_t regs) {
+#if defined(__x86_64__)
+	return ((const struct user_regs_struct*)regs)->rsp;
+#elif defined(__aarch64__)
+	return ((const struct user_regs_struct*)regs)->sp;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Internal helper: stop every thread but @crashed, which is already in its
+ * signal-delivery-stop.  A thread that cannot be waited for is left out.
+ * @return Number of threads in @threads, the crashed one first
+ */
+static unsigned int ptsnap_stop_threads(pid_t pid, pid_t crashed, struct ptsnap_thread *threads, unsigned int max) {
+	char path[64];
+	struct dirent *d;
+	unsigned int n = 0;
+	DIR *dir;
+
+	threads[n].tid = crashed;
+	threads[n++].pending = 0;
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (!dir) return n;
+	while ((d = readdir(dir)) && n < max) {
+		pid_t tid = atoi(d->d_name);
+
+		if (tid <= 0 || tid == crashed || ptrace(PTRACE_INTERRUPT, tid, 0, 0) < 0) continue;
+		threads[n].tid = tid;
+		threads[n].pending = 0;
+		n++;
+	}
+	closedir(dir);
+
+	for (unsigned int i = 1; i < n; i++) {
+		pid_t ret;
+		int status;
+
+		while ((ret = waitpid(threads[i].tid, &status, __WALL)) < 0 && errno == EINTR) {
+		}
+		if (ret < 0) {
+			// Gone, or not ours to wait for: leave it out of the core
+			threads[i--] = threads[--n];
+			continue;
+		}
+		// Stopped with a signal of its own rather than by the interrupt: deliver it later
+		if (WIFSTOPPED(status) && !(status >> 16)) {
+			threads[i].pending = WSTOPSIG(status);
+		}
+	}
+	return n;
+}
+
+/*
+ * ====================================================================================
+ * API
+ * ====================================================================================
+ */
+
+/**
+ * Write the core of the stopped process @pid, whose thread @crashed is in
+ * the signal-delivery-stop of @signo
+ * @return 0 on success, -1 on error
+ */
+int ptsnap_dump(pid_t pid, pid_t crashed, int signo, const char *path, const struct ptsnap_policy *policy,
+				struct ptsnap_stats *stats) {
+	static struct ptsnap_thread pthreads[PTSNAP_MAX_THREADS];
+	struct elfcore_thread *threads = NULL;
+	struct elfcore_segment *segs = NULL;
+	struct elfcore_file *files = NULL;
+	struct ptsnap_map *maps = NULL;
+	struct ptsnap_reader *reader = NULL;
+	struct elfcore core;
+	struct timespec start, end;
+	siginfo_t si;
+	uint64_t sps[PTSNAP_MAX_THREADS];
+	unsigned int nthreads, nmaps, maxmaps;
+	char proc[64], *text = NULL, auxv[4096];
+	ssize_t len;
+	int fd, ret = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(stats, 0, sizeof(*stats));
+	memset(&core, 0, sizeof(core));
+	nthreads = ptsnap_stop_threads(pid, crashed, pthreads, PTSNAP_MAX_THREADS);
+
+	threads = (struct elfcore_thread*)calloc(nthreads, sizeof(*threads));
+	text = (char*)malloc(4 << 20);
+	if (!threads || !text) {
+		perror("ptsnap: malloc");
+		goto out;
+	}
+	for (unsigned int i = 0; i < nthreads; i++) {
+		struct iovec iov = { threads[i].regs, sizeof(threads[i].regs) };
+
+		threads[i].tid = pthreads[i].tid;
+		threads[i].signo = i == 0 ? signo : 0;
+		if (ptrace(PTRACE_GETREGSET, pthreads[i].tid, NT_PRSTATUS, &iov) < 0) perror("ptsnap: PTRACE_GETREGSET");
+		sps[i] = ptsnap_sp(threads[i].regs);
+	}
+	if (ptrace(PTRACE_GETSIGINFO, crashed, 0, &si) == 0) core.siginfo = &si;
+
+	snprintf(proc, sizeof(proc), "/proc/%d/maps", pid);
+	len = ptsnap_read_file(proc, text, (4 << 20) - 1);
+	if (len < 0) {
+		perror(proc);
+		goto out;
+	}
+	text[len] = '\0';
+	maxmaps = 1;
+	for (ssize_t i = 0; i < len; i++) maxmaps += text[i] == '\n';
+	maps = (struct ptsnap_map*)calloc(maxmaps, sizeof(*maps));
+	segs = (struct elfcore_segment*)calloc(maxmaps, sizeof(*segs));
+	files = (struct elfcore_file*)calloc(maxmaps, sizeof(*files));
+	reader = (struct ptsnap_reader*)calloc(1, sizeof(*reader));
+	if (!maps || !segs || !files || !reader || !(reader->buf = (char*)malloc(PTSNAP_BATCH))) {
+		perror("ptsnap: calloc");
+		goto out;
+	}
+	nmaps = ptsnap_parse_maps(text, maps, maxmaps);
+
+	for (unsigned int i = 0; i < nmaps; i++) {
+		const struct ptsnap_map *m = &maps[i];
+		struct elfcore_segment *seg = &segs[core.nsegs++];
+
+		seg->addr = m->start;
+		seg->size = m->end - m->start;
+		seg->flags = m->flags;
+		if (ptsnap_select(m, policy, sps, nthreads)) {
+			seg->filesz = seg->size;
+			stats->nselected++;
+		}
+		if (m->path && m->path[0] == '/') {
+			files[core.nfiles].start = m->start;
+			files[core.nfiles].end = m->end;
+			files[core.nfiles].offset = m->offset;
+			files[core.nfiles].path = m->path;
+			core.nfiles++;
+		}
+	}
+
+	core.pid = pid;
+	core.signo = signo;
+	snprintf(proc, sizeof(proc), "/proc/%d/comm", pid);
+	len = ptsnap_read_file(proc, core.fname, sizeof(core.fname) - 1);
+	if (len > 0 && core.fname[len - 1] == '\n') core.fname[len - 1] = '\0';
+	snprintf(proc, sizeof(proc), "/proc/%d/cmdline", pid);
+	len = ptsnap_read_file(proc, core.psargs, sizeof(core.psargs) - 1);
+	for (ssize_t i = 0; i < len - 1; i++) {
+		if (!core.psargs[i]) core.psargs[i] = ' ';
+	}
+	snprintf(proc, sizeof(proc), "/proc/%d/auxv", pid);
+	len = ptsnap_read_file(proc, auxv, sizeof(auxv));
+	core.auxv = auxv;
+	core.auxv_len = len > 0 ? len : 0;
+	core.threads = threads;
+	core.nthreads = nthreads;
+	core.segs = segs;
+	core.files = files;
+
+	reader->pid = pid;
+	reader->segs = segs;
+	reader->nsegs = core.nsegs;
+	reader->stats = stats;
+	core.read = ptsnap_read;
+	core.read_arg = reader;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		perror(path);
+		goto out;
+	}
+	ret = elfcore_write(fd, &core);
+	if (close(fd) < 0) ret = -1;
+
+	stats->dumped = ret == 0;
+	stats->signo = signo;
+	stats->nthreads = nthreads;
+	stats->nmaps = nmaps;
+out:
+	// Everyone but the crashed thread goes on; the caller delivers its signal
+	for (unsigned int i = 1; i < nthreads; i++) ptrace(PTRACE_CONT, pthreads[i].tid, 0, pthreads[i].pending);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	stats->ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+	if (reader) free(reader->buf);
+	free(reader);
+	free(threads);
+	free(segs);
+	free(files);
+	free(maps);
+	free(text);
+	return ret;
+}
+
+/**
+ * fork() a child that is traced by the parent before it returns
+ * @return As fork()
+ */
+pid_t ptsnap_fork(void) {
+	int handshake[2];
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(handshake) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(handshake[0]);
+		close(handshake[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		// Wait until seized: whatever the child does next happens traced
+		close(handshake[1]);
+		while (read(handshake[0], &c, 1) < 0 && errno == EINTR) {
+		}
+		close(handshake[0]);
+		return 0;
+	}
+
+	close(handshake[0]);
+	if (ptrace(PTRACE_SEIZE, pid, 0, PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL) < 0) {
+		perror("PTRACE_SEIZE");
+	}
+	if (write(handshake[1], &c, 1) < 0) perror("write handshake");
+	close(handshake[1]);
+	return pid;
+}
+
+static int ptsnap_fatal(int sig) {
+	switch (sig) {
+	case SIGSEGV: case SIGBUS: case SIGILL: case SIGFPE: case SIGABRT:
+	case SIGTRAP: case SIGSYS: case SIGQUIT: case SIGXCPU: case SIGXFSZ:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Run the child from ptsnap_fork() to its end, writing @path at its first
+ * fatal signal
+ * @param status Its wait status
+ * @param stats Filled in, stats->dumped tells whether there is a core
+ * @return 0 on success, -1 on error
+ */
+int ptsnap_wait(pid_t pid, const char *path, const struct ptsnap_policy *policy, int *status,
+				struct ptsnap_stats *stats) {
+	int tried = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	for (;;) {
+		int st, sig;
+		pid_t tid = waitpid(-1, &st, __WALL);
+
+		if (tid < 0) {
+			if (errno == EINTR) continue;
+			perror("waitpid");
+			return -1;
+		}
+		if (WIFEXITED(st) || WIFSIGNALED(st)) {
+			if (tid == pid) {
+				*status = st;
+				return 0;
+			}
+			continue;   // A thread
+		}
+		if (!WIFSTOPPED(st)) continue;
+
+		sig = WSTOPSIG(st);
+		// ptrace events (clone) and group-stops, new threads included: carry on
+		if (st >> 16) {
+			ptrace(PTRACE_CONT, tid, 0, 0);
+			continue;
+		}
+		// Only the first: a crash handler that re-raises brings the signal back
+		if (ptsnap_fatal(sig) && !tried++) ptsnap_dump(pid, tid, sig, path, policy, stats);
+		ptrace(PTRACE_CONT, tid, 0, sig);
+	}
+}
+
+#endif /* PTSNAP_H */
@@ -7,21 +7,12 @@ struct mytype {
     struct rb_node node;
 };
 
+#define mytype_cmp(key, entry) (((key) > (entry)->value) - ((key) < (entry)->value))
+
 struct mytype *my_search(struct rb_root *root, int value) {
-    struct rb_node *node = root->rb_node;
     struct mytype *entry;
 
-    while (node) {
-        entry = rb_entry(node, struct mytype, node);
-        if (value < entry->value) {
-            node = node->rb_left;
-        } else if (value > entry->value) {
-            node = node->rb_right;
-        } else {
-            return entry;
-        }
-    }
-    return NULL;
+    return rb_find_entry(entry, root, node, mytype_cmp(value, entry));
 }
 
 int my_insert(struct rb_root *root, struct mytype *data) {
@@ -58,13 +49,25 @@ void my_delete(struct rb_root *root, int value) {
     free(data);
 }
 
+void my_release(struct rb_node *node, void *arg) {
+    free(rb_entry(node, struct mytype, node));
+}
+
 void print_tree(struct rb_root *root) {
-    struct rb_node *node;
     struct mytype *entry;
 
     printf("In-order traversal: ");
-    for (node = rb_first(root); node; node = rb_next(node)) {
-        entry = rb_entry(node, struct mytype, node);
+    rb_for_each_entry(entry, root, node) {
+        printf("%d ", entry->value);
+    }
+    printf("\n");
+}
+
+void print_range(struct rb_root *root, int lo, int hi) {
+    struct mytype *entry;
+
+    printf("Range [%d, %d): ", lo, hi);
+    rb_for_each_entry_range(entry, root, node, mytype_cmp(lo, entry), mytype_cmp(hi, entry)) {
         printf("%d ", entry->value);
     }
     printf("\n");
@@ -106,6 +109,18 @@ int main() {
         printf("Searched for %d: not found\n", search_val);
     }
 
+    // Test bounds and range iteration
+    struct mytype *bound;
+    int bound_val = 11;
+    rb_lower_bound_entry(bound, &mytree, node, mytype_cmp(bound_val, bound));
+    printf("lower_bound(%d): %s\n", bound_val, bound ? "found" : "end");
+    bound_val = 3;
+    rb_upper_bound_entry(bound, &mytree, node, mytype_cmp(bound_val, bound));
+    if (bound) {
+        printf("upper_bound(%d): %d\n", bound_val, bound->value);
+    }
+    print_range(&mytree, 3, 7);
+
     // Test delete
     int delete_val = 5;
     printf("Deleting %d\n", delete_val);
@@ -114,13 +129,8 @@ int main() {
     // Print tree after delete
     print_tree(&mytree);
 
-    // Clean up remaining nodes
-    while (!RB_EMPTY_ROOT(&mytree)) {
-        struct rb_node *node = rb_first(&mytree);
-        struct mytype *entry = rb_entry(node, struct mytype, node);
-        rb_erase(node, &mytree);
-        free(entry);
-    }
+    // Clean up remaining nodes in post-order: O(n), no rebalancing
+    rb_destroy(&mytree, my_release, NULL);
 
     return 0;
 }
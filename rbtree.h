@@ -28,6 +28,7 @@
 #define _LINUX_RBTREE_H
 
 #include <stddef.h>
+#include <stats.h>
 
 #ifndef container_of
 #define container_of(ptr, type, member)                                                            \
@@ -105,12 +106,140 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
 	*rb_link = node;
 }
 
+#define rb_entry_safe(ptr, type, member)                                                           \
+	({                                                                                         \
+		typeof(ptr) ____ptr = (ptr);                                                       \
+		____ptr ? rb_entry(____ptr, type, member) : NULL;                                  \
+	})
+
+/*
+ * Search helpers, specialized on a compare expression instead of a
+ * callback so the compare is inlined into the loop.
+ *
+ * @cmp is evaluated with @pos pointing at the entry being visited and must
+ * yield <0, 0 or >0 when the searched key is less than, equal to or
+ * greater than that entry, e.g. for an int key:
+ *
+ *	rb_find_entry(pos, &tree, node, (key > pos->value) - (key < pos->value));
+ *
+ * Each helper leaves its result in @pos (NULL when there is none).
+ */
+
+/* rb_find_entry - the entry equal to the key */
+#define rb_find_entry(pos, root, member, cmp)                                                      \
+	({                                                                                         \
+		struct rb_node *__n = (root)->rb_node;                                             \
+		typeof(pos) __hit = NULL;                                                          \
+		while (__n) {                                                                      \
+			int __c;                                                                   \
+			pos = rb_entry(__n, typeof(*pos), member);                                 \
+			__c = (cmp);                                                               \
+			if (__c < 0)                                                               \
+				__n = __n->rb_left;                                                \
+			else if (__c > 0)                                                          \
+				__n = __n->rb_right;                                               \
+			else {                                                                     \
+				__hit = pos;                                                       \
+				break;                                                             \
+			}                                                                          \
+		}                                                                                  \
+		pos = __hit;                                                                       \
+	})
+
+/* rb_lower_bound_entry - the first entry that is >= key */
+#define rb_lower_bound_entry(pos, root, member, cmp)                                               \
+	({                                                                                         \
+		struct rb_node *__n = (root)->rb_node;                                             \
+		typeof(pos) __hit = NULL;                                                          \
+		while (__n) {                                                                      \
+			pos = rb_entry(__n, typeof(*pos), member);                                 \
+			if ((cmp) <= 0) {                                                          \
+				__hit = pos;                                                       \
+				__n = __n->rb_left;                                                \
+			} else                                                                     \
+				__n = __n->rb_right;                                               \
+		}                                                                                  \
+		pos = __hit;                                                                       \
+	})
+
+/* rb_upper_bound_entry - the first entry that is > key */
+#define rb_upper_bound_entry(pos, root, member, cmp)                                               \
+	({                                                                                         \
+		struct rb_node *__n = (root)->rb_node;                                             \
+		typeof(pos) __hit = NULL;                                                          \
+		while (__n) {                                                                      \
+			pos = rb_entry(__n, typeof(*pos), member);                                 \
+			if ((cmp) < 0) {                                                           \
+				__hit = pos;                                                       \
+				__n = __n->rb_left;                                                \
+			} else                                                                     \
+				__n = __n->rb_right;                                               \
+		}                                                                                  \
+		pos = __hit;                                                                       \
+	})
+
+#define rb_next_entry(pos, member)                                                                 \
+	rb_entry_safe(rb_next(&(pos)->member), typeof(*(pos)), member)
+
+/**
+ * rb_for_each_entry - iterate over a tree in sort order
+ * @pos:    the type * to use as a loop counter.
+ * @root:   the rb_root of the tree.
+ * @member: the name of the rb_node within the struct.
+ */
+#define rb_for_each_entry(pos, root, member)                                                       \
+	for (pos = rb_entry_safe(rb_first(root), typeof(*pos), member); pos;                       \
+	     pos = rb_next_entry(pos, member))
+
+/**
+ * rb_for_each_entry_range - iterate over the entries in [lo, hi)
+ * @pos:    the type * to use as a loop counter.
+ * @root:   the rb_root of the tree.
+ * @member: the name of the rb_node within the struct.
+ * @lo_cmp: compare expression of the lower key against @pos (see above).
+ * @hi_cmp: compare expression of the upper key against @pos.
+ */
+#define rb_for_each_entry_range(pos, root, member, lo_cmp, hi_cmp)                                 \
+	for (rb_lower_bound_entry(pos, root, member, lo_cmp); pos && (hi_cmp) > 0;                 \
+	     pos = rb_next_entry(pos, member))
+
+/* Postorder iteration: children are always visited before their parent */
+extern struct rb_node *rb_first_postorder(const struct rb_root *);
+extern struct rb_node *rb_next_postorder(const struct rb_node *);
+
+/*
+ * Release every node in one post-order pass, no rebalancing.  @release
+ * must not be NULL: the nodes are embedded in the caller's structures,
+ * so only the caller knows how to free them (e.g. free(rb_entry(...))).
+ */
+extern void rb_destroy(struct rb_root *root, void (*release)(struct rb_node *, void *),
+		       void *arg);
+
+/**
+ * rbtree_postorder_for_each_entry_safe - iterate in post-order over the
+ * tree, safe against the visited entry being freed.  Unlike rb_erase()
+ * in a loop it never rebalances, so tearing down a whole tree is O(n).
+ * The tree must not be used (or rb_erase()d from) during the walk; reset
+ * the root with RB_ROOT afterwards.
+ * @pos:    the type * to use as a loop counter.
+ * @n:      another type * to use as temporary storage.
+ * @root:   the rb_root of the tree.
+ * @member: the name of the rb_node within the struct.
+ */
+#define rbtree_postorder_for_each_entry_safe(pos, n, root, member)                                 \
+	for (pos = rb_entry_safe(rb_first_postorder(root), typeof(*pos), member);                 \
+	     pos && ({ n = rb_entry_safe(rb_next_postorder(&pos->member), typeof(*pos), member);   \
+			1; });                                                                     \
+	     pos = n)
+
 
 static void __rb_rotate_left(struct rb_node *node, struct rb_root *root)
 {
 	struct rb_node *right = node->rb_right;
 	struct rb_node *parent = rb_parent(node);
 
+	STAT_INC(STAT_RB_ROTATE);
+
 	if ((node->rb_right = right->rb_left))
 		rb_set_parent(right->rb_left, node);
 	right->rb_left = node;
@@ -133,6 +262,8 @@ static void __rb_rotate_right(struct rb_node *node, struct rb_root *root)
 	struct rb_node *left = node->rb_left;
 	struct rb_node *parent = rb_parent(node);
 
+	STAT_INC(STAT_RB_ROTATE);
+
 	if ((node->rb_left = left->rb_right))
 		rb_set_parent(left->rb_right, node);
 	left->rb_right = node;
@@ -154,6 +285,8 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root)
 {
 	struct rb_node *parent, *gparent;
 
+	STAT_INC(STAT_RB_INSERT);
+
 	while ((parent = rb_parent(node)) && rb_is_red(parent)) {
 		gparent = rb_parent(parent);
 
@@ -283,6 +416,8 @@ void rb_erase(struct rb_node *node, struct rb_root *root)
 	struct rb_node *child, *parent;
 	int color;
 
+	STAT_INC(STAT_RB_ERASE);
+
 	if (!node->rb_left)
 		child = node->rb_right;
 	else if (!node->rb_right)
@@ -424,6 +559,65 @@ struct rb_node *rb_prev(const struct rb_node *node)
 	return parent;
 }
 
+static struct rb_node *rb_left_deepest_node(const struct rb_node *node)
+{
+	for (;;) {
+		if (node->rb_left)
+			node = node->rb_left;
+		else if (node->rb_right)
+			node = node->rb_right;
+		else
+			return (struct rb_node *)node;
+	}
+}
+
+struct rb_node *rb_next_postorder(const struct rb_node *node)
+{
+	const struct rb_node *parent;
+
+	if (!node)
+		return NULL;
+	parent = rb_parent(node);
+
+	/* If we're sitting on node, we've already seen our children */
+	if (parent && node == parent->rb_left && parent->rb_right) {
+		/* If we are the parent's left node, go to the parent's right
+		 * node then all the way down to the left */
+		return rb_left_deepest_node(parent->rb_right);
+	}
+	else
+		/* Otherwise we are the parent's right node, and the parent
+		 * should be next */
+		return (struct rb_node *)parent;
+}
+
+struct rb_node *rb_first_postorder(const struct rb_root *root)
+{
+	if (!root->rb_node)
+		return NULL;
+
+	return rb_left_deepest_node(root->rb_node);
+}
+
+/*
+ * Hand every node to @release, which must not be NULL (e.g. free() the
+ * container or put it back on a pool), and leave @root empty.  Each node
+ * is released after both of its children and its links are never read
+ * again, so @release may reuse or poison it.  O(n), against O(n log n)
+ * for rb_erase() in a loop.
+ */
+void rb_destroy(struct rb_root *root, void (*release)(struct rb_node *, void *), void *arg)
+{
+	struct rb_node *node = rb_first_postorder(root), *next;
+
+	while (node) {
+		next = rb_next_postorder(node);
+		release(node, arg);
+		node = next;
+	}
+	root->rb_node = NULL;
+}
+
 void rb_replace_node(struct rb_node *victim, struct rb_node *new_entry, struct rb_root *root)
 {
 	struct rb_node *parent = rb_parent(victim);
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <skiplist.h>
+#include <rbtree.h>
+
+struct item {
+	long key;
+	struct item *retired;	// bench: erased, freed once the workers are joined
+	struct sl_node node;
+};
+
+static int item_cmp(const struct sl_node *node, const void *key)
+{
+	long a = sl_entry(node, struct item, node)->key;
+	long b = *(const long *)key;
+
+	return (a > b) - (a < b);
+}
+
+static void print_list(struct skiplist *sl, const char *tag)
+{
+	struct item *it;
+
+	printf("%s: ", tag);
+	sl_for_each_entry(it, sl, node) {
+		printf("%ld ", it->key);
+	}
+	printf("\n");
+}
+
+/*
+ * ====================================================================================
+ * Scaling benchmark: skip list vs. mutex-guarded rbtree
+ * ====================================================================================
+ */
+
+#define BENCH_KEYS (1 << 16)
+#define BENCH_OPS (1 << 20)
+#define BENCH_MAX_THREADS 64
+
+struct rb_item {
+	long key;
+	struct rb_node node;
+};
+
+static struct skiplist bench_sl;
+static struct item *sl_retired[BENCH_MAX_THREADS];
+
+static struct rb_root bench_rb = RB_ROOT;
+static pthread_mutex_t bench_rb_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rb_item *rb_items;
+
+static int bench_threads;
+
+static int rb_bench_insert(struct rb_root *root, struct rb_item *data)
+{
+	struct rb_node **new_node = &root->rb_node, *parent = NULL;
+
+	while (*new_node) {
+		struct rb_item *this = rb_entry(*new_node, struct rb_item, node);
+
+		parent = *new_node;
+		if (data->key < this->key)
+			new_node = &(*new_node)->rb_left;
+		else if (data->key > this->key)
+			new_node = &(*new_node)->rb_right;
+		else
+			return 0;
+	}
+	rb_link_node(&data->node, parent, new_node);
+	rb_insert_color(&data->node, root);
+	return 1;
+}
+
+static struct rb_item *rb_bench_search(struct rb_root *root, long key)
+{
+	struct rb_node *node = root->rb_node;
+
+	while (node) {
+		struct rb_item *this = rb_entry(node, struct rb_item, node);
+
+		if (key < this->key)
+			node = node->rb_left;
+		else if (key > this->key)
+			node = node->rb_right;
+		else
+			return this;
+	}
+	return NULL;
+}
+
+static unsigned long bench_rand(unsigned long *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static struct item *sl_bench_item(long key)
+{
+	struct item *it = malloc(sizeof(*it));
+
+	if (!it) {
+		perror("malloc item");
+		exit(1);
+	}
+	it->key = key;
+	it->retired = NULL;
+	return it;
+}
+
+/*
+ * 80% lookups, 10% inserts, 10% erases.  Every thread only writes the
+ * keys with key % nthreads == tid.  Each insert links a fresh node: an
+ * erased node may still be walked by other threads, so it is only put on
+ * the thread's retire list and freed by sl_bench_free() after the join.
+ */
+static void *sl_worker(void *arg)
+{
+	long tid = (long)arg;
+	unsigned long seed = 0x2545f4914f6cdd1dUL * (tid + 1);
+	struct sl_node *node;
+	struct item *it;
+
+	for (long i = 0; i < BENCH_OPS / bench_threads; i++) {
+		unsigned long r = bench_rand(&seed);
+		long key = (long)((r >> 8) % BENCH_KEYS);
+		unsigned int op = r % 10;
+
+		if (op < 8) {
+			sl_find(&bench_sl, &key);
+			continue;
+		}
+		key -= key % bench_threads;
+		key += tid;
+		if (key >= BENCH_KEYS)
+			continue;
+		if (op == 8) {
+			it = sl_bench_item(key);
+			if (!sl_insert(&bench_sl, &it->node, &it->key))
+				free(it);	// Never linked
+		} else {
+			node = sl_erase(&bench_sl, &key);
+			if (node) {
+				it = sl_entry(node, struct item, node);
+				it->retired = sl_retired[tid];
+				sl_retired[tid] = it;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *rb_worker(void *arg)
+{
+	long tid = (long)arg;
+	unsigned long seed = 0x2545f4914f6cdd1dUL * (tid + 1);
+
+	for (long i = 0; i < BENCH_OPS / bench_threads; i++) {
+		unsigned long r = bench_rand(&seed);
+		long key = (long)((r >> 8) % BENCH_KEYS);
+		unsigned int op = r % 10;
+		struct rb_item *hit;
+
+		pthread_mutex_lock(&bench_rb_lock);
+		if (op < 8) {
+			rb_bench_search(&bench_rb, key);
+		} else if (op == 8) {
+			if (!rb_bench_search(&bench_rb, key))
+				rb_bench_insert(&bench_rb, &rb_items[key]);
+		} else {
+			hit = rb_bench_search(&bench_rb, key);
+			if (hit)
+				rb_erase(&hit->node, &bench_rb);
+		}
+		pthread_mutex_unlock(&bench_rb_lock);
+	}
+	return NULL;
+}
+
+static double bench_run(void *(*worker)(void *), int nthreads)
+{
+	pthread_t threads[BENCH_MAX_THREADS];
+	struct timespec t0, t1;
+
+	bench_threads = nthreads;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (long t = 0; t < nthreads; t++)
+		pthread_create(&threads[t], NULL, worker, (void *)t);
+	for (long t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/* Free the list and the retired nodes; the workers are joined */
+static void sl_bench_free(void)
+{
+	struct sl_node *node;
+	struct item *it;
+	long key;
+
+	while ((node = sl_first(&bench_sl)) != NULL) {
+		key = sl_entry(node, struct item, node)->key;
+		sl_erase(&bench_sl, &key);
+		free(sl_entry(node, struct item, node));
+	}
+	for (int t = 0; t < BENCH_MAX_THREADS; t++) {
+		while ((it = sl_retired[t]) != NULL) {
+			sl_retired[t] = it->retired;
+			free(it);
+		}
+	}
+}
+
+static void bench_reset(void)
+{
+	sl_bench_free();
+	sl_init(&bench_sl, item_cmp);
+	bench_rb = RB_ROOT;
+	for (long k = 0; k < BENCH_KEYS; k++) {
+		rb_items[k].key = k;
+		/* Start half full */
+		if (k & 1) {
+			struct item *it = sl_bench_item(k);
+
+			sl_insert(&bench_sl, &it->node, &it->key);
+			rb_bench_insert(&bench_rb, &rb_items[k]);
+		}
+	}
+}
+
+static int bench(int max_threads)
+{
+	rb_items = calloc(BENCH_KEYS, sizeof(*rb_items));
+	if (!rb_items) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("%-8s %20s %20s\n", "threads", "skiplist Mops/s", "rbtree+mutex Mops/s");
+	for (int n = 1; n <= max_threads; n *= 2) {
+		double sl_sec, rb_sec;
+
+		bench_reset();
+		sl_sec = bench_run(sl_worker, n);
+		bench_reset();
+		rb_sec = bench_run(rb_worker, n);
+
+		printf("%-8d %20.2f %20.2f\n", n, BENCH_OPS / sl_sec / 1e6, BENCH_OPS / rb_sec / 1e6);
+	}
+
+	sl_bench_free();
+	free(rb_items);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct skiplist sl;
+	long values[] = {5, 3, 7, 2, 4, 6, 8, 1, 9, 10};
+	int num_values = sizeof(values) / sizeof(values[0]);
+	struct sl_node *node;
+	struct item *it;
+	long key;
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+
+		if (max_threads < 1 || max_threads > BENCH_MAX_THREADS)
+			max_threads = 8;
+		return bench(max_threads);
+	}
+
+	sl_init(&sl, item_cmp);
+
+	// Insert values
+	printf("Inserting values: ");
+	for (int i = 0; i < num_values; i++) {
+		it = malloc(sizeof(*it));
+		if (!it) {
+			perror("malloc failed");
+			return 1;
+		}
+		it->key = values[i];
+		if (sl_insert(&sl, &it->node, &it->key)) {
+			printf("%ld ", values[i]);
+		} else {
+			free(it);
+			printf("(duplicate %ld skipped) ", values[i]);
+		}
+	}
+	printf("\n");
+	print_list(&sl, "In-order traversal");
+
+	// Find and lower_bound
+	key = 4;
+	node = sl_find(&sl, &key);
+	printf("Searched for %ld: %s\n", key, node ? "found" : "not found");
+
+	key = 11;
+	node = sl_lower_bound(&sl, &key);
+	printf("lower_bound(%ld): %s\n", key, node ? "found" : "end");
+
+	// Erase
+	key = 5;
+	printf("Deleting %ld\n", key);
+	node = sl_erase(&sl, &key);
+	if (node)
+		free(sl_entry(node, struct item, node));
+
+	key = 5;
+	printf("Entries from %ld: ", key);
+	sl_for_each_entry_from(it, &sl, &key, node) {
+		printf("%ld ", it->key);
+	}
+	printf("\n");
+
+	// Clean up: single threaded now, so nodes can be freed right away
+	while ((node = sl_first(&sl)) != NULL) {
+		key = sl_entry(node, struct item, node)->key;
+		sl_erase(&sl, &key);
+		free(sl_entry(node, struct item, node));
+	}
+
+	printf("Run './skiplist bench [max_threads]' for the scaling benchmark.\n");
+	return 0;
+}
@@ -0,0 +1,398 @@
+/*
+  Concurrent Skip List
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Ordered map for many concurrent writers, where rbtree.h only allows one
+  (rb_insert_color() may rotate every node up to the root).
+
+  This is the "lazy" skip list of Herlihy, Lev, Luchangco and Shavit:
+  - sl_find(), sl_lower_bound() and iteration take no locks at all.
+  - sl_insert() and sl_erase() only lock the predecessors of the node
+    they touch, one small spinlock per node, so writers on different
+    parts of the key space never meet.
+
+  Like list.h the node is intrusive: embed a struct sl_node in your own
+  structure and get back to it with sl_entry().  Keys stay in your
+  structure too, the list only asks a compare function about them.
+
+  Memory reclamation is left to the user.  A node returned by sl_erase()
+  is unlinked, but a concurrent reader may still be walking through it,
+  so it must not be freed until no sl_* call that started before the
+  erase can still be running (e.g. after joining the worker threads, or
+  behind an epoch/RCU scheme).  Erased nodes keep their forward links
+  so such readers always make progress.
+*/
+
+#ifndef _SKIPLIST_H
+#define _SKIPLIST_H
+
+#include <stddef.h>
+#include <sched.h>
+
+#ifndef container_of
+#define container_of(ptr, type, member)                                                            \
+	({                                                                                         \
+		const typeof(((type *)0)->member) *__mptr = (ptr);                                 \
+		(type *)((char *)__mptr - offsetof(type, member));                                 \
+	})
+#endif
+
+/*
+ * Tower height limit.  A list stays O(log n) up to about 2^SL_MAX_LEVEL
+ * entries; define it before including this header for bigger lists.
+ * Every node carries SL_MAX_LEVEL forward pointers.
+ */
+#ifndef SL_MAX_LEVEL
+#define SL_MAX_LEVEL 16
+#endif
+
+struct sl_node {
+	int height;	   // Number of levels this node is linked on
+	int marked;	   // Logically deleted (set under lock, before unlinking)
+	int fully_linked; // Linked on all of its levels
+	int lock;	   // Per-node spinlock, only taken by writers
+	struct sl_node *next[SL_MAX_LEVEL];
+};
+
+/**
+ * Compare function: <0, 0 or >0 when the key of @node is less than,
+ * equal to or greater than @key.
+ */
+typedef int (*sl_cmp_t)(const struct sl_node *node, const void *key);
+
+struct skiplist {
+	struct sl_node head; // Sentinel, smaller than every key
+	sl_cmp_t cmp;
+};
+
+#define sl_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define sl_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define sl_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static inline void sl_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+static inline void sl_lock(struct sl_node *node)
+{
+	unsigned int spins = 0;
+
+	while (__atomic_exchange_n(&node->lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&node->lock, __ATOMIC_RELAXED)) {
+			/* The holder may be preempted: don't burn its time slice. */
+			if (++spins & 63)
+				sl_cpu_relax();
+			else
+				sched_yield();
+		}
+	}
+}
+
+static inline void sl_unlock(struct sl_node *node)
+{
+	__atomic_store_n(&node->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Geometric tower height (p = 1/2) from a per-thread xorshift generator,
+ * so writers never share random state.
+ */
+static inline int sl_random_level(void)
+{
+	static __thread unsigned long seed;
+
+	if (!seed)
+		seed = (unsigned long)&seed ^ 0x9e3779b97f4a7c15UL;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return 1 + __builtin_ctzl(seed | (1UL << (SL_MAX_LEVEL - 1)));
+}
+
+/**
+ * Initialize an empty skip list
+ * @param sl  Skip list
+ * @param cmp Compare function used by every operation
+ */
+static inline void sl_init(struct skiplist *sl, sl_cmp_t cmp)
+{
+	int lv;
+
+	sl->head.height = SL_MAX_LEVEL;
+	sl->head.marked = 0;
+	sl->head.fully_linked = 1;
+	sl->head.lock = 0;
+	for (lv = 0; lv < SL_MAX_LEVEL; lv++)
+		sl->head.next[lv] = NULL;
+	sl->cmp = cmp;
+}
+
+static inline int sl_empty(struct skiplist *sl)
+{
+	return sl_load(&sl->head.next[0]) == NULL;
+}
+
+/*
+ * Fill preds[]/succs[] with the last node < key and the first node >= key
+ * on every level.  Returns the highest level a node equal to key was seen
+ * on, or -1.
+ */
+static int __sl_find(struct skiplist *sl, const void *key,
+		     struct sl_node **preds, struct sl_node **succs)
+{
+	struct sl_node *pred = &sl->head, *curr;
+	int found = -1;
+	int lv, c;
+
+	for (lv = SL_MAX_LEVEL - 1; lv >= 0; lv--) {
+		curr = sl_load(&pred->next[lv]);
+		c = -1;
+		while (curr && (c = sl->cmp(curr, key)) < 0) {
+			pred = curr;
+			curr = sl_load(&pred->next[lv]);
+		}
+		if (found == -1 && curr && c == 0)
+			found = lv;
+		preds[lv] = pred;
+		succs[lv] = curr;
+	}
+	return found;
+}
+
+/* Unlock the distinct predecessors of levels [0, levels) */
+static void __sl_unlock_preds(struct sl_node **preds, int levels)
+{
+	int lv;
+
+	for (lv = 0; lv < levels; lv++)
+		if (lv == 0 || preds[lv] != preds[lv - 1])
+			sl_unlock(preds[lv]);
+}
+
+/*
+ * Lock the predecessors of levels [0, levels) bottom-up and check that
+ * pred -> succs[lv] is still a live link.  When erasing, the successor is
+ * the (already marked) victim itself; otherwise it must be unmarked.
+ * *locked is the number of levels visited, for __sl_unlock_preds().
+ */
+static int __sl_lock_preds(struct sl_node **preds, struct sl_node **succs, int levels,
+			   struct sl_node *victim, int *locked)
+{
+	struct sl_node *prev = NULL;
+	int valid = 1;
+	int lv;
+
+	for (lv = 0; valid && lv < levels; lv++) {
+		struct sl_node *pred = preds[lv];
+		struct sl_node *succ = victim ? victim : succs[lv];
+
+		if (pred != prev) {
+			sl_lock(pred);
+			prev = pred;
+		}
+		valid = !sl_load(&pred->marked) && sl_load(&pred->next[lv]) == succ &&
+			(victim || !succ || !sl_load(&succ->marked));
+	}
+	*locked = lv;
+	return valid;
+}
+
+/* First node >= key that has not been erased, or NULL */
+static struct sl_node *__sl_search(struct skiplist *sl, const void *key)
+{
+	struct sl_node *pred = &sl->head, *curr = NULL;
+	int lv;
+
+	for (lv = SL_MAX_LEVEL - 1; lv >= 0; lv--) {
+		curr = sl_load(&pred->next[lv]);
+		while (curr && sl->cmp(curr, key) < 0) {
+			pred = curr;
+			curr = sl_load(&pred->next[lv]);
+		}
+	}
+	while (curr && sl_load(&curr->marked))
+		curr = sl_load(&curr->next[0]);
+	return curr;
+}
+
+/**
+ * Insert a node
+ * @param sl   Skip list
+ * @param node Node to link (embedded in the caller's structure)
+ * @param key  Key of @node, as understood by sl->cmp
+ * @return 1 if inserted, 0 if an equal key is already present
+ */
+int sl_insert(struct skiplist *sl, struct sl_node *node, const void *key)
+{
+	struct sl_node *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+	int top = sl_random_level();
+	int found, locked, lv;
+
+	for (;;) {
+		found = __sl_find(sl, key, preds, succs);
+		if (found != -1) {
+			struct sl_node *hit = succs[found];
+
+			if (!sl_load(&hit->marked)) {
+				/* Wait for a concurrent insert to publish it */
+				while (!sl_load(&hit->fully_linked))
+					sl_cpu_relax();
+				return 0;
+			}
+			/* Being erased right now: retry until it is gone */
+			continue;
+		}
+
+		if (!__sl_lock_preds(preds, succs, top, NULL, &locked)) {
+			__sl_unlock_preds(preds, locked);
+			continue;
+		}
+
+		node->height = top;
+		node->marked = 0;
+		node->fully_linked = 0;
+		node->lock = 0;
+		for (lv = 0; lv < top; lv++)
+			node->next[lv] = succs[lv];
+
+		/* Bottom-up, so the node is reachable on level 0 first */
+		for (lv = 0; lv < top; lv++)
+			sl_store(&preds[lv]->next[lv], node);
+		sl_store(&node->fully_linked, 1);
+
+		__sl_unlock_preds(preds, locked);
+		return 1;
+	}
+}
+
+/**
+ * Unlink the node matching a key
+ * @param sl  Skip list
+ * @param key Key to remove
+ * @return The unlinked node, NULL if not found.  See the header comment
+ *         before freeing it.
+ */
+struct sl_node *sl_erase(struct skiplist *sl, const void *key)
+{
+	struct sl_node *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+	struct sl_node *victim = NULL;
+	int top = 0, marked = 0;
+	int found, locked, lv;
+
+	for (;;) {
+		found = __sl_find(sl, key, preds, succs);
+
+		if (!marked) {
+			if (found == -1)
+				return NULL;
+
+			victim = succs[found];
+			if (!sl_load(&victim->fully_linked) || victim->height - 1 != found ||
+			    sl_load(&victim->marked))
+				return NULL;
+
+			top = victim->height;
+			sl_lock(victim);
+			if (victim->marked) {
+				/* Lost the race against another eraser */
+				sl_unlock(victim);
+				return NULL;
+			}
+			sl_store(&victim->marked, 1);
+			marked = 1;
+		}
+
+		if (!__sl_lock_preds(preds, succs, top, victim, &locked)) {
+			__sl_unlock_preds(preds, locked);
+			continue;
+		}
+
+		/* Top-down, so the node disappears from the fast lanes first */
+		for (lv = top - 1; lv >= 0; lv--)
+			sl_store(&preds[lv]->next[lv], victim->next[lv]);
+
+		sl_unlock(victim);
+		__sl_unlock_preds(preds, locked);
+		return victim;
+	}
+}
+
+/**
+ * Find the node matching a key
+ * @return The node, NULL if not found
+ */
+struct sl_node *sl_find(struct skiplist *sl, const void *key)
+{
+	struct sl_node *node = __sl_search(sl, key);
+
+	if (node && sl->cmp(node, key) == 0 && sl_load(&node->fully_linked))
+		return node;
+	return NULL;
+}
+
+/**
+ * Find the first node whose key is >= key
+ * @return The node, NULL if every key is smaller
+ */
+struct sl_node *sl_lower_bound(struct skiplist *sl, const void *key)
+{
+	return __sl_search(sl, key);
+}
+
+/* Ordered iteration, skipping erased nodes (weakly consistent under writers) */
+static inline struct sl_node *sl_next(const struct sl_node *node)
+{
+	struct sl_node *next = sl_load(&node->next[0]);
+
+	while (next && sl_load(&next->marked))
+		next = sl_load(&next->next[0]);
+	return next;
+}
+
+static inline struct sl_node *sl_first(struct skiplist *sl)
+{
+	return sl_next(&sl->head);
+}
+
+#define sl_entry_safe(ptr, type, member)                                                           \
+	({                                                                                         \
+		typeof(ptr) ____ptr = (ptr);                                                       \
+		____ptr ? sl_entry(____ptr, type, member) : NULL;                                  \
+	})
+
+/**
+ * sl_for_each_entry - iterate over a skip list in key order
+ * @pos:    the type * to use as a loop counter.
+ * @sl:     the skip list.
+ * @member: the name of the sl_node within the struct.
+ */
+#define sl_for_each_entry(pos, sl, member)                                                         \
+	for (pos = sl_entry_safe(sl_first(sl), typeof(*pos), member); pos;                         \
+	     pos = sl_entry_safe(sl_next(&pos->member), typeof(*pos), member))
+
+/**
+ * sl_for_each_entry_from - iterate in key order starting at the first
+ *                          entry >= key
+ */
+#define sl_for_each_entry_from(pos, sl, key, member)                                               \
+	for (pos = sl_entry_safe(sl_lower_bound(sl, key), typeof(*pos), member); pos;              \
+	     pos = sl_entry_safe(sl_next(&pos->member), typeof(*pos), member))
+
+#endif /* _SKIPLIST_H */
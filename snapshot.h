@@ -0,0 +1,503 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <hashmap.h>
+#include <lru.h>
+
+/**
+ * Snapshot files for warm restarts of struct hash_map and lru_cache_t.
+ *
+ * Layout (host byte order, all offsets from the start of the file, so the
+ * file is position independent and can be mmap()ed anywhere):
+ *
+ *	struct snap_header
+ *	struct snap_record  x count   (8-byte aligned, key inline)
+ *	uint64_t buckets[nbuckets]    (offset of the first record, 0 = empty)
+ *
+ * Each record also carries the offset of the next record in its bucket,
+ * so the bucket table plus records form a ready-made hash table:
+ * snap_open() serves lookups straight from the mapping without building
+ * anything.  hash_map_load()/lru_cache_load() instead rebuild the
+ * in-memory structure in one sequential pass over the records.
+ *
+ * LRU caches are written LRU first, so re-inserting each record at the
+ * MRU position restores the recency order.  TTLs are not saved: they
+ * refer to a monotonic clock that does not survive a restart.
+ */
+
+#define SNAP_MAGIC "LUDTMSNP"
+#define SNAP_VERSION 1
+
+enum snap_kind {
+	SNAP_HASH_MAP = 1,
+	SNAP_LRU_CACHE = 2,
+};
+
+struct snap_header {
+	char magic[8];		  // SNAP_MAGIC
+	uint32_t version;	   // SNAP_VERSION
+	uint32_t kind;		  // enum snap_kind
+	uint64_t count;		 // Number of records
+	uint32_t nbuckets;	  // Bucket count of the saved structure
+	uint32_t capacity;	  // lru_cache_t capacity, 0 for a hash map
+	uint64_t max_weight;	// lru_cache_t max_weight, 0 for a hash map
+	uint64_t records_off;   // Offset of the first record
+	uint64_t buckets_off;   // Offset of the bucket table
+	uint64_t file_size;	 // Expected size, guards against truncation
+};
+
+struct snap_record {
+	uint64_t hash;	  // hash_function(key)
+	uint64_t next;	  // Next record in the same bucket, 0 = end of chain
+	uint64_t weight;	// lru_node_t weight, 0 for a hash map
+	int32_t value;
+	uint32_t key_len;   // Excluding the NUL terminator
+	char key[];		 // key_len + 1 bytes, then padding to 8
+};
+
+#define SNAP_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+#define SNAP_RECORD_SIZE(key_len) SNAP_ALIGN(sizeof(struct snap_record) + (key_len) + 1)
+
+/**
+ * Read-only snapshot mapped in memory (see snap_open()).
+ */
+typedef struct snap_map {
+	const void *base;
+	size_t size;
+	const struct snap_header *hdr;
+	const uint64_t *buckets;
+} snap_map_t;
+
+/*
+ * ====================================================================================
+ * Writing
+ * ====================================================================================
+ */
+
+struct snap_writer {
+	FILE *fp;
+	char tmp_path[4096];
+	uint64_t off;	   // Offset of the next record
+	uint64_t count;
+	uint32_t nbuckets;
+	uint64_t *buckets;  // Chain heads built while writing
+};
+
+/**
+ * Internal helper: open "<path>.tmp" and reserve room for the header.
+ */
+static int snap_writer_open(struct snap_writer *w, const char *path, uint32_t nbuckets) {
+	struct snap_header hdr;
+
+	snprintf(w->tmp_path, sizeof(w->tmp_path), "%s.tmp", path);
+	w->off = sizeof(struct snap_header);
+	w->count = 0;
+	w->nbuckets = nbuckets;
+
+	w->buckets = (uint64_t*)calloc(nbuckets, sizeof(uint64_t));
+	if (!w->buckets) {
+		perror("calloc snapshot buckets");
+		return -1;
+	}
+
+	w->fp = fopen(w->tmp_path, "wb");
+	if (!w->fp) {
+		perror(w->tmp_path);
+		free(w->buckets);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (fwrite(&hdr, sizeof(hdr), 1, w->fp) != 1) {
+		perror("write snapshot header");
+		fclose(w->fp);
+		unlink(w->tmp_path);
+		free(w->buckets);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Internal helper: append one record and link it into its bucket chain.
+ */
+static int snap_writer_add(struct snap_writer *w, const char *key, unsigned long hash,
+			   int value, uint64_t weight) {
+	static const char pad[8];
+	struct snap_record rec;
+	uint32_t index = hash % w->nbuckets;
+	size_t key_len = strlen(key);
+	uint64_t size = SNAP_RECORD_SIZE(key_len);
+	size_t pad_len = size - sizeof(rec) - key_len - 1;
+
+	rec.hash = hash;
+	rec.next = w->buckets[index];
+	rec.weight = weight;
+	rec.value = value;
+	rec.key_len = (uint32_t)key_len;
+
+	if (fwrite(&rec, sizeof(rec), 1, w->fp) != 1 ||
+		fwrite(key, key_len + 1, 1, w->fp) != 1 ||
+		(pad_len && fwrite(pad, pad_len, 1, w->fp) != 1)) {
+		perror("write snapshot record");
+		return -1;
+	}
+
+	w->buckets[index] = w->off;
+	w->off += size;
+	w->count++;
+	return 0;
+}
+
+/**
+ * Internal helper: write the bucket table and header, then atomically
+ * replace @path.  Cleans up on failure as well (pass err != 0).
+ */
+static int snap_writer_close(struct snap_writer *w, const char *path, uint32_t kind,
+			     uint32_t capacity, uint64_t max_weight, int err) {
+	struct snap_header hdr;
+
+	if (!err) {
+		memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+		hdr.version = SNAP_VERSION;
+		hdr.kind = kind;
+		hdr.count = w->count;
+		hdr.nbuckets = w->nbuckets;
+		hdr.capacity = capacity;
+		hdr.max_weight = max_weight;
+		hdr.records_off = sizeof(struct snap_header);
+		hdr.buckets_off = w->off;
+		hdr.file_size = w->off + (uint64_t)w->nbuckets * sizeof(uint64_t);
+
+		if (fwrite(w->buckets, sizeof(uint64_t), w->nbuckets, w->fp) != w->nbuckets ||
+			fseek(w->fp, 0, SEEK_SET) != 0 ||
+			fwrite(&hdr, sizeof(hdr), 1, w->fp) != 1 ||
+			fflush(w->fp) != 0 || fsync(fileno(w->fp)) != 0) {
+			perror("write snapshot");
+			err = 1;
+		}
+	}
+
+	if (fclose(w->fp) != 0 && !err) {
+		perror("close snapshot");
+		err = 1;
+	}
+	free(w->buckets);
+
+	if (!err && rename(w->tmp_path, path) != 0) {
+		perror("rename snapshot");
+		err = 1;
+	}
+	if (err) {
+		unlink(w->tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Save a hash map
+ * @param map Hashmap pointer
+ * @param path Snapshot file (replaced atomically)
+ * @return 0 on success, -1 on failure
+ */
+int hash_map_save(struct hash_map *map, const char *path) {
+	struct snap_writer w;
+	int err = 0;
+
+	if (snap_writer_open(&w, path, map->size) < 0) return -1;
+
+	for (unsigned int i = 0; i < map->size && !err; i++) {
+		struct hlist_node *pos;
+		struct hash_node *entry;
+
+		hlist_for_each_entry(entry, pos, &map->buckets[i], h_node) {
+			if (snap_writer_add(&w, entry->key, entry->hash, entry->value, 0) < 0) {
+				err = 1;
+				break;
+			}
+		}
+	}
+
+	return snap_writer_close(&w, path, SNAP_HASH_MAP, 0, 0, err);
+}
+
+/**
+ * Save an LRU cache, keeping its recency order
+ * @param cache LRU cache instance
+ * @param path Snapshot file (replaced atomically)
+ * @return 0 on success, -1 on failure
+ */
+int lru_cache_save(lru_cache_t *cache, const char *path) {
+	struct snap_writer w;
+	lru_node_t *entry;
+	int err = 0;
+
+	if (snap_writer_open(&w, path, cache->bucket_size) < 0) return -1;
+
+	// LRU first, so that loading can simply add every record at MRU
+	list_for_each_entry_reverse(entry, &cache->lru_head, lru_list) {
+		if (snap_writer_add(&w, entry->key, entry->hash, entry->value,
+				    entry->weight) < 0) {
+			err = 1;
+			break;
+		}
+	}
+
+	return snap_writer_close(&w, path, SNAP_LRU_CACHE, cache->capacity, cache->max_weight, err);
+}
+
+/*
+ * ====================================================================================
+ * Reading
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: map a snapshot read-only and validate its header.
+ */
+static int snap_map_file(snap_map_t *snap, const char *path, uint32_t kind) {
+	struct stat st;
+	const struct snap_header *hdr;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("fstat snapshot");
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(struct snap_header)) {
+		fprintf(stderr, "%s: not a snapshot\n", path);
+		close(fd);
+		return -1;
+	}
+
+	snap->size = st.st_size;
+	snap->base = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snap->base == MAP_FAILED) {
+		perror("mmap snapshot");
+		return -1;
+	}
+
+	hdr = (const struct snap_header*)snap->base;
+	if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != SNAP_VERSION || (kind && hdr->kind != kind) ||
+		hdr->file_size != snap->size || hdr->nbuckets == 0 ||
+		hdr->buckets_off + (uint64_t)hdr->nbuckets * sizeof(uint64_t) != snap->size ||
+		hdr->records_off > hdr->buckets_off) {
+		fprintf(stderr, "%s: bad or truncated snapshot\n", path);
+		munmap((void*)snap->base, snap->size);
+		return -1;
+	}
+
+	snap->hdr = hdr;
+	snap->buckets = (const uint64_t*)((const char*)snap->base + hdr->buckets_off);
+	return 0;
+}
+
+/**
+ * Internal helper: record at @off, or NULL if it does not fit in the
+ * record area or its key is not NUL-terminated.
+ */
+static const struct snap_record* snap_record_at(const snap_map_t *snap, uint64_t off) {
+	const struct snap_record *rec;
+
+	if (off < snap->hdr->records_off || off + sizeof(*rec) > snap->hdr->buckets_off) {
+		return NULL;
+	}
+	rec = (const struct snap_record*)((const char*)snap->base + off);
+	if (off + SNAP_RECORD_SIZE(rec->key_len) > snap->hdr->buckets_off ||
+		rec->key[rec->key_len] != '\0') {
+		return NULL;
+	}
+	return rec;
+}
+
+/**
+ * Internal helper: walk all records in file order.
+ * @return 0, or -1 if the record area is corrupt.
+ */
+static int snap_for_each_record(const snap_map_t *snap,
+				int (*fn)(const struct snap_record *, void *), void *arg) {
+	uint64_t off = snap->hdr->records_off;
+
+	for (uint64_t i = 0; i < snap->hdr->count; i++) {
+		const struct snap_record *rec = snap_record_at(snap, off);
+
+		if (!rec || fn(rec, arg) < 0) return -1;
+		off += SNAP_RECORD_SIZE(rec->key_len);
+	}
+	return 0;
+}
+
+static int snap_load_hash_node(const struct snap_record *rec, void *arg) {
+	struct hash_map *map = (struct hash_map*)arg;
+	struct hash_node *entry = (struct hash_node*)malloc(sizeof(struct hash_node));
+
+	if (!entry) {
+		perror("malloc hash_node");
+		return -1;
+	}
+	entry->key = strndup(rec->key, rec->key_len);
+	if (!entry->key) {
+		perror("strdup key");
+		free(entry);
+		return -1;
+	}
+	entry->hash = rec->hash;
+	entry->value = rec->value;
+
+	// Keys in a snapshot are unique: link directly, no lookup
+	hlist_add_head(&entry->h_node, &map->buckets[rec->hash % map->size]);
+	map->count++;
+	return 0;
+}
+
+/**
+ * Rebuild a hash map from a snapshot in one sequential pass
+ * @param path Snapshot file written by hash_map_save()
+ * @return Pointer to the new hash_map, NULL on failure
+ */
+struct hash_map* hash_map_load(const char *path) {
+	snap_map_t snap;
+	struct hash_map *map;
+
+	if (snap_map_file(&snap, path, SNAP_HASH_MAP) < 0) return NULL;
+
+	map = hash_map_create(snap.hdr->nbuckets);
+	if (map) {
+		madvise((void*)snap.base, snap.size, MADV_SEQUENTIAL);
+		if (snap_for_each_record(&snap, snap_load_hash_node, map) < 0) {
+			fprintf(stderr, "%s: corrupt snapshot\n", path);
+			hash_map_destroy_bulk(map, NULL, NULL);
+			map = NULL;
+		}
+	}
+
+	munmap((void*)snap.base, snap.size);
+	return map;
+}
+
+static int snap_load_lru_node(const struct snap_record *rec, void *arg) {
+	lru_cache_t *cache = (lru_cache_t*)arg;
+	lru_node_t *node = alloc_node(cache, rec->key, rec->key_len);
+
+	if (!node) return -1;
+	node->hash = rec->hash;
+	node->value = rec->value;
+	node->weight = rec->weight;
+	tw_timer_init(&node->ttl);
+
+	hlist_add_head(&node->h_node, &cache->buckets[rec->hash % cache->bucket_size]);
+	list_add(&node->lru_list, &cache->lru_head);
+	cache->count++;
+	cache->weight += node->weight;
+	return 0;
+}
+
+/**
+ * Rebuild an LRU cache (recency order included) from a snapshot in one
+ * sequential pass
+ * @param path Snapshot file written by lru_cache_save()
+ * @return Pointer to the new cache, NULL on failure
+ */
+lru_cache_t* lru_cache_load(const char *path) {
+	snap_map_t snap;
+	lru_cache_t *cache;
+
+	if (snap_map_file(&snap, path, SNAP_LRU_CACHE) < 0) return NULL;
+
+	cache = lru_cache_create(snap.hdr->capacity, snap.hdr->nbuckets);
+	if (cache) {
+		cache->max_weight = snap.hdr->max_weight;
+		madvise((void*)snap.base, snap.size, MADV_SEQUENTIAL);
+		if (snap_for_each_record(&snap, snap_load_lru_node, cache) < 0) {
+			fprintf(stderr, "%s: corrupt snapshot\n", path);
+			lru_cache_destroy(cache);
+			cache = NULL;
+		}
+	}
+
+	munmap((void*)snap.base, snap.size);
+	return cache;
+}
+
+/*
+ * ====================================================================================
+ * Read-only mode: lookups straight from the mapped file
+ * ====================================================================================
+ */
+
+/**
+ * Map a snapshot (of either kind) for read-only lookups, with zero
+ * deserialization.
+ * @param path Snapshot file
+ * @return Pointer to the mapped snapshot, NULL on failure
+ */
+snap_map_t* snap_open(const char *path) {
+	snap_map_t *snap = (snap_map_t*)malloc(sizeof(snap_map_t));
+
+	if (!snap) {
+		perror("malloc snap_map_t");
+		return NULL;
+	}
+	if (snap_map_file(snap, path, 0) < 0) {
+		free(snap);
+		return NULL;
+	}
+	return snap;
+}
+
+/**
+ * Retrieve a value from a mapped snapshot
+ * @param snap Snapshot from snap_open()
+ * @param key Key to search
+ * @param value Pointer to store the value
+ * @return 1 if key found, 0 otherwise
+ */
+int snap_get(const snap_map_t *snap, const char *key, int *value) {
+	unsigned long hash = hash_function(key);
+	uint64_t off = snap->buckets[hash % snap->hdr->nbuckets];
+
+	while (off) {
+		const struct snap_record *rec = snap_record_at(snap, off);
+
+		if (!rec) break;  // Corrupt chain
+		if (rec->hash == hash && strcmp(rec->key, key) == 0) {
+			*value = rec->value;
+			return 1;
+		}
+		// Records are appended and link to the older chain head, so a
+		// chain only goes backwards; anything else is a corrupt cycle
+		if (rec->next >= off) break;
+		off = rec->next;
+	}
+	return 0;
+}
+
+/**
+ * Unmap a snapshot opened with snap_open()
+ */
+void snap_close(snap_map_t *snap) {
+	if (!snap) return;
+
+	munmap((void*)snap->base, snap->size);
+	free(snap);
+}
+
+#endif /* SNAPSHOT_H */
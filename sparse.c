@@ -0,0 +1,132 @@
+/*
+ * sparse: copy a file (an old core, say) leaving holes for its zero pages.
+ *
+ *   ./sparse SRC DST     copy, then report data vs hole bytes
+ *   ./sparse             zero-page scan speed: scalar vs memcmp vs SIMD
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sparse.h>
+
+#define COPY_CHUNK (1 << 20)
+
+static double now_sec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int memcmp_is_zero(const void *buf, size_t len) {
+	static const char zeros[SPARSE_PAGE];
+
+	for (size_t off = 0; off < len; off += SPARSE_PAGE) {
+		size_t n = len - off < SPARSE_PAGE ? len - off : SPARSE_PAGE;
+
+		if (memcmp((const char*)buf + off, zeros, n)) return 0;
+	}
+	return 1;
+}
+
+static int scalar_is_zero(const void *buf, size_t len) {
+	return sparse_is_zero_scalar((const unsigned char*)buf, len);
+}
+
+static void scan_bench(void) {
+	const size_t len = 64 << 20;
+	const struct {
+		const char *name;
+		int (*is_zero)(const void*, size_t);
+	} scanners[] = {
+		{ "scalar", scalar_is_zero },
+		{ "memcmp", memcmp_is_zero },
+		{ "sparse_is_zero", sparse_is_zero },
+	};
+	char *buf = (char*)calloc(1, len);
+
+	if (!buf) {
+		perror("calloc");
+		return;
+	}
+	memset(buf, 0, len);   // Fault it in
+	printf("scanning %zu MiB of zero pages, page by page\n", len >> 20);
+	for (size_t i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+		double best = 0;
+
+		for (int rep = 0; rep < 5; rep++) {
+			double t0 = now_sec(), gbs;
+			size_t zero = 0;
+
+			for (size_t off = 0; off < len; off += SPARSE_PAGE) zero += scanners[i].is_zero(buf + off, SPARSE_PAGE);
+			gbs = len / (now_sec() - t0) / 1e9;
+			if (zero != len / SPARSE_PAGE) printf("%s: wrong answer\n", scanners[i].name);
+			if (gbs > best) best = gbs;
+		}
+		printf("  %-16s %6.1f GB/s\n", scanners[i].name, best);
+	}
+	free(buf);
+}
+
+static int copy(const char *src, const char *dst) {
+	struct sparse_file sf;
+	struct stat st;
+	char *buf = (char*)malloc(COPY_CHUNK);
+	int in = open(src, O_RDONLY), out = -1, ret = -1;
+	double t0 = now_sec();
+	ssize_t n;
+
+	if (!buf) {
+		perror("malloc");
+		goto out;
+	}
+	if (in < 0) {
+		perror(src);
+		goto out;
+	}
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		perror(dst);
+		goto out;
+	}
+	if (sparse_open(&sf, out) < 0) goto out;
+
+	while ((n = read(in, buf, COPY_CHUNK)) > 0) {
+		if (sparse_write(&sf, buf, n) < 0) goto out;
+	}
+	if (n < 0) {
+		perror("read");
+		goto out;
+	}
+	if (sparse_finish(&sf) < 0 || fstat(out, &st) < 0) goto out;
+
+	printf("%s: %llu bytes, %llu data, %llu in holes, %lld allocated, %.1f ms\n", dst,
+		   (unsigned long long)sf.pos, (unsigned long long)sf.written, (unsigned long long)sf.holes,
+		   (long long)st.st_blocks * 512, (now_sec() - t0) * 1e3);
+	ret = 0;
+out:
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
+	free(buf);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc == 1) {
+		scan_bench();
+		return 0;
+	}
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s [SRC DST]\n", argv[0]);
+		return 1;
+	}
+	return copy(argv[1], argv[2]) < 0 ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Sparse file writer: sequential writes in which all-zero pages become
+ * holes, so writing a core costs what the process actually touched.
+ *
+ * Zero pages are found with vector ORs (AVX2 when the CPU has it, SSE2
+ * otherwise on x86, NEON on arm64).  A run of them is skipped with lseek(),
+ * or punched out with fallocate(FALLOC_FL_PUNCH_HOLE) where it overwrites
+ * existing data, and sparse_finish() sets the size for a trailing hole.
+ * Holes are whole pages at page-aligned file offsets; anything else is
+ * written.  On a pipe, or a file system without holes, zeros are written.
+ *
+ * fallocate() needs _GNU_SOURCE, defined before the first #include.
+ */
+
+#define SPARSE_PAGE 4096
+
+struct sparse_file {
+	int fd;
+	int seekable;
+	uint64_t pos;		// Where the next byte goes
+	uint64_t size;	   // File size: below it holes must be punched
+	uint64_t hole;	   // Zeros skipped but not yet seeked over
+	uint64_t written;	// Bytes of data
+	uint64_t holes;	  // Bytes left as holes
+};
+
+/*
+ * ====================================================================================
+ * Zero detection
+ * ====================================================================================
+ */
+
+static int sparse_is_zero_scalar(const unsigned char *p, size_t len) {
+	uint64_t acc = 0, w;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&w, p + i, 8);
+		acc |= w;
+	}
+	for (; i < len; i++) acc |= p[i];
+	return acc == 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static int sparse_is_zero_avx2(const unsigned char *p, size_t len) {
+	size_t i = 0;
+
+	for (; i + 128 <= len; i += 128) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i*)(p + i + 64));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(p + i + 96));
+		__m256i x = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+
+		if (!_mm256_testz_si256(x, x)) return 0;
+	}
+	return sparse_is_zero_scalar(p + i, len - i);
+}
+
+static int sparse_is_zero_sse2(const unsigned char *p, size_t len) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(p + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(p + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(p + i + 48));
+		__m128i x = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff) return 0;
+	}
+	return sparse_is_zero_scalar(p + i, len - i);
+}
+#elif defined(__aarch64__)
+static int sparse_is_zero_neon(const unsigned char *p, size_t len) {
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		uint8x16_t x = vorrq_u8(vorrq_u8(vld1q_u8(p + i), vld1q_u8(p + i + 16)),
+								vorrq_u8(vld1q_u8(p + i + 32), vld1q_u8(p + i + 48)));
+
+		if (vmaxvq_u8(x)) return 0;
+	}
+	return sparse_is_zero_scalar(p + i, len - i);
+}
+#endif
+
+/**
+ * Whether @len bytes at @buf are all zero
+ */
+int sparse_is_zero(const void *buf, size_t len) {
+	const unsigned char *p = (const unsigned char*)buf;
+
+#if defined(__x86_64__) || defined(__i386__)
+	static int avx2 = -1;
+
+	if (avx2 < 0) avx2 = __builtin_cpu_supports("avx2");
+	return avx2 ? sparse_is_zero_avx2(p, len) : sparse_is_zero_sse2(p, len);
+#elif defined(__aarch64__)
+	return sparse_is_zero_neon(p, len);
+#else
+	return sparse_is_zero_scalar(p, len);
+#endif
+}
+
+/*
+ * ====================================================================================
+ * Internal helpers
+ * ====================================================================================
+ */
+
+static int sparse_out(struct sparse_file *sf, const void *buf, size_t len) {
+	const char *p = (const char*)buf;
+
+	while (len) {
+		ssize_t n = write(sf->fd, p, len);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			perror("sparse write");
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Internal helper: turn the pending zeros into a hole before writing data
+ * @return 0 on success, -1 on error
+ */
+static int sparse_flush_hole(struct sparse_file *sf) {
+	uint64_t start = sf->pos - sf->hole;
+
+	if (!sf->hole) return 0;
+
+	// Old data under the hole has to go; beyond the end of the file seeking is enough
+	if (start < sf->size) {
+		uint64_t len = sf->size - start < sf->hole ? sf->size - start : sf->hole;
+
+		if (fallocate(sf->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, len) < 0) {
+			static const char zeros[SPARSE_PAGE];
+
+			// No hole punching here: overwrite with zeros instead
+			if (lseek(sf->fd, start, SEEK_SET) < 0) {
+				perror("sparse lseek");
+				return -1;
+			}
+			for (uint64_t off = 0; off < len; off += SPARSE_PAGE) {
+				if (sparse_out(sf, zeros, len - off < SPARSE_PAGE ? len - off : SPARSE_PAGE) < 0) return -1;
+			}
+			sf->written += len;
+			sf->holes -= len;
+		}
+	}
+	if (lseek(sf->fd, sf->pos, SEEK_SET) < 0) {
+		perror("sparse lseek");
+		return -1;
+	}
+	sf->hole = 0;
+	return 0;
+}
+
+/*
+ * ====================================================================================
+ * API
+ * ====================================================================================
+ */
+
+/**
+ * Start writing @fd at its current position
+ * @return 0 on success, -1 on error
+ */
+int sparse_open(struct sparse_file *sf, int fd) {
+	struct stat st;
+	off_t pos;
+
+	memset(sf, 0, sizeof(*sf));
+	sf->fd = fd;
+	if (fstat(fd, &st) < 0) {
+		perror("sparse fstat");
+		return -1;
+	}
+	pos = lseek(fd, 0, SEEK_CUR);
+	sf->seekable = S_ISREG(st.st_mode) && pos >= 0;
+	sf->pos = pos >= 0 ? pos : 0;
+	sf->size = st.st_size;
+	return 0;
+}
+
+/**
+ * Append @len bytes, leaving holes for the zero pages
+ * @return 0 on success, -1 on error
+ */
+int sparse_write(struct sparse_file *sf, const void *buf, size_t len) {
+	const char *p = (const char*)buf;
+
+	if (!sf->seekable) {
+		sf->pos += len;
+		sf->written += len;
+		return sparse_out(sf, buf, len);
+	}
+
+	while (len) {
+		// Up to the next page boundary of the file, so that holes are page-aligned
+		size_t n = SPARSE_PAGE - sf->pos % SPARSE_PAGE;
+		size_t run = 0;
+
+		if (n > len) n = len;
+		if (n == SPARSE_PAGE && sparse_is_zero(p, n)) {
+			sf->pos += n;
+			sf->hole += n;
+			sf->holes += n;
+			p += n;
+			len -= n;
+			continue;
+		}
+
+		// Data: gather the following non-zero pages into one write()
+		do {
+			run += n;
+			n = len - run < SPARSE_PAGE ? len - run : SPARSE_PAGE;
+		} while (n && !(n == SPARSE_PAGE && sparse_is_zero(p + run, n)));
+
+		if (sparse_flush_hole(sf) < 0 || sparse_out(sf, p, run) < 0) return -1;
+		sf->pos += run;
+		sf->written += run;
+		p += run;
+		len -= run;
+	}
+	return 0;
+}
+
+/**
+ * Set the file size when it ends in a hole
+ * @return 0 on success, -1 on error
+ */
+int sparse_finish(struct sparse_file *sf) {
+	struct stat st;
+
+	if (!sf->seekable || !sf->hole) return 0;
+	if (fstat(sf->fd, &st) < 0) {
+		perror("sparse fstat");
+		return -1;
+	}
+	if ((uint64_t)st.st_size < sf->pos && ftruncate(sf->fd, sf->pos) < 0) {
+		perror("sparse ftruncate");
+		return -1;
+	}
+	return sparse_flush_hole(sf);
+}
+
+#endif /* SPARSE_H */
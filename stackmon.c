@@ -0,0 +1,188 @@
+/*
+ * stackmon: stack depth of the recursive bt_* functions, and a runaway
+ * recursion caught by the sampler before it reaches the guard page.
+ *
+ *   ./stackmon
+ */
+
+#include <stackmon.h>
+
+#include <setjmp.h>
+
+#include <btree.h>
+
+#define RUNAWAY_STACK (256 * 1024)
+
+static double now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * A tree of @n keys: in order makes a list @n deep, shuffled about 2.5 log2(n)
+ */
+static struct bt_root build_tree(int n, int sorted) {
+	struct bt_root root = BT_ROOT;
+	int *keys = (int*)malloc(n * sizeof(int));
+
+	for (int i = 0; i < n; i++) keys[i] = i;
+	for (int i = n - 1; !sorted && i > 0; i--) {
+		int j = rand() % (i + 1), tmp = keys[i];
+
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+	for (int i = 0; i < n; i++) bt_insert(&root, keys[i]);
+	free(keys);
+	return root;
+}
+
+/*
+ * ====================================================================================
+ * High-water marks of the recursive bt_* functions
+ * ====================================================================================
+ */
+
+static void depths(struct stackmon_thread *self) {
+	static const int sizes[] = { 1000, 10000, 50000 };
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+
+	// Bytes below this frame; the first few hundred are not painted, shallow calls look free
+	printf("%-9s %7s %7s %12s %12s %10s\n", "tree", "keys", "height", "bt_height B", "bt_is_bst B", "B/level");
+	for (int sorted = 0; sorted <= 1; sorted++) {
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			struct bt_root root = build_tree(sizes[i], sorted);
+			size_t base = self->hi - sp, height_bytes, bst_bytes;
+			int height;
+
+			stackmon_reset();
+			height = bt_height(root.node);
+			height_bytes = stackmon_high_water(self) - base;
+
+			stackmon_reset();
+			if (!bt_is_bst(root.node)) printf("not a BST?\n");
+			bst_bytes = stackmon_high_water(self) - base;
+
+			printf("%-9s %7d %7d %12zu %12zu %10.1f\n", sorted ? "in order" : "shuffled", sizes[i], height,
+				   height_bytes, bst_bytes, (double)height_bytes / height);
+			bt_destroy(&root, NULL, NULL);
+		}
+	}
+}
+
+/*
+ * ====================================================================================
+ * Runaway recursion, stopped at the warning
+ * ====================================================================================
+ */
+
+static __thread sigjmp_buf runaway_jmp;
+static struct bt_root runaway_work;
+
+static void runaway_hook(struct stackmon_thread *t, size_t depth) {
+	(void)t;
+	(void)depth;
+	siglongjmp(runaway_jmp, 1);
+}
+
+/**
+ * Internal helper: recursion with some work at every level, like a parser
+ * or a tree walk that has lost its base case
+ */
+static __attribute__((noinline)) int descend(int level) {
+	volatile int h = bt_height(runaway_work.node);
+
+	return descend(level + 1) + h;
+}
+
+static void* runaway(void *arg) {
+	struct stackmon_thread *self = stackmon_thread_init("runaway", 0);
+	double t0 = now_ms();
+
+	(void)arg;
+	if (!self) return NULL;
+	crash_handler_thread_init();	// The sampler's handler runs off the failing stack
+	stackmon_sample_start(1000, 50);
+	if (!sigsetjmp(runaway_jmp, 1)) {
+		descend(0);
+		printf("runaway: not stopped?\n");
+	} else {
+		printf("runaway: stopped after %.0f ms at %zu of %zu KiB, no crash\n", now_ms() - t0,
+			   stackmon_high_water(self) >> 10, (size_t)(self->hi - self->lo) >> 10);
+	}
+	stackmon_thread_exit();
+	return NULL;
+}
+
+/*
+ * ====================================================================================
+ * Cost
+ * ====================================================================================
+ */
+
+static double walk_ms(struct bt_root *root, int reps) {
+	double t0 = now_ms();
+	volatile int sink = 0;
+
+	for (int i = 0; i < reps; i++) sink += bt_height(root->node) + bt_is_bst(root->node);
+	return now_ms() - t0;
+}
+
+static void cost(struct stackmon_thread *self) {
+	struct bt_root root = build_tree(200000, 0);
+	double plain = 1e9, sampled = 1e9, t0, scan;
+	size_t hwm;
+
+	// Best of 5, alternating, against the noise
+	walk_ms(&root, 2);
+	for (int rep = 0; rep < 5; rep++) {
+		double ms = walk_ms(&root, 10);
+
+		if (ms < plain) plain = ms;
+		stackmon_sample_start(1000, 90);
+		ms = walk_ms(&root, 10);
+		stackmon_sample_stop();
+		if (ms < sampled) sampled = ms;
+	}
+
+	t0 = now_ms();
+	for (int i = 0; i < 100; i++) hwm = stackmon_high_water(self);
+	scan = (now_ms() - t0) / 100;
+
+	printf("bt walks: %.1f ms, %.1f ms sampled at 1000 Hz (%+.1f%%); high-water scan of %zu KiB: %.3f ms\n",
+		   plain, sampled, (sampled / plain - 1) * 100, (self->paint_hi - self->paint_lo) >> 10, scan);
+	(void)hwm;
+	bt_destroy(&root, NULL, NULL);
+}
+
+int main(void) {
+	struct stackmon_thread *self = stackmon_thread_init("main", 0);
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	if (!self) return 1;
+	srand(1);
+	depths(self);
+	printf("\n");
+
+	runaway_work = build_tree(1000, 0);
+	stackmon.hook = runaway_hook;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, RUNAWAY_STACK);
+	if (pthread_create(&tid, &attr, runaway, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+	pthread_join(tid, NULL);
+	pthread_attr_destroy(&attr);
+	stackmon.hook = NULL;
+	bt_destroy(&runaway_work, NULL, NULL);
+	printf("\n");
+
+	cost(self);
+	printf("\n");
+	stackmon_report(stdout);
+	return 0;
+}
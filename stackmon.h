@@ -0,0 +1,336 @@
+#ifndef STACKMON_H
+#define STACKMON_H
+
+#include <crash.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * Stack usage monitor: how deep each thread's stack has been, to size
+ * thread stacks and to catch runaway recursion before the guard page does.
+ *
+ * Two measurements:
+ *
+ *  - painting: stackmon_thread_init() fills the unused part of the stack
+ *    with a canary word; stackmon_high_water() scans up from the bottom to
+ *    the first word that is no longer the canary.  Exact, costs nothing
+ *    while the thread runs, and a scan is a fast pass over the untouched
+ *    part only.
+ *
+ *  - sampling: stackmon_sample_start() reads the stack pointer from a
+ *    SIGPROF handler, on a per-thread CPU-time timer, and warns once (with
+ *    a backtrace, through crash.h) when the thread is deeper than a share
+ *    of its stack.  The hook may then stop the recursion, e.g. with
+ *    siglongjmp().  A sampler only sees recursion that takes a few
+ *    milliseconds to get there; painting sees everything, afterwards.
+ *
+ * Each thread calls stackmon_thread_init() on itself, and
+ * stackmon_thread_exit() before it returns, which records its peak while
+ * the stack is still mapped.  stackmon_report() prints all of them.
+ */
+
+#define STACKMON_CANARY 0x6e6f6d6b63617473ull  // "stackmon"
+#define STACKMON_MAX_THREADS 64
+#define STACKMON_MARGIN 256					  // Left unpainted below the caller: our own frames
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct stackmon_thread {
+	char name[16];
+	pid_t tid;
+	uintptr_t lo;			 // Lowest usable address (above the guard)
+	uintptr_t hi;			 // Top of the stack
+	uintptr_t paint_lo;	   // Painted [paint_lo, paint_hi)
+	uintptr_t paint_hi;
+	uintptr_t min_sp;		 // Lowest sampled stack pointer, 0 if none
+	size_t warn;			  // Depth that triggers the warning, 0 for none
+	unsigned long samples;
+	int warned;
+	int sampling;
+	timer_t timer;
+	_Atomic int active;	   // Its stack can be scanned
+	size_t peak;			  // Recorded by stackmon_thread_exit()
+};
+
+/**
+ * Called in the SIGPROF handler of a thread deeper than its warning
+ * threshold, once.  Must be async-signal-safe.
+ */
+typedef void (*stackmon_hook_t)(struct stackmon_thread *t, size_t depth);
+
+static struct {
+	struct stackmon_thread threads[STACKMON_MAX_THREADS];
+	_Atomic unsigned int nthreads;
+	stackmon_hook_t hook;
+	int handler_installed;
+} stackmon;
+
+static __thread struct stackmon_thread *stackmon_self;
+
+/*
+ * ====================================================================================
+ * Painting
+ * ====================================================================================
+ */
+
+/**
+ * Internal helper: fill [lo, hi) with the canary, top down so that the main
+ * thread's stack grows one page at a time.  Not inlined: its frame is the
+ * lowest in use while it runs.
+ */
+static __attribute__((noinline)) void stackmon_fill(uintptr_t lo, uintptr_t hi) {
+	volatile uint64_t *p = (volatile uint64_t*)hi;
+
+	while ((uintptr_t)p > lo) *--p = STACKMON_CANARY;
+}
+
+/**
+ * Internal helper: repaint from @t's bottom up to just below the caller
+ */
+static __attribute__((noinline)) void stackmon_paint(struct stackmon_thread *t) {
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+	uintptr_t hi = (sp - STACKMON_MARGIN) & ~(uintptr_t)7;
+
+	if (hi <= t->paint_lo) return;
+	stackmon_fill(t->paint_lo, hi);
+	t->paint_hi = hi;
+}
+
+/**
+ * Start monitoring the calling thread, painting up to @max_paint bytes of
+ * its stack below the caller (0: all of it, as far down as the guard page)
+ * @return the thread's record, or NULL on error
+ */
+struct stackmon_thread* stackmon_thread_init(const char *name, size_t max_paint) {
+	unsigned int i = atomic_fetch_add(&stackmon.nthreads, 1);
+	struct stackmon_thread *t;
+	pthread_attr_t attr;
+	size_t size, guard = 0;
+	void *addr;
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+
+	if (i >= STACKMON_MAX_THREADS) {
+		atomic_fetch_sub(&stackmon.nthreads, 1);
+		fprintf(stderr, "stackmon: more than %d threads\n", STACKMON_MAX_THREADS);
+		return NULL;
+	}
+	t = &stackmon.threads[i];
+	memset(t, 0, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "%s", name);
+	t->tid = (pid_t)syscall(SYS_gettid);
+
+	if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+		perror("pthread_getattr_np");
+		return NULL;
+	}
+	pthread_attr_getstack(&attr, &addr, &size);
+	pthread_attr_getguardsize(&attr, &guard);
+	pthread_attr_destroy(&attr);
+
+	t->hi = (uintptr_t)addr + size;
+	// The main thread's "stack" is RLIMIT_STACK below the top, with a guard gap under that
+	t->lo = (uintptr_t)addr + (guard > 4096 ? guard : 4096);
+	t->paint_lo = t->lo;
+	if (max_paint && sp - t->lo > max_paint) t->paint_lo = (sp - max_paint) & ~(uintptr_t)7;
+	stackmon_paint(t);
+
+	stackmon_self = t;
+	atomic_store(&t->active, 1);
+	return t;
+}
+
+/**
+ * Bytes of @t's stack in use at the deepest point since it was painted,
+ * by a scan for the lowest overwritten canary.  Where the whole painted
+ * area is overwritten the true peak may be deeper still.
+ */
+size_t stackmon_high_water(const struct stackmon_thread *t) {
+	const uint64_t *p = (const uint64_t*)t->paint_lo, *end = (const uint64_t*)t->paint_hi;
+
+	if (!atomic_load(&t->active)) return t->peak;
+	// Four words at a time, then the word in which they differ
+	while (p + 4 <= end &&
+		   !((p[0] ^ STACKMON_CANARY) | (p[1] ^ STACKMON_CANARY) | (p[2] ^ STACKMON_CANARY) | (p[3] ^ STACKMON_CANARY)))
+		p += 4;
+	while (p < end && *p == STACKMON_CANARY) p++;
+	return t->hi - (uintptr_t)p;
+}
+
+/**
+ * Start measuring the calling thread afresh: its high-water mark and
+ * sampled peak are reset to where it is now
+ */
+void stackmon_reset(void) {
+	struct stackmon_thread *t = stackmon_self;
+
+	if (!t) return;
+	stackmon_paint(t);
+	t->min_sp = 0;
+	t->warned = 0;
+}
+
+/*
+ * ====================================================================================
+ * Sampling
+ * ====================================================================================
+ */
+
+static void stackmon_handler(int sig, siginfo_t *info, void *ucontext) {
+	struct stackmon_thread *t = stackmon_self;
+	int saved_errno = errno;
+	const ucontext_t *uc = (const ucontext_t*)ucontext;
+	uintptr_t pc, fp, lr, sp;
+	size_t depth;
+
+	(void)sig;
+	(void)info;
+	if (!t) return;
+	// As crash_registers(), without printing them
+#if defined(__x86_64__)
+	sp = uc->uc_mcontext.gregs[REG_RSP];
+	pc = uc->uc_mcontext.gregs[REG_RIP];
+	fp = uc->uc_mcontext.gregs[REG_RBP];
+	lr = 0;
+#elif defined(__aarch64__)
+	sp = uc->uc_mcontext.sp;
+	pc = uc->uc_mcontext.pc;
+	fp = uc->uc_mcontext.regs[29];
+	lr = uc->uc_mcontext.regs[30];
+#else
+	sp = (uintptr_t)__builtin_frame_address(0);
+	pc = fp = lr = 0;
+#endif
+	t->samples++;
+	if (!t->min_sp || sp < t->min_sp) t->min_sp = sp;
+
+	depth = t->hi - sp;
+	if (t->warn && depth >= t->warn && !t->warned) {
+		t->warned = 1;
+		crash_puts("stackmon: thread ");
+		crash_puts(t->name);
+		crash_puts(" (tid ");
+		crash_dec(t->tid);
+		crash_puts(") is ");
+		crash_dec((long)(depth >> 10));
+		crash_puts(" KiB deep, of a ");
+		crash_dec((long)((t->hi - t->lo) >> 10));
+		crash_puts(" KiB stack, at\n");
+		crash_maps_load();
+		crash_backtrace(pc, fp, lr);
+		crash_flush();
+		if (stackmon.hook) stackmon.hook(t, depth);
+	}
+	errno = saved_errno;
+}
+
+/**
+ * Sample the calling thread's stack pointer @hz times per second of its
+ * CPU time, warning when it gets deeper than @warn_pct percent of the
+ * stack (0: never)
+ * @return 0 on success, -1 on error
+ */
+int stackmon_sample_start(int hz, unsigned int warn_pct) {
+	struct stackmon_thread *t = stackmon_self;
+	struct sigevent sev;
+	struct itimerspec its;
+
+	if (!t || hz <= 0) return -1;
+	if (!stackmon.handler_installed) {
+		struct sigaction sa;
+
+		// The warning reads frames through crash.h, which probes them with a pipe
+		if (crash.probe[0] < 0 && pipe2(crash.probe, O_CLOEXEC | O_NONBLOCK) < 0) {
+			perror("pipe2");
+			return -1;
+		}
+		if (crash.fd < 0) crash.fd = STDERR_FILENO;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = stackmon_handler;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGPROF, &sa, NULL) < 0) {
+			perror("sigaction");
+			return -1;
+		}
+		stackmon.handler_installed = 1;
+	}
+
+	t->warn = warn_pct ? (t->hi - t->lo) / 100 * warn_pct : 0;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev.sigev_notify_thread_id = t->tid;
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t->timer) < 0) {
+		perror("timer_create");
+		return -1;
+	}
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = 1000000000L / hz;
+	if (hz == 1) its.it_interval.tv_sec = 1, its.it_interval.tv_nsec = 0;
+	its.it_value = its.it_interval;
+	if (timer_settime(t->timer, 0, &its, NULL) < 0) {
+		perror("timer_settime");
+		timer_delete(t->timer);
+		return -1;
+	}
+	t->sampling = 1;
+	return 0;
+}
+
+/**
+ * Stop sampling the calling thread
+ */
+void stackmon_sample_stop(void) {
+	struct stackmon_thread *t = stackmon_self;
+
+	if (!t || !t->sampling) return;
+	timer_delete(t->timer);
+	t->sampling = 0;
+}
+
+/*
+ * ====================================================================================
+ * Report
+ * ====================================================================================
+ */
+
+/**
+ * Stop monitoring the calling thread, keeping its peak for the report
+ */
+void stackmon_thread_exit(void) {
+	struct stackmon_thread *t = stackmon_self;
+
+	if (!t) return;
+	stackmon_sample_stop();
+	t->peak = stackmon_high_water(t);
+	atomic_store(&t->active, 0);
+	stackmon_self = NULL;
+}
+
+/**
+ * Print every monitored thread: stack size, painted high-water mark and
+ * sampled peak
+ */
+void stackmon_report(FILE *fp) {
+	unsigned int n = atomic_load(&stackmon.nthreads);
+
+	if (n > STACKMON_MAX_THREADS) n = STACKMON_MAX_THREADS;
+	fprintf(fp, "%-16s %8s %10s %12s %6s %12s %8s\n", "thread", "tid", "stack KiB", "peak KiB", "%",
+			"sampled KiB", "samples");
+	for (unsigned int i = 0; i < n; i++) {
+		const struct stackmon_thread *t = &stackmon.threads[i];
+		size_t size = t->hi - t->lo, peak = stackmon_high_water(t);
+
+		// "+": all that was painted is used, the peak may be deeper
+		fprintf(fp, "%-16s %8d %10zu %11zu%s %5.1f%% %12zu %8lu\n", t->name, (int)t->tid, size >> 10, peak >> 10,
+				peak >= t->hi - t->paint_lo ? "+" : " ", 100.0 * peak / size,
+				t->min_sp ? (size_t)(t->hi - t->min_sp) >> 10 : 0, t->samples);
+	}
+}
+
+#endif /* STACKMON_H */
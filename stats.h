@@ -0,0 +1,249 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Opt-in operation counters and latency histograms for hash_map,
+ * lru_cache_t and rbtree.
+ *
+ * Build with -DLUDTM_STATS to enable.  Without it every hook below
+ * expands to nothing and stats_dump() only says so: no fields, no
+ * branches, no code in the data structures.
+ *
+ * Counters and histograms are per thread (no shared cache lines, no
+ * atomics on the fast path) and are summed when dumped.  Latencies are
+ * sampled: one operation in STATS_SAMPLE_RATE is timed, with rdtsc on
+ * x86 and CLOCK_MONOTONIC elsewhere, into an HDR-style log-bucketed
+ * histogram (histogram.h).
+ *
+ * The dump is racy by design: it reads other threads' counters without
+ * stopping them, so totals may be off by the operations in flight.
+ */
+
+enum stat_counter {
+	STAT_HM_GET_HIT,
+	STAT_HM_GET_MISS,
+	STAT_HM_INSERT,		// New keys
+	STAT_HM_UPDATE,		// Existing keys
+	STAT_HM_DELETE,
+	STAT_HM_LOOKUP,		// Chain walks ...
+	STAT_HM_CHAIN_STEPS,   // ... and the nodes they visited
+	STAT_LRU_GET_HIT,
+	STAT_LRU_GET_MISS,
+	STAT_LRU_PUT,
+	STAT_LRU_EVICT,
+	STAT_LRU_EXPIRE,
+	STAT_RB_INSERT,
+	STAT_RB_ERASE,
+	STAT_RB_ROTATE,
+	STAT_NR_COUNTERS,
+};
+
+enum stat_latency {
+	STAT_LAT_HM_GET,
+	STAT_LAT_HM_PUT,
+	STAT_LAT_LRU_GET,
+	STAT_LAT_LRU_PUT,
+	STAT_LAT_LRU_EVICT,
+	STAT_NR_LATENCIES,
+};
+
+#ifdef LUDTM_STATS
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <histogram.h>
+
+#ifndef STATS_SAMPLE_RATE
+#define STATS_SAMPLE_RATE 64  // Time one operation in 64
+#endif
+
+struct stats_thread {
+	uint64_t counters[STAT_NR_COUNTERS];
+	unsigned int countdown;		// Operations until the next timed one
+	struct histogram latency[STAT_NR_LATENCIES];  // In ticks
+	struct stats_thread *next;	 // All threads, newest first
+};
+
+static struct stats_thread *stats_threads;
+static __thread struct stats_thread *stats_self;
+
+static const char *const stat_counter_names[STAT_NR_COUNTERS] = {
+	"hash_map.get_hit", "hash_map.get_miss", "hash_map.insert", "hash_map.update",
+	"hash_map.delete", "hash_map.lookup", "hash_map.chain_steps",
+	"lru.get_hit", "lru.get_miss", "lru.put", "lru.evict", "lru.expire",
+	"rbtree.insert", "rbtree.erase", "rbtree.rotate",
+};
+
+static const char *const stat_latency_names[STAT_NR_LATENCIES] = {
+	"hash_map.get", "hash_map.put", "lru.get", "lru.put", "lru.evict",
+};
+
+/**
+ * Internal helper: this thread's stats, registered on first use.
+ * Threads are never unregistered, so a dump still counts exited threads.
+ */
+static struct stats_thread* stats_thread(void) {
+	struct stats_thread *self = stats_self;
+
+	if (__builtin_expect(!self, 0)) {
+		self = (struct stats_thread*)calloc(1, sizeof(*self));
+		if (!self) {
+			// Out of memory: count into a shared sink rather than crash
+			static struct stats_thread sink;
+
+			return &sink;
+		}
+		for (int i = 0; i < STAT_NR_LATENCIES; i++) {
+			hist_init(&self->latency[i]);
+		}
+		self->countdown = STATS_SAMPLE_RATE;
+		self->next = __atomic_load_n(&stats_threads, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&stats_threads, &self->next, self, 0,
+						    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		stats_self = self;
+	}
+	return self;
+}
+
+static inline uint64_t stats_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Internal helper: start of a possibly timed operation, 0 if this one is
+ * not sampled.
+ */
+static inline uint64_t stats_sample_begin(void) {
+	struct stats_thread *self = stats_thread();
+
+	if (--self->countdown) return 0;
+	self->countdown = STATS_SAMPLE_RATE;
+	return stats_ticks();
+}
+
+static inline void stats_sample_end(enum stat_latency lat, uint64_t start) {
+	if (start) hist_record(&stats_thread()->latency[lat], stats_ticks() - start);
+}
+
+#define STAT_ADD(counter, n) (stats_thread()->counters[counter] += (n))
+#define STAT_INC(counter) STAT_ADD(counter, 1)
+#define STAT_LATENCY_BEGIN(var) uint64_t var = stats_sample_begin()
+#define STAT_LATENCY_END(lat, var) stats_sample_end(lat, var)
+
+/**
+ * Internal helper: ticks per nanosecond, measured once.
+ */
+static double stats_ticks_per_ns(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	static double ratio;
+
+	if (!ratio) {
+		struct timespec t0, t1, pause = { 0, 10 * 1000 * 1000 };
+		uint64_t c0, c1;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		c0 = __rdtsc();
+		nanosleep(&pause, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		c1 = __rdtsc();
+		ratio = (double)(c1 - c0) /
+			((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec));
+	}
+	return ratio;
+#else
+	return 1.0;
+#endif
+}
+
+/**
+ * Sum of a counter over all threads
+ */
+static uint64_t stats_counter(enum stat_counter counter) {
+	uint64_t sum = 0;
+
+	for (struct stats_thread *t = __atomic_load_n(&stats_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+		sum += __atomic_load_n(&t->counters[counter], __ATOMIC_RELAXED);
+	}
+	return sum;
+}
+
+/**
+ * Print every non-zero counter and latency histogram (summed over all
+ * threads), one line each
+ */
+void stats_dump(FILE *fp) {
+	static struct histogram merged;
+	double ratio = stats_ticks_per_ns();
+
+	fprintf(fp, "--- stats (1/%d operations timed) ---\n", STATS_SAMPLE_RATE);
+	for (int i = 0; i < STAT_NR_COUNTERS; i++) {
+		uint64_t v = stats_counter((enum stat_counter)i);
+
+		if (v) fprintf(fp, "%-22s %12llu\n", stat_counter_names[i], (unsigned long long)v);
+	}
+
+	for (int i = 0; i < STAT_NR_LATENCIES; i++) {
+		hist_init(&merged);
+		for (struct stats_thread *t = __atomic_load_n(&stats_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+			hist_merge(&merged, &t->latency[i]);
+		}
+		if (!merged.count) continue;
+
+		fprintf(fp, "%-22s n=%llu p50=%.0fns p99=%.0fns p999=%.0fns max=%.0fns\n",
+			stat_latency_names[i], (unsigned long long)merged.count,
+			hist_percentile(&merged, 50.0) / ratio, hist_percentile(&merged, 99.0) / ratio,
+			hist_percentile(&merged, 99.9) / ratio, merged.max / ratio);
+	}
+}
+
+/**
+ * Zero the calling thread's counters and histograms
+ */
+void stats_reset(void) {
+	struct stats_thread *self = stats_thread();
+
+	memset(self->counters, 0, sizeof(self->counters));
+	for (int i = 0; i < STAT_NR_LATENCIES; i++) {
+		hist_init(&self->latency[i]);
+	}
+}
+
+#else /* !LUDTM_STATS */
+
+#define STAT_ADD(counter, n) do {} while (0)
+#define STAT_INC(counter) do {} while (0)
+#define STAT_LATENCY_BEGIN(var) do {} while (0)
+#define STAT_LATENCY_END(lat, var) do {} while (0)
+
+static inline uint64_t stats_counter(enum stat_counter counter) {
+	(void)counter;
+	return 0;
+}
+
+static inline void stats_dump(FILE *fp) {
+	fprintf(fp, "--- stats disabled (build with -DLUDTM_STATS) ---\n");
+}
+
+static inline void stats_reset(void) {
+}
+
+#endif /* LUDTM_STATS */
+
+#endif /* STATS_H */
@@ -0,0 +1,217 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+
+#include <list.h>
+
+/**
+ * Hierarchical timer wheel built from list_head buckets.
+ *
+ * TW_LEVELS levels of TW_LVL_SIZE buckets each.  Level 0 has one bucket
+ * per tick, every higher level covers TW_LVL_SIZE times the span of the
+ * level below.  A timer is filed in the level that matches how far away
+ * it is; when the level 0 index wraps, the next bucket of level 1 is
+ * re-filed ("cascaded") into level 0, and so on upwards.
+ *
+ * Arming and cancelling a timer are O(1).  Each timer is cascaded at most
+ * TW_LEVELS - 1 times and never looked at before it is due.  Advancing
+ * jumps over ticks with nothing to run or cascade, so a long idle stretch
+ * costs a scan of the buckets, not one step per tick.
+ *
+ * Ticks are whatever unit the caller passes as "now" (lru.h uses ms).
+ */
+
+#define TW_LVL_BITS 6
+#define TW_LVL_SIZE (1UL << TW_LVL_BITS)
+#define TW_LVL_MASK (TW_LVL_SIZE - 1)
+#define TW_LEVELS 4
+// Timers further away than this are parked in the last level and re-filed
+#define TW_MAX_DELTA ((1UL << (TW_LVL_BITS * TW_LEVELS)) - 1)
+
+struct tw_timer {
+	struct list_head entry;  // Bucket linkage, empty when not armed
+	unsigned long expires;   // Absolute tick
+};
+
+struct timer_wheel {
+	unsigned long clk;	  // Next tick to be processed
+	unsigned long pending;  // Number of armed timers
+	struct list_head vec[TW_LEVELS][TW_LVL_SIZE];
+};
+
+#define tw_time_after_eq(a, b) ((long)((a) - (b)) >= 0)
+
+static inline void tw_timer_init(struct tw_timer *timer) {
+	INIT_LIST_HEAD(&timer->entry);
+	timer->expires = 0;
+}
+
+static inline int tw_timer_pending(const struct tw_timer *timer) {
+	return !list_empty(&timer->entry);
+}
+
+/**
+ * Initialize an empty wheel
+ * @param tw  Timer wheel
+ * @param now Current tick
+ */
+static inline void tw_init(struct timer_wheel *tw, unsigned long now) {
+	tw->clk = now;
+	tw->pending = 0;
+	for (int lvl = 0; lvl < TW_LEVELS; lvl++)
+		for (unsigned long i = 0; i < TW_LVL_SIZE; i++)
+			INIT_LIST_HEAD(&tw->vec[lvl][i]);
+}
+
+/**
+ * Internal helper: file a timer into the bucket matching its distance.
+ */
+static void __tw_enqueue(struct timer_wheel *tw, struct tw_timer *timer) {
+	unsigned long expires = timer->expires;
+	unsigned long delta = expires - tw->clk;
+	struct list_head *vec;
+	int lvl;
+
+	if ((long)delta < 0) {
+		// Already due: run on the next processed tick
+		vec = &tw->vec[0][tw->clk & TW_LVL_MASK];
+	} else {
+		if (delta > TW_MAX_DELTA) {
+			delta = TW_MAX_DELTA;
+			expires = tw->clk + delta;
+		}
+		for (lvl = 0; lvl < TW_LEVELS - 1; lvl++)
+			if (delta < (1UL << (TW_LVL_BITS * (lvl + 1))))
+				break;
+		vec = &tw->vec[lvl][(expires >> (TW_LVL_BITS * lvl)) & TW_LVL_MASK];
+	}
+	list_add_tail(&timer->entry, vec);
+}
+
+/**
+ * Arm (or re-arm) a timer
+ * @param tw      Timer wheel
+ * @param timer   Timer, initialized with tw_timer_init()
+ * @param expires Absolute tick at which it fires
+ */
+static inline void tw_add(struct timer_wheel *tw, struct tw_timer *timer,
+			  unsigned long expires) {
+	if (tw_timer_pending(timer))
+		list_del(&timer->entry);
+	else
+		tw->pending++;
+
+	timer->expires = expires;
+	__tw_enqueue(tw, timer);
+}
+
+/**
+ * Cancel a timer (no-op if it is not armed)
+ */
+static inline void tw_del(struct timer_wheel *tw, struct tw_timer *timer) {
+	if (tw_timer_pending(timer)) {
+		list_del_init(&timer->entry);
+		tw->pending--;
+	}
+}
+
+/**
+ * Internal helper: re-file one bucket of a higher level.
+ * @return The bucket index, 0 meaning the next level must cascade too
+ */
+static unsigned long __tw_cascade(struct timer_wheel *tw, int lvl, unsigned long index) {
+	struct list_head work;
+	struct tw_timer *timer, *tmp;
+
+	INIT_LIST_HEAD(&work);
+	list_splice_init(&tw->vec[lvl][index], &work);
+
+	list_for_each_entry_safe(timer, tmp, &work, entry) {
+		__tw_enqueue(tw, timer);
+	}
+	return index;
+}
+
+/**
+ * Internal helper: the first tick from tw->clk on that has a timer to run
+ * in level 0 or a non-empty bucket to cascade.  Level 0 is looked at
+ * first, so a busy wheel usually finds it in one step.
+ */
+static unsigned long __tw_next_tick(struct timer_wheel *tw) {
+	unsigned long clk = tw->clk, best = ~0UL;
+
+	for (unsigned long i = 0; i < TW_LVL_SIZE; i++) {
+		if (!list_empty(&tw->vec[0][(clk + i) & TW_LVL_MASK])) {
+			best = i;
+			break;
+		}
+	}
+	// A bucket of level lvl is cascaded on the multiples of its span
+	for (int lvl = 1; lvl < TW_LEVELS; lvl++) {
+		unsigned long span = 1UL << (TW_LVL_BITS * lvl);
+		unsigned long t = (clk + span - 1) & ~(span - 1);
+
+		for (unsigned long k = 0; k < TW_LVL_SIZE && t - clk < best; k++, t += span) {
+			if (!list_empty(&tw->vec[lvl][(t >> (TW_LVL_BITS * lvl)) & TW_LVL_MASK])) {
+				best = t - clk;
+				break;
+			}
+		}
+	}
+	return best == ~0UL ? clk : clk + best;
+}
+
+/**
+ * Run every timer due up to and including @now.
+ * Expired timers are disarmed before @expire is called, so the callback
+ * may free them.  It must not re-arm a timer for a tick <= @now.
+ * @param tw     Timer wheel
+ * @param now    Current tick
+ * @param expire Called once per expired timer
+ * @param arg    Passed through to expire
+ * @return Number of expired timers
+ */
+static inline unsigned long tw_advance(struct timer_wheel *tw, unsigned long now,
+				       void (*expire)(struct tw_timer *, void *), void *arg) {
+	unsigned long fired = 0;
+	struct list_head work;
+
+	INIT_LIST_HEAD(&work);
+
+	while (tw_time_after_eq(now, tw->clk)) {
+		unsigned long next, index;
+
+		// Skip the ticks with nothing to do, up to now if that is all of them
+		next = tw->pending ? __tw_next_tick(tw) : now + 1;
+		if (!tw_time_after_eq(now, next)) {
+			tw->clk = now + 1;
+			break;
+		}
+		tw->clk = next;
+		index = next & TW_LVL_MASK;
+
+		if (!index) {
+			int lvl = 1;
+
+			while (lvl < TW_LEVELS &&
+			       !__tw_cascade(tw, lvl, (tw->clk >> (TW_LVL_BITS * lvl)) & TW_LVL_MASK))
+				lvl++;
+		}
+
+		list_splice_init(&tw->vec[0][index], &work);
+		while (!list_empty(&work)) {
+			struct tw_timer *timer = list_entry(work.next, struct tw_timer, entry);
+
+			list_del_init(&timer->entry);
+			tw->pending--;
+			fired++;
+			expire(timer, arg);
+		}
+		tw->clk++;
+	}
+
+	return fired;
+}
+
+#endif /* TIMERWHEEL_H */